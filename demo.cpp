@@ -1,4 +1,5 @@
 #include <chrono>
+#include <thread>
 #include <yarn_dialogue_runner.h>
 
 void beep(int count)
@@ -130,9 +131,6 @@ struct YarnRunnerConsole : public Yarn::YarnRunnerBase
     /// handle the main loop, processing instructions, updating the time, etc.
     void loop()
     {
-        const Yarn::Instruction& inst = vm.currentInstruction();
-        vm.processInstruction(inst);
-
         auto time = std::chrono::steady_clock::now();
 
         while (true)
@@ -145,16 +143,19 @@ struct YarnRunnerConsole : public Yarn::YarnRunnerBase
 
             if (dt)
             {
-                vm.incrementTime(dt);
                 time = time2;
             }
 
+            // run for at most a frame's worth of instructions, so a script stuck in a loop can't hang the loop
+            update(dt, 1000000);
+
             switch (vm.runningState)
             {
             case Yarn::YarnVM::RUNNING:
-                vm.processInstruction(vm.currentInstruction());
                 break;
             case Yarn::YarnVM::ASLEEP:
+                // nothing happens until the wait is over, so sleep until then instead of spinning on the clock
+                std::this_thread::sleep_for(std::chrono::milliseconds(vm.waitUntilTime - vm.time));
                 break;
             default:
                 return;
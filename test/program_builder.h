@@ -0,0 +1,52 @@
+#pragma once
+
+/**
+ * @file program_builder.h
+ *
+ * @brief Builds small Yarn programs in memory for the tests, so they don't need the Yarn compiler
+ */
+
+#include <initializer_list>
+#include <string>
+
+#include <yarn_spinner.pb.h>
+
+namespace ProgramBuilder
+{
+    inline Yarn::Operand string(const std::string& s)
+    {
+        Yarn::Operand operand;
+        operand.set_string_value(s);
+        return operand;
+    }
+
+    inline Yarn::Operand number(float f)
+    {
+        Yarn::Operand operand;
+        operand.set_float_value(f);
+        return operand;
+    }
+
+    inline void add(Yarn::Node& node, Yarn::Instruction::OpCode opcode, std::initializer_list<Yarn::Operand> operands = {})
+    {
+        Yarn::Instruction* instruction = node.add_instructions();
+        instruction->set_opcode(opcode);
+
+        for (const Yarn::Operand& operand : operands)
+        {
+            *instruction->add_operands() = operand;
+        }
+    }
+
+    inline void label(Yarn::Node& node, const std::string& name) ///< label the next instruction added to node
+    {
+        (*node.mutable_labels())[name] = node.instructions_size();
+    }
+
+    inline Yarn::Node& addNode(Yarn::Program& program, const std::string& name)
+    {
+        Yarn::Node& node = (*program.mutable_nodes())[name];
+        node.set_name(name);
+        return node;
+    }
+}
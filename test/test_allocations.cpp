@@ -0,0 +1,162 @@
+/**
+ * @file test_allocations.cpp
+ *
+ * @brief Checks that a VM running a dialogue loop in steady state doesn't allocate
+ *
+ * Runs a node that shows a line, then two options that both lead back to the line, and counts the heap allocations made while the VM
+ * goes round the loop once it's warmed up.  Line ids, option destinations and commands are views of the program's string pool,
+ * and the options list keeps its storage between option sets, so there should be none.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include <yarn_vm.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    std::atomic<bool> counting = false;
+    std::atomic<std::size_t> allocations = 0;
+
+    void* allocate(std::size_t size)
+    {
+        if (counting)
+        {
+            allocations++;
+        }
+
+        if (void* p = std::malloc(size ? size : 1))
+        {
+            return p;
+        }
+
+        throw std::bad_alloc();
+    }
+
+    struct Callbacks : public Yarn::YarnVM::YarnCallbacks
+    {
+        std::size_t lines = 0;
+        std::size_t commands = 0;
+        std::size_t optionSets = 0;
+
+        void onRunLine(const Yarn::YarnVM::Line&) override { lines++; }
+        void onRunCommand(const std::string_view&) override { commands++; }
+        void onPresentOptions(const Yarn::YarnVM::OptionsList&) override { optionSets++; }
+    };
+
+    /// Start : a line, a command, and two options that both lead back to the line.  The ids are too long for small string storage
+    Yarn::Program loopProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("allocations");
+
+        Yarn::Node& node = addNode(program, "Start");
+
+        label(node, "allocation-test-loop");
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:allocation-test-greeting"), number(0) });
+        add(node, Yarn::Instruction::RUN_COMMAND, { string("allocation_test_command with arguments"), number(0) });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:allocation-test-first-option"), string("allocation-test-chosen"), number(0) });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:allocation-test-second-option"), string("allocation-test-chosen"), number(0) });
+        add(node, Yarn::Instruction::SHOW_OPTIONS);
+        add(node, Yarn::Instruction::JUMP);
+
+        // like the compiler's option destinations, pop the destination JUMP left on the stack
+        label(node, "allocation-test-chosen");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::JUMP_TO, { string("allocation-test-loop") });
+
+        return program;
+    }
+
+    /// go round the loop once : line, command, options, answer
+    bool cycle(Yarn::YarnVM& vm, int selection)
+    {
+        if (vm.run() != Yarn::YarnVM::YIELD_LINE)
+        {
+            return false;
+        }
+
+        if (vm.run() != Yarn::YarnVM::YIELD_COMMAND)
+        {
+            return false;
+        }
+
+        if (vm.run() != Yarn::YarnVM::YIELD_OPTIONS)
+        {
+            return false;
+        }
+
+        vm.selectOption(selection);
+        return true;
+    }
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+int main()
+{
+    static constexpr int WARM_UP_CYCLES = 16;
+    static constexpr int COUNTED_CYCLES = 10000;
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(loopProgram(), error);
+
+    if (!image)
+    {
+        std::cerr << "couldn't link the test program : " << error << std::endl;
+        return 1;
+    }
+
+    Yarn::YarnVM vm(image);
+    Callbacks callbacks;
+    vm.setCallbacks(&callbacks);
+    vm.loadNode("Start");
+
+    for (int i = 0; i < WARM_UP_CYCLES; i++)
+    {
+        if (!cycle(vm, i % 2))
+        {
+            std::cerr << "the test program didn't yield a line, a command, then options" << std::endl;
+            return 1;
+        }
+    }
+
+    counting = true;
+
+    for (int i = 0; i < COUNTED_CYCLES; i++)
+    {
+        cycle(vm, i % 2);
+    }
+
+    counting = false;
+
+    const std::size_t expectedLines = WARM_UP_CYCLES + COUNTED_CYCLES;
+
+    if ((callbacks.lines != expectedLines) || (callbacks.commands != expectedLines) || (callbacks.optionSets != expectedLines))
+    {
+        std::cerr << "expected " << expectedLines << " lines, commands and option sets, got " << callbacks.lines << ", " << callbacks.commands << " and " << callbacks.optionSets << std::endl;
+        return 1;
+    }
+
+    if (allocations != 0)
+    {
+        std::cerr << allocations << " allocations in " << COUNTED_CYCLES << " RUN_LINE -> RUN_COMMAND -> SHOW_OPTIONS cycles, expected none" << std::endl;
+        return 1;
+    }
+
+    std::cout << COUNTED_CYCLES << " RUN_LINE -> RUN_COMMAND -> SHOW_OPTIONS cycles, no allocations" << std::endl;
+    return 0;
+}
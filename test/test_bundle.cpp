@@ -0,0 +1,177 @@
+/**
+ * @file test_bundle.cpp
+ *
+ * @brief Checks that bundles with conditional jumps tampered to leave their node fail to load
+ *
+ * Writes a bundle of a program with a JUMP_IF_FALSE, and a condition the linker fuses into JUMP_IF_VARIABLE_NOT_EQUAL, and loads it back.
+ * Then rewrites each jump's target in the file : aimed at the node's END_OF_NODE, the step after the jump would run past the node, so
+ * the bundle has to be rejected.  Aimed at the last instruction before it, the bundle is as the linker could have written it, and loads.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <yarn_bundle.h>
+#include <yarn_line_database.h>
+#include <yarn_vm.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /// Start : if false, skip a line.  Fused : if $visits == 1, skip a line
+    Yarn::Program jumpsProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("bundle");
+
+        (*program.mutable_initial_values())["$visits"] = number(0);
+
+        Yarn::Node& start = addNode(program, "Start");
+        add(start, Yarn::Instruction::PUSH_BOOL);
+        start.mutable_instructions(0)->add_operands()->set_bool_value(false);
+        add(start, Yarn::Instruction::JUMP_IF_FALSE, { string("bundle-start-skip") });
+        add(start, Yarn::Instruction::POP);
+        add(start, Yarn::Instruction::RUN_LINE, { string("line:bundle-start"), number(0) });
+        label(start, "bundle-start-skip");
+        add(start, Yarn::Instruction::POP);
+        add(start, Yarn::Instruction::STOP);
+
+        Yarn::Node& fused = addNode(program, "Fused");
+        add(fused, Yarn::Instruction::PUSH_VARIABLE, { string("$visits") });
+        add(fused, Yarn::Instruction::PUSH_FLOAT, { number(1) });
+        add(fused, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(fused, Yarn::Instruction::CALL_FUNC, { string("Number.EqualTo") });
+        add(fused, Yarn::Instruction::JUMP_IF_FALSE, { string("bundle-fused-skip") });
+        add(fused, Yarn::Instruction::POP);
+        add(fused, Yarn::Instruction::RUN_LINE, { string("line:bundle-fused"), number(0) });
+        label(fused, "bundle-fused-skip");
+        add(fused, Yarn::Instruction::POP);
+        add(fused, Yarn::Instruction::STOP);
+
+        return program;
+    }
+
+    std::vector<char> readFile(const std::string& path)
+    {
+        std::ifstream is(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& path, const std::vector<char>& bytes)
+    {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        os.write(bytes.data(), (std::streamsize)bytes.size());
+    }
+
+    /// a copy of bundle with the target of the first opcode instruction of every node that has one moved to the node's last instruction + offset
+    std::vector<char> retarget(const std::vector<char>& bundle, Yarn::LinkedProgram::OpCode opcode, std::int32_t offset, bool& found)
+    {
+        using namespace Yarn::BundleFormat;
+
+        std::vector<char> tampered = bundle;
+
+        Header header;
+        std::memcpy(&header, tampered.data(), sizeof(header));
+
+        const SectionRef nodes = header.sections[NODES];
+        const SectionRef code = header.sections[CODE];
+
+        found = false;
+
+        for (std::uint64_t n = 0; n < nodes.size / sizeof(NodeRecord); n++)
+        {
+            NodeRecord node;
+            std::memcpy(&node, tampered.data() + nodes.offset + n * sizeof(NodeRecord), sizeof(node));
+
+            for (std::uint32_t i = 0; i < node.instructionCount; i++)
+            {
+                char* at = tampered.data() + code.offset + (node.firstInstruction + i) * sizeof(Yarn::LinkedProgram::Instruction);
+
+                Yarn::LinkedProgram::Instruction instruction;
+                std::memcpy(&instruction, at, sizeof(instruction));
+
+                if (instruction.opcode == opcode)
+                {
+                    instruction.a = (std::int32_t)node.instructionCount - 1 + offset;
+                    std::memcpy(at, &instruction, sizeof(instruction));
+                    found = true;
+                    break;
+                }
+            }
+        }
+
+        return tampered;
+    }
+
+    bool opens(const std::string& path, std::string& error)
+    {
+        error.clear();
+        return Yarn::Bundle::open(path, error) != nullptr;
+    }
+}
+
+int main()
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path();
+    const std::string original = (directory / "test_bundle.yarnbundle").string();
+    const std::string tampered = (directory / "test_bundle_tampered.yarnbundle").string();
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(jumpsProgram(), error);
+
+    if (!image || !Yarn::Bundle::write(original, *image, Yarn::LineDatabase(), error))
+    {
+        std::cerr << "couldn't write the test bundle : " << error << std::endl;
+        return 1;
+    }
+
+    check(opens(original, error), "the bundle as written opens : " + error);
+
+    const std::vector<char> bytes = readFile(original);
+
+    for (Yarn::LinkedProgram::OpCode opcode : { Yarn::LinkedProgram::JUMP_IF_FALSE, Yarn::LinkedProgram::JUMP_IF_VARIABLE_NOT_EQUAL })
+    {
+        const std::string name = (opcode == Yarn::LinkedProgram::JUMP_IF_FALSE) ? "JUMP_IF_FALSE" : "JUMP_IF_VARIABLE_NOT_EQUAL";
+        bool found = false;
+
+        writeFile(tampered, retarget(bytes, opcode, 0, found));
+        check(found, "the bundle has a " + name);
+        check(!opens(tampered, error), "a bundle with a " + name + " to END_OF_NODE is rejected");
+        check(!Yarn::ProgramImage::load(tampered, error), "a bundle with a " + name + " to END_OF_NODE doesn't load as a program");
+
+        writeFile(tampered, retarget(bytes, opcode, -1, found));
+        check(opens(tampered, error), "a bundle with a " + name + " to the instruction before END_OF_NODE opens : " + error);
+    }
+
+    std::filesystem::remove(original);
+    std::filesystem::remove(tampered);
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "bundles with conditional jumps out of their node are rejected" << std::endl;
+    return 0;
+}
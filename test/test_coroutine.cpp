@@ -0,0 +1,152 @@
+/**
+ * @file test_coroutine.cpp
+ *
+ * @brief Checks that a dialogue pulled through runDialogue() does the same as the VM run with callbacks
+ *
+ * Plays each node of every .yarnc in test/ twice with the same answers : once with run() and callbacks, once by pulling events out of
+ * runDialogue(), answering its options with select() and its waits with advanceTime().  The lines, commands, options, waits and node
+ * changes have to match, as do the runtime errors the coroutine rethrows.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_coroutine.h>
+
+#include "trace_player.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /// the events carry everything but node changes, so those still come from a callback
+    struct NodeChanges : public Yarn::YarnVM::YarnCallbacks
+    {
+        TracePlayer::Trace& trace;
+
+        explicit NodeChanges(TracePlayer::Trace& trace) : trace(trace) {}
+
+        void onRunLine(const Yarn::YarnVM::Line&) override { }
+        void onRunCommand(const std::string_view&) override { }
+        void onPresentOptions(const Yarn::YarnVM::OptionsList&) override { }
+
+        void onChangeNode(const Yarn::Node*, const Yarn::Node* toNode) override
+        {
+            trace.push_back("node " + (toNode ? toNode->name() : std::string()));
+        }
+    };
+
+    /// TracePlayer::play(), through runDialogue()
+    TracePlayer::Trace pull(Yarn::YarnVM& vm, const std::string& node)
+    {
+        TracePlayer::Trace trace;
+        NodeChanges nodeChanges(trace);
+        vm.setCallbacks(&nodeChanges);
+
+        try
+        {
+            vm.loadNode(node);
+
+            Yarn::Dialogue dialogue = Yarn::runDialogue(vm);
+            int answers = 0;
+
+            while ((trace.size() < TracePlayer::MAX_EVENTS) && dialogue.next())
+            {
+                const Yarn::DialogueEvent& event = dialogue.event();
+
+                switch (event.type)
+                {
+                case Yarn::DialogueEvent::LINE:
+                    trace.push_back("line " + TracePlayer::describe(*event.line));
+                    break;
+                case Yarn::DialogueEvent::COMMAND:
+                    trace.push_back("command " + std::string(event.command));
+                    break;
+                case Yarn::DialogueEvent::OPTIONS:
+                {
+                    trace.push_back(TracePlayer::describe(*event.options));
+
+                    const int option = TracePlayer::choose(*event.options, answers++);
+
+                    if (option < 0)
+                    {
+                        trace.push_back("no enabled options");
+                        vm.setCallbacks(nullptr);
+                        return trace;
+                    }
+
+                    dialogue.select(option);
+                }
+                break;
+                case Yarn::DialogueEvent::WAIT:
+                    trace.push_back("wait " + std::to_string(event.waitUntil));
+                    dialogue.advanceTime(event.waitUntil - vm.time);
+                    break;
+                case Yarn::DialogueEvent::STOP:
+                    trace.push_back("stopped");
+                    break;
+                }
+            }
+        }
+        catch (const YarnException& e)
+        {
+            trace.push_back(std::string("error ") + e.what());
+        }
+
+        vm.setCallbacks(nullptr);
+
+        return trace;
+    }
+}
+
+int main()
+{
+    const std::vector<std::filesystem::path> files = TracePlayer::testPrograms();
+    check(!files.empty(), "there are compiled programs in test/");
+
+    for (const std::filesystem::path& file : files)
+    {
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(file.string(), error);
+
+        if (!image)
+        {
+            check(false, file.string() + " loads : " + error);
+            continue;
+        }
+
+        for (const Yarn::LinkedProgram::Node& node : image->linked.nodes)
+        {
+            const std::string& name = node.source->name();
+
+            Yarn::YarnVM called(image);
+            Yarn::YarnVM pulled(image);
+
+            const TracePlayer::Trace expected = TracePlayer::play(called, name);
+            const TracePlayer::Trace actual = pull(pulled, name);
+
+            check(expected == actual, file.string() + ", node " + name + " : runDialogue() runs differently, " + TracePlayer::difference(expected, actual));
+        }
+    }
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << files.size() << " programs run the same through runDialogue() as with callbacks" << std::endl;
+    return 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file test_csv.cpp
+ *
+ * @brief Checks that CsvScanner reads csv text into the same records as the generic reader, depends/csv.hpp, which it replaced
+ *
+ * Badly formed and awkward text first : doubled quotes, text after a closing quote, quotes inside unquoted fields, lone \r line ends, a byte
+ * order mark, trailing commas, blank lines, unterminated quotes, and fields long enough that the specials fall either side of the 16 bytes the
+ * vectorized scan looks at.  Then many random records of plain and quoted fields.  The scanner skips blank lines, where csv.hpp reads a record
+ * of one empty field, so those are left out of csv.hpp's records.  No quoted field is closed by the text's very last byte, which csv.hpp loses,
+ * and stray quotes are kept out of fields with doubled quotes, which csv.hpp unescapes wrongly.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <csv.hpp>
+
+#include <yarn_csv.h>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    typedef std::vector<std::vector<std::string>> Records;
+
+    Records scan(const std::string& text)
+    {
+        Records records;
+        Yarn::CsvScanner scanner(text);
+        std::vector<std::string_view> fields;
+
+        while (scanner.next(fields))
+        {
+            records.emplace_back(fields.begin(), fields.end());
+        }
+
+        return records;
+    }
+
+    Records generic(const std::string& text)
+    {
+        csv::CSVFormat format;
+        format.no_header();
+        format.variable_columns(csv::VariableColumnPolicy::KEEP);
+
+        Records records;
+
+        for (const csv::CSVRow& row : csv::parse(text, format))
+        {
+            std::vector<std::string> fields;
+
+            for (std::size_t i = 0; i < row.size(); i++)
+            {
+                fields.emplace_back(row[i].get<csv::string_view>());
+            }
+
+            // blank lines, which the scanner skips
+            if ((fields.size() != 1) || !fields[0].empty())
+            {
+                records.push_back(std::move(fields));
+            }
+        }
+
+        return records;
+    }
+
+    std::string describe(const Records& records)
+    {
+        std::string text;
+
+        for (const std::vector<std::string>& fields : records)
+        {
+            text += "[";
+
+            for (const std::string& field : fields)
+            {
+                text += "<" + field + ">";
+            }
+
+            text += "]";
+        }
+
+        return text;
+    }
+
+    /// text with its line ends and quotes visible
+    std::string escape(const std::string& text)
+    {
+        std::string escaped;
+
+        for (char c : text)
+        {
+            escaped += (c == '\n') ? std::string("\\n") : (c == '\r') ? std::string("\\r") : std::string(1, c);
+        }
+
+        return escaped;
+    }
+
+    void same(const std::string& text, const std::string& what)
+    {
+        const Records scanned = scan(text);
+        const Records expected = generic(text);
+
+        check(scanned == expected, what + " : \"" + escape(text) + "\" scans as " + escape(describe(scanned)) + ", csv.hpp reads " + escape(describe(expected)));
+    }
+
+    void awkward()
+    {
+        const std::string BOM = "\xEF\xBB\xBF";
+        const std::string LONG = "a field much longer than sixteen bytes";
+
+        same("id,text,file\nline:0,Hello,test.yarn\n", "plain records");
+
+        same("a,\"say \"\"hi\"\"\",b\n", "doubled quotes");
+        same("\"\"\"\",\"\"\"\"\"\"\n", "fields of nothing but doubled quotes");
+        same("\"" + LONG + " \"\"with\"\" doubled quotes past the first sixteen bytes\",b\n", "doubled quotes in a long field");
+
+        same("a,\"quoted\"after,c\nd,e\n", "text after a closing quote");
+        same("\"quoted\" \"again\",b\n", "a quote and a space after a closing quote");
+        same("a,\"" + LONG + "\"" + LONG + ",c\n", "text after a long quoted field");
+
+        same("a,b\"c,d\"\n", "quotes inside an unquoted field");
+        same(LONG + "\"" + LONG + "\n", "a quote inside a long unquoted field");
+
+        same("a,b\rc,d\r", "lone \\r line ends");
+        same("a,\"b\rc\",d\r\"e\r\",f\r", "lone \\r in quoted fields");
+        same("a,b\r\nc,d\r\n", "\\r\\n line ends");
+        same("a,b\rc,d\ne,f\r\n", "mixed line ends");
+
+        same(BOM + "id,text\nline:0,Hello\n", "a byte order mark");
+        same(BOM + "\"id\",text\n", "a byte order mark before a quote");
+        same(BOM + "\n", "a byte order mark alone");
+
+        same("a,b,\n", "a trailing comma");
+        same("a,b,", "a trailing comma ending the text");
+        same("a,\n,\n,,\n", "records of empty fields");
+        same("a,\"\",b\n\"\",\"\"\n", "empty quoted fields");
+
+        same("a,b\n\n\nc,d\n\n", "blank lines");
+        same("\n\na,b\n", "blank lines first");
+        same("x\r\n\r\ny\r\n\r\n", "blank \\r\\n lines");
+        same("x\r\ry\r", "blank \\r lines");
+
+        same("a,\"multi\nline\",c\n", "a quoted field across lines");
+        same("a,\"unterminated\nb,c\n", "an unterminated quoted field");
+
+        // the specials on either side of every place the vectorized scan looks at 16 bytes at a time
+        for (std::size_t offset = 0; offset < 40; offset++)
+        {
+            for (char special : { ',', '"', '\n', '\r' })
+            {
+                std::string text = std::string(offset, 'x') + special + std::string(40 - offset, 'y') + ",z\n";
+                same(text, "a '" + escape(std::string(1, special)) + "' at " + std::to_string(offset));
+            }
+        }
+    }
+
+    /// random records of plain fields, and quoted fields with separators, line ends and doubled quotes in them
+    void randomRecords()
+    {
+        static const char* const PLAIN[] = { "a", "b", " ", "\"", "line:", "0123456789abcdef" };
+        static const char* const QUOTED[] = { "a", " ", ",", "\n", "\r", "\r\n", "\"\"", "0123456789abcdef" };
+        static const char* const LINE_ENDS[] = { "\n", "\r\n", "\r", "\n\n" };
+
+        std::mt19937 random(2024);
+        auto below = [&random](std::size_t n) { return std::uniform_int_distribution<std::size_t>(0, n - 1)(random); };
+
+        for (int round = 0; round < 20000; round++)
+        {
+            std::string text;
+
+            for (std::size_t record = below(4); record > 0; record--)
+            {
+                for (std::size_t field = 1 + below(4); field > 0; field--)
+                {
+                    if (below(2))
+                    {
+                        text += "\"";
+
+                        for (std::size_t part = below(6); part > 0; part--)
+                        {
+                            text += QUOTED[below(std::size(QUOTED))];
+                        }
+
+                        text += "\"";
+                    }
+                    else
+                    {
+                        // a quote only starts a quoted field at the start of one
+                        std::string plain = "p";
+
+                        for (std::size_t part = below(6); part > 0; part--)
+                        {
+                            plain += PLAIN[below(std::size(PLAIN))];
+                        }
+
+                        text += plain;
+                    }
+
+                    if (field > 1)
+                    {
+                        text += ",";
+                    }
+                }
+
+                text += LINE_ENDS[below(std::size(LINE_ENDS))];
+            }
+
+            same(text, "random records, round " + std::to_string(round));
+
+            if (failures)
+            {
+                return;
+            }
+        }
+    }
+}
+
+int main()
+{
+    awkward();
+    randomRecords();
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "CsvScanner reads the same records as csv.hpp" << (Yarn::CsvScanner::vectorized() ? ", vectorized" : "") << std::endl;
+    return 0;
+}
@@ -0,0 +1,371 @@
+/**
+ * @file test_event_ring.cpp
+ *
+ * @brief Checks that an EventRing hands back every event and substitution in order as it wraps around, and stops the VM when it's full
+ *
+ * First the ring on its own : capacities round up, reserve() refuses an event once either the events or the values are full, and events
+ * with their substitutions come out of a small ring intact while it goes round many times, drained a few at a time.  Then a VM writing
+ * lines, commands and options into rings too small for one time round the program, so it's stopped by full events and by full values :
+ * it has to yield YIELD_EVENTS_FULL, and after each drain pick up where it left off without losing or repeating an event.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_event_ring.h>
+#include <yarn_vm.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    constexpr int ROUNDS = 50;
+    constexpr int MAX_RUNS = 10000;
+
+    /// publishes an event carrying its number, with count substitutions counting up from firstValue
+    void publish(Yarn::EventRing& ring, int number, int count, int firstValue)
+    {
+        Yarn::VMEvent event;
+        event.type = Yarn::VMEvent::LINE;
+        event.index = number;
+        event.substitutionCount = (std::uint16_t)count;
+        event.firstSubstitution = ring.nextValue();
+
+        for (int i = 0; i < count; i++)
+        {
+            ring.pushValue(Yarn::Value((float)(firstValue + i)));
+        }
+
+        ring.publish(event);
+    }
+
+    void capacities()
+    {
+        Yarn::EventRing rounded(3, 5);
+        check((rounded.eventCapacity() == 4) && (rounded.valueCapacity() == 8), "capacities round up to powers of two");
+
+        Yarn::EventRing exact(4, 8);
+        check((exact.eventCapacity() == 4) && (exact.valueCapacity() == 8), "capacities that are powers of two stay as they are");
+
+        Yarn::EventRing smallest(1, 1);
+        check((smallest.eventCapacity() == 1) && (smallest.valueCapacity() == 1), "a ring can hold a single event");
+    }
+
+    /// reserve() refuses once the events are full, or the values are, and accepts again once they're drained
+    void full()
+    {
+        auto ignore = [](const Yarn::VMEvent&) { };
+
+        Yarn::EventRing events(4, 8);
+
+        for (int i = 0; i < 4; i++)
+        {
+            check(events.reserve(0), "there's room for event " + std::to_string(i) + " of 4");
+            publish(events, i, 0, 0);
+        }
+
+        check(!events.reserve(0), "a ring with every event taken is full");
+        check(events.drain(ignore, 1) == 1, "drain() stops at maxEvents");
+        check(events.reserve(0), "draining an event makes room for one");
+        check(!events.empty(), "a ring with events left isn't empty");
+        check(events.drain(ignore) == 3, "drain() drains the rest");
+        check(events.empty(), "a drained ring is empty");
+        check(events.drain(ignore) == 0, "draining an empty ring drains nothing");
+
+        Yarn::EventRing values(4, 8);
+
+        publish(values, 0, 6, 0);
+        check(values.reserve(2) && !values.reserve(3), "an event only fits if its substitutions fit in the values left");
+
+        publish(values, 1, 2, 6);
+        check(values.reserve(0) && !values.reserve(1), "a ring with every value taken still takes events without substitutions");
+
+        publish(values, 2, 0, 8);
+        check(values.drain(ignore, 1) == 1, "the first event drains");
+        check(values.reserve(6) && !values.reserve(7), "draining an event hands back its substitutions");
+        check(values.drain(ignore) == 2, "the other events drain");
+        check(values.reserve(8), "a drained ring has room for a full set of values");
+    }
+
+    /// many more events and values than fit, published while there's room and drained a few at a time
+    void wraparound()
+    {
+        constexpr int EVENTS = 1000;
+
+        Yarn::EventRing ring(4, 8);
+
+        int published = 0;
+        int drained = 0;
+        int nextValue = 0;
+        int expectedValue = 0;
+        int round = 0;
+
+        while (drained < EVENTS)
+        {
+            // 0 to 3 substitutions, so the values wrap around at a different place from the events
+            while ((published < EVENTS) && ring.reserve(published % 4))
+            {
+                publish(ring, published, published % 4, nextValue);
+                nextValue += published % 4;
+                published++;
+            }
+
+            const std::size_t maxEvents = 1 + (std::size_t)(round++ % 3);
+
+            const std::size_t count = ring.drain([&](const Yarn::VMEvent& event)
+            {
+                bool intact = (event.index == drained) && (event.substitutionCount == drained % 4);
+
+                for (std::size_t i = 0; i < event.substitutionCount; i++)
+                {
+                    intact = intact && (ring.substitution(event, i).float_value() == (float)(expectedValue + (int)i));
+                }
+
+                check(intact, "event " + std::to_string(drained) + " comes out with its substitutions, after the ring went round");
+
+                expectedValue += event.substitutionCount;
+                drained++;
+            }, maxEvents);
+
+            if (count == 0)
+            {
+                check(false, "a ring with events published drains some");
+                return;
+            }
+
+            if (failures)
+            {
+                return;
+            }
+        }
+
+        check(published == EVENTS, "every event is published");
+        check(ring.empty(), "the ring is empty once every event is drained");
+    }
+
+    Yarn::Operand boolean(bool b)
+    {
+        Yarn::Operand operand;
+        operand.set_bool_value(b);
+        return operand;
+    }
+
+    /// Start : a line with three substitutions, count $i up, a command, then until $i reaches ROUNDS, three options (one disabled) and go again
+    Yarn::Program ringProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("event-ring");
+
+        (*program.mutable_initial_values())["$i"] = number(0);
+
+        Yarn::Node& node = addNode(program, "Start");
+
+        label(node, "event-ring-again");
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$i") });
+        add(node, Yarn::Instruction::PUSH_STRING, { string("ring") });
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$i") });
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:event-ring-count"), number(3) });
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$i") });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(1) });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(node, Yarn::Instruction::CALL_FUNC, { string("Number.Add") });
+        add(node, Yarn::Instruction::STORE_VARIABLE, { string("$i") });
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::RUN_COMMAND, { string("event-ring-command"), number(0) });
+
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$i") });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(ROUNDS) });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(node, Yarn::Instruction::CALL_FUNC, { string("Number.LessThan") });
+        add(node, Yarn::Instruction::JUMP_IF_FALSE, { string("event-ring-done") });
+        add(node, Yarn::Instruction::POP);
+
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$i") });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:event-ring-again"), string("event-ring-next"), number(1) });
+        add(node, Yarn::Instruction::PUSH_BOOL, { boolean(false) });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:event-ring-never"), string("event-ring-next"), number(0), boolean(true) });
+        add(node, Yarn::Instruction::PUSH_STRING, { string("x") });
+        add(node, Yarn::Instruction::PUSH_STRING, { string("y") });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:event-ring-also"), string("event-ring-next"), number(2) });
+        add(node, Yarn::Instruction::SHOW_OPTIONS);
+        add(node, Yarn::Instruction::JUMP);
+
+        label(node, "event-ring-next");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::JUMP_TO, { string("event-ring-again") });
+
+        label(node, "event-ring-done");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::STOP);
+
+        return program;
+    }
+
+    std::string describe(const Yarn::ProgramImage& image, const Yarn::EventRing& ring, const Yarn::VMEvent& event)
+    {
+        std::string text;
+
+        switch (event.type)
+        {
+        case Yarn::VMEvent::LINE: text = "line "; break;
+        case Yarn::VMEvent::COMMAND: text = "command "; break;
+        case Yarn::VMEvent::OPTION: text = "option " + std::to_string(event.index) + (event.enabled ? " " : " (disabled) "); break;
+        case Yarn::VMEvent::OPTIONS: return "options " + std::to_string(event.index);
+        case Yarn::VMEvent::STOPPED: return "stopped";
+        }
+
+        text += image.linked.strings[event.string];
+
+        for (std::size_t i = 0; i < event.substitutionCount; i++)
+        {
+            const Yarn::Value& value = ring.substitution(event, i);
+            text += " " + (value.has_string_value() ? std::string(value.string_value()) : std::to_string((int)value.float_value()));
+        }
+
+        return text;
+    }
+
+    /// what ringProgram() writes, substitutions top of the stack first
+    std::vector<std::string> expectedEvents()
+    {
+        std::vector<std::string> events;
+
+        for (int i = 0; i < ROUNDS; i++)
+        {
+            const std::string count = std::to_string(i);
+
+            events.push_back("line line:event-ring-count " + count + " ring " + count);
+            events.push_back("command event-ring-command");
+
+            if (i + 1 == ROUNDS)
+            {
+                events.push_back("stopped");
+                break;
+            }
+
+            events.push_back("option 0 line:event-ring-again " + std::to_string(i + 1));
+            events.push_back("option 1 (disabled) line:event-ring-never");
+            events.push_back("option 2 line:event-ring-also y x");
+            events.push_back("options 3");
+        }
+
+        return events;
+    }
+
+    /// runs ringProgram() on a ring of the given capacities, draining up to maxEvents after every run(), or when maxEvents is SIZE_MAX, all of them once it's full
+    void fillingVM(const std::shared_ptr<const Yarn::ProgramImage>& image, std::size_t eventCapacity, std::size_t valueCapacity, std::size_t maxEvents)
+    {
+        const std::string what = "a ring of " + std::to_string(eventCapacity) + " events and " + std::to_string(valueCapacity) + " values, drained "
+                               + ((maxEvents == SIZE_MAX) ? std::string("whole once full") : std::to_string(maxEvents) + " at a time");
+
+        Yarn::EventRing ring(eventCapacity, valueCapacity);
+
+        Yarn::YarnVM vm(image);
+        vm.eventRing = &ring;
+        vm.loadNode("Start");
+
+        std::vector<std::string> events;
+        int fulls = 0;
+        int answers = 0;
+        bool stopped = false;
+
+        auto record = [&](const Yarn::VMEvent& event) { events.push_back(describe(*image, ring, event)); };
+
+        try
+        {
+            for (int runs = 0; !stopped && (runs < MAX_RUNS); runs++)
+            {
+                const Yarn::YarnVM::YieldReason reason = vm.run();
+
+                if ((maxEvents != SIZE_MAX) || (reason == Yarn::YarnVM::YIELD_EVENTS_FULL))
+                {
+                    ring.drain(record, maxEvents);
+                }
+
+                switch (reason)
+                {
+                case Yarn::YarnVM::YIELD_EVENTS_FULL:
+                    fulls++;
+                    break;
+                case Yarn::YarnVM::YIELD_OPTIONS:
+                    vm.selectOption(((answers++ % 2) == 0) ? 0 : 2);
+                    break;
+                case Yarn::YarnVM::YIELD_STOPPED:
+                    stopped = true;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        catch (const YarnException& e)
+        {
+            check(false, what + " : " + e.what());
+        }
+
+        ring.drain(record);
+
+        const std::vector<std::string> expected = expectedEvents();
+
+        check(stopped, what + " : the program runs to its end");
+        check(fulls > 0, what + " : the VM yields YIELD_EVENTS_FULL");
+        check(events.size() == expected.size(), what + " : " + std::to_string(events.size()) + " events drained, expected " + std::to_string(expected.size()));
+
+        for (std::size_t i = 0; i < std::min(events.size(), expected.size()); i++)
+        {
+            if (events[i] != expected[i])
+            {
+                check(false, what + " : event " + std::to_string(i) + " is \"" + events[i] + "\", expected \"" + expected[i] + "\"");
+                return;
+            }
+        }
+    }
+}
+
+int main()
+{
+    capacities();
+    full();
+    wraparound();
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(ringProgram(), error);
+
+    if (!image)
+    {
+        std::cerr << "couldn't link the test program : " << error << std::endl;
+        return 1;
+    }
+
+    // full of events, then full of values : a line's three substitutions and the first option's leave no room for the third option's two
+    for (std::size_t maxEvents : { SIZE_MAX, std::size_t(1) })
+    {
+        fillingVM(image, 4, 8, maxEvents);
+        fillingVM(image, 16, 4, maxEvents);
+    }
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "events and substitutions come out of full and wrapped around rings in order" << std::endl;
+    return 0;
+}
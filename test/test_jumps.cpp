@@ -0,0 +1,158 @@
+/**
+ * @file test_jumps.cpp
+ *
+ * @brief Checks that conditional jumps to a label at the very end of a node stay within the node
+ *
+ * Conditional jumps carry on after their label, so one aimed at a label past the node's last instruction has nowhere to go.  Builds a node
+ * ending in such a label, once with a plain JUMP_IF_FALSE and once in the shape the linker fuses into JUMP_IF_VARIABLE_NOT_EQUAL, next to
+ * a node with a line of its own.  Taking the jump has to report running off the node, not step into the other node's code.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <iostream>
+#include <string>
+
+#include <yarn_vm.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    struct Callbacks : public Yarn::YarnVM::YarnCallbacks
+    {
+        int lines = 0;
+
+        void onRunLine(const Yarn::YarnVM::Line&) override { lines++; }
+        void onRunCommand(const std::string_view&) override { }
+        void onPresentOptions(const Yarn::YarnVM::OptionsList&) override { }
+    };
+
+    /// Start : a condition that's false, a jump past the end of the node when it is, and a line that's skipped.  Other : a line that must not run
+    Yarn::Program programEndingInLabel(bool fusable)
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("jumps");
+
+        (*program.mutable_initial_values())["$visits"] = number(0);
+
+        for (const char* name : { "A", "Start", "Z" })
+        {
+            Yarn::Node& other = addNode(program, name);
+            add(other, Yarn::Instruction::RUN_LINE, { string(std::string("line:jumps-") + name), number(0) });
+            add(other, Yarn::Instruction::STOP);
+        }
+
+        Yarn::Node& node = addNode(program, "Start");
+        node.clear_instructions();
+
+        if (fusable)
+        {
+            // $visits == 1, which the linker fuses into one JUMP_IF_VARIABLE_NOT_EQUAL
+            add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$visits") });
+            add(node, Yarn::Instruction::PUSH_FLOAT, { number(1) });
+            add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+            add(node, Yarn::Instruction::CALL_FUNC, { string("Number.EqualTo") });
+        }
+        else
+        {
+            add(node, Yarn::Instruction::PUSH_BOOL, { });
+            node.mutable_instructions(node.instructions_size() - 1)->add_operands()->set_bool_value(false);
+        }
+
+        add(node, Yarn::Instruction::JUMP_IF_FALSE, { string("jumps-end") });
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:jumps-skipped"), number(0) });
+        label(node, "jumps-end");
+
+        return program;
+    }
+
+    void jumpToEnd(bool fusable)
+    {
+        const std::string shape = fusable ? "JUMP_IF_VARIABLE_NOT_EQUAL" : "JUMP_IF_FALSE";
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(programEndingInLabel(fusable), error);
+
+        if (!image)
+        {
+            check(false, shape + " : the test program links : " + error);
+            return;
+        }
+
+        const Yarn::LinkedProgram& linked = image->linked;
+        const Yarn::LinkedProgram::Node& start = linked.nodes[linked.findNode("Start")];
+
+        bool fused = false;
+
+        for (const Yarn::LinkedProgram::Instruction& instruction : start.code)
+        {
+            fused = fused || (instruction.opcode == Yarn::LinkedProgram::JUMP_IF_VARIABLE_NOT_EQUAL);
+        }
+
+        check(fused == fusable, shape + " : the condition is " + (fusable ? "" : "not ") + "fused");
+
+        {
+            Yarn::YarnVM vm(image);
+            Callbacks callbacks;
+            vm.setCallbacks(&callbacks);
+            vm.loadNode("Start");
+
+            bool threw = false;
+
+            try
+            {
+                vm.run();
+            }
+            catch (const YarnException&)
+            {
+                threw = true;
+            }
+
+            check(threw, shape + " : a jump to the end of the node reports running off it");
+            check(callbacks.lines == 0, shape + " : a jump to the end of the node doesn't run another node's line");
+        }
+
+        {
+            Yarn::YarnVM::Settings settings;
+            settings.enableExceptions = false;
+
+            Yarn::YarnVM vm(settings);
+            Callbacks callbacks;
+            vm.setCallbacks(&callbacks);
+            vm.loadProgram(image);
+            vm.loadNode("Start");
+
+            check(vm.run() == Yarn::YarnVM::YIELD_STOPPED, shape + " : without exceptions, a jump to the end of the node stops the VM");
+            check(callbacks.lines == 0, shape + " : without exceptions, a jump to the end of the node doesn't run another node's line");
+        }
+    }
+}
+
+int main()
+{
+    jumpToEnd(false);
+    jumpToEnd(true);
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "conditional jumps to the end of a node stay within it" << std::endl;
+    return 0;
+}
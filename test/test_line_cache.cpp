@@ -0,0 +1,249 @@
+/**
+ * @file test_line_cache.cpp
+ *
+ * @brief Checks that the line database's binary cache reads back what was written, and is turned down once it no longer fits the csv files
+ *
+ * Writes a module's csv files, with quoted text, tags, and tags for a line the lines file doesn't have, then saves the parsed database with
+ * saveBinary() and reads it back with loadBinary() : every line has to come back the same.  A cache is still used when a csv file was only
+ * touched, and turned down when a file's size or contents change, or when its checksum, header or length is damaged.  A cache turned down
+ * leaves the database as it was, and loadCached() parses the csv files instead and writes a cache that fits them.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_line_database.h>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    const char* const LINES =
+        "id,text,file,node,lineNumber\n"
+        "line:cache-0,Hello there.,cache.yarn,Start,3\n"
+        "line:cache-1,\"Hi, and \"\"welcome\"\".\",cache.yarn,Start,4\n"
+        "line:cache-2,\"Two\nlines\",cache.yarn,Other,10\n";
+
+    const char* const METADATA =
+        "id,node,lineNumber,tags\n"
+        "line:cache-0,Start,3,tone:warm,greeting\n"
+        "line:cache-2,Other,10,last\n"
+        "line:cache-tags-only,Other,11,orphan\n";
+
+    struct Module
+    {
+        std::filesystem::path directory;
+        std::string lines;
+        std::string metadata;
+        std::string cache;
+    };
+
+    void write(const std::string& path, const std::string& contents)
+    {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        os << contents;
+    }
+
+    std::string read(const std::string& path)
+    {
+        std::ifstream is(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    /// every line of the database, with its tags, in id order
+    std::vector<std::string> describe(const Yarn::LineDatabase& db)
+    {
+        std::vector<std::string> lines;
+
+        for (std::size_t i = 0; i < db.size(); i++)
+        {
+            const Yarn::LineData line = db.line(i);
+            std::string text = std::string(line.id) + "|" + std::string(line.text) + "|" + std::string(line.file) + "|" + std::string(line.node) + "|" + std::to_string(line.lineNumber);
+
+            for (std::size_t tag = 0; tag < line.tags.size(); tag++)
+            {
+                text += "|#" + std::string(line.tags[tag]);
+            }
+
+            lines.push_back(text);
+        }
+
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    }
+
+    std::vector<std::string> parse(const Module& module)
+    {
+        Yarn::LineDatabase db;
+        db.load(module.lines, module.metadata);
+        return describe(db);
+    }
+
+    /// whether loadBinary() takes the cache.  One that's turned down has to leave the database untouched
+    bool accepted(const Module& module)
+    {
+        Yarn::LineDatabase db;
+        db.add("line:cache-before", "already here", "other.yarn", "Start", 1);
+
+        const std::vector<std::string> before = describe(db);
+
+        if (db.loadBinary(module.cache, module.lines, module.metadata))
+        {
+            return true;
+        }
+
+        check(describe(db) == before, "a cache that's turned down leaves the database as it was");
+        return false;
+    }
+
+    void roundTrip(const Module& module)
+    {
+        Yarn::LineDatabase parsed;
+        parsed.load(module.lines, module.metadata);
+
+        check(parsed.size() == 4, "the csv files have four lines, one of them only tagged");
+        check(parsed.saveBinary(module.cache, module.lines, module.metadata), "the cache is written");
+        check(!std::filesystem::exists(module.cache + ".tmp"), "the temporary cache file is renamed over the cache");
+
+        Yarn::LineDatabase cached;
+        check(cached.loadBinary(module.cache, module.lines, module.metadata), "the cache is read back");
+        check(describe(cached) == describe(parsed), "the cache holds the lines and tags that were parsed");
+
+        check(cached.text("line:cache-1") == "Hi, and \"welcome\".", "quoted text comes back unquoted");
+        check(cached.text("line:cache-2") == "Two\nlines", "text across lines comes back");
+        check(cached.hasTag("line:cache-0", "tone:warm") && cached.hasTag("line:cache-0", "greeting"), "tags come back");
+        check(cached.hasTag("line:cache-tags-only", "orphan"), "tags of lines the lines file doesn't have come back");
+
+        Yarn::LineDatabase loaded;
+        loaded.loadCached(module.lines, module.metadata);
+        check(describe(loaded) == describe(parsed), "loadCached() reads the same lines from the cache");
+    }
+
+    /// a csv file only touched keeps the cache.  Changing its size or, at the same size, its contents makes it stale
+    void stale(const Module& module)
+    {
+        const std::filesystem::file_time_type modified = std::filesystem::last_write_time(module.lines);
+
+        std::filesystem::last_write_time(module.lines, modified + std::chrono::seconds(5));
+        check(accepted(module), "a cache is still used when its lines file was only touched");
+
+        std::filesystem::last_write_time(module.metadata, std::filesystem::last_write_time(module.metadata) + std::chrono::seconds(5));
+        check(accepted(module), "a cache is still used when its metadata file was only touched");
+
+        // same size, different text
+        std::string sameSize = LINES;
+        sameSize.replace(sameSize.find("Hello there."), 12, "Hello again.");
+        write(module.lines, sameSize);
+        std::filesystem::last_write_time(module.lines, modified + std::chrono::seconds(10));
+        check(!accepted(module), "a cache is turned down when its lines file changes, even at the same size");
+
+        Yarn::LineDatabase reloaded;
+        reloaded.loadCached(module.lines, module.metadata);
+        check(reloaded.text("line:cache-0") == "Hello again.", "loadCached() parses a lines file that changed");
+        check(describe(reloaded) == parse(module), "loadCached() parses everything when the cache is stale");
+        check(accepted(module), "loadCached() rewrites a stale cache");
+
+        write(module.lines, std::string(LINES) + "line:cache-3,Added.,cache.yarn,Other,12\n");
+        check(!accepted(module), "a cache is turned down when its lines file grows");
+
+        write(module.lines, LINES);
+        Yarn::LineDatabase rewritten;
+        rewritten.loadCached(module.lines, module.metadata);
+
+        write(module.metadata, std::string(METADATA) + "line:cache-1,Start,4,new\n");
+        check(!accepted(module), "a cache is turned down when its metadata file changes");
+
+        write(module.metadata, METADATA);
+        rewritten.clear();
+        rewritten.loadCached(module.lines, module.metadata);
+        check(accepted(module), "the cache fits the csv files again");
+    }
+
+    /// flips one byte of the cache, or cuts it short, and checks it's turned down, then puts it back
+    void corrupt(const Module& module)
+    {
+        const std::string good = read(module.cache);
+
+        auto damaged = [&](std::size_t offset, const std::string& what)
+        {
+            std::string bad = good;
+            bad[offset] ^= 0x20;
+            write(module.cache, bad);
+
+            check(!accepted(module), "a cache is turned down with a damaged " + what);
+        };
+
+        damaged(0, "magic number");
+        damaged(16, "checksum");
+        damaged(good.size() / 2, "table");
+        damaged(good.size() - 1, "string");
+
+        write(module.cache, good.substr(0, good.size() - 1));
+        check(!accepted(module), "a cache is turned down when it's cut short");
+
+        write(module.cache, good + "x");
+        check(!accepted(module), "a cache is turned down with bytes after it");
+
+        write(module.cache, good.substr(0, 10));
+        check(!accepted(module), "a cache is turned down when it's shorter than its header");
+
+        write(module.cache, good);
+        check(accepted(module), "the cache put back is used");
+
+        write(module.cache, good.substr(0, good.size() - 1) + (char)(good.back() ^ 0x20));
+
+        Yarn::LineDatabase reloaded;
+        reloaded.loadCached(module.lines, module.metadata);
+        check(describe(reloaded) == parse(module), "loadCached() parses the csv files instead of a damaged cache");
+        check(accepted(module), "loadCached() rewrites a damaged cache");
+    }
+}
+
+int main()
+{
+    Module module;
+    module.directory = std::filesystem::temp_directory_path() / "test_line_cache_module";
+    std::filesystem::remove_all(module.directory);
+    std::filesystem::create_directories(module.directory);
+
+    module.lines = (module.directory / "cache-Lines.csv").string();
+    module.metadata = (module.directory / "cache-Metadata.csv").string();
+    module.cache = Yarn::LineDatabase::cachePath(module.lines);
+
+    check(module.cache == (module.directory / "cache-Lines.yarnlines").string(), "the cache goes next to the lines file");
+
+    write(module.lines, LINES);
+    write(module.metadata, METADATA);
+
+    check(!accepted(module), "there's no cache before one is written");
+
+    roundTrip(module);
+    stale(module);
+    corrupt(module);
+
+    std::filesystem::remove_all(module.directory);
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "the line cache round trips, and stale and damaged caches are turned down" << std::endl;
+    return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file test_line_database.cpp
+ *
+ * @brief Checks that LineDatabase::add() replaces a line's text, in place when the new text fits and after the other lines when it doesn't
+ *
+ * Replaces the middle one of three lines with shorter, equal, empty and longer text, and with text viewing the database's own storage : the
+ * line has to read back its new text, keep its index and tags, and leave its neighbours alone.  Reloading the same text over and over, as
+ * reloading a module does, and shortening it mustn't grow the database, while longer text has to.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <iostream>
+#include <string>
+
+#include <yarn_line_database.h>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    const std::string FIRST = "The first line, left alone.";
+    const std::string LAST = "The last line, also left alone.";
+
+    /// the middle line reads text, and the lines either side of it haven't changed
+    void expect(const Yarn::LineDatabase& db, const std::string& text, const std::string& what)
+    {
+        check(db.text("line:middle") == text, what + " : the line reads \"" + std::string(db.text("line:middle")) + "\", expected \"" + text + "\"");
+        check((db.text("line:first") == FIRST) && (db.text("line:last") == LAST), what + " : the lines around it are left alone");
+        check((db.size() == 3) && (db.findLine("line:middle") == 1), what + " : the line keeps its place");
+        check(db.hasTag("line:middle", "kept"), what + " : the line keeps its tags");
+    }
+
+    void replace()
+    {
+        Yarn::LineDatabase db;
+
+        db.add("line:first", FIRST, "replace.yarn", "Start", 1);
+        db.add("line:middle", "The middle line, to be replaced.", "replace.yarn", "Start", 2);
+        db.add("line:last", LAST, "replace.yarn", "Start", 3);
+        db.addTag("line:middle", "kept");
+
+        db.add("line:middle", "Shorter.", "other.yarn", "Other", 20);
+        expect(db, "Shorter.", "shorter text");
+
+        const Yarn::LineData line = db.line(1);
+        check((line.file == "other.yarn") && (line.node == "Other") && (line.lineNumber == 20), "shorter text : the file, node and line number are replaced");
+
+        db.add("line:middle", "Same....", "replace.yarn", "Start", 2);
+        expect(db, "Same....", "text of the same length");
+
+        db.add("line:middle", "", "replace.yarn", "Start", 2);
+        expect(db, "", "empty text");
+
+        db.add("line:middle", "Now longer than any text the line has had before.", "replace.yarn", "Start", 2);
+        expect(db, "Now longer than any text the line has had before.", "longer text");
+
+        db.add("line:middle", "Short again.", "replace.yarn", "Start", 2);
+        expect(db, "Short again.", "shorter text after longer text");
+
+        // text viewing the database's own storage : part of the line's own text, which overlaps where it's copied to, then a longer neighbour's
+        db.add("line:middle", db.text("line:middle").substr(6), "replace.yarn", "Start", 2);
+        expect(db, "again.", "the line's own text, shortened");
+
+        db.add("line:middle", db.text("line:last"), "replace.yarn", "Start", 2);
+        expect(db, LAST, "a longer line's text");
+
+        db.add("line:middle", db.text("line:first"), "replace.yarn", "Start", 2);
+        expect(db, FIRST, "a shorter line's text");
+    }
+
+    /// replacing with the same or shorter text, as reloading a module's lines does, leaves the database the size it was.  Longer text makes it grow
+    void growth()
+    {
+        Yarn::LineDatabase db;
+
+        for (int i = 0; i < 100; i++)
+        {
+            db.add("line:growth-" + std::to_string(i), "Line number " + std::to_string(i) + " of the module.", "growth.yarn", "Start", i);
+        }
+
+        const std::uint64_t size = db.sizeBytes();
+
+        for (int reload = 0; reload < 50; reload++)
+        {
+            for (int i = 0; i < 100; i++)
+            {
+                db.add("line:growth-" + std::to_string(i), "Line number " + std::to_string(i) + " of the module.", "growth.yarn", "Start", i);
+            }
+        }
+
+        check(db.sizeBytes() == size, "reloading the same text leaves the database at " + std::to_string(size) + " bytes, it's " + std::to_string(db.sizeBytes()));
+
+        for (int i = 0; i < 100; i++)
+        {
+            db.add("line:growth-" + std::to_string(i), "Line " + std::to_string(i) + ".", "growth.yarn", "Start", i);
+        }
+
+        check(db.sizeBytes() == size, "shortening every line leaves the database at " + std::to_string(size) + " bytes, it's " + std::to_string(db.sizeBytes()));
+        check(db.text("line:growth-42") == "Line 42.", "shortened lines read their new text");
+
+        for (int reload = 0; reload < 50; reload++)
+        {
+            db.add("line:growth-0", std::string(100 + reload, 'x'), "growth.yarn", "Start", 0);
+        }
+
+        check(db.sizeBytes() > size, "text that doesn't fit makes the database grow");
+        check(db.text("line:growth-0") == std::string(149, 'x'), "a line replaced with ever longer text reads its last text");
+        check(db.text("line:growth-1") == "Line 1.", "the line after it is left alone");
+    }
+}
+
+int main()
+{
+    replace();
+    growth();
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "replaced lines read their new text, in place or appended" << std::endl;
+    return 0;
+}
@@ -0,0 +1,242 @@
+/**
+ * @file test_load_async.cpp
+ *
+ * @brief Checks that YarnRunnerBase::loadModuleAsync() leaves a runner in the same state as loadModule()
+ *
+ * Loads every module in test/ on one runner with loadModule() and on another with loadModuleAsync(), with the line cache off and on, and at the
+ * start node and at a node the program doesn't have.  The runners need the same module name, line database, links from the program's strings
+ * to lines, missing lines and current node, and have to play the same dialogue from there : the text of every line and option, and every
+ * command.  With missing lines made errors, either both loads throw or neither does.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest from the source directory
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_dialogue_runner.h>
+
+#include "trace_player.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /// records the text it's handed, the options it's shown and the commands it runs, and handles the built in wait itself
+    struct Runner : public Yarn::YarnRunnerBase
+    {
+        TracePlayer::Trace trace;
+
+        void onReceiveText(const std::string_view& s, bool) override
+        {
+            trace.push_back("text " + std::string(s));
+        }
+
+        void onRunCommand(const std::string_view& command) override
+        {
+            if (!vm.handleWaitCommand(command))
+            {
+                trace.push_back("command " + std::string(command));
+            }
+        }
+
+        void onPresentOptions(const Yarn::YarnVM::OptionsList& options) override
+        {
+            std::string s = "options";
+
+            for (const Yarn::YarnVM::Option& option : options)
+            {
+                s += " " + std::string(db.text(option.line.id)) + (option.enabled ? "" : " (disabled)");
+            }
+
+            trace.push_back(s);
+        }
+    };
+
+    /// everything loading a module sets : the line database, how the program's strings link to it, and where the VM starts
+    TracePlayer::Trace describe(const Runner& runner)
+    {
+        TracePlayer::Trace state;
+
+        state.push_back("module " + runner.moduleName);
+
+        TracePlayer::Trace lines;
+
+        for (std::size_t i = 0; i < runner.db.lineCount(); i++)
+        {
+            const Yarn::LineData line = runner.db.line(i);
+            std::string s = "line " + std::string(line.id) + " : " + std::string(line.text) + " (" + std::string(line.file) + ", " + std::string(line.node) + ", " + std::to_string(line.lineNumber) + ")";
+
+            for (std::size_t tag = 0; tag < line.tags.size(); tag++)
+            {
+                s += " #" + std::string(line.tags[tag]);
+            }
+
+            lines.push_back(s);
+        }
+
+        // merged databases may hold their lines in another order, so links are compared by line id
+        std::sort(lines.begin(), lines.end());
+        state.insert(state.end(), lines.begin(), lines.end());
+
+        for (std::size_t i = 0; i < runner.vm.lineIndices.size(); i++)
+        {
+            const std::int32_t line = runner.vm.lineIndices[i];
+            state.push_back("string " + std::to_string(i) + " links to " + ((line == Yarn::LineDatabase::NOT_FOUND) ? std::string("nothing") : std::string(runner.db.line((std::size_t)line).id)));
+        }
+
+        for (const std::string& missing : runner.missingLines)
+        {
+            state.push_back("missing " + missing);
+        }
+
+        state.push_back("node " + (runner.vm.currentNode ? runner.vm.currentNode->name() : std::string("none")) + " at " + std::to_string(runner.vm.instructionPointer)
+                        + ", state " + std::to_string((int)runner.vm.runningState));
+
+        return state;
+    }
+
+    /// runs the runner from wherever loading left it, answering options with TracePlayer::choose()
+    void play(Runner& runner)
+    {
+        Yarn::YarnVM& vm = runner.vm;
+
+        try
+        {
+            for (int answers = 0; runner.trace.size() < TracePlayer::MAX_EVENTS;)
+            {
+                const Yarn::YarnVM::YieldReason reason = vm.run();
+
+                if (reason == Yarn::YarnVM::YIELD_STOPPED)
+                {
+                    runner.trace.push_back("stopped");
+                    break;
+                }
+
+                if (reason == Yarn::YarnVM::YIELD_WAIT)
+                {
+                    vm.setTime(vm.waitUntilTime);
+                }
+                else if ((reason == Yarn::YarnVM::YIELD_OPTIONS) && (vm.runningState == Yarn::YarnVM::AWAITING_INPUT))
+                {
+                    const int option = TracePlayer::choose(vm.currentOptionsList, answers++);
+
+                    if (option < 0)
+                    {
+                        runner.trace.push_back("no enabled options");
+                        break;
+                    }
+
+                    vm.selectOption(option);
+                }
+            }
+        }
+        catch (const YarnException& e)
+        {
+            runner.trace.push_back(std::string("error ") + e.what());
+        }
+    }
+
+    /// loads module with loadModule() into one runner and with loadModuleAsync() into another, and compares them
+    void sameLoad(const std::string& module, const std::string& startNode, bool cache, bool missingLinesAreErrors)
+    {
+        const std::string what = module + " at " + startNode + (cache ? ", through the line cache" : "") + (missingLinesAreErrors ? ", with missing lines errors" : "");
+
+        Runner loaded;
+        Runner loadedAsync;
+
+        for (Runner* runner : { &loaded, &loadedAsync })
+        {
+            runner->setts.cacheLineDatabase = cache;
+            runner->setts.missingLinesAreErrors = missingLinesAreErrors;
+            runner->setts.alwaysIgnoreMarkup = true;
+        }
+
+        std::string error;
+        std::string asyncError;
+
+        try
+        {
+            loaded.loadModule(module, startNode);
+        }
+        catch (const YarnException& e)
+        {
+            error = e.what();
+        }
+
+        try
+        {
+            loadedAsync.loadModuleAsync(module, startNode).get();
+        }
+        catch (const YarnException& e)
+        {
+            asyncError = e.what();
+        }
+
+        check(error.empty() == asyncError.empty(), what + " : loadModule() " + (error.empty() ? "loads" : "throws " + error) + ", loadModuleAsync() " + (asyncError.empty() ? "loads" : "throws " + asyncError));
+
+        if (!error.empty() || !asyncError.empty())
+        {
+            return;
+        }
+
+        const TracePlayer::Trace expected = describe(loaded);
+        const TracePlayer::Trace actual = describe(loadedAsync);
+
+        check(expected == actual, what + " : loadModuleAsync() loads differently, " + TracePlayer::difference(expected, actual));
+
+        play(loaded);
+        play(loadedAsync);
+
+        check(loaded.trace == loadedAsync.trace, what + " : the runners play differently, " + TracePlayer::difference(loaded.trace, loadedAsync.trace));
+    }
+}
+
+int main()
+{
+    std::vector<std::string> modules;
+
+    for (const std::filesystem::path& file : TracePlayer::testPrograms())
+    {
+        std::filesystem::path module = file;
+        module.replace_extension();
+
+        if (std::filesystem::exists(module.string() + "-Lines.csv") && std::filesystem::exists(module.string() + "-Metadata.csv"))
+        {
+            modules.push_back(module.string());
+        }
+    }
+
+    check(!modules.empty(), "there are modules in test/");
+
+    for (const std::string& module : modules)
+    {
+        for (bool cache : { false, true })
+        {
+            sameLoad(module, "Start", cache, false);
+        }
+
+        sameLoad(module, "NoSuchNode", false, false);
+        sameLoad(module, "Start", false, true);
+    }
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << modules.size() << " modules load the same through loadModuleAsync() as through loadModule()" << std::endl;
+    return 0;
+}
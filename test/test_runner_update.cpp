@@ -0,0 +1,242 @@
+/**
+ * @file test_runner_update.cpp
+ *
+ * @brief Checks that YarnRunnerBase::update() keeps to its budgets, and that a dialogue cut into budgeted updates ends the same as one run whole
+ *
+ * The program waits, then sums a countdown in a loop of a few thousand instructions, and says the sum.  It's played with instruction budgets
+ * either side of the 4096 instructions update() runs between reading the clock : every update that runs out has to stop on exactly its budget
+ * with the VM still running, and the next one carry on, to the same sum and the same number of instructions as an update without a budget.
+ * Then a loop too long to finish is run against time budgets : update() only reads the clock between slices, so the instructions run have
+ * to come in whole slices of 4096, and no time budget at all runs none.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <yarn_dialogue_runner.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    constexpr std::size_t UNLIMITED = std::numeric_limits<std::size_t>::max();
+    constexpr std::size_t TIME_CHECK_INTERVAL = 4096; ///< as in update()
+    constexpr long long WAIT = 10;
+    constexpr int COUNTDOWN = 5000;     ///< the sum stays exact in a float
+    constexpr int MAX_UPDATES = 1000000;
+
+    /// records the lines it runs, and handles the built in wait without the console, which echoes what it runs
+    struct Runner : public Yarn::YarnRunnerBase
+    {
+        std::vector<std::string> lines;
+
+        void onReceiveText(const std::string_view&, bool) override { }
+        void onPresentOptions(const Yarn::YarnVM::OptionsList&) override { }
+        void onRunCommand(const std::string_view& command) override { vm.handleWaitCommand(command); }
+
+        void onRunLine(const Yarn::YarnVM::Line& line) override
+        {
+            lines.push_back(std::string(line.id) + (line.substitutions.empty() ? std::string() : " " + std::to_string((long long)line.substitutions[0].float_value())));
+        }
+    };
+
+    /// Start : wait, then $sum += $n while $n counts down to 0, and say $sum
+    std::shared_ptr<const Yarn::ProgramImage> countdownProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("runner-update");
+
+        (*program.mutable_initial_values())["$n"] = number(0);
+        (*program.mutable_initial_values())["$sum"] = number(0);
+
+        Yarn::Node& node = addNode(program, "Start");
+
+        add(node, Yarn::Instruction::RUN_COMMAND, { string("wait " + std::to_string(WAIT)), number(0) });
+
+        label(node, "runner-update-loop");
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$n") });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(0) });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(node, Yarn::Instruction::CALL_FUNC, { string("Number.GreaterThan") });
+        add(node, Yarn::Instruction::JUMP_IF_FALSE, { string("runner-update-done") });
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$sum") });
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$n") });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(node, Yarn::Instruction::CALL_FUNC, { string("Number.Add") });
+        add(node, Yarn::Instruction::STORE_VARIABLE, { string("$sum") });
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$n") });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(1) });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(node, Yarn::Instruction::CALL_FUNC, { string("Number.Minus") });
+        add(node, Yarn::Instruction::STORE_VARIABLE, { string("$n") });
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::JUMP_TO, { string("runner-update-loop") });
+
+        label(node, "runner-update-done");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$sum") });
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:runner-update-sum"), number(1) });
+        add(node, Yarn::Instruction::STOP);
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(std::move(program), error);
+
+        check(image != nullptr, "the test program links : " + error);
+        return image;
+    }
+
+    void start(Runner& runner, const std::shared_ptr<const Yarn::ProgramImage>& image, int countdown)
+    {
+        runner.vm.loadProgram(image);
+        runner.vm.setVariable("$n", ProgramBuilder::number((float)countdown));
+        runner.vm.loadNode("Start");
+    }
+
+    struct Played
+    {
+        std::vector<std::string> lines;
+        std::uint64_t instructions = 0;
+        int updates = 0;
+    };
+
+    /// updates with the given instruction budget until the program stops, advancing time only while the VM is asleep
+    Played play(const std::shared_ptr<const Yarn::ProgramImage>& image, std::size_t budget)
+    {
+        const std::string what = (budget == UNLIMITED) ? std::string("without a budget") : "with a budget of " + std::to_string(budget);
+
+        Runner runner;
+        start(runner, image, COUNTDOWN);
+
+        Played played;
+        Yarn::YarnVM::YieldReason reason = Yarn::YarnVM::YIELD_LINE;
+
+        for (; (reason != Yarn::YarnVM::YIELD_STOPPED) && (played.updates < MAX_UPDATES); played.updates++)
+        {
+            const bool asleep = (runner.vm.runningState == Yarn::YarnVM::ASLEEP);
+
+            reason = runner.update(asleep ? WAIT : 0, budget);
+
+            if (runner.frameStats.instructions > budget)
+            {
+                check(false, what + " : update " + std::to_string(played.updates) + " ran " + std::to_string(runner.frameStats.instructions) + " instructions");
+                break;
+            }
+
+            if (reason == Yarn::YarnVM::YIELD_BUDGET_EXHAUSTED)
+            {
+                if ((runner.frameStats.instructions != budget) || !runner.frameStats.budgetExhausted || (runner.vm.runningState != Yarn::YarnVM::RUNNING))
+                {
+                    check(false, what + " : update " + std::to_string(played.updates) + " runs out on exactly its budget, leaving the VM running");
+                    break;
+                }
+            }
+            else if (reason == Yarn::YarnVM::YIELD_WAIT)
+            {
+                // an update that doesn't move time past the wait leaves the VM asleep, without running anything
+                const Yarn::YarnVM::YieldReason still = runner.update(0, budget);
+
+                check(still == Yarn::YarnVM::YIELD_WAIT, what + " : the VM sleeps until time reaches the wait");
+                check((runner.frameStats.instructions == 0) && !runner.frameStats.budgetExhausted, what + " : a sleeping VM runs nothing");
+            }
+        }
+
+        check(reason == Yarn::YarnVM::YIELD_STOPPED, what + " : the program runs to its end");
+
+        played.lines = runner.lines;
+        played.instructions = runner.vm.instructionsExecuted;
+
+        return played;
+    }
+
+    /// budgeted by time alone, update() runs whole slices of TIME_CHECK_INTERVAL instructions, until a slice ends past the budget
+    void timeBudgets(const std::shared_ptr<const Yarn::ProgramImage>& image)
+    {
+        Runner runner;
+        start(runner, image, 10000000); // far more than a few milliseconds' worth
+
+        check(runner.update(0, UNLIMITED) == Yarn::YarnVM::YIELD_WAIT, "the program starts with a wait");
+
+        long long dt = WAIT;
+
+        for (std::chrono::nanoseconds budget : { std::chrono::nanoseconds(0), std::chrono::nanoseconds(std::chrono::microseconds(1)),
+                                                 std::chrono::nanoseconds(std::chrono::microseconds(200)), std::chrono::nanoseconds(std::chrono::milliseconds(2)) })
+        {
+            const std::string what = "with a time budget of " + std::to_string(budget.count()) + "ns";
+            const std::uint64_t before = runner.vm.instructionsExecuted;
+
+            const Yarn::YarnVM::YieldReason reason = runner.update(dt, UNLIMITED, budget);
+            dt = 0;
+
+            check(reason == Yarn::YarnVM::YIELD_BUDGET_EXHAUSTED, what + " : the update runs out of time");
+            check(runner.frameStats.budgetExhausted && (runner.vm.runningState == Yarn::YarnVM::RUNNING), what + " : the VM is left running");
+            check(runner.frameStats.instructions == runner.vm.instructionsExecuted - before, what + " : frameStats counts the instructions run");
+            check(runner.frameStats.instructions % TIME_CHECK_INTERVAL == 0, what + " : " + std::to_string(runner.frameStats.instructions) + " instructions aren't whole slices");
+            check(runner.frameStats.time >= budget, what + " : the update took at least its budget");
+
+            if (budget.count() == 0)
+            {
+                check(runner.frameStats.instructions == 0, what + " : no time runs nothing");
+            }
+            else if (budget >= std::chrono::milliseconds(1))
+            {
+                check(runner.frameStats.instructions > 0, what + " : the update runs something");
+            }
+        }
+    }
+}
+
+int main()
+{
+    std::shared_ptr<const Yarn::ProgramImage> image = countdownProgram();
+
+    if (!image)
+    {
+        return 1;
+    }
+
+    const Played whole = play(image, UNLIMITED);
+    const std::string sum = "line:runner-update-sum " + std::to_string(COUNTDOWN * (COUNTDOWN + 1) / 2);
+
+    check((whole.lines.size() == 1) && (whole.lines[0] == sum), "without a budget, the program says the sum");
+    check(whole.instructions > 3 * TIME_CHECK_INTERVAL, "the loop runs for several time checks");
+
+    for (std::size_t budget : { std::size_t(1), std::size_t(7), TIME_CHECK_INTERVAL - 1, TIME_CHECK_INTERVAL, TIME_CHECK_INTERVAL + 1, std::size_t(10000) })
+    {
+        const Played cut = play(image, budget);
+        const std::string what = "with a budget of " + std::to_string(budget);
+
+        check(cut.lines == whole.lines, what + " : the program says the same as without a budget");
+        check(cut.instructions == whole.instructions, what + " : the program runs the same instructions as without a budget");
+        check((std::uint64_t)cut.updates >= whole.instructions / budget, what + " : the program takes as many updates as its budget allows");
+    }
+
+    timeBudgets(image);
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "budgeted updates stop on their budgets and resume to the same end, over " << whole.instructions << " instructions" << std::endl;
+    return 0;
+}
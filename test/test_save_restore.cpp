@@ -0,0 +1,173 @@
+/**
+ * @file test_save_restore.cpp
+ *
+ * @brief Checks that VM saves restore, and that saves that don't fit the loaded program are rejected rather than run
+ *
+ * Runs test/dopts until it presents options, saves, and restores the save into a fresh VM.  Then restores saves without a version
+ * (written before instruction pointers indexed the lowered code), and with an instruction pointer past the end of the node, which have to fail.
+ * Last, saves a dialogue runner while options are showing, and checks the restored runner presents them against its loaded, linked line database.
+ *
+ * Built with BUILD_UNIT_TESTS and YARN_SERIALIZATION_JSON, run by ctest from the source directory
+ */
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_dialogue_runner.h>
+#include <yarn_vm.h>
+
+namespace
+{
+    struct Callbacks : public Yarn::YarnVM::YarnCallbacks
+    {
+        void onRunLine(const Yarn::YarnVM::Line&) override { }
+        void onRunCommand(const std::string_view&) override { }
+        void onPresentOptions(const Yarn::YarnVM::OptionsList&) override { }
+    };
+
+    /// records the text of the options it's shown, looked up the way onRunLine looks lines up
+    struct OptionsRunner : public Yarn::YarnRunnerBase
+    {
+        std::vector<std::string> shown;
+        bool resolved = true;
+
+        void onReceiveText(const std::string_view&, bool) override { }
+
+        void onPresentOptions(const Yarn::YarnVM::OptionsList& options) override
+        {
+            shown.clear();
+
+            for (const Yarn::YarnVM::Option& option : options)
+            {
+                resolved = resolved && (option.line.index != Yarn::LinkedProgram::UNRESOLVED);
+                shown.push_back(std::string(db.text(option.line.id)));
+            }
+        }
+    };
+
+    int failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /// whether restoring js into a fresh VM throws
+    bool rejected(const nlohmann::json& js)
+    {
+        Yarn::YarnVM vm;
+        Callbacks callbacks;
+        vm.setCallbacks(&callbacks);
+
+        try
+        {
+            vm.fromJS(js);
+        }
+        catch (const YarnException&)
+        {
+            return true;
+        }
+
+        return false;
+    }
+}
+
+int main()
+{
+    Yarn::YarnVM vm;
+    Callbacks callbacks;
+    vm.setCallbacks(&callbacks);
+
+    vm.loadProgram("test/dopts.yarnc");
+    vm.loadNode("Start");
+
+    Yarn::YarnVM::YieldReason reason = Yarn::YarnVM::YIELD_LINE;
+
+    while ((reason != Yarn::YarnVM::YIELD_OPTIONS) && (reason != Yarn::YarnVM::YIELD_STOPPED))
+    {
+        reason = vm.run();
+    }
+
+    if (reason != Yarn::YarnVM::YIELD_OPTIONS)
+    {
+        std::cerr << "test/dopts stopped without presenting options" << std::endl;
+        return 1;
+    }
+
+    const nlohmann::json saved = vm.toJS();
+
+    check(saved.value("saveVersion", 0) == Yarn::YarnVM::SAVE_VERSION, "saves are stamped with SAVE_VERSION");
+
+    {
+        Yarn::YarnVM restored;
+        Callbacks restoredCallbacks;
+        restored.setCallbacks(&restoredCallbacks);
+        restored.fromJS(saved);
+
+        check(restored.toJS() == saved, "a restored VM saves the same state");
+        check(restored.runningState == Yarn::YarnVM::AWAITING_INPUT, "a restored VM is awaiting input");
+    }
+
+    nlohmann::json unversioned = saved;
+    unversioned.erase("saveVersion");
+    check(rejected(unversioned), "saves without a version are rejected");
+
+    nlohmann::json pastTheEnd = saved;
+    pastTheEnd["instructionPointer"] = 1000000;
+    check(rejected(pastTheEnd), "instruction pointers past the end of the node are rejected");
+
+    {
+        // without exceptions, a save that doesn't fit leaves the VM stopped
+        nlohmann::json quiet = pastTheEnd;
+        quiet["settings"]["enableExceptions"] = false;
+
+        Yarn::YarnVM restored;
+        Callbacks restoredCallbacks;
+        restored.setCallbacks(&restoredCallbacks);
+        restored.fromJS(quiet);
+
+        check(restored.runningState == Yarn::YarnVM::STOPPED, "without exceptions, a rejected save leaves the VM stopped");
+        check(restored.run() == Yarn::YarnVM::YIELD_STOPPED, "a VM stopped by a rejected save doesn't run");
+    }
+
+    {
+        // a runner saved while options are showing has to present them, on restore, with the line database already loaded and linked
+        const std::string saveFile = (std::filesystem::temp_directory_path() / "test_save_restore.json").string();
+
+        OptionsRunner runner;
+        runner.setts.cacheLineDatabase = false;
+        runner.loadModule("test/dopts");
+
+        while ((runner.vm.runningState == Yarn::YarnVM::RUNNING) && (runner.vm.run() != Yarn::YarnVM::YIELD_OPTIONS))
+        {
+        }
+
+        check(runner.vm.runningState == Yarn::YarnVM::AWAITING_INPUT, "the runner stops at test/dopts's options");
+        check(!runner.shown.empty() && !runner.shown.front().empty(), "test/dopts's options have text");
+
+        runner.save(saveFile);
+
+        OptionsRunner restored;
+        restored.setts.cacheLineDatabase = false;
+        restored.restore(saveFile);
+
+        check(restored.shown == runner.shown, "a restored runner presents the options it was saved at, with their text");
+        check(restored.resolved, "a restored runner presents options with their line ids linked to the line database");
+
+        std::filesystem::remove(saveFile);
+    }
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "saves restore, and saves that don't fit the program are rejected" << std::endl;
+    return 0;
+}
@@ -0,0 +1,260 @@
+/**
+ * @file test_scheduler.cpp
+ *
+ * @brief Runs many sessions on a DialogueScheduler, and checks more workers don't change what they do
+ *
+ * Every session counts down a number of its own, with a line, a wait and a command every time round, and asks whether to go on.  Some of them
+ * spin first, so the workers they're dealt to fall behind and the others have to steal from them.  Sessions leave when asked or once
+ * they've counted down.  The same sessions are played on one worker and on several : each session's events, tick by tick, have to match,
+ * every session has to stop, and the workers have to steal.  Also checks a session whose start node doesn't exist isn't added.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest.  Configure with YARN_SANITIZE_THREAD to run it under ThreadSanitizer
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_scheduler.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    constexpr int SESSIONS = 200;
+    constexpr int MAX_TICKS = 1000;
+
+    /// Start : spin $spin times, then say $n, wait, run a command, count $n down, and ask whether to go again until it's 0
+    std::shared_ptr<const Yarn::ProgramImage> countdownProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("scheduler");
+
+        (*program.mutable_initial_values())["$n"] = number(0);
+        (*program.mutable_initial_values())["$spin"] = number(0);
+
+        Yarn::Node& node = addNode(program, "Start");
+
+        auto countDown = [&node](const std::string& variable, const std::string& label)
+        {
+            add(node, Yarn::Instruction::PUSH_VARIABLE, { string(variable) });
+            add(node, Yarn::Instruction::PUSH_FLOAT, { number(0) });
+            add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+            add(node, Yarn::Instruction::CALL_FUNC, { string("Number.GreaterThan") });
+            add(node, Yarn::Instruction::JUMP_IF_FALSE, { string(label) });
+            add(node, Yarn::Instruction::POP);
+            add(node, Yarn::Instruction::PUSH_VARIABLE, { string(variable) });
+            add(node, Yarn::Instruction::PUSH_FLOAT, { number(1) });
+            add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+            add(node, Yarn::Instruction::CALL_FUNC, { string("Number.Minus") });
+            add(node, Yarn::Instruction::STORE_VARIABLE, { string(variable) });
+            add(node, Yarn::Instruction::POP);
+        };
+
+        label(node, "scheduler-spin");
+        countDown("$spin", "scheduler-spun");
+        add(node, Yarn::Instruction::JUMP_TO, { string("scheduler-spin") });
+        label(node, "scheduler-spun");
+        add(node, Yarn::Instruction::POP);
+
+        label(node, "scheduler-again");
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$n") });
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:scheduler-count"), number(1) });
+        add(node, Yarn::Instruction::RUN_COMMAND, { string("wait 2"), number(0) });
+        add(node, Yarn::Instruction::RUN_COMMAND, { string("counted"), number(0) });
+        countDown("$n", "scheduler-done");
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:scheduler-again"), string("scheduler-next"), number(0) });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:scheduler-leave"), string("scheduler-leave"), number(0) });
+        add(node, Yarn::Instruction::SHOW_OPTIONS);
+        add(node, Yarn::Instruction::JUMP);
+
+        label(node, "scheduler-next");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::JUMP_TO, { string("scheduler-again") });
+
+        label(node, "scheduler-leave");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::STOP);
+
+        label(node, "scheduler-done");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::STOP);
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(std::move(program), error);
+
+        check(image != nullptr, "the test program links : " + error);
+        return image;
+    }
+
+    struct Run
+    {
+        std::vector<std::vector<std::string>> events; ///< by session : what it did, tick by tick
+        std::vector<bool> stopped;
+        std::size_t steals = 0;
+        int ticks = 0;
+    };
+
+    std::string describe(const Yarn::DialogueScheduler::Event& event)
+    {
+        switch (event.type)
+        {
+        case Yarn::DialogueScheduler::Event::LINE:
+            return "line " + std::string(event.text) + " " + (event.substitutions.empty() ? std::string() : event.substitutions[0].ShortDebugString());
+        case Yarn::DialogueScheduler::Event::COMMAND:
+            return "command " + std::string(event.text);
+        case Yarn::DialogueScheduler::Event::OPTIONS:
+            return "options";
+        case Yarn::DialogueScheduler::Event::STOPPED:
+            return "stopped";
+        }
+
+        return "?";
+    }
+
+    /// every session until they've all stopped.  Every eighth session spins first, every fifth leaves at its first question
+    Run play(const std::shared_ptr<const Yarn::ProgramImage>& image, unsigned threads, std::size_t batchSize)
+    {
+        Yarn::DialogueScheduler::Settings settings;
+        settings.threadCount = threads;
+        settings.batchSize = batchSize;
+
+        Yarn::DialogueScheduler scheduler(image, settings);
+
+        Run run;
+        run.events.resize(SESSIONS);
+        run.stopped.resize(SESSIONS, false);
+
+        for (int i = 0; i < SESSIONS; i++)
+        {
+            const Yarn::DialogueScheduler::SessionId id = scheduler.addSession();
+            check(id == (Yarn::DialogueScheduler::SessionId)i, "sessions are numbered in order");
+
+            scheduler.vm(id).setVariable("$n", ProgramBuilder::number((float)(1 + i % 4)));
+            scheduler.vm(id).setVariable("$spin", ProgramBuilder::number((i % 8 == 1) ? 2000.f : 0.f));
+        }
+
+        std::vector<int> answers(SESSIONS, 0);
+        int stopped = 0;
+
+        for (run.ticks = 0; (stopped < SESSIONS) && (run.ticks < MAX_TICKS); run.ticks++)
+        {
+            scheduler.tick(1);
+            run.steals += scheduler.stats().steals;
+
+            for (const std::vector<Yarn::DialogueScheduler::Event>& buffer : scheduler.events())
+            {
+                for (const Yarn::DialogueScheduler::Event& event : buffer)
+                {
+                    run.events[event.session].push_back("tick " + std::to_string(run.ticks) + " : " + describe(event));
+
+                    if (event.type == Yarn::DialogueScheduler::Event::STOPPED)
+                    {
+                        run.stopped[event.session] = true;
+                        stopped++;
+                    }
+                }
+            }
+
+            for (int i = 0; i < SESSIONS; i++)
+            {
+                if (scheduler.vm(i).runningState == Yarn::YarnVM::AWAITING_INPUT)
+                {
+                    scheduler.selectOption(i, ((i % 5 == 0) && (answers[i] == 0)) ? 1 : 0);
+                    answers[i]++;
+                }
+            }
+        }
+
+        for (int i = 0; i < SESSIONS; i++)
+        {
+            scheduler.removeSession(i);
+        }
+
+        check(scheduler.sessionCount() == 0, "removed sessions aren't counted");
+
+        return run;
+    }
+
+    /// addSession() at a node that doesn't exist throws, and leaves the scheduler as it was
+    void missingStartNode(const std::shared_ptr<const Yarn::ProgramImage>& image)
+    {
+        Yarn::DialogueScheduler scheduler(image, { 2, 100000, 32 });
+
+        const Yarn::DialogueScheduler::SessionId first = scheduler.addSession();
+        bool threw = false;
+
+        try
+        {
+            scheduler.addSession("Missing");
+        }
+        catch (const YarnException&)
+        {
+            threw = true;
+        }
+
+        check(threw, "a session at a node that doesn't exist throws");
+        check(scheduler.sessionCount() == 1, "a session at a node that doesn't exist isn't added");
+        check(scheduler.addSession() == first + 1, "a session at a node that doesn't exist doesn't use up an id");
+
+        scheduler.tick(1);
+        check(scheduler.stats().runnable == 2, "only the sessions that started run");
+    }
+}
+
+int main()
+{
+    std::shared_ptr<const Yarn::ProgramImage> image = countdownProgram();
+
+    if (!image)
+    {
+        return 1;
+    }
+
+    const Run one = play(image, 1, 4);
+    const Run many = play(image, 4, 1);
+
+    for (const Run* run : { &one, &many })
+    {
+        const std::string workers = (run == &one) ? "one worker" : "four workers";
+
+        check(run->ticks < MAX_TICKS, "on " + workers + ", every session stops");
+        check(std::find(run->stopped.begin(), run->stopped.end(), false) == run->stopped.end(), "on " + workers + ", every session reports stopping");
+    }
+
+    check(one.steals == 0, "one worker doesn't steal");
+    check(many.steals > 0, "four workers steal from the ones running spinning sessions");
+    check(one.ticks == many.ticks, "four workers take as many ticks as one");
+
+    for (int i = 0; i < SESSIONS; i++)
+    {
+        if (one.events[i] != many.events[i])
+        {
+            check(false, "session " + std::to_string(i) + " does the same on four workers as on one");
+        }
+    }
+
+    missingStartNode(image);
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << SESSIONS << " sessions run the same on 1 and 4 workers, with " << many.steals << " steals" << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file test_string_arena.cpp
+ *
+ * @brief Checks that the strings a program builds don't pile up in the VM's string arena
+ *
+ * Runs a node that joins a host-set variable with "!" into another variable and shows it as a line's substitution, with a different
+ * name every time round.  Events go to an event ring drained only every few lines, so collections happen while substitutions are
+ * waiting in the ring, and those have to come out intact.  The arena has to stay bounded over many more strings than it collects at.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <yarn_event_ring.h>
+#include <yarn_vm.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    struct Callbacks : public Yarn::YarnVM::YarnCallbacks
+    {
+        void onRunLine(const Yarn::YarnVM::Line&) override { }
+        void onRunCommand(const std::string_view&) override { }
+        void onPresentOptions(const Yarn::YarnVM::OptionsList&) override { }
+    };
+
+    /// the name the host gives the player on cycle i.  Too long for small string storage
+    std::string playerName(int i)
+    {
+        return "a player called number " + std::to_string(i);
+    }
+
+    /// Start : $greeting = $name + "!", then a line showing $greeting, round and round
+    Yarn::Program greetingProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("string-arena");
+
+        (*program.mutable_initial_values())["$name"] = string("");
+        (*program.mutable_initial_values())["$greeting"] = string("");
+
+        Yarn::Node& node = addNode(program, "Start");
+
+        label(node, "string-arena-loop");
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$name") });
+        add(node, Yarn::Instruction::PUSH_STRING, { string("!") });
+        add(node, Yarn::Instruction::PUSH_FLOAT, { number(2) });
+        add(node, Yarn::Instruction::CALL_FUNC, { string("String.Add") });
+        add(node, Yarn::Instruction::STORE_VARIABLE, { string("$greeting") });
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::PUSH_VARIABLE, { string("$greeting") });
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:string-arena-greeting"), number(1) });
+        add(node, Yarn::Instruction::JUMP_TO, { string("string-arena-loop") });
+
+        return program;
+    }
+}
+
+int main()
+{
+    static constexpr int CYCLES = 100000;
+    static constexpr int DRAIN_EVERY = 100; ///< fits the ring's 256 events and 1024 values
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(greetingProgram(), error);
+
+    if (!image)
+    {
+        std::cerr << "couldn't link the test program : " << error << std::endl;
+        return 1;
+    }
+
+    Yarn::YarnVM vm(image);
+    Callbacks callbacks;
+    vm.setCallbacks(&callbacks);
+
+    Yarn::EventRing ring;
+    vm.eventRing = &ring;
+
+    vm.loadNode("Start");
+
+    int drained = 0;
+    std::size_t largestArena = 0;
+
+    auto drain = [&]()
+    {
+        ring.drain([&](const Yarn::VMEvent& event)
+        {
+            const std::string expected = playerName(drained) + "!";
+
+            check(event.type == Yarn::VMEvent::LINE, "the ring only has lines");
+            check((event.substitutionCount == 1) && (ring.substitution(event, 0).string_value() == expected), "greeting " + std::to_string(drained) + " is " + expected);
+            drained++;
+        });
+    };
+
+    for (int i = 0; i < CYCLES; i++)
+    {
+        vm.setVariable("$name", ProgramBuilder::string(playerName(i)));
+
+        if (vm.run() != Yarn::YarnVM::YIELD_LINE)
+        {
+            std::cerr << "the test program didn't yield a line" << std::endl;
+            return 1;
+        }
+
+        largestArena = std::max(largestArena, vm.strings.size());
+
+        if ((i % DRAIN_EVERY) == DRAIN_EVERY - 1)
+        {
+            drain();
+        }
+    }
+
+    drain();
+
+    check(drained == CYCLES, "every greeting is drained");
+    check(largestArena <= 2 * Yarn::StringArena::MIN_COLLECTION_SIZE, "the arena stays bounded, its largest was " + std::to_string(largestArena) + " strings");
+
+    const Yarn::Value* greeting = vm.getVariable("$greeting");
+    check(greeting && (greeting->string_value() == playerName(CYCLES - 1) + "!"), "$greeting survives collections");
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << CYCLES << " greetings built, the string arena peaked at " << largestArena << " strings" << std::endl;
+    return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * @file test_threads.cpp
+ *
+ * @brief Passes dialogue between threads through SPSCQueue and ThreadedRunner, for ThreadSanitizer to check
+ *
+ * Pushes numbered messages through a small SPSCQueue from one thread to another and checks they all arrive, in order and intact.
+ * Then plays a dialogue on a ThreadedRunner from the main thread : a wait, a line and two options, round and round until the
+ * UI answers with the option that stops the program, advancing time every frame it has nothing to read.  Last, stops a runner
+ * that's waiting for an answer.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest.  Configure with YARN_SANITIZE_THREAD to run it under ThreadSanitizer
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <yarn_spsc_queue.h>
+#include <yarn_threaded_runner.h>
+
+#include "program_builder.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /// one thread pushes, the other pops, through a queue much smaller than the number of messages
+    void queueAcrossThreads()
+    {
+        static constexpr int MESSAGES = 100000;
+
+        struct Message
+        {
+            int number = -1;
+            std::string text; ///< too long for small string storage, so the consumer reads memory the producer allocated
+        };
+
+        auto text = [](int number) { return "message number " + std::to_string(number) + " from the producer thread"; };
+
+        Yarn::SPSCQueue<Message> queue(16);
+
+        std::thread producer([&]()
+        {
+            for (int i = 0; i < MESSAGES; i++)
+            {
+                Message message = { i, text(i) };
+
+                while (!queue.push(std::move(message)))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        int received = 0;
+        bool intact = true;
+        Message message;
+
+        while (received < MESSAGES)
+        {
+            if (!queue.pop(message))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            intact = intact && (message.number == received) && (message.text == text(received));
+            received++;
+        }
+
+        producer.join();
+
+        check(intact, "SPSCQueue messages arrive in order and intact");
+        check(queue.empty(), "SPSCQueue is empty once every message is popped");
+    }
+
+    /// Start : wait, ask, and either ask again or stop
+    std::shared_ptr<const Yarn::ProgramImage> guardProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("threads");
+
+        Yarn::Node& node = addNode(program, "Start");
+
+        label(node, "threads-ask");
+        add(node, Yarn::Instruction::RUN_COMMAND, { string("wait 3"), number(0) });
+        add(node, Yarn::Instruction::RUN_LINE, { string("line:threads-guard"), number(0) });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:threads-again"), string("threads-again"), number(0) });
+        add(node, Yarn::Instruction::ADD_OPTION, { string("line:threads-leave"), string("threads-leave"), number(0) });
+        add(node, Yarn::Instruction::SHOW_OPTIONS);
+        add(node, Yarn::Instruction::JUMP);
+
+        label(node, "threads-again");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::JUMP_TO, { string("threads-ask") });
+
+        label(node, "threads-leave");
+        add(node, Yarn::Instruction::POP);
+        add(node, Yarn::Instruction::STOP);
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::create(std::move(program), error);
+
+        check(image != nullptr, "the test program links : " + error);
+        return image;
+    }
+
+    void loadGuard(Yarn::ThreadedRunner& runner, const std::shared_ptr<const Yarn::ProgramImage>& image)
+    {
+        runner.db.add("line:threads-guard", "Guard: You're not allowed in!", "threads.yarn", "Start", 1);
+        runner.db.add("line:threads-again", "Please?", "threads.yarn", "Start", 2);
+        runner.db.add("line:threads-leave", "Fine, I'm going.", "threads.yarn", "Start", 3);
+
+        runner.vm.loadProgram(image);
+        runner.vm.loadNode("Start");
+    }
+
+    /// the main thread plays the UI : it reads lines and options, answers, and moves time on every frame there's nothing to read
+    void dialogueAcrossThreads(const std::shared_ptr<const Yarn::ProgramImage>& image)
+    {
+        static constexpr int ROUNDS = 500;
+
+        Yarn::ThreadedRunner runner(8);
+        loadGuard(runner, image);
+        runner.start();
+
+        int lines = 0;
+        int rounds = 0;
+        bool stopped = false;
+        Yarn::ThreadedRunner::OutputEvent event;
+
+        while (!stopped)
+        {
+            if (!runner.poll(event))
+            {
+                runner.advanceTime(1);
+                std::this_thread::yield();
+                continue;
+            }
+
+            switch (event.type)
+            {
+            case Yarn::ThreadedRunner::OutputEvent::LINE:
+                check(event.text == "Guard: You're not allowed in!", "line " + std::to_string(lines) + " is the guard's, got \"" + event.text + "\"");
+                lines++;
+                break;
+            case Yarn::ThreadedRunner::OutputEvent::OPTIONS:
+                check((event.options.size() == 2) && (event.options[0] == "Please?") && (event.options[1] == "Fine, I'm going."), "options " + std::to_string(rounds) + " are rendered");
+                check((event.enabled.size() == 2) && event.enabled[0] && event.enabled[1], "options " + std::to_string(rounds) + " are enabled");
+                rounds++;
+                runner.selectOption((rounds < ROUNDS) ? 0 : 1);
+                break;
+            case Yarn::ThreadedRunner::OutputEvent::STOPPED:
+                check(event.text.empty(), "the dialogue ends without an error, got \"" + event.text + "\"");
+                stopped = true;
+                break;
+            }
+        }
+
+        runner.stop();
+
+        check((lines == ROUNDS) && (rounds == ROUNDS), "the VM thread runs " + std::to_string(ROUNDS) + " rounds, got " + std::to_string(lines) + " lines and " + std::to_string(rounds) + " option sets");
+    }
+
+    /// stop() has to wake and join a VM thread that's waiting for an answer
+    void stopWhileWaiting(const std::shared_ptr<const Yarn::ProgramImage>& image)
+    {
+        Yarn::ThreadedRunner runner;
+        loadGuard(runner, image);
+        runner.start();
+
+        Yarn::ThreadedRunner::OutputEvent event;
+
+        while (!runner.poll(event) || (event.type != Yarn::ThreadedRunner::OutputEvent::OPTIONS))
+        {
+            runner.advanceTime(1);
+            std::this_thread::yield();
+        }
+
+        runner.stop();
+
+        check(runner.vm.runningState == Yarn::YarnVM::AWAITING_INPUT, "a runner stopped while waiting for an answer is still waiting for it");
+    }
+}
+
+int main()
+{
+    queueAcrossThreads();
+
+    if (std::shared_ptr<const Yarn::ProgramImage> image = guardProgram())
+    {
+        dialogueAcrossThreads(image);
+        stopWhileWaiting(image);
+    }
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "messages, lines and options pass between threads intact" << std::endl;
+    return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file test_timer_wheel.cpp
+ *
+ * @brief Checks that TimerWheel expires every timer exactly when time reaches its deadline
+ *
+ * Deadlines just either side of the level boundaries, so timers cascade from the coarse levels into the fine ones, and past the top level,
+ * so they wait in the overflow list.  Deadlines that have already passed or are due now, advances that don't move time, and rescheduling
+ * and cancelling.  Last, a long random run against a plain list of deadlines, with advances from a single unit to far past the top level.
+ *
+ * Built with BUILD_UNIT_TESTS, run by ctest
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <yarn_timer_wheel.h>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    typedef Yarn::TimerWheel::TimerId TimerId;
+
+    constexpr long long LEVEL_1 = 1LL << Yarn::TimerWheel::SLOT_BITS;                               ///< first deadline past level 0, from time 0
+    constexpr long long TOP = 1LL << (Yarn::TimerWheel::SLOT_BITS * Yarn::TimerWheel::LEVELS);      ///< first deadline past the top level, from time 0
+
+    /// the wheel, and the deadlines it should hold
+    struct Checked
+    {
+        Yarn::TimerWheel wheel;
+        std::vector<long long> deadlines; ///< by id, -1 if not scheduled
+
+        void schedule(TimerId id, long long deadline)
+        {
+            deadlines.resize(std::max<std::size_t>(deadlines.size(), (std::size_t)id + 1), -1);
+            deadlines[id] = deadline;
+            wheel.schedule(id, deadline);
+        }
+
+        void cancel(TimerId id)
+        {
+            if (id < deadlines.size()) deadlines[id] = -1;
+            wheel.cancel(id);
+        }
+
+        /// advance both, and check the wheel expired exactly the timers due by time
+        void advance(long long time, const std::string& what)
+        {
+            std::vector<TimerId> expected;
+
+            for (TimerId id = 0; id < deadlines.size(); id++)
+            {
+                if ((deadlines[id] >= 0) && (deadlines[id] <= time))
+                {
+                    expected.push_back(id);
+                    deadlines[id] = -1;
+                }
+            }
+
+            std::vector<TimerId> expired;
+            wheel.advance(time, expired);
+            std::sort(expired.begin(), expired.end());
+
+            const std::size_t left = (std::size_t)std::count_if(deadlines.begin(), deadlines.end(), [](long long deadline) { return deadline >= 0; });
+
+            check(expired == expected, what + " : at " + std::to_string(time) + ", " + std::to_string(expired.size()) + " timers expired, expected " + std::to_string(expected.size()));
+            check(wheel.size() == left, what + " : at " + std::to_string(time) + ", " + std::to_string(wheel.size()) + " timers left, expected " + std::to_string(left));
+            check(wheel.time() == time, what + " : the wheel's time is " + std::to_string(time));
+
+            bool scheduled = true;
+
+            for (TimerId id = 0; id < deadlines.size(); id++)
+            {
+                scheduled = scheduled && (wheel.scheduled(id) == (deadlines[id] >= 0));
+            }
+
+            check(scheduled, what + " : at " + std::to_string(time) + ", the wheel has the timers scheduled that haven't expired");
+        }
+    };
+
+    /// deadlines on both sides of every level boundary, reached one unit at a time and in jumps that land on and across them
+    void cascades()
+    {
+        for (long long step : { 1LL, 7LL, LEVEL_1 - 1, LEVEL_1, LEVEL_1 * LEVEL_1 + 3 })
+        {
+            Checked checked;
+            TimerId id = 0;
+
+            for (long long boundary = LEVEL_1; boundary < TOP; boundary *= LEVEL_1)
+            {
+                for (long long offset : { -1LL, 0LL, 1LL, boundary / 2 })
+                {
+                    checked.schedule(id++, boundary + offset);
+                }
+            }
+
+            const std::string what = "cascading, in steps of " + std::to_string(step);
+
+            for (long long time = step; checked.wheel.size(); time += step)
+            {
+                checked.advance(time, what);
+
+                if (failures)
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    /// deadlines past the top level wait in the overflow list, and come out at the right time however far time jumps
+    void overflow()
+    {
+        for (long long start : { 0LL, 5LL, TOP - 1 })
+        {
+            Checked checked{ Yarn::TimerWheel(start), {} };
+            const std::string what = "overflow, from " + std::to_string(start);
+
+            checked.schedule(0, start + TOP);
+            checked.schedule(1, start + TOP + 1);
+            checked.schedule(2, start + TOP * 3 + 12345);
+            checked.schedule(3, start + TOP - 1);
+
+            checked.advance(start + TOP - 2, what);
+            checked.advance(start + TOP - 1, what);
+            checked.advance(start + TOP, what);
+            checked.advance(start + TOP + 1, what);
+            checked.advance(start + TOP * 2, what);
+            checked.advance(start + TOP * 3 + 12344, what);
+            checked.advance(start + TOP * 3 + 12345, what);
+
+            check(checked.wheel.size() == 0, what + " : every timer expires");
+        }
+    }
+
+    /// waits of zero or less expire on the next advance, even one that doesn't move time, and later deadlines don't expire early
+    void zeroWaits()
+    {
+        Checked checked{ Yarn::TimerWheel(100), {} };
+
+        checked.schedule(0, 100);
+        checked.schedule(1, 50);
+        checked.schedule(2, 101);
+        check(checked.wheel.size() == 3, "zero waits : due timers are counted");
+
+        checked.advance(100, "zero waits, without moving time");
+        checked.advance(100, "zero waits, again without moving time");
+
+        checked.schedule(3, 100);
+        checked.schedule(4, 100);
+        checked.cancel(4);
+        checked.advance(100, "a cancelled zero wait");
+
+        checked.advance(101, "the next unit");
+
+        checked.schedule(5, 200);
+        checked.schedule(5, 101);
+        checked.advance(101, "rescheduled to now");
+
+        checked.schedule(6, 102);
+        checked.schedule(6, 150);
+        checked.advance(102, "rescheduled later");
+        checked.advance(150, "rescheduled later");
+
+        check(checked.wheel.size() == 0, "zero waits : every timer expires");
+    }
+
+    /// random schedules, cancels and advances against the plain list
+    void randomRun()
+    {
+        static const long long RANGES[] = { 2, LEVEL_1, LEVEL_1 * LEVEL_1, TOP / LEVEL_1, TOP, TOP * 4 };
+        static const long long STEPS[] = { 0, 1, 3, LEVEL_1, LEVEL_1 * LEVEL_1 + 17, TOP / 3 };
+
+        std::mt19937 random(12345);
+        Checked checked;
+
+        auto below = [&random](long long n) { return std::uniform_int_distribution<long long>(0, n - 1)(random); };
+
+        long long time = 0;
+
+        for (int round = 0; round < 3000; round++)
+        {
+            for (int i = (int)below(8); i > 0; i--)
+            {
+                // mostly short waits, some across the levels and past the top
+                const long long range = RANGES[below(std::size(RANGES))];
+                checked.schedule((TimerId)below(500), time + below(range) - ((below(10) == 0) ? 3 : 0));
+            }
+
+            if (below(4) == 0)
+            {
+                checked.cancel((TimerId)below(500));
+            }
+
+            const long long step = STEPS[below(std::size(STEPS))];
+            time += below(step + 1);
+
+            checked.advance(time, "random run, round " + std::to_string(round));
+
+            if (failures)
+            {
+                return;
+            }
+        }
+    }
+}
+
+int main()
+{
+    cascades();
+    overflow();
+    zeroWaits();
+    randomRun();
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << "timers expire on time across levels, the overflow list and zero waits" << std::endl;
+    return 0;
+}
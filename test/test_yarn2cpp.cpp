@@ -0,0 +1,98 @@
+/**
+ * @file test_yarn2cpp.cpp
+ *
+ * @brief Checks that programs compiled to C++ by yarn2cpp run the same as the interpreter
+ *
+ * CMake compiles every .yarnc in test/ into this test with yarn_compile_to_cpp, and lists them in test_yarn2cpp_programs.inc.  Each node of every
+ * program is played on an interpreting VM and on one running the compiled code, with the same answers, and their lines, commands, options and
+ * node changes compared.  The compiled VMs are also played a few instructions at a time, to check compiled nodes stop and resume where they left off.
+ *
+ * Built with BUILD_UNIT_TESTS and BUILD_TOOLS, run by ctest
+ */
+
+#include <iostream>
+#include <string>
+
+#include <yarn_compiled.h>
+
+#include "trace_player.h"
+
+#define YARN_COMPILED_TEST(name, file) extern const Yarn::CompiledProgram name;
+#include "test_yarn2cpp_programs.inc"
+#undef YARN_COMPILED_TEST
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    struct TestProgram
+    {
+        const Yarn::CompiledProgram& compiled;
+        const char* yarncFile;
+    };
+
+    const TestProgram testPrograms[] =
+    {
+        #define YARN_COMPILED_TEST(name, file) { name, file },
+        #include "test_yarn2cpp_programs.inc"
+        #undef YARN_COMPILED_TEST
+    };
+
+    void sameTraces(const TestProgram& test)
+    {
+        const std::string file = test.yarncFile;
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(file, error);
+
+        if (!image)
+        {
+            check(false, file + " loads : " + error);
+            return;
+        }
+
+        for (const Yarn::LinkedProgram::Node& node : image->linked.nodes)
+        {
+            const std::string& name = node.source->name();
+
+            Yarn::YarnVM interpreted(image);
+            const TracePlayer::Trace expected = TracePlayer::play(interpreted, name);
+
+            for (std::size_t budget : { std::numeric_limits<std::size_t>::max(), std::size_t(3) })
+            {
+                Yarn::YarnVM compiled(image);
+                check(compiled.useCompiled(test.compiled), file + " : the compiled program matches the .yarnc");
+
+                const TracePlayer::Trace actual = TracePlayer::play(compiled, name, budget);
+                const std::string how = (budget == 3) ? " three instructions at a time" : "";
+
+                check(expected == actual, file + ", node " + name + " : the compiled program runs differently" + how + ", " + TracePlayer::difference(expected, actual));
+            }
+        }
+    }
+}
+
+int main()
+{
+    for (const TestProgram& test : testPrograms)
+    {
+        sameTraces(test);
+    }
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << std::size(testPrograms) << " programs compiled to C++ run the same as the interpreter" << std::endl;
+    return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file test_yarnopt.cpp
+ *
+ * @brief Checks that programs optimized by yarnopt run the same as the programs they came from
+ *
+ * usage : test_yarnopt <path to yarnopt>
+ *
+ * Optimizes every .yarnc in test/ with yarnopt, then plays each of their nodes on the original and on the optimized program with the same answers
+ * and compares the lines, commands, options and node changes.  Last, optimizes a program with a JUMP_TO to itself, a loop of two JUMP_TOs, and a
+ * JUMP_TO to the next instruction that a JUMP_IF_FALSE lands through : yarnopt has to finish, and leave the loops alone.
+ *
+ * Built with BUILD_UNIT_TESTS and BUILD_TOOLS, run by ctest
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <yarn_vm.h>
+
+#include "program_builder.h"
+#include "trace_player.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED : " << what << std::endl;
+            failures++;
+        }
+    }
+
+    bool optimize(const std::string& yarnopt, const std::string& input, const std::string& output)
+    {
+        const std::string command = "\"" + yarnopt + "\" \"" + input + "\" \"" + output + "\"";
+        return std::system(command.c_str()) == 0;
+    }
+
+    /// plays every node of file and of its optimized copy, and compares them
+    void sameTraces(const std::string& yarnopt, const std::filesystem::path& file, const std::filesystem::path& directory)
+    {
+        const std::string optimized = (directory / file.filename()).string();
+
+        if (!optimize(yarnopt, file.string(), optimized))
+        {
+            check(false, "yarnopt optimizes " + file.string());
+            return;
+        }
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> original = Yarn::ProgramImage::load(file.string(), error);
+        check(original != nullptr, file.string() + " loads : " + error);
+
+        std::shared_ptr<const Yarn::ProgramImage> optimizedImage = Yarn::ProgramImage::load(optimized, error);
+        check(optimizedImage != nullptr, "the optimized " + file.string() + " loads : " + error);
+
+        if (!original || !optimizedImage)
+        {
+            return;
+        }
+
+        for (const Yarn::LinkedProgram::Node& node : original->linked.nodes)
+        {
+            const std::string& name = node.source->name();
+
+            Yarn::YarnVM before(original);
+            Yarn::YarnVM after(optimizedImage);
+
+            const TracePlayer::Trace expected = TracePlayer::play(before, name);
+            const TracePlayer::Trace actual = TracePlayer::play(after, name);
+
+            check(expected == actual, file.string() + ", node " + name + " : the optimized program runs differently, " + TracePlayer::difference(expected, actual));
+        }
+    }
+
+    /// Start : a JUMP_TO the next instruction, which is also where a JUMP_IF_FALSE lands.  SelfLoop and Cycle : jumps that go round forever
+    Yarn::Program jumpLoopsProgram()
+    {
+        using namespace ProgramBuilder;
+
+        Yarn::Program program;
+        program.set_name("yarnopt");
+
+        (*program.mutable_initial_values())["$flag"].set_bool_value(false);
+
+        Yarn::Node& start = addNode(program, "Start");
+        add(start, Yarn::Instruction::PUSH_VARIABLE, { string("$flag") });
+        add(start, Yarn::Instruction::JUMP_IF_FALSE, { string("yarnopt-anchor") });
+        add(start, Yarn::Instruction::RUN_LINE, { string("line:yarnopt-true"), number(0) });
+        label(start, "yarnopt-anchor");
+        add(start, Yarn::Instruction::JUMP_TO, { string("yarnopt-next") });
+        label(start, "yarnopt-next");
+        add(start, Yarn::Instruction::POP);
+        add(start, Yarn::Instruction::RUN_LINE, { string("line:yarnopt-after"), number(0) });
+        add(start, Yarn::Instruction::STOP);
+
+        Yarn::Node& self = addNode(program, "SelfLoop");
+        label(self, "yarnopt-self");
+        add(self, Yarn::Instruction::JUMP_TO, { string("yarnopt-self") });
+
+        Yarn::Node& cycle = addNode(program, "Cycle");
+        label(cycle, "yarnopt-there");
+        add(cycle, Yarn::Instruction::JUMP_TO, { string("yarnopt-back") });
+        label(cycle, "yarnopt-back");
+        add(cycle, Yarn::Instruction::JUMP_TO, { string("yarnopt-there") });
+
+        return program;
+    }
+
+    void jumpLoops(const std::string& yarnopt, const std::filesystem::path& directory)
+    {
+        const std::string input = (directory / "jumps.yarnc").string();
+        const std::string output = (directory / "jumps-optimized.yarnc").string();
+
+        {
+            std::ofstream os(input, std::ios::binary | std::ios::trunc);
+            check(jumpLoopsProgram().SerializeToOstream(&os), "the jump loops program is written");
+        }
+
+        if (!optimize(yarnopt, input, output))
+        {
+            check(false, "yarnopt optimizes the jump loops program");
+            return;
+        }
+
+        std::string error;
+        std::shared_ptr<const Yarn::ProgramImage> original = Yarn::ProgramImage::load(input, error);
+        std::shared_ptr<const Yarn::ProgramImage> optimized = Yarn::ProgramImage::load(output, error);
+
+        if (!original || !optimized)
+        {
+            check(false, "the jump loops programs load : " + error);
+            return;
+        }
+
+        for (const char* name : { "SelfLoop", "Cycle" })
+        {
+            const Yarn::Node& node = optimized->program.nodes().at(name);
+            const bool loops = std::all_of(node.instructions().begin(), node.instructions().end(), [](const Yarn::Instruction& instruction) { return instruction.opcode() == Yarn::Instruction::JUMP_TO; });
+
+            check((node.instructions_size() > 0) && loops, std::string(name) + " still only jumps");
+        }
+
+        Yarn::YarnVM before(original);
+        Yarn::YarnVM after(optimized);
+
+        const TracePlayer::Trace expected = TracePlayer::play(before, "Start");
+        const TracePlayer::Trace actual = TracePlayer::play(after, "Start");
+
+        check(expected == actual, "the optimized jump loops program runs differently, " + TracePlayer::difference(expected, actual));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage : test_yarnopt <path to yarnopt>" << std::endl;
+        return 1;
+    }
+
+    const std::string yarnopt = argv[1];
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "test_yarnopt_programs";
+    std::filesystem::create_directories(directory);
+
+    const std::vector<std::filesystem::path> files = TracePlayer::testPrograms();
+    check(!files.empty(), "there are compiled programs in test/");
+
+    for (const std::filesystem::path& file : files)
+    {
+        sameTraces(yarnopt, file, directory);
+    }
+
+    jumpLoops(yarnopt, directory);
+
+    std::filesystem::remove_all(directory);
+
+    if (failures)
+    {
+        return 1;
+    }
+
+    std::cout << files.size() << " programs run the same after yarnopt" << std::endl;
+    return 0;
+}
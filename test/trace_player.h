@@ -0,0 +1,183 @@
+#pragma once
+
+/**
+ * @file trace_player.h
+ *
+ * @brief Plays a program on a VM with scripted answers and records what it does, so the tests can compare two ways of running the same dialogue
+ *
+ * Lines, commands, option sets, waits and node changes go into a trace, one string each.  Options are answered by cycling through the enabled ones,
+ * waits are skipped by moving time on to the end of the wait, and a runtime error ends the trace with its message.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <yarn_vm.h>
+
+namespace TracePlayer
+{
+    typedef std::vector<std::string> Trace;
+
+    inline std::string describe(const Yarn::YarnVM::Line& line)
+    {
+        std::string s = std::string(line.id);
+
+        for (const Yarn::Operand& substitution : line.substitutions)
+        {
+            s += " [" + substitution.ShortDebugString() + "]";
+        }
+
+        return s;
+    }
+
+    inline std::string describe(const Yarn::YarnVM::OptionsList& options)
+    {
+        std::string s = "options";
+
+        for (const Yarn::YarnVM::Option& option : options)
+        {
+            s += " " + describe(option.line) + (option.enabled ? "" : " (disabled)");
+        }
+
+        return s;
+    }
+
+    /// the option play() answers the n-th set of options with : the n-th enabled one, round and round.  -1 if none are enabled
+    inline int choose(const Yarn::YarnVM::OptionsList& options, int n)
+    {
+        std::vector<int> enabled;
+
+        for (int i = 0; i < (int)options.size(); i++)
+        {
+            if (options[i].enabled) enabled.push_back(i);
+        }
+
+        return enabled.empty() ? -1 : enabled[n % enabled.size()];
+    }
+
+    class Recorder : public Yarn::YarnVM::YarnCallbacks
+    {
+    public:
+
+        Recorder(Yarn::YarnVM& vm, Trace& trace) : vm(vm), trace(trace)
+        {
+            vm.setCallbacks(this);
+        }
+
+        void onRunLine(const Yarn::YarnVM::Line& line) override
+        {
+            trace.push_back("line " + describe(line));
+        }
+
+        void onRunCommand(const std::string_view& command) override
+        {
+            if (!vm.handleWaitCommand(command))
+            {
+                trace.push_back("command " + std::string(command));
+            }
+        }
+
+        void onPresentOptions(const Yarn::YarnVM::OptionsList& options) override
+        {
+            trace.push_back(describe(options));
+        }
+
+        void onChangeNode(const Yarn::Node*, const Yarn::Node* toNode) override
+        {
+            trace.push_back("node " + (toNode ? toNode->name() : std::string()));
+        }
+
+    private:
+
+        Yarn::YarnVM& vm;
+        Trace& trace;
+    };
+
+    constexpr std::size_t MAX_EVENTS = 1000;
+
+    /// run vm from node, budget instructions at a time, until it stops, a runtime error stops it, or the trace is MAX_EVENTS long.  Options are answered by choose()
+    inline Trace play(Yarn::YarnVM& vm, const std::string& node, std::size_t budget = std::numeric_limits<std::size_t>::max())
+    {
+        Trace trace;
+        Recorder recorder(vm, trace);
+
+        try
+        {
+            vm.loadNode(node);
+
+            for (int answers = 0; trace.size() < MAX_EVENTS;)
+            {
+                const Yarn::YarnVM::YieldReason reason = vm.runFor(budget);
+
+                if (reason == Yarn::YarnVM::YIELD_STOPPED)
+                {
+                    trace.push_back("stopped");
+                    break;
+                }
+
+                if (reason == Yarn::YarnVM::YIELD_WAIT)
+                {
+                    trace.push_back("wait " + std::to_string(vm.waitUntilTime));
+                    vm.setTime(vm.waitUntilTime);
+                }
+                else if ((reason == Yarn::YarnVM::YIELD_OPTIONS) && (vm.runningState == Yarn::YarnVM::AWAITING_INPUT))
+                {
+                    const int option = choose(vm.currentOptionsList, answers++);
+
+                    if (option < 0)
+                    {
+                        trace.push_back("no enabled options");
+                        break;
+                    }
+
+                    vm.selectOption(option);
+                }
+            }
+        }
+        catch (const YarnException& e)
+        {
+            trace.push_back(std::string("error ") + e.what());
+        }
+
+        vm.setCallbacks(nullptr);
+
+        return trace;
+    }
+
+    /// every .yarnc in test/, in order
+    inline std::vector<std::filesystem::path> testPrograms()
+    {
+        std::vector<std::filesystem::path> files;
+
+        for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator("test"))
+        {
+            if (entry.path().extension() == ".yarnc")
+            {
+                files.push_back(entry.path());
+            }
+        }
+
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    /// the first line where a and b differ, or empty if they're the same
+    inline std::string difference(const Trace& a, const Trace& b)
+    {
+        for (std::size_t i = 0; i < std::max(a.size(), b.size()); i++)
+        {
+            const std::string x = (i < a.size()) ? a[i] : "<end>";
+            const std::string y = (i < b.size()) ? b[i] : "<end>";
+
+            if (x != y)
+            {
+                return "event " + std::to_string(i) + " : \"" + x + "\" vs \"" + y + "\"";
+            }
+        }
+
+        return {};
+    }
+}
@@ -0,0 +1,497 @@
+/**
+ * @file yarn2cpp.cpp
+ *
+ * @brief Ahead of time compiler from .yarnc programs to C++
+ *
+ * usage : yarn2cpp <input.yarnc> <output.cpp> [name]
+ *
+ * Writes a C++ source file defining a Yarn::CompiledProgram called name (default : the input file name) with a function for every node of the linked program.
+ * Load the .yarnc as usual and pass the compiled program to YarnVM::useCompiled() to run those functions instead of the interpreter, see yarn_compiled.h
+ *
+ * Each function is one switch on the instruction pointer with a case per lowered instruction, so it can start or resume at any instruction :
+ * - JUMP_TO, JUMP_IF_FALSE and the fused comparison jump become gotos
+ * - constants, variables, and the built in Number, Bool and String operators are inlined, with constants and variable slots as literals
+ * - everything that talks to the host (lines, commands, options, function calls, STOP) and everything that changes node or jumps to a computed label
+ *   is run by the interpreter, one instruction at a time
+ *
+ * The generated code is only valid for the exact program it was generated from : useCompiled() checks the linked program's fingerprint.
+ */
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <yarn_program.h>
+
+namespace
+{
+    typedef Yarn::LinkedProgram LP;
+
+    const char* opcodeName(LP::OpCode opcode)
+    {
+        static const char* const names[] =
+        {
+            "JUMP_TO", "JUMP", "RUN_LINE", "RUN_COMMAND", "ADD_OPTION", "SHOW_OPTIONS",
+            "PUSH_STRING", "PUSH_FLOAT", "PUSH_BOOL", "PUSH_NULL", "JUMP_IF_FALSE", "POP",
+            "CALL_FUNC", "PUSH_VARIABLE", "STORE_VARIABLE", "STOP", "RUN_NODE",
+            "NUMBER_ADD", "NUMBER_SUBTRACT", "NUMBER_MULTIPLY", "NUMBER_DIVIDE", "NUMBER_MODULO", "NUMBER_NEGATE",
+            "NUMBER_EQUAL", "NUMBER_NOT_EQUAL", "NUMBER_LESS", "NUMBER_LESS_EQUAL", "NUMBER_GREATER", "NUMBER_GREATER_EQUAL",
+            "BOOL_AND", "BOOL_OR", "BOOL_XOR", "BOOL_NOT", "BOOL_EQUAL", "BOOL_NOT_EQUAL",
+            "STRING_ADD", "STRING_EQUAL", "STRING_NOT_EQUAL",
+            "JUMP_IF_VARIABLE_NOT_EQUAL", "ADD_TO_VARIABLE", "RUN_NODE_DIRECT",
+            "END_OF_NODE",
+        };
+
+        static_assert(std::size(names) == LP::OPCODE_COUNT, "opcode name table is missing opcodes");
+
+        return (opcode < LP::OPCODE_COUNT) ? names[opcode] : "?";
+    }
+
+    /// s as a C++ string literal
+    std::string quote(std::string_view s)
+    {
+        std::string quoted = "\"";
+
+        for (const char c : s)
+        {
+            switch (c)
+            {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\%03o", (unsigned char)c);
+                    quoted += escaped;
+                }
+                else
+                {
+                    quoted += c;
+                }
+            }
+        }
+
+        return quoted + "\"";
+    }
+
+    /// exact float literal, or nothing for values C++ can't spell as a literal
+    std::string floatLiteral(float f)
+    {
+        if (!std::isfinite(f))
+        {
+            return std::string();
+        }
+
+        char literal[64];
+        std::snprintf(literal, sizeof(literal), "%af", (double)f);
+
+        return literal;
+    }
+
+    /// name for the generated program : the input's file name, without its extension, as an identifier
+    std::string defaultName(const std::string& path)
+    {
+        std::string name = path.substr(path.find_last_of("/\\") + 1);
+        name = name.substr(0, name.find('.'));
+
+        for (char& c : name)
+        {
+            if (!std::isalnum((unsigned char)c))
+            {
+                c = '_';
+            }
+        }
+
+        if (name.empty() || std::isdigit((unsigned char)name[0]))
+        {
+            name = "yarn_" + name;
+        }
+
+        return name;
+    }
+
+    class NodeCompiler
+    {
+    public:
+
+        NodeCompiler(const LP& linked, const LP::Node& node, std::ostream& os) : linked(linked), node(node), code(node.code), os(os) {}
+
+        void compile(std::size_t index)
+        {
+            findJumpTargets();
+
+            os << "    // " << quote(node.source->name()) << "\n";
+            os << "    bool node" << index << "(Yarn::YarnVM& vm, std::size_t& budget, Yarn::YarnVM::YieldReason& reason)\n";
+            os << "    {\n";
+            os << "        YARN_COMPILED_ENTER();\n\n";
+            os << "    dispatch:\n";
+            os << "        switch (vm.instructionPointer)\n";
+            os << "        {\n";
+
+            for (std::int32_t k = 0; k < (std::int32_t)code.size(); k++)
+            {
+                instruction(k);
+            }
+
+            os << "        default:\n";
+            os << "            // not one of this node's instructions, the interpreter reports it\n";
+            os << "            reason = vm.interpret(remaining);\n";
+            os << "            return true;\n";
+            os << "        }\n";
+            os << "    }\n\n";
+        }
+
+    private:
+
+        const LP& linked;
+        const LP::Node& node;
+        std::span<const LP::Instruction> code;
+        std::ostream& os;
+
+        std::vector<bool> jumpTarget; ///< instructions reached by a goto, which need a label
+
+        /// instruction the generated code goes to for a jump, or UNRESOLVED if the jump is left to the interpreter
+        std::int32_t destination(const LP::Instruction& instruction) const
+        {
+            if (instruction.a == LP::UNRESOLVED)
+            {
+                return LP::UNRESOLVED;
+            }
+
+            // JUMP_TO lands on its target.  The conditional jumps land on the label's instruction, which counts as executed, and carry on after it
+            const std::int32_t target = (instruction.opcode == LP::JUMP_TO) ? instruction.a : instruction.a + 1;
+
+            return (target < (std::int32_t)code.size()) ? target : LP::UNRESOLVED;
+        }
+
+        void findJumpTargets()
+        {
+            jumpTarget.assign(code.size(), false);
+
+            for (const LP::Instruction& instruction : code)
+            {
+                if ((instruction.opcode == LP::JUMP_TO) || (instruction.opcode == LP::JUMP_IF_FALSE) || (instruction.opcode == LP::JUMP_IF_VARIABLE_NOT_EQUAL))
+                {
+                    const std::int32_t target = destination(instruction);
+
+                    if (target != LP::UNRESOLVED)
+                    {
+                        jumpTarget[target] = true;
+                    }
+                }
+            }
+        }
+
+        std::string constant(std::int32_t index) const
+        {
+            const Yarn::Value& value = linked.constants[index];
+
+            if (value.has_bool_value())
+            {
+                return value.bool_value() ? "Yarn::Value(true)" : "Yarn::Value(false)";
+            }
+
+            if (value.has_float_value() && !floatLiteral(value.float_value()).empty())
+            {
+                return "Yarn::Value(" + floatLiteral(value.float_value()) + ")";
+            }
+
+            return "constants[" + std::to_string(index) + "]";
+        }
+
+        std::string floatConstant(std::int32_t index) const
+        {
+            const std::string literal = floatLiteral(linked.constants[index].float_value());
+            return literal.empty() ? "constants[" + std::to_string(index) + "].float_value()" : literal;
+        }
+
+        std::string comment(const LP::Instruction& instruction) const
+        {
+            std::string text = opcodeName(instruction.opcode);
+
+            switch (instruction.opcode)
+            {
+            case LP::RUN_LINE:
+            case LP::RUN_COMMAND:
+            case LP::ADD_OPTION:
+                text += " " + quote(linked.strings[instruction.a]);
+                break;
+            case LP::PUSH_STRING:
+                text += " " + quote(linked.constants[instruction.a].string_value());
+                break;
+            case LP::PUSH_VARIABLE:
+            case LP::STORE_VARIABLE:
+            case LP::ADD_TO_VARIABLE:
+                text += " " + linked.variableNames[instruction.a];
+                break;
+            case LP::JUMP_IF_VARIABLE_NOT_EQUAL:
+                text += " " + linked.variableNames[instruction.b];
+                break;
+            case LP::CALL_FUNC:
+                text += " " + linked.functionNames[instruction.a];
+                break;
+            case LP::RUN_NODE_DIRECT:
+                text += " " + quote(linked.nodes[instruction.a].source->name());
+                break;
+            default:
+                break;
+            }
+
+            return text;
+        }
+
+        void line(const std::string& statement) { os << "            " << statement << "\n"; }
+
+        void interpret(std::int32_t k) { line("YARN_COMPILED_INTERPRET(" + std::to_string(k) + ");"); }
+
+        void popParameterCount(const LP::Instruction& instruction)
+        {
+            if (instruction.flags & LP::POP_PARAMETER_COUNT)
+            {
+                line("stack.pop();");
+            }
+        }
+
+        void numberOperator(const LP::Instruction& instruction, const std::string& expression, bool comparison)
+        {
+            popParameterCount(instruction);
+            line("{");
+            line("    const float b = stack.top().float_value();");
+            line("    stack.pop();");
+            line("    Yarn::Value& a = stack.top();");
+            line(std::string("    a.") + (comparison ? "set_bool_value(" : "set_float_value(") + expression + ");");
+            line("}");
+        }
+
+        void boolOperator(const LP::Instruction& instruction, const std::string& expression)
+        {
+            popParameterCount(instruction);
+            line("{");
+            line("    const bool b = stack.top().bool_value();");
+            line("    stack.pop();");
+            line("    Yarn::Value& a = stack.top();");
+            line("    a.set_bool_value(" + expression + ");");
+            line("}");
+        }
+
+        void stringComparison(const LP::Instruction& instruction, const std::string& op)
+        {
+            popParameterCount(instruction);
+            line("{");
+            line("    const bool result = (stack.peek(1).string_value() " + op + " stack.top().string_value());");
+            line("    stack.pop();");
+            line("    stack.top().set_bool_value(result);");
+            line("}");
+        }
+
+        void instruction(std::int32_t k)
+        {
+            const LP::Instruction& instruction = code[k];
+            const std::string index = std::to_string(k);
+
+            os << "        case " << k << ":";
+
+            if (jumpTarget[k])
+            {
+                os << " i" << k << ":";
+            }
+
+            os << " // " << comment(instruction) << "\n";
+
+            line("YARN_COMPILED_BUDGET(" + index + ");");
+
+            const std::string a = std::to_string(instruction.a);
+            const std::string b = std::to_string(instruction.b);
+
+            switch (instruction.opcode)
+            {
+            case LP::PUSH_STRING:
+            case LP::PUSH_FLOAT:
+            case LP::PUSH_BOOL:
+                line("stack.push(" + constant(instruction.a) + ");");
+                break;
+            case LP::PUSH_NULL:
+                line("stack.push(Yarn::Value());");
+                break;
+            case LP::PUSH_VARIABLE:
+                line("stack.push(vm.variableStorage[" + a + "]);");
+                break;
+            case LP::STORE_VARIABLE:
+                // an empty stack is an error the interpreter reports
+                line("if (stack.empty()) { YARN_COMPILED_INTERPRET(" + index + "); }");
+                line("else vm.variableStorage[" + a + "] = stack.top();");
+                break;
+            case LP::POP:
+                line("if (stack.empty()) { YARN_COMPILED_INTERPRET(" + index + "); }");
+                line("else stack.pop();");
+                break;
+            case LP::JUMP_TO:
+            case LP::JUMP_IF_FALSE:
+            {
+                const std::int32_t target = destination(instruction);
+
+                if (target == LP::UNRESOLVED)
+                {
+                    interpret(k);
+                }
+                else if (instruction.opcode == LP::JUMP_TO)
+                {
+                    line("goto i" + std::to_string(target) + ";");
+                }
+                else
+                {
+                    line("if (!Yarn::Compiled::truthy(stack.top())) goto i" + std::to_string(target) + ";");
+                }
+                break;
+            }
+            case LP::JUMP_IF_VARIABLE_NOT_EQUAL:
+            {
+                const std::int32_t target = destination(instruction);
+
+                if (target == LP::UNRESOLVED)
+                {
+                    interpret(k);
+                    break;
+                }
+
+                line("{");
+                line("    const bool equal = (vm.variableStorage[" + b + "].float_value() == " + floatConstant(instruction.c) + ");");
+                line("    stack.push(Yarn::Value(equal));");
+                line("    if (!equal) goto i" + std::to_string(target) + ";");
+                line("}");
+                break;
+            }
+            case LP::ADD_TO_VARIABLE:
+                line("{");
+                line("    Yarn::Value& variable = vm.variableStorage[" + a + "];");
+                line("    variable.set_float_value(variable.float_value() + " + floatConstant(instruction.b) + ");");
+                line("}");
+                break;
+            case LP::NUMBER_ADD: numberOperator(instruction, "a.float_value() + b", false); break;
+            case LP::NUMBER_SUBTRACT: numberOperator(instruction, "a.float_value() - b", false); break;
+            case LP::NUMBER_MULTIPLY: numberOperator(instruction, "a.float_value() * b", false); break;
+            case LP::NUMBER_DIVIDE: numberOperator(instruction, "a.float_value() / b", false); break;
+            case LP::NUMBER_MODULO: numberOperator(instruction, "std::fmod(a.float_value(), b)", false); break;
+            case LP::NUMBER_EQUAL: numberOperator(instruction, "a.float_value() == b", true); break;
+            case LP::NUMBER_NOT_EQUAL: numberOperator(instruction, "a.float_value() != b", true); break;
+            case LP::NUMBER_LESS: numberOperator(instruction, "a.float_value() < b", true); break;
+            case LP::NUMBER_LESS_EQUAL: numberOperator(instruction, "a.float_value() <= b", true); break;
+            case LP::NUMBER_GREATER: numberOperator(instruction, "a.float_value() > b", true); break;
+            case LP::NUMBER_GREATER_EQUAL: numberOperator(instruction, "a.float_value() >= b", true); break;
+            case LP::NUMBER_NEGATE:
+                popParameterCount(instruction);
+                line("stack.top().set_float_value(-stack.top().float_value());");
+                break;
+            case LP::BOOL_AND: boolOperator(instruction, "a.bool_value() && b"); break;
+            case LP::BOOL_OR: boolOperator(instruction, "a.bool_value() || b"); break;
+            case LP::BOOL_XOR: boolOperator(instruction, "a.bool_value() != b"); break;
+            case LP::BOOL_EQUAL: boolOperator(instruction, "a.bool_value() == b"); break;
+            case LP::BOOL_NOT_EQUAL: boolOperator(instruction, "a.bool_value() != b"); break;
+            case LP::BOOL_NOT:
+                popParameterCount(instruction);
+                line("stack.top().set_bool_value(!stack.top().bool_value());");
+                break;
+            case LP::STRING_EQUAL: stringComparison(instruction, "=="); break;
+            case LP::STRING_NOT_EQUAL: stringComparison(instruction, "!="); break;
+            case LP::STRING_ADD:
+                popParameterCount(instruction);
+                line("{");
+                line("    std::string result(stack.peek(1).string_value());");
+                line("    result += stack.top().string_value();");
+                line("    stack.pop();");
+                line("    stack.top().set_string_value(vm.makeString(result));");
+                line("}");
+                break;
+            default:
+                // lines, commands, options, function calls, computed jumps, node changes and STOP
+                interpret(k);
+                break;
+            }
+        }
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage : yarn2cpp <input.yarnc> <output.cpp> [name]" << std::endl;
+        return 1;
+    }
+
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(argv[1], error);
+
+    if (!image)
+    {
+        std::cerr << "yarn2cpp : " << error << std::endl;
+        return 1;
+    }
+
+    const LP& linked = image->linked;
+    const std::string name = (argc > 3) ? argv[3] : defaultName(argv[1]);
+    const std::string file = std::string(argv[1]).substr(std::string(argv[1]).find_last_of("/\\") + 1);
+
+    std::ofstream os(argv[2], std::ios::out);
+
+    if (!os.is_open())
+    {
+        std::cerr << "yarn2cpp : couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    os << "// generated by yarn2cpp from " << file << ", do not edit.  See yarn_compiled.h\n\n";
+    os << "#include <cmath>\n";
+    os << "#include <string>\n\n";
+    os << "#include <yarn_compiled.h>\n\n";
+    os << "namespace\n";
+    os << "{\n";
+
+    for (std::size_t i = 0; i < linked.nodes.size(); i++)
+    {
+        NodeCompiler(linked, linked.nodes[i], os).compile(i);
+    }
+
+    // C++ has no empty arrays, so a program without nodes still gets one entry
+    os << "    const Yarn::YarnVM::CompiledNode nodes[] =\n";
+    os << "    {\n";
+
+    for (std::size_t i = 0; i < linked.nodes.size(); i++)
+    {
+        os << "        node" << i << ",\n";
+    }
+
+    if (linked.nodes.empty())
+    {
+        os << "        nullptr,\n";
+    }
+
+    char fingerprint[32];
+    std::snprintf(fingerprint, sizeof(fingerprint), "0x%016llxull", (unsigned long long)linked.fingerprint());
+
+    os << "    };\n";
+    os << "}\n\n";
+    os << "extern const Yarn::CompiledProgram " << name << ";\n\n";
+    os << "const Yarn::CompiledProgram " << name << " = { " << quote(file) << ", " << fingerprint << ", " << linked.nodes.size() << ", nodes };\n";
+
+    if (!os.good())
+    {
+        std::cerr << "yarn2cpp : couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cout << argv[1] << " : " << linked.nodes.size() << " nodes -> " << argv[2] << std::endl;
+
+    return 0;
+}
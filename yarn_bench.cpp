@@ -0,0 +1,527 @@
+/**
+ * @file yarn_bench.cpp
+ *
+ * @brief Interpreter throughput benchmark
+ *
+ * Runs every compiled module in a directory (test/ by default) and a large synthetic program of condition logic,
+ * and reports the instructions executed per second.  Options are answered with the first enabled option, lines and commands are ignored.
+ * Then runs thousands of sessions of a smaller synthetic program through the DialogueScheduler on 1 to N threads, and reports how it scales.
+ * Then runs a program of lines on a ThreadedRunner and reports the latency from a line being queued on the VM thread to the UI thread receiving it.
+ * Last, writes a 100k line -Lines.csv and -Metadata.csv pair to the temporary directory and compares loading it with the generic csv reader
+ * (LineDatabase::loadLinesGeneric) to loading it with the fixed layout scanner (LineDatabase::loadLines, yarn_csv.h).
+ *
+ * usage : YarnBench [module directory] [repetitions] [max scheduler threads]
+ *
+ * Build once with YARN_THREADED_DISPATCH on and once with it off to compare the two dispatch loops.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <yarn_csv.h>
+#include <yarn_line_database.h>
+#include <yarn_scheduler.h>
+#include <yarn_threaded_runner.h>
+#include <yarn_vm.h>
+
+namespace
+{
+    /// answers every option with the first enabled option, ignores lines and commands
+    struct BenchCallbacks : public Yarn::YarnVM::YarnCallbacks
+    {
+        Yarn::YarnVM& vm;
+
+        BenchCallbacks(Yarn::YarnVM& vm) : vm(vm) {}
+
+        void onRunLine(const Yarn::YarnVM::Line&) override {}
+
+        void onRunCommand(const std::string_view&) override {}
+
+        void onPresentOptions(const Yarn::YarnVM::OptionsList& options) override
+        {
+            for (int i = 0; i < (int)options.size(); i++)
+            {
+                if (options[i].enabled)
+                {
+                    vm.selectOption(i);
+                    return;
+                }
+            }
+
+            vm.selectOption(0);
+        }
+    };
+
+    /// restart the program from the Start node with its initial state
+    void reset(Yarn::YarnVM& vm)
+    {
+        vm.variableStorage = vm.image->linked.initialValues;
+        vm.variableStack = {};
+        vm.currentOptionsList.clear();
+        vm.generator.seed(vm.settings.randomSeed);
+        vm.loadNode("Start");
+    }
+
+    /// instructions executed by one run of the program
+    std::size_t countInstructions(Yarn::YarnVM& vm)
+    {
+        reset(vm);
+
+        const std::uint64_t start = vm.instructionsExecuted;
+
+        while (vm.run() != Yarn::YarnVM::YIELD_STOPPED)
+        {
+        }
+
+        return (std::size_t)(vm.instructionsExecuted - start);
+    }
+
+    void bench(const std::string& name, std::shared_ptr<const Yarn::ProgramImage> image, int repetitions)
+    {
+        Yarn::YarnVM vm;
+        BenchCallbacks callbacks(vm);
+        vm.setCallbacks(&callbacks);
+
+        try
+        {
+            vm.loadProgram(std::move(image));
+
+            const std::size_t instructions = countInstructions(vm);
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < repetitions; i++)
+            {
+                reset(vm);
+
+                while (vm.run() != Yarn::YarnVM::YIELD_STOPPED)
+                {
+                }
+            }
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const double total = (double)instructions * repetitions;
+
+            std::cout << std::left << std::setw(24) << name
+                << std::right << std::setw(14) << (std::size_t)total << " instructions"
+                << std::setw(12) << std::fixed << std::setprecision(3) << seconds << " s"
+                << std::setw(12) << std::setprecision(1) << (total / seconds) / 1e6 << " M instructions/s" << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << std::left << std::setw(24) << name << " skipped : " << e.what() << std::endl;
+        }
+    }
+
+    /// a single node that loops over arithmetic and boolean logic, the kind of code a node runs between lines
+    Yarn::Program makeSyntheticProgram(int iterations)
+    {
+        Yarn::Program program;
+        program.set_name("synthetic");
+
+        Yarn::Node& node = (*program.mutable_nodes())["Start"];
+        node.set_name("Start");
+
+        auto emit = [&node](Yarn::Instruction_OpCode opcode) -> Yarn::Instruction&
+        {
+            Yarn::Instruction& instruction = *node.add_instructions();
+            instruction.set_opcode(opcode);
+            return instruction;
+        };
+
+        auto emitString = [&emit](Yarn::Instruction_OpCode opcode, const std::string& s) { emit(opcode).add_operands()->set_string_value(s); };
+        auto emitFloat = [&emit](Yarn::Instruction_OpCode opcode, float f) { emit(opcode).add_operands()->set_float_value(f); };
+        auto label = [&node](const std::string& name) { (*node.mutable_labels())[name] = node.instructions_size(); };
+
+        auto call = [&](const std::string& function, int parameters)
+        {
+            emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, (float)parameters);
+            emitString(Yarn::Instruction_OpCode_CALL_FUNC, function);
+        };
+
+        auto store = [&](const std::string& variable)
+        {
+            emitString(Yarn::Instruction_OpCode_STORE_VARIABLE, variable);
+            emit(Yarn::Instruction_OpCode_POP);
+        };
+
+        (*program.mutable_initial_values())["$i"].set_float_value(0.f);
+        (*program.mutable_initial_values())["$x"].set_float_value(1.f);
+        (*program.mutable_initial_values())["$n"].set_float_value(0.f);
+        (*program.mutable_initial_values())["$b"].set_bool_value(false);
+
+        // while ($i < iterations)
+        label("loop");
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$i");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, (float)iterations);
+        call("Number.LessThan", 2);
+        emitString(Yarn::Instruction_OpCode_JUMP_IF_FALSE, "end");
+        emit(Yarn::Instruction_OpCode_POP);
+
+        // $x = ($x * 3 + 1) % 7
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$x");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 3.f);
+        call("Number.Multiply", 2);
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 1.f);
+        call("Number.Add", 2);
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 7.f);
+        call("Number.Modulo", 2);
+        store("$x");
+
+        // $b = ($x > 3) xor $b
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$x");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 3.f);
+        call("Number.GreaterThan", 2);
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$b");
+        call("Bool.Xor", 2);
+        store("$b");
+
+        // if ($b) $n = $n + 1
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$b");
+        emitString(Yarn::Instruction_OpCode_JUMP_IF_FALSE, "skip");
+        emit(Yarn::Instruction_OpCode_POP);
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$n");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 1.f);
+        call("Number.Add", 2);
+        store("$n");
+        emitString(Yarn::Instruction_OpCode_JUMP_TO, "join");
+        label("skip");
+        emit(Yarn::Instruction_OpCode_PUSH_NULL); // jumping to a label skips the instruction at the label
+        emit(Yarn::Instruction_OpCode_POP);
+        label("join");
+
+        // $i = $i + 1
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$i");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 1.f);
+        call("Number.Add", 2);
+        store("$i");
+        emitString(Yarn::Instruction_OpCode_JUMP_TO, "loop");
+
+        label("end");
+        emit(Yarn::Instruction_OpCode_PUSH_NULL);
+        emit(Yarn::Instruction_OpCode_POP);
+        emit(Yarn::Instruction_OpCode_STOP);
+
+        return program;
+    }
+
+    /// run every session to the end through a scheduler with the given number of threads.  Returns the seconds taken
+    double benchScheduler(std::shared_ptr<const Yarn::ProgramImage> image, unsigned threads, int sessions, std::uint64_t& instructions)
+    {
+        Yarn::DialogueScheduler::Settings settings;
+        settings.threadCount = threads;
+        settings.instructionBudget = 10000;
+
+        Yarn::DialogueScheduler scheduler(std::move(image), settings);
+
+        for (int i = 0; i < sessions; i++)
+        {
+            scheduler.addSession("Start");
+        }
+
+        instructions = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        do
+        {
+            scheduler.tick(1);
+            instructions += scheduler.stats().instructions;
+        } while (scheduler.stats().runnable);
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void schedulerScaling(std::shared_ptr<const Yarn::ProgramImage> image, unsigned maxThreads, int sessions)
+    {
+        std::cout << std::endl << "scheduler : " << sessions << " sessions" << std::endl;
+
+        // powers of two up to maxThreads, and maxThreads itself
+        std::vector<unsigned> threadCounts;
+
+        for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+        {
+            threadCounts.push_back(threads);
+        }
+
+        threadCounts.push_back(maxThreads);
+
+        double baseline = 0.0;
+
+        for (unsigned threads : threadCounts)
+        {
+            std::uint64_t instructions = 0;
+            const double seconds = benchScheduler(image, threads, sessions, instructions);
+
+            if (threads == 1)
+            {
+                baseline = seconds;
+            }
+
+            std::cout << std::left << std::setw(24) << (std::to_string(threads) + " threads")
+                << std::right << std::setw(14) << instructions << " instructions"
+                << std::setw(12) << std::fixed << std::setprecision(3) << seconds << " s"
+                << std::setw(12) << std::setprecision(1) << ((double)instructions / seconds) / 1e6 << " M instructions/s"
+                << std::setw(8) << std::setprecision(2) << baseline / seconds << "x" << std::endl;
+        }
+    }
+
+    /// a single node that runs the same line over and over
+    Yarn::Program makeLineProgram(int lines)
+    {
+        Yarn::Program program;
+        program.set_name("lines");
+
+        Yarn::Node& node = (*program.mutable_nodes())["Start"];
+        node.set_name("Start");
+
+        auto emit = [&node](Yarn::Instruction_OpCode opcode) -> Yarn::Instruction&
+        {
+            Yarn::Instruction& instruction = *node.add_instructions();
+            instruction.set_opcode(opcode);
+            return instruction;
+        };
+
+        auto emitString = [&emit](Yarn::Instruction_OpCode opcode, const std::string& s) { emit(opcode).add_operands()->set_string_value(s); };
+        auto emitFloat = [&emit](Yarn::Instruction_OpCode opcode, float f) { emit(opcode).add_operands()->set_float_value(f); };
+        auto label = [&node](const std::string& name) { (*node.mutable_labels())[name] = node.instructions_size(); };
+
+        (*program.mutable_initial_values())["$i"].set_float_value(0.f);
+
+        // while ($i < lines) { line; $i = $i + 1 }
+        label("loop");
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$i");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, (float)lines);
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 2.f);
+        emitString(Yarn::Instruction_OpCode_CALL_FUNC, "Number.LessThan");
+        emitString(Yarn::Instruction_OpCode_JUMP_IF_FALSE, "end");
+        emit(Yarn::Instruction_OpCode_POP);
+        emitString(Yarn::Instruction_OpCode_RUN_LINE, "line:bench");
+        node.mutable_instructions()->rbegin()->add_operands()->set_float_value(0.f); // substitution count
+        emitString(Yarn::Instruction_OpCode_PUSH_VARIABLE, "$i");
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 1.f);
+        emitFloat(Yarn::Instruction_OpCode_PUSH_FLOAT, 2.f);
+        emitString(Yarn::Instruction_OpCode_CALL_FUNC, "Number.Add");
+        emitString(Yarn::Instruction_OpCode_STORE_VARIABLE, "$i");
+        emit(Yarn::Instruction_OpCode_POP);
+        emitString(Yarn::Instruction_OpCode_JUMP_TO, "loop");
+
+        label("end");
+        emit(Yarn::Instruction_OpCode_PUSH_NULL);
+        emit(Yarn::Instruction_OpCode_POP);
+        emit(Yarn::Instruction_OpCode_STOP);
+
+        return program;
+    }
+
+    /// time from the VM thread queueing each line to the UI thread polling it
+    void threadedRunnerLatency(std::shared_ptr<const Yarn::ProgramImage> image)
+    {
+        // the line database is empty, so every line renders as empty text and the benchmark measures the queue rather than rendering
+        struct BenchRunner : public Yarn::ThreadedRunner
+        {
+            ~BenchRunner() { stop(); }
+        };
+
+        BenchRunner runner;
+        runner.vm.loadProgram(std::move(image));
+        runner.vm.loadNode("Start");
+
+        std::vector<double> latencies;
+        Yarn::ThreadedRunner::OutputEvent event;
+
+        runner.start();
+
+        for (;;)
+        {
+            if (!runner.poll(event))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            if (event.type == Yarn::ThreadedRunner::OutputEvent::STOPPED)
+            {
+                break;
+            }
+
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - event.produced).count());
+        }
+
+        runner.stop();
+
+        if (latencies.empty())
+        {
+            std::cout << "threaded runner skipped : no lines" << std::endl;
+            return;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        auto percentile = [&latencies](double p) { return latencies[(std::size_t)(p * (latencies.size() - 1))]; };
+
+        std::cout << std::endl << "threaded runner : " << latencies.size() << " lines, latency produced -> consumed (us)" << std::endl
+            << std::fixed << std::setprecision(2)
+            << "p50 " << percentile(0.5) << "   p90 " << percentile(0.9) << "   p99 " << percentile(0.99) << "   max " << latencies.back() << std::endl;
+    }
+
+    /// write a module's worth of lines and tags in the layout the Yarn compiler writes, with the quoting, commas and long paths real files have
+    void writeLineTables(const std::string& module, int lines)
+    {
+        std::ofstream linesCSV(module + "-Lines.csv", std::ios::binary);
+        std::ofstream metadataCSV(module + "-Metadata.csv", std::ios::binary);
+
+        linesCSV << "id,text,file,node,lineNumber\n";
+        metadataCSV << "id,node,lineNumber,tags\n";
+
+        const std::string file = "C:\\Users\\writer\\Documents\\Game\\Dialogue\\Chapter1.yarn";
+
+        for (int i = 0; i < lines; i++)
+        {
+            const std::string node = "Node" + std::to_string(i / 50);
+            const std::string id = "line:" + file + "-" + node + "-" + std::to_string(i % 50);
+
+            // every fourth line needs quoting, as lines with commas and quotes in them do
+            if (i % 4 == 0)
+            {
+                linesCSV << id << ",\"Well, \"\"that\"\" is line " << i << ", isn't it?\"," << file << "," << node << "," << (i % 50) * 2 + 3 << "\n";
+            }
+            else
+            {
+                linesCSV << id << ",Character" << i % 7 << ": This is line number " << i << " of the benchmark module," << file << "," << node << "," << (i % 50) * 2 + 3 << "\n";
+            }
+
+            if (i % 3 == 0)
+            {
+                metadataCSV << id << "," << node << "," << (i % 50) * 2 + 3 << ",mood:" << i % 5 << ",voice:line" << i << "\n";
+            }
+        }
+    }
+
+    /// fastest of repetitions loads of the module into an empty database.  Returns the seconds taken
+    template <typename Load>
+    double timeLoad(Load load, int repetitions, std::size_t& lines)
+    {
+        double best = std::numeric_limits<double>::max();
+
+        for (int i = 0; i < repetitions; i++)
+        {
+            Yarn::LineDatabase db;
+
+            auto start = std::chrono::steady_clock::now();
+            load(db);
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+            lines = db.size();
+        }
+
+        return best;
+    }
+
+    void csvLoading(int lines)
+    {
+        const std::string module = (std::filesystem::temp_directory_path() / "yarn_bench_lines").string();
+        const std::string linesCSV = module + "-Lines.csv";
+        const std::string metadataCSV = module + "-Metadata.csv";
+
+        writeLineTables(module, lines);
+
+        const double megabytes = (double)(std::filesystem::file_size(linesCSV) + std::filesystem::file_size(metadataCSV)) / (1024.0 * 1024.0);
+
+        std::cout << std::endl << "line database : " << lines << " lines, " << std::fixed << std::setprecision(1) << megabytes << " MB of csv"
+            << ", field scan " << (Yarn::CsvScanner::vectorized() ? "vectorized" : "scalar") << std::endl;
+
+        std::size_t genericLines = 0;
+        std::size_t scannedLines = 0;
+
+        const double generic = timeLoad([&](Yarn::LineDatabase& db) { db.loadLinesGeneric(linesCSV); db.loadMetadataGeneric(metadataCSV); }, 3, genericLines);
+        const double scanned = timeLoad([&](Yarn::LineDatabase& db) { db.loadLines(linesCSV); db.loadMetadata(metadataCSV); }, 3, scannedLines);
+
+        auto report = [megabytes](const std::string& name, std::size_t loaded, double seconds)
+        {
+            std::cout << std::left << std::setw(24) << name
+                << std::right << std::setw(14) << loaded << " lines"
+                << std::setw(12) << std::fixed << std::setprecision(3) << seconds << " s"
+                << std::setw(12) << std::setprecision(1) << megabytes / seconds << " MB/s" << std::endl;
+        };
+
+        report("csv.hpp reader", genericLines, generic);
+        report("fixed layout scanner", scannedLines, scanned);
+
+        std::cout << std::fixed << std::setprecision(2) << generic / scanned << "x" << ((genericLines == scannedLines) ? "" : "  (the loaders disagree on the line count!)") << std::endl;
+
+        std::error_code error;
+        std::filesystem::remove(linesCSV, error);
+        std::filesystem::remove(metadataCSV, error);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const std::filesystem::path moduleDirectory = (argc > 1) ? argv[1] : "test";
+    const int repetitions = (argc > 2) ? std::stoi(argv[2]) : 20000;
+    const unsigned maxThreads = (argc > 3) ? (unsigned)std::stoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "dispatch : " << (Yarn::YarnVM::threadedDispatch() ? "threaded" : "switch") << std::endl;
+
+    std::error_code ec;
+
+    for (const auto& entry : std::filesystem::directory_iterator(moduleDirectory, ec))
+    {
+        if (entry.path().extension() == ".yarnc")
+        {
+            std::string error;
+            std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(entry.path().string(), error);
+
+            if (!image)
+            {
+                std::cout << entry.path().stem().string() << " skipped : " << error << std::endl;
+                continue;
+            }
+
+            bench(entry.path().stem().string(), image, repetitions);
+        }
+    }
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> synthetic = Yarn::ProgramImage::create(makeSyntheticProgram(1000000), error);
+
+    if (!synthetic)
+    {
+        std::cout << "synthetic skipped : " << error << std::endl;
+        return 1;
+    }
+
+    bench("synthetic", synthetic, 1);
+
+    std::shared_ptr<const Yarn::ProgramImage> session = Yarn::ProgramImage::create(makeSyntheticProgram(2000), error);
+
+    if (!session)
+    {
+        std::cout << "scheduler skipped : " << error << std::endl;
+        return 1;
+    }
+
+    schedulerScaling(session, maxThreads, 4096);
+
+    std::shared_ptr<const Yarn::ProgramImage> lines = Yarn::ProgramImage::create(makeLineProgram(100000), error);
+
+    if (!lines)
+    {
+        std::cout << "threaded runner skipped : " << error << std::endl;
+        return 1;
+    }
+
+    threadedRunnerLatency(lines);
+
+    csvLoading(100000);
+}
@@ -0,0 +1,524 @@
+#include <yarn_bundle.h>
+#include <yarn_line_database.h>
+#include <yarn_program.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+using namespace Yarn;
+using namespace Yarn::BundleFormat;
+
+// Header alone would be ambiguous with the Yarn::Header protobuf message
+typedef Yarn::BundleFormat::Header BundleHeader;
+
+std::shared_ptr<const Bundle> Bundle::open(const std::string& path, std::string& error)
+{
+    std::shared_ptr<Bundle> bundle = std::make_shared<Bundle>();
+
+    bundle->filePath = path;
+
+    if (!bundle->file.open(path, error) || !bundle->validate(error))
+    {
+        return nullptr;
+    }
+
+    return bundle;
+}
+
+bool Bundle::validate(std::string& error)
+{
+    auto fail = [&](const std::string& message)
+    {
+        error = filePath + " : " + message;
+        return false;
+    };
+
+    // -- header --
+    if ((file.size() < sizeof(BundleHeader)) || std::memcmp(file.data(), MAGIC, sizeof(MAGIC)))
+    {
+        return fail("not a Yarn bundle");
+    }
+
+    const BundleHeader& h = header();
+
+    if (h.byteOrder != BYTE_ORDER_MARK)
+    {
+        return fail("written on a machine with a different byte order");
+    }
+
+    if (h.version != VERSION)
+    {
+        return fail("bundle version " + std::to_string(h.version) + ", this build reads version " + std::to_string(VERSION));
+    }
+
+    if ((h.instructionSize != sizeof(LinkedProgram::Instruction)) || (h.opcodeCount != LinkedProgram::OPCODE_COUNT))
+    {
+        return fail("written by a build with a different instruction set, rebuild it with yarnbundle");
+    }
+
+    if (h.fileSize != file.size())
+    {
+        return fail("truncated");
+    }
+
+    static constexpr std::size_t recordSizes[SECTION_COUNT] =
+    {
+        sizeof(StringRef), 1, sizeof(std::int32_t), sizeof(ValueRecord), sizeof(NodeRecord), sizeof(LinkedProgram::Instruction),
+        sizeof(LinkedProgram::Label), sizeof(std::uint32_t), sizeof(VariableRecord), 1, sizeof(LineRecord), sizeof(std::uint32_t)
+    };
+
+    for (std::uint32_t s = 0; s < SECTION_COUNT; s++)
+    {
+        const SectionRef& ref = h.sections[s];
+
+        if ((ref.offset % ALIGNMENT) || (ref.offset > file.size()) || (ref.size > file.size() - ref.offset) || (ref.size % recordSizes[s]))
+        {
+            return fail("section " + std::to_string(s) + " is out of bounds");
+        }
+    }
+
+    strings = section<StringRef>(STRINGS);
+    stringData = std::string_view((const char*)file.data() + h.sections[STRING_DATA].offset, (std::size_t)h.sections[STRING_DATA].size);
+    lines = section<LineRecord>(LINES);
+    tagStrings = section<std::uint32_t>(TAGS);
+
+    // -- strings --
+    for (const StringRef& ref : strings)
+    {
+        if ((ref.offset > stringData.size()) || (ref.size > stringData.size() - ref.offset))
+        {
+            return fail("string out of bounds");
+        }
+    }
+
+    const std::size_t programStrings = h.programStringCount;
+
+    if (programStrings > strings.size())
+    {
+        return fail("bad program string count");
+    }
+
+    auto isString = [&](std::uint32_t index) { return index < strings.size(); };
+    auto isProgramString = [&](std::int32_t index) { return (index >= 0) && ((std::size_t)index < programStrings); };
+
+    const std::span<const std::int32_t> sorted = section<std::int32_t>(SORTED_STRINGS);
+
+    if (sorted.size() != programStrings)
+    {
+        return fail("bad sorted string table");
+    }
+
+    for (std::size_t i = 0; i < sorted.size(); i++)
+    {
+        if (!isProgramString(sorted[i]) || ((i > 0) && !(string(sorted[i - 1]) < string(sorted[i]))))
+        {
+            return fail("bad sorted string table");
+        }
+    }
+
+    // -- pools --
+    auto isValue = [&](const ValueRecord& v)
+    {
+        return (v.type == Value::NONE) || (v.type == Value::FLOAT) || (v.type == Value::BOOL) || ((v.type == Value::STRING) && isProgramString((std::int32_t)v.value));
+    };
+
+    const std::span<const ValueRecord> constants = section<ValueRecord>(CONSTANTS);
+
+    for (const ValueRecord& constant : constants)
+    {
+        if ((constant.type == Value::NONE) || !isValue(constant))
+        {
+            return fail("bad constant");
+        }
+    }
+
+    const std::span<const std::uint32_t> functions = section<std::uint32_t>(FUNCTIONS);
+
+    if (!std::all_of(functions.begin(), functions.end(), isString))
+    {
+        return fail("bad function name");
+    }
+
+    const std::span<const VariableRecord> variables = section<VariableRecord>(VARIABLES);
+
+    for (const VariableRecord& variable : variables)
+    {
+        if (!isString(variable.name) || !isValue(variable.initialValue))
+        {
+            return fail("bad variable");
+        }
+    }
+
+    // -- nodes : every operand has to index the pools, so the VM can run the code without checking --
+    const std::span<const NodeRecord> nodes = section<NodeRecord>(NODES);
+    const std::span<const LinkedProgram::Instruction> code = section<LinkedProgram::Instruction>(CODE);
+    const std::span<const LinkedProgram::Label> labels = section<LinkedProgram::Label>(LABELS);
+
+    auto inRange = [](std::int32_t index, std::size_t size) { return (index >= 0) && ((std::size_t)index < size); };
+
+    auto isConstant = [&](std::int32_t index, Value::Type type) { return inRange(index, constants.size()) && (constants[index].type == type); };
+
+    for (const NodeRecord& node : nodes)
+    {
+        if (!isString(node.name) ||
+            (node.firstInstruction > code.size()) || (node.instructionCount == 0) || (node.instructionCount > code.size() - node.firstInstruction) ||
+            (node.firstLabel > labels.size()) || (node.labelCount > labels.size() - node.firstLabel))
+        {
+            return fail("bad node");
+        }
+
+        const std::string nodeName(string(node.name));
+        const std::size_t size = node.instructionCount;
+
+        auto isTarget = [&](std::int32_t target) { return (target == LinkedProgram::UNRESOLVED) || inRange(target, size); };
+
+        // conditional jumps carry on after their target, so that has to be inside the node too.  The linker never aims one at END_OF_NODE
+        auto isConditionalTarget = [&](std::int32_t target) { return inRange(target, size - 1); };
+
+        for (const LinkedProgram::Label& label : labels.subspan(node.firstLabel, node.labelCount))
+        {
+            if (!isProgramString(label.name) || !isTarget(label.target))
+            {
+                return fail("node " + nodeName + " : bad label");
+            }
+        }
+
+        const std::span<const LinkedProgram::Instruction> nodeCode = code.subspan(node.firstInstruction, size);
+
+        if (nodeCode.back().opcode != LinkedProgram::END_OF_NODE)
+        {
+            return fail("node " + nodeName + " : missing END_OF_NODE");
+        }
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            const LinkedProgram::Instruction& instruction = nodeCode[i];
+            bool valid = true;
+
+            switch (instruction.opcode)
+            {
+            case LinkedProgram::JUMP_TO:
+                valid = isTarget(instruction.a) && isProgramString(instruction.b);
+                break;
+            case LinkedProgram::JUMP_IF_FALSE:
+                valid = ((instruction.a == LinkedProgram::UNRESOLVED) || isConditionalTarget(instruction.a)) && isProgramString(instruction.b);
+                break;
+            case LinkedProgram::RUN_LINE:
+            case LinkedProgram::RUN_COMMAND:
+                valid = isProgramString(instruction.a);
+                break;
+            case LinkedProgram::ADD_OPTION:
+                valid = isProgramString(instruction.a) && isProgramString(instruction.b);
+                break;
+            case LinkedProgram::PUSH_STRING:
+                valid = isConstant(instruction.a, Value::STRING);
+                break;
+            case LinkedProgram::PUSH_FLOAT:
+                valid = isConstant(instruction.a, Value::FLOAT);
+                break;
+            case LinkedProgram::PUSH_BOOL:
+                valid = isConstant(instruction.a, Value::BOOL);
+                break;
+            case LinkedProgram::CALL_FUNC:
+                valid = inRange(instruction.a, functions.size());
+                break;
+            case LinkedProgram::PUSH_VARIABLE:
+            case LinkedProgram::STORE_VARIABLE:
+                valid = inRange(instruction.a, variables.size());
+                break;
+            case LinkedProgram::RUN_NODE:
+                valid = (instruction.a == LinkedProgram::UNRESOLVED) || inRange(instruction.a, nodes.size());
+                break;
+            case LinkedProgram::JUMP_IF_VARIABLE_NOT_EQUAL:
+                valid = isConditionalTarget(instruction.a) && inRange(instruction.b, variables.size()) && isConstant(instruction.c, Value::FLOAT);
+                break;
+            case LinkedProgram::ADD_TO_VARIABLE:
+                valid = inRange(instruction.a, variables.size()) && isConstant(instruction.b, Value::FLOAT);
+                break;
+            case LinkedProgram::RUN_NODE_DIRECT:
+                valid = inRange(instruction.a, nodes.size());
+                break;
+            case LinkedProgram::END_OF_NODE:
+                valid = (i == size - 1);
+                break;
+            default:
+                valid = (instruction.opcode < LinkedProgram::OPCODE_COUNT);
+                break;
+            }
+
+            if (!valid)
+            {
+                return fail("node " + nodeName + ", instruction " + std::to_string(i) + " : bad opcode or operand");
+            }
+        }
+    }
+
+    // -- line database --
+    for (std::size_t i = 0; i < lines.size(); i++)
+    {
+        const LineRecord& line = lines[i];
+
+        if (!isString(line.id) || !isString(line.text) || !isString(line.file) || !isString(line.node) ||
+            (line.firstTag > tagStrings.size()) || (line.tagCount > tagStrings.size() - line.firstTag) ||
+            ((i > 0) && !(string(lines[i - 1].id) < string(line.id))))
+        {
+            return fail("bad line " + std::to_string(i));
+        }
+    }
+
+    if (!std::all_of(tagStrings.begin(), tagStrings.end(), isString))
+    {
+        return fail("bad tag");
+    }
+
+    return true;
+}
+
+Value Bundle::value(const ValueRecord& record) const
+{
+    switch (record.type)
+    {
+    case Value::FLOAT:
+    {
+        float f = 0.f;
+        std::memcpy(&f, &record.value, sizeof(f));
+        return Value(f);
+    }
+    case Value::BOOL:
+        return Value(record.value != 0);
+    case Value::STRING:
+        return Value(string(record.value));
+    default:
+        return Value();
+    }
+}
+
+const LineRecord* Bundle::findLine(std::string_view id) const
+{
+    auto it = std::lower_bound(lines.begin(), lines.end(), id, [this](const LineRecord& line, std::string_view id) { return string(line.id) < id; });
+
+    return ((it != lines.end()) && (string(it->id) == id)) ? &*it : nullptr;
+}
+
+namespace
+{
+    /// the sections of a bundle being written
+    struct BundleWriter
+    {
+        std::vector<StringRef> strings;
+        std::string stringData;
+        std::unordered_map<std::string_view, std::uint32_t> stringIndices; // views the strings being written, which outlive the writer
+
+        std::uint32_t intern(std::string_view s)
+        {
+            auto [it, inserted] = stringIndices.insert({ s, (std::uint32_t)strings.size() });
+
+            if (inserted)
+            {
+                strings.push_back({ (std::uint32_t)stringData.size(), (std::uint32_t)s.size() });
+                stringData += s;
+            }
+
+            return it->second;
+        }
+
+        ValueRecord record(const Value& value)
+        {
+            ValueRecord record = { value.type(), 0 };
+
+            switch (value.type())
+            {
+            case Value::FLOAT:
+            {
+                const float f = value.float_value();
+                std::memcpy(&record.value, &f, sizeof(f));
+            }
+            break;
+            case Value::BOOL: record.value = value.bool_value() ? 1 : 0; break;
+            case Value::STRING: record.value = intern(value.string_value()); break;
+            default: break;
+            }
+
+            return record;
+        }
+
+        /// append a section at the next aligned offset
+        template <typename T>
+        void add(std::string& out, SectionRef& ref, const std::vector<T>& records)
+        {
+            add(out, ref, records.data(), records.size() * sizeof(T));
+        }
+
+        void add(std::string& out, SectionRef& ref, const void* data, std::size_t size)
+        {
+            out.resize((out.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT, '\0');
+
+            ref.offset = out.size();
+            ref.size = size;
+
+            out.append((const char*)data, size);
+        }
+    };
+}
+
+bool Bundle::write(const std::string& path, const ProgramImage& image, const LineDatabase& db, std::string& error)
+{
+    const LinkedProgram& linked = image.linked;
+    BundleWriter writer;
+
+    // -- the program's strings come first, so string operands index the pool directly --
+    for (std::size_t i = 0; i < linked.strings.size(); i++)
+    {
+        writer.intern(linked.strings[i]);
+    }
+
+    std::vector<std::int32_t> sortedStrings(linked.strings.size());
+
+    for (std::size_t i = 0; i < sortedStrings.size(); i++)
+    {
+        sortedStrings[i] = (std::int32_t)i;
+    }
+
+    std::sort(sortedStrings.begin(), sortedStrings.end(), [&linked](std::int32_t a, std::int32_t b) { return linked.strings[a] < linked.strings[b]; });
+
+    std::vector<ValueRecord> constants;
+
+    for (const Value& constant : linked.constants)
+    {
+        constants.push_back(writer.record(constant));
+    }
+
+    std::vector<NodeRecord> nodes;
+    std::vector<LinkedProgram::Instruction> code;
+    std::vector<LinkedProgram::Label> labels;
+
+    for (const LinkedProgram::Node& node : linked.nodes)
+    {
+        nodes.push_back({ writer.intern(node.source->name()), (std::uint32_t)code.size(), (std::uint32_t)node.code.size(), (std::uint32_t)labels.size(), (std::uint32_t)node.labels.size() });
+
+        code.insert(code.end(), node.code.begin(), node.code.end());
+        labels.insert(labels.end(), node.labels.begin(), node.labels.end());
+    }
+
+    std::vector<std::uint32_t> functions;
+
+    for (const std::string& name : linked.functionNames)
+    {
+        functions.push_back(writer.intern(name));
+    }
+
+    std::vector<VariableRecord> variables;
+
+    for (std::size_t slot = 0; slot < linked.variableNames.size(); slot++)
+    {
+        variables.push_back({ writer.intern(linked.variableNames[slot]), writer.record(linked.initialValues[slot]) });
+    }
+
+    // -- the nodes' names, tags and headers, without the code the bundle already holds lowered --
+    Yarn::Program metadata = image.program;
+    metadata.clear_initial_values();
+
+    for (auto& [name, node] : *metadata.mutable_nodes())
+    {
+        node.clear_instructions();
+        node.clear_labels();
+    }
+
+    std::string nodeMetadata;
+
+    {
+        google::protobuf::io::StringOutputStream stream(&nodeMetadata);
+        google::protobuf::io::CodedOutputStream coded(&stream);
+        coded.SetSerializationDeterministic(true);
+        metadata.SerializeToCodedStream(&coded);
+    }
+
+    // -- lines, in id order for the binary search.  Ids that only have tags are lines without text in the database too --
+    std::vector<LineData> sortedLines;
+    sortedLines.reserve(db.size());
+
+    for (std::size_t i = 0; i < db.size(); i++)
+    {
+        sortedLines.push_back(db.line(i));
+    }
+
+    std::sort(sortedLines.begin(), sortedLines.end(), [](const LineData& a, const LineData& b) { return a.id < b.id; });
+
+    std::vector<LineRecord> lines;
+    std::vector<std::uint32_t> tags;
+
+    for (const LineData& line : sortedLines)
+    {
+        LineRecord record = { writer.intern(line.id), writer.intern(line.text), writer.intern(line.file), writer.intern(line.node), line.lineNumber, (std::uint32_t)tags.size(), 0, 0 };
+
+        std::vector<std::string_view> sortedTags;
+
+        for (std::size_t tag = 0; tag < line.tags.size(); tag++)
+        {
+            sortedTags.push_back(line.tags[tag]);
+        }
+
+        std::sort(sortedTags.begin(), sortedTags.end());
+
+        for (std::string_view tag : sortedTags)
+        {
+            tags.push_back(writer.intern(tag));
+        }
+
+        record.tagCount = (std::uint32_t)sortedTags.size();
+
+        lines.push_back(record);
+    }
+
+    if ((writer.stringData.size() > std::numeric_limits<std::uint32_t>::max()) || (code.size() > std::numeric_limits<std::uint32_t>::max()))
+    {
+        error = path + " : the module is too large for a bundle";
+        return false;
+    }
+
+    // -- layout --
+    BundleHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.instructionSize = sizeof(LinkedProgram::Instruction);
+    header.opcodeCount = LinkedProgram::OPCODE_COUNT;
+    header.programStringCount = (std::uint32_t)linked.strings.size();
+    header.fingerprint = linked.fingerprint();
+
+    std::string out(sizeof(BundleHeader), '\0');
+
+    writer.add(out, header.sections[STRINGS], writer.strings);
+    writer.add(out, header.sections[STRING_DATA], writer.stringData.data(), writer.stringData.size());
+    writer.add(out, header.sections[SORTED_STRINGS], sortedStrings);
+    writer.add(out, header.sections[CONSTANTS], constants);
+    writer.add(out, header.sections[NODES], nodes);
+    writer.add(out, header.sections[CODE], code);
+    writer.add(out, header.sections[LABELS], labels);
+    writer.add(out, header.sections[FUNCTIONS], functions);
+    writer.add(out, header.sections[VARIABLES], variables);
+    writer.add(out, header.sections[NODE_METADATA], nodeMetadata.data(), nodeMetadata.size());
+    writer.add(out, header.sections[LINES], lines);
+    writer.add(out, header.sections[TAGS], tags);
+
+    header.fileSize = out.size();
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::ofstream os(path, std::ios::binary | std::ios::out | std::ios::trunc);
+
+    if (!os.is_open() || !os.write(out.data(), (std::streamsize)out.size()))
+    {
+        error = "couldn't write " + path;
+        return false;
+    }
+
+    return true;
+}
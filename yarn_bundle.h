@@ -0,0 +1,183 @@
+#pragma once
+
+/**
+ * @file yarn_bundle.h
+ *
+ * @brief Single file binary Yarn modules, memory mapped and used in place
+ *
+ * Loading a module from its .yarnc, -Lines.csv and -Metadata.csv parses a protobuf, lowers every node, and parses two csv files into maps of strings.
+ * A .yarnbundle holds the result of all that : the lowered code, every pool the code indexes, and the line database, in one file laid out so that
+ * it's mapped into memory and read where it lies.  Loading one is a few checks and a pass over the section tables :
+ * - LinkedProgram::nodes point at the bundle's code and labels, and LinkedProgram::strings and string constants view its string pool
+ * - LineDatabase looks lines and tags up in the bundle's line table with a binary search, see LineDatabase::load(bundle)
+ * - only the nodes' names, tags and headers, which Yarn::Node carries for onChangeNode callbacks, still go through protobuf, without any instructions
+ *
+ * Usage :
+ * - yarnbundle path/to/dialogue, or Bundle::write() from a loaded module, writes path/to/dialogue.yarnbundle
+ * - runner.loadBundle("path/to/dialogue"), or vm.loadProgram("path/to/dialogue.yarnbundle") for just the program
+ *
+ * A bundle is tied to the instruction set and the byte order of the build that wrote it : open() refuses bundles written by another version,
+ * and checks every section, operand and jump target, so a truncated or mismatched file fails to load instead of crashing the VM.
+ * Bundles are cached with the other program images, by path, so saves made while running a bundle restore from it.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <yarn_mapped_file.h>
+#include <yarn_value.h>
+
+namespace Yarn
+{
+    struct ProgramImage;
+    struct LineDatabase;
+
+    /// the layout of a .yarnbundle.  Every field is in the byte order of the machine that wrote it, and every section starts on an ALIGNMENT boundary
+    namespace BundleFormat
+    {
+        constexpr char MAGIC[8] = { 'Y', 'A', 'R', 'N', 'B', 'N', 'D', 'L' };
+        constexpr std::uint32_t VERSION = 1;
+        constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+        constexpr std::size_t ALIGNMENT = 16;
+
+        enum Section : std::uint32_t
+        {
+            STRINGS,        ///< StringRef per string.  The first Header::programStringCount are LinkedProgram::strings, in order
+            STRING_DATA,    ///< the characters of every string, back to back
+            SORTED_STRINGS, ///< int32 index of every program string, in string order, see LinkedProgram::findString
+            CONSTANTS,      ///< ValueRecord per LinkedProgram::constants
+            NODES,          ///< NodeRecord per LinkedProgram::nodes
+            CODE,           ///< LinkedProgram::Instruction : the code of every node, back to back
+            LABELS,         ///< LinkedProgram::Label : the labels of every node, back to back
+            FUNCTIONS,      ///< uint32 string per LinkedProgram::functionNames
+            VARIABLES,      ///< VariableRecord per variable slot
+            NODE_METADATA,  ///< serialized Yarn::Program holding the nodes without their instructions and labels
+            LINES,          ///< LineRecord per line of the line database, in line id order
+            TAGS,           ///< uint32 string : the tags of every line, back to back
+            SECTION_COUNT
+        };
+
+        struct SectionRef
+        {
+            std::uint64_t offset;   ///< from the start of the file
+            std::uint64_t size;     ///< in bytes
+        };
+
+        struct Header
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byteOrder;            ///< BYTE_ORDER_MARK, as the machine that wrote the bundle stores it
+            std::uint32_t instructionSize;      ///< sizeof(LinkedProgram::Instruction)
+            std::uint32_t opcodeCount;          ///< LinkedProgram::OPCODE_COUNT of the build that wrote the bundle
+            std::uint32_t programStringCount;
+            std::uint32_t reserved;
+            std::uint64_t fingerprint;          ///< LinkedProgram::fingerprint() of the program, the same as when it's linked from its .yarnc
+            std::uint64_t fileSize;
+            SectionRef sections[SECTION_COUNT];
+        };
+
+        struct StringRef
+        {
+            std::uint32_t offset;   ///< into STRING_DATA
+            std::uint32_t size;
+        };
+
+        struct ValueRecord
+        {
+            std::uint32_t type;     ///< Value::Type
+            std::uint32_t value;    ///< float bits, bool, or string
+        };
+
+        struct NodeRecord
+        {
+            std::uint32_t name;             ///< string
+            std::uint32_t firstInstruction; ///< into CODE
+            std::uint32_t instructionCount;
+            std::uint32_t firstLabel;       ///< into LABELS
+            std::uint32_t labelCount;
+        };
+
+        struct VariableRecord
+        {
+            std::uint32_t name;         ///< string
+            ValueRecord initialValue;   ///< Value::NONE for variables the program doesn't declare
+        };
+
+        struct LineRecord
+        {
+            std::uint32_t id;       ///< string
+            std::uint32_t text;     ///< string
+            std::uint32_t file;     ///< string
+            std::uint32_t node;     ///< string
+            std::int32_t lineNumber;
+            std::uint32_t firstTag; ///< into TAGS
+            std::uint32_t tagCount;
+            std::uint32_t reserved;
+        };
+
+        static_assert(sizeof(Header) == 48 + SECTION_COUNT * sizeof(SectionRef), "the header has no padding");
+        static_assert(sizeof(LineRecord) == 32, "line records pack two to a cache line");
+    }
+
+    /// a mapped, checked .yarnbundle.  Immutable once opened, and shared by the program image and line databases that use it
+    class Bundle
+    {
+    public:
+
+        static constexpr std::string_view EXTENSION = ".yarnbundle";
+
+        /// map and check a bundle.  Returns nullptr and fills in error if the file can't be mapped or isn't a bundle this build can run
+        static std::shared_ptr<const Bundle> open(const std::string& path, std::string& error);
+
+        /// write the linked program of image and the lines and tags of db (those loaded from csv files) to path.
+        /// Returns false and fills in error if the file can't be written
+        static bool write(const std::string& path, const ProgramImage& image, const LineDatabase& db, std::string& error);
+
+        static bool isBundle(std::string_view path) { return path.ends_with(EXTENSION); } ///< whether path has the bundle extension
+
+        const BundleFormat::Header& header() const { return *(const BundleFormat::Header*)file.data(); }
+
+        const std::string& path() const { return filePath; }
+
+        /// the records of a section.  Checked against T's size when the bundle is opened
+        template <typename T>
+        std::span<const T> section(BundleFormat::Section s) const
+        {
+            const BundleFormat::SectionRef& ref = header().sections[s];
+            return std::span<const T>((const T*)(file.data() + ref.offset), (std::size_t)(ref.size / sizeof(T)));
+        }
+
+        std::string_view string(std::uint32_t index) const
+        {
+            const BundleFormat::StringRef& ref = strings[index];
+            return stringData.substr(ref.offset, ref.size);
+        }
+
+        /// a value whose string, if any, views the string pool
+        Value value(const BundleFormat::ValueRecord& record) const;
+
+        std::size_t lineCount() const { return lines.size(); }
+
+        const BundleFormat::LineRecord& line(std::size_t index) const { return lines[index]; } ///< in line id order
+
+        const BundleFormat::LineRecord* findLine(std::string_view id) const; ///< nullptr if there's no line with that id
+
+        std::span<const std::uint32_t> tags(const BundleFormat::LineRecord& line) const { return tagStrings.subspan(line.firstTag, line.tagCount); }
+
+    private:
+
+        bool validate(std::string& error);
+
+        MappedFile file;
+        std::string filePath;
+
+        std::span<const BundleFormat::StringRef> strings;
+        std::string_view stringData;
+        std::span<const BundleFormat::LineRecord> lines;
+        std::span<const std::uint32_t> tagStrings;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+ * @file yarn_compiled.h
+ *
+ * @brief Runtime support for programs compiled ahead of time to C++ by yarn2cpp
+ *
+ * yarn2cpp turns every node of a linked .yarnc into a C++ function : jumps become gotos, built in operators become inline arithmetic,
+ * and constants and variable slots become literals.  Lines, commands, options, function calls and node changes still go through the interpreter,
+ * one instruction at a time, so callbacks, the event ring and errors behave exactly as they do for interpreted code.
+ *
+ * Usage :
+ * - yarn2cpp dialogue.yarnc dialogue.cpp dialogue, or yarn_compile_to_cpp(target dialogue.yarnc dialogue) in CMake, and build dialogue.cpp into the game
+ * - declare the program with extern const Yarn::CompiledProgram dialogue;
+ * - load dialogue.yarnc as usual, then call vm.useCompiled(dialogue).  If the .yarnc changed since it was compiled, useCompiled() raises an error and the VM keeps interpreting
+ * - the VM keeps the compiled nodes until it loads a different program, so fromJS() with the same .yarnc still runs them
+ *
+ * Generated code works on the VM's own state : the variable stack, the variable slots, and an instruction pointer that counts the same lowered instructions the interpreter does.
+ * Saves made with toJS() load into interpreted and compiled VMs alike, runFor() budgets count the same instructions, and a compiled node can stop and resume at any instruction.
+ */
+
+#include <cstdint>
+
+#include <yarn_vm.h>
+
+namespace Yarn
+{
+    /// every node of one program, as generated by yarn2cpp
+    struct CompiledProgram
+    {
+        const char* yarncFile;              ///< the file the program was compiled from, for error messages
+        std::uint64_t fingerprint;          ///< LinkedProgram::fingerprint() of the program it was compiled from
+        std::size_t nodeCount;
+        const YarnVM::CompiledNode* nodes;  ///< in the order of LinkedProgram::nodes
+    };
+
+    namespace Compiled
+    {
+        /// whether JUMP_IF_FALSE falls through
+        inline bool truthy(const Yarn::Value& value)
+        {
+            return value.has_string_value() || (value.has_bool_value() && value.bool_value()) || (value.has_float_value() && (value.float_value() != 0.f));
+        }
+
+        /// run the instruction at the instruction pointer in the interpreter.  It has already been taken from remaining, which gets it back if the instruction didn't run.
+        /// returns true, with the reason, if the VM yielded
+        inline bool interpretOne(YarnVM& vm, std::size_t& remaining, YarnVM::YieldReason& reason)
+        {
+            std::size_t one = 1;
+            reason = vm.interpret(one);
+            remaining += one;
+
+            return reason != YarnVM::YIELD_BUDGET_EXHAUSTED;
+        }
+
+        /// writes what's left of the budget back to the caller on the way out of a generated node, exceptions included
+        struct ReturnBudget
+        {
+            std::size_t& budget;
+            const std::size_t& remaining;
+
+            ~ReturnBudget() { budget = remaining; }
+        };
+    }
+}
+
+// -- building blocks of the code yarn2cpp generates.  Not for hand written code --
+
+/// locals of a generated node : what's left of the budget, the stack, the program's constants, and the node being run
+#define YARN_COMPILED_ENTER() \
+    std::size_t remaining = budget; \
+    Yarn::Compiled::ReturnBudget returnBudget{budget, remaining}; \
+    [[maybe_unused]] Yarn::YarnVM::Stack& stack = vm.variableStack; \
+    [[maybe_unused]] const std::vector<Yarn::Value>& constants = vm.image->linked.constants; \
+    const Yarn::Node* const node = vm.currentNode
+
+/// start of instruction k : every instruction takes one from the budget, and yields before it runs if there's none left
+#define YARN_COMPILED_BUDGET(k) \
+    if (!remaining) { vm.instructionPointer = k; reason = Yarn::YarnVM::YIELD_BUDGET_EXHAUSTED; return true; } \
+    remaining--
+
+/// run instruction k in the interpreter, then carry on in the generated code wherever the instruction left the VM
+#define YARN_COMPILED_INTERPRET(k) \
+    vm.instructionPointer = k; \
+    if (Yarn::Compiled::interpretOne(vm, remaining, reason)) return true; \
+    if (vm.currentNode != node) return false; \
+    if (vm.instructionPointer != k + 1) goto dispatch
@@ -0,0 +1,72 @@
+#include <yarn_coroutine.h>
+
+using namespace Yarn;
+
+bool Dialogue::next()
+{
+    if (done())
+    {
+        return false;
+    }
+
+    coroutine.resume();
+
+    if (coroutine.promise().exception)
+    {
+        std::rethrow_exception(std::exchange(coroutine.promise().exception, nullptr));
+    }
+
+    return !coroutine.done();
+}
+
+void Dialogue::select(int option)
+{
+    coroutine.promise().vm.selectOption(option);
+}
+
+void Dialogue::advanceTime(long long dt)
+{
+    coroutine.promise().vm.incrementTime(dt);
+}
+
+void Dialogue::destroy()
+{
+    if (coroutine)
+    {
+        coroutine.destroy();
+        coroutine = nullptr;
+    }
+}
+
+Dialogue Yarn::runDialogue(YarnVM& vm)
+{
+    for (;;)
+    {
+        switch (vm.run())
+        {
+        case YarnVM::YIELD_LINE:
+            co_yield DialogueEvent{DialogueEvent::LINE, &vm.currentLine, {}, nullptr, 0};
+            break;
+        case YarnVM::YIELD_COMMAND:
+            if (vm.handleWaitCommand(vm.currentCommand))
+            {
+                break;
+            }
+
+            co_yield DialogueEvent{DialogueEvent::COMMAND, nullptr, vm.currentCommand, nullptr, 0};
+            break;
+        case YarnVM::YIELD_OPTIONS:
+            co_yield DialogueEvent{DialogueEvent::OPTIONS, nullptr, {}, &vm.currentOptionsList, 0};
+            break;
+        case YarnVM::YIELD_WAIT:
+            co_yield DialogueEvent{DialogueEvent::WAIT, nullptr, {}, nullptr, vm.waitUntilTime};
+            break;
+        case YarnVM::YIELD_STOPPED:
+            co_yield DialogueEvent{DialogueEvent::STOP, nullptr, {}, nullptr, 0};
+            co_return;
+        case YarnVM::YIELD_BUDGET_EXHAUSTED:
+        case YarnVM::YIELD_EVENTS_FULL:
+            break;
+        }
+    }
+}
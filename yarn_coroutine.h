@@ -0,0 +1,138 @@
+#pragma once
+
+/**
+ * @file yarn_coroutine.h
+ *
+ * @brief C++20 coroutine front end for YarnVM : the dialogue as a generator of DialogueEvents
+ *
+ * Instead of implementing YarnCallbacks and pumping the VM from a separate loop, async game code can pull events out of a Dialogue :
+ *
+ *     Yarn::Dialogue dialogue = Yarn::runDialogue(vm);
+ *
+ *     while (dialogue.next())
+ *     {
+ *         const Yarn::DialogueEvent& event = dialogue.event();
+ *
+ *         switch (event.type)
+ *         {
+ *         case Yarn::DialogueEvent::LINE: ... show event.line ... break;
+ *         case Yarn::DialogueEvent::OPTIONS: ... dialogue.select(choice) ... break;
+ *         case Yarn::DialogueEvent::WAIT: ... dialogue.advanceTime(dt) ... break;
+ *         ...
+ *         }
+ *     }
+ *
+ * or, from inside a coroutine of the host's own, const Yarn::DialogueEvent* event = co_await dialogue;
+ *
+ * The coroutine runs the VM with run(), so it executes in one contiguous loop and only suspends when there's an event for the host.
+ * The VM should have no callbacks set; the events carry everything the callbacks would have been given.
+ * The built in "wait <time>" command is handled by the coroutine, and shows up as WAIT events until the host has advanced the VM's time past the wait.
+ * Options are yielded again each time the coroutine is resumed until the host selects one.
+ */
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include <yarn_vm.h>
+
+namespace Yarn
+{
+    /// what the dialogue is waiting on the host for.  Views the VM's state, valid until the dialogue is resumed
+    struct DialogueEvent
+    {
+        enum Type { LINE, COMMAND, OPTIONS, WAIT, STOP };
+
+        Type type = STOP;
+        const YarnVM::Line* line = nullptr;             ///< LINE
+        std::string_view command;                       ///< COMMAND
+        const YarnVM::OptionsList* options = nullptr;   ///< OPTIONS : answer with Dialogue::select()
+        long long waitUntil = 0;                        ///< WAIT : VM time the wait is over.  Advance it with Dialogue::advanceTime()
+    };
+
+    /// generator of DialogueEvents, see runDialogue().  Move only, destroys the coroutine with it
+    class Dialogue
+    {
+    public:
+
+        struct promise_type
+        {
+            YarnVM& vm;
+            DialogueEvent current;
+            std::exception_ptr exception;
+
+            explicit promise_type(YarnVM& vm) : vm(vm) {} ///< takes runDialogue's argument
+
+            Dialogue get_return_object() { return Dialogue(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+
+            std::suspend_always yield_value(const DialogueEvent& event) noexcept
+            {
+                current = event;
+                return {};
+            }
+
+            void return_void() {}
+
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        Dialogue(Dialogue&& other) noexcept : coroutine(std::exchange(other.coroutine, nullptr)) {}
+
+        Dialogue& operator=(Dialogue&& other) noexcept
+        {
+            if (this != &other)
+            {
+                destroy();
+                coroutine = std::exchange(other.coroutine, nullptr);
+            }
+
+            return *this;
+        }
+
+        Dialogue(const Dialogue&) = delete;
+        Dialogue& operator=(const Dialogue&) = delete;
+
+        ~Dialogue() { destroy(); }
+
+        /// run the VM until the next event.  Returns false once the dialogue is over, after its STOP event.
+        /// Rethrows runtime errors thrown by the VM
+        bool next();
+
+        const DialogueEvent& event() const { return coroutine.promise().current; } ///< the event returned by the last next()
+
+        bool done() const { return !coroutine || coroutine.done(); }
+
+        void select(int option); ///< answer an OPTIONS event.  The dialogue carries on at the next call to next()
+
+        void advanceTime(long long dt); ///< move the VM's time along, eg. while it's waiting
+
+        /// for host coroutines : co_await dialogue runs to the next event without suspending the caller, and returns it, or nullptr once the dialogue is over
+        auto operator co_await()
+        {
+            struct Awaiter
+            {
+                Dialogue& dialogue;
+
+                bool await_ready() const noexcept { return true; }
+                void await_suspend(std::coroutine_handle<>) const noexcept {}
+                const DialogueEvent* await_resume() { return dialogue.next() ? &dialogue.event() : nullptr; }
+            };
+
+            return Awaiter{*this};
+        }
+
+    private:
+
+        std::coroutine_handle<promise_type> coroutine;
+
+        explicit Dialogue(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+        void destroy();
+    };
+
+    /// run the node the VM has loaded as a coroutine.  The VM must outlive the Dialogue
+    Dialogue runDialogue(YarnVM& vm);
+}
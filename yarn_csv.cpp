@@ -0,0 +1,229 @@
+#include <yarn_csv.h>
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define YARN_CSV_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define YARN_CSV_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace Yarn;
+
+namespace
+{
+    /// the first ',', '"', '\n' or '\r' in [p, end), or end
+    const char* findSpecial(const char* p, const char* end)
+    {
+#if defined(YARN_CSV_SSE2)
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+
+        for (; end - p >= 16; p += 16)
+        {
+            const __m128i block = _mm_loadu_si128((const __m128i*)p);
+            const __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, comma), _mm_cmpeq_epi8(block, quote)),
+                                              _mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr)));
+
+            const unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+
+            if (mask)
+            {
+                return p + std::countr_zero(mask);
+            }
+        }
+#elif defined(YARN_CSV_NEON)
+        const uint8x16_t comma = vdupq_n_u8(',');
+        const uint8x16_t quote = vdupq_n_u8('"');
+        const uint8x16_t lf = vdupq_n_u8('\n');
+        const uint8x16_t cr = vdupq_n_u8('\r');
+
+        for (; end - p >= 16; p += 16)
+        {
+            const uint8x16_t block = vld1q_u8((const std::uint8_t*)p);
+            const uint8x16_t hits = vorrq_u8(vorrq_u8(vceqq_u8(block, comma), vceqq_u8(block, quote)), vorrq_u8(vceqq_u8(block, lf), vceqq_u8(block, cr)));
+
+            // NEON has no movemask : narrowing each 16 bit lane by 4 leaves a nibble per byte
+            const std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+
+            if (mask)
+            {
+                return p + (std::countr_zero(mask) >> 2);
+            }
+        }
+#endif
+
+        for (; p < end; p++)
+        {
+            const char c = *p;
+
+            if ((c == ',') || (c == '"') || (c == '\n') || (c == '\r'))
+            {
+                return p;
+            }
+        }
+
+        return end;
+    }
+}
+
+CsvScanner::CsvScanner(std::string_view text)
+    : position(text.data()), end(text.data() + text.size())
+{
+    static constexpr std::string_view BOM = "\xEF\xBB\xBF";
+
+    if (text.starts_with(BOM))
+    {
+        position += BOM.size();
+    }
+}
+
+bool CsvScanner::vectorized()
+{
+#if defined(YARN_CSV_SSE2) || defined(YARN_CSV_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool CsvScanner::next(std::vector<std::string_view>& fields)
+{
+    while (position < end)
+    {
+        pending.clear();
+        scratch.clear();
+
+        for (;;)
+        {
+            if (*position == '"')
+            {
+                position++;
+                quoted();
+            }
+            else
+            {
+                const char* start = position;
+
+                // a quote inside an unquoted field is just a character
+                for (;;)
+                {
+                    position = findSpecial(position, end);
+
+                    if ((position == end) || (*position != '"'))
+                    {
+                        break;
+                    }
+
+                    position++;
+                }
+
+                pending.push_back({ start, 0, (std::size_t)(position - start) });
+            }
+
+            if ((position == end) || (*position != ','))
+            {
+                break;
+            }
+
+            position++;
+
+            if (position == end)
+            {
+                // a trailing comma ends the text with an empty field
+                pending.push_back({ position, 0, 0 });
+                break;
+            }
+        }
+
+        // \n, \r\n or a lone \r end the record
+        if ((position < end) && (*position == '\r'))
+        {
+            position++;
+        }
+
+        if ((position < end) && (*position == '\n'))
+        {
+            position++;
+        }
+
+        if ((pending.size() == 1) && (pending[0].size == 0))
+        {
+            continue;
+        }
+
+        fields.clear();
+
+        for (const Field& field : pending)
+        {
+            fields.push_back(field.text ? std::string_view(field.text, field.size) : std::string_view(scratch.data() + field.offset, field.size));
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void CsvScanner::quoted()
+{
+    Field field = { position, 0, 0 };
+
+    const char* segment = position; // start of the text not yet in the field, once it's copied to scratch
+
+    auto copy = [&](const char* until)
+    {
+        if (field.text)
+        {
+            field.offset = scratch.size();
+            segment = field.text;
+            field.text = nullptr;
+        }
+
+        scratch.append(segment, until - segment);
+    };
+
+    for (;;)
+    {
+        const char* quote = (const char*)std::memchr(position, '"', end - position);
+
+        if (quote && (quote + 1 < end) && (quote[1] == '"'))
+        {
+            // a doubled quote : keep one
+            copy(quote + 1);
+            position = segment = quote + 2;
+            continue;
+        }
+
+        if (quote && (quote + 1 < end) && (quote[1] != ',') && (quote[1] != '\n') && (quote[1] != '\r'))
+        {
+            // a quote that isn't followed by the end of the field is kept, and the field goes on, as the generic reader (csv.hpp) does
+            position = quote + 1;
+            continue;
+        }
+
+        // an unterminated field runs to the end of the text
+        const char* close = quote ? quote : end;
+
+        if (field.text)
+        {
+            field.size = close - field.text;
+        }
+        else
+        {
+            copy(close);
+            field.size = scratch.size() - field.offset;
+        }
+
+        position = quote ? quote + 1 : end;
+        break;
+    }
+
+    pending.push_back(field);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/**
+ * @file yarn_csv.h
+ *
+ * @brief Record by record scanner for the csv files the Yarn compiler writes
+ *
+ * The -Lines.csv and -Metadata.csv files have a fixed layout : a header row, then one record per line, comma separated, with fields that contain commas,
+ * quotes or line breaks quoted and their quotes doubled.  So rather than a general csv parser, which guesses the layout, converts every field and copies
+ * it into a row object, CsvScanner walks the text once and hands out each record's fields as string_views of the text itself.  Only quoted fields with
+ * doubled quotes in them are copied, to undo the doubling.  Stray quotes are read the way the generic reader (depends/csv.hpp) reads them, and only
+ * empty lines, which it turns into records of one empty field, are read differently.
+ *
+ * The scan for the end of a field looks at 16 bytes at a time with SSE2 on x86 and NEON on ARM64, and a byte at a time elsewhere.
+ * Quoted fields are scanned with memchr, which the C library already vectorizes.
+ *
+ * See LineDatabase::loadLines and LineDatabase::loadMetadata
+ */
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Yarn
+{
+    class CsvScanner
+    {
+    public:
+
+        explicit CsvScanner(std::string_view text); ///< text must outlive the scanner.  A UTF-8 byte order mark is skipped
+
+        /// the fields of the next record, skipping empty lines.  Returns false at the end of the text.
+        /// The fields view the text, or the scanner for fields that had doubled quotes, and are valid until the next call
+        bool next(std::vector<std::string_view>& fields);
+
+        static bool vectorized(); ///< whether the field scan was built with SSE2 or NEON
+
+    private:
+
+        /// a field, before the record is complete and the scratch buffer has stopped moving
+        struct Field
+        {
+            const char* text;   ///< nullptr for fields in scratch
+            std::size_t offset; ///< into scratch
+            std::size_t size;
+        };
+
+        const char* position;
+        const char* end;
+
+        std::vector<Field> pending;
+        std::string scratch; ///< unescaped quoted fields of the current record
+
+        void quoted(); ///< scan a quoted field, position is past the opening quote
+    };
+}
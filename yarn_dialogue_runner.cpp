@@ -2,6 +2,10 @@
 #include <json.hpp>
 #endif
 
+#include <algorithm>
+#include <charconv>
+#include <thread>
+
 #include <yarn_dialogue_runner.h>
 #include <yarn_markup.h>
 #include <yarn_spinner.pb.h>
@@ -51,12 +55,12 @@ const std::string& Yarn::YarnRunnerBase::findValue(const Yarn::Markup::Attribute
 
 void Yarn::YarnRunnerBase::setAttribCallbacks()
 {
-    this->markupCallbacks["nomarkup"] = [this](const std::string_view& line, const Yarn::Markup::Attribute& attrib)
+    this->markupCallbacks["nomarkup"] = [this](const std::string_view& /*line*/, const Yarn::Markup::Attribute& attrib)
     {
         this->setts.nomarkup = attrib.type == Yarn::Markup::Attribute::OPEN;
     };
 
-    this->markupCallbacks["select"] = [this](const std::string_view& line, const Yarn::Markup::Attribute& attrib)
+    this->markupCallbacks["select"] = [this](const std::string_view& /*line*/, const Yarn::Markup::Attribute& attrib)
     {
         const std::string& value = findValue(attrib);
 
@@ -84,7 +88,7 @@ void Yarn::YarnRunnerBase::setAttribCallbacks()
         }
     };
 
-    this->markupCallbacks["plural"] = [this](const std::string_view& line, const Yarn::Markup::Attribute& attrib)
+    this->markupCallbacks["plural"] = [this](const std::string_view& /*line*/, const Yarn::Markup::Attribute& attrib)
     {
         const std::string& value = findValue(attrib);
 
@@ -100,7 +104,7 @@ void Yarn::YarnRunnerBase::setAttribCallbacks()
         }
     };
 
-    this->markupCallbacks["ordinal"] = [this](const std::string_view& line, const Yarn::Markup::Attribute& attrib)
+    this->markupCallbacks["ordinal"] = [this](const std::string_view& /*line*/, const Yarn::Markup::Attribute& attrib)
     {
         const std::string& value = findValue(attrib);
 
@@ -242,12 +246,12 @@ std::string make_substitutions(const std::string_view& sv, const std::vector<Yar
         {
             int arg = -1;
             i++;
-            std::istringstream is(sv.data() + i);
-            is >> arg;
 
-            while (isdigit(sv[i]))i++;
+            // parsed within the view : a bundle's line text isn't null terminated
+            const char* end = std::from_chars(sv.data() + i, sv.data() + sv.size(), arg).ptr;
+            i = (int)(end - sv.data());
 
-            assert(sv[i] == '}');
+            assert(i < sv.size() && sv[i] == '}');
 
             const auto& sub = substitutions[subsRemaining - arg - 1];
 
@@ -285,27 +289,147 @@ void Yarn::YarnRunnerBase::loadModule(const std::string& mod, const std::string&
 
     loadModuleLineDB(mod);
     vm.loadProgram(yarncFile);
+    linkLines();
+    loadStartNode(startNode);
+}
 
-    // find the start node
-    auto it = vm.program.nodes().begin();
-    if ((it = vm.program.nodes().find(startNode)) != vm.program.nodes().end())
+std::future<void> Yarn::YarnRunnerBase::loadModuleAsync(const std::string& mod, const std::string& startNode)
+{
+    return std::async(std::launch::async, [this, mod, startNode]()
     {
-        const Yarn::Node& startnode = it->second;
+        const std::string yarncFile = mod + ".yarnc";
+        const std::string linesCSV = mod + "-Lines.csv";
+        const std::string metaCSV = mod + "-Metadata.csv";
 
-        vm.loadNode(startNode);
+        std::future<std::shared_ptr<const Yarn::ProgramImage>> program = std::async(std::launch::async, [yarncFile]()
+        {
+            std::string error;
+            std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(yarncFile, error);
+
+            if (!image)
+            {
+                throw YarnException("loadModuleAsync() failure : " + error);
+            }
+
+            return image;
+        });
+
+        // the module's lines are gathered apart from db, which stays untouched until everything has loaded
+        Yarn::LineDatabase parsed;
+        const std::string cacheFile = Yarn::LineDatabase::cachePath(linesCSV);
+
+        if (!setts.cacheLineDatabase || !parsed.loadBinary(cacheFile, linesCSV, metaCSV))
+        {
+            // the metadata's tags go in a database of their own, merged in once the lines are parsed.  The merge costs about a third of parsing
+            // the metadata, so it's only worth it with a core to spare for each of the three parses
+            if (std::thread::hardware_concurrency() >= 3)
+            {
+                // if loadLines throws, destroying tags waits for the parse before metadata goes
+                Yarn::LineDatabase metadata;
+                std::future<void> tags = std::async(std::launch::async, [&metadata, &metaCSV]() { metadata.loadMetadata(metaCSV); });
+
+                parsed.loadLines(linesCSV);
+                tags.get();
+                parsed.merge(std::move(metadata));
+            }
+            else
+            {
+                parsed.loadLines(linesCSV);
+                parsed.loadMetadata(metaCSV);
+            }
+
+            if (setts.cacheLineDatabase)
+            {
+                parsed.saveBinary(cacheFile, linesCSV, metaCSV);
+            }
+        }
+
+        std::shared_ptr<const Yarn::ProgramImage> image = program.get();
+
+        // lines the program runs that neither the module nor db has would make linkLines() throw with the runner half changed, so check first
+        if (setts.missingLinesAreErrors)
+        {
+            std::vector<std::string_view> missing;
+            parsed.link(image->linked, missing);
+
+            std::erase_if(missing, [this](std::string_view id) { return db.findLine(id) != Yarn::LineDatabase::NOT_FOUND; });
+
+            if (!missing.empty())
+            {
+                throw YarnException(mod + " : " + std::to_string(missing.size()) + " line(s) missing from the line database, the first is " + std::string(missing.front()));
+            }
+        }
+
+        // -- everything's loaded and checked, nothing below reads a file --
+        moduleName = mod;
+
+        db.merge(std::move(parsed));
+
+#if _DEBUG
+        std::cout << "Loading lines from : " << linesCSV << std::endl;
+        std::cout << "Line database total lines : " << db.lineCount() << std::endl;
+        std::cout << "Line database size (bytes) : " << db.sizeBytes() << std::endl;
+        std::cout << "Time spent in parsing (ms) : " << db.parsingTime << std::endl;
+#endif
+
+        vm.loadProgram(std::move(image));
+        linkLines();
+        loadStartNode(startNode);
+    });
+}
+
+void Yarn::YarnRunnerBase::loadModuleFromMemory(const Yarn::EmbeddedModule& module, const std::string& startNode)
+{
+    moduleName = std::string(module.name);
+
+    db.load(module);
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(moduleName + ".yarnc", module.yarnc, module.yarncSize, error);
+
+    if (!image)
+    {
+        throw YarnException("loadModuleFromMemory() failure : " + error);
     }
+
+    vm.loadProgram(std::move(image));
+    linkLines();
+    loadStartNode(startNode);
+}
+
+void Yarn::YarnRunnerBase::loadBundle(const std::string& module, const std::string& startNode)
+{
+    moduleName = module;
+
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(moduleName + std::string(Yarn::Bundle::EXTENSION), error);
+
+    if (!image)
+    {
+        throw YarnException("loadBundle() failure : " + error);
+    }
+
+    // the image maps the bundle, and the line database shares the mapping
+    db.load(image->bundle);
+
+    vm.loadProgram(std::move(image));
+    linkLines();
+    loadStartNode(startNode);
 }
 
 void Yarn::YarnRunnerBase::onRunLine(const Yarn::YarnVM::Line& line)
 {
+    // lines of a linked program are looked up by index.  The id is only hashed for lines the database didn't have at load time, or programs loaded behind the runner's back
+    const std::string_view text = (line.index != Yarn::LinkedProgram::UNRESOLVED) ? db.text((std::size_t)line.index) : db.text(line.id);
+
     std::string lineS;
     if (!line.substitutions.size())
     {
-        lineS = db.lines[line.id].text;
+        lineS = text;
     }
     else
     {
-        lineS = make_substitutions(db.lines[line.id].text, line.substitutions);
+        lineS = make_substitutions(text, line.substitutions);
     }
 
     if (setts.alwaysIgnoreMarkup)
@@ -320,9 +444,79 @@ void Yarn::YarnRunnerBase::onRunLine(const Yarn::YarnVM::Line& line)
     }
 }
 
-void Yarn::YarnRunnerBase::onRunCommand(const std::string& command)
+Yarn::YarnVM::YieldReason Yarn::YarnRunnerBase::update(long long deltaTime, std::size_t instructionBudget, std::chrono::nanoseconds timeBudget)
 {
-    this->commands.commandExecute(command, std::cout);
+    // the clock is only read between slices of this many instructions, and whenever the VM returns with a line or command
+    static constexpr std::size_t TIME_CHECK_INTERVAL = 4096;
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::uint64_t startInstructions = vm.instructionsExecuted;
+
+    vm.incrementTime(deltaTime);
+
+    Yarn::YarnVM::YieldReason reason = vm.runFor(0); // doesn't execute anything, just reports the state the VM is in
+
+    frameStats.budgetExhausted = false;
+
+    // options answered from inside the callback leave the VM running, so carry on for as long as it's running rather than stopping at the first yield
+    while (vm.runningState == Yarn::YarnVM::RUNNING)
+    {
+        const std::uint64_t used = vm.instructionsExecuted - startInstructions;
+
+        if (used >= instructionBudget || (std::chrono::steady_clock::now() - start) >= timeBudget)
+        {
+            frameStats.budgetExhausted = true;
+            reason = Yarn::YarnVM::YIELD_BUDGET_EXHAUSTED;
+            break;
+        }
+
+        reason = vm.runFor(std::min<std::size_t>(instructionBudget - used, TIME_CHECK_INTERVAL));
+
+        if (reason == Yarn::YarnVM::YIELD_EVENTS_FULL)
+        {
+            break;
+        }
+    }
+
+    frameStats.instructions = vm.instructionsExecuted - startInstructions;
+    frameStats.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    return reason;
+}
+
+void Yarn::YarnRunnerBase::onRunCommand(const std::string_view& command)
+{
+    this->commands.commandExecute(std::string(command), std::cout);
+}
+
+void Yarn::YarnRunnerBase::linkLines()
+{
+    std::vector<std::string_view> missing;
+
+    vm.lineIndices = db.link(vm.image->linked, missing);
+
+    missingLines.assign(missing.begin(), missing.end());
+
+#if _DEBUG
+    for (const std::string& id : missingLines)
+    {
+        std::cout << "Line missing from the line database : " << id << std::endl;
+    }
+#endif
+
+    if (setts.missingLinesAreErrors && !missingLines.empty())
+    {
+        throw YarnException(moduleName + " : " + std::to_string(missingLines.size()) + " line(s) missing from the line database, the first is " + missingLines.front());
+    }
+}
+
+void Yarn::YarnRunnerBase::loadStartNode(const std::string& startNode)
+{
+    // a module without the start node is still loaded, and the host picks a node itself
+    if (vm.image->linked.findNode(startNode) != Yarn::LinkedProgram::UNRESOLVED)
+    {
+        vm.loadNode(startNode);
+    }
 }
 
 void Yarn::YarnRunnerBase::loadModuleLineDB(const std::string& moduleName)
@@ -330,8 +524,15 @@ void Yarn::YarnRunnerBase::loadModuleLineDB(const std::string& moduleName)
     const std::string testLinesCSV = moduleName + "-Lines.csv";
     const std::string testMetaCSV = moduleName + "-Metadata.csv";
 
-    db.loadLines(testLinesCSV);
-    db.loadMetadata(testMetaCSV);
+    if (setts.cacheLineDatabase)
+    {
+        db.loadCached(testLinesCSV, testMetaCSV);
+    }
+    else
+    {
+        db.loadLines(testLinesCSV);
+        db.loadMetadata(testMetaCSV);
+    }
 
 #if _DEBUG
     std::cout << "Loading lines from : " << testLinesCSV << std::endl;
@@ -369,7 +570,29 @@ void Yarn::YarnRunnerBase::restore(const std::string& restoreFile)
 
     nlohmann::json js = nlohmann::json::parse(inJS);
 
-    loadModuleLineDB(js["moduleName"].get<std::string>());
+    moduleName = js["moduleName"].get<std::string>();
+
+    // the line database is loaded and linked before fromJS, which presents the options of a save made while they were showing.
+    // fromJS reattaches to the image loaded here, keeping the line indices
+    std::string error;
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(js["vm"]["yarncFile"].get<std::string>(), error);
+
+    if (!image)
+    {
+        throw YarnException("restore() failure : " + error);
+    }
+
+    if (image->bundle)
+    {
+        db.load(image->bundle);
+    }
+    else
+    {
+        loadModuleLineDB(moduleName);
+    }
+
+    vm.loadProgram(std::move(image));
+    linkLines();
 
     vm.fromJS(js["vm"]);
 
@@ -16,7 +16,9 @@
  * add whatever markupCallbacks for markup processing you need beyond the built in ones by creating std::function AttribCallback's and
  * adding them to markupCallbacks lookup table
  *
- * At runtime, load a Yarn module by path/module name by calling loadModule()
+ * At runtime, load a Yarn module by path/module name by calling loadModule() or loadBundle(), or one embedded in the executable with loadModuleFromMemory()
+ * (loadModuleAsync() loads in the background, for a loading screen)
+ * then call update() once per frame to run the VM within a budget
  * (de)serialize with save / restore method
  *
  * This class handles creating the VM, loading the line database, parsing and executing commands, running lines, and more.
@@ -24,6 +26,8 @@
  * Access the vm member to add custom functions
  */
 
+#include <chrono>
+#include <future>
 #include <string>
 #include <yarn_vm.h>
 
@@ -40,6 +44,16 @@ namespace Yarn
             bool alwaysIgnoreMarkup = false;    ///< always ignore all markup and treat it as raw text
             bool nomarkup = false;              ///< is the built in nomarkup attribute toggled
             bool emitUnhandledMarkup = true;    ///< spits out markup with an unhandled / unknown attrib identifier as part of the line.  set to false to omit that text instead
+            bool cacheLineDatabase = true;      ///< loadModule keeps a binary copy of the line database next to the csv files, and reads it instead while they're unchanged.  See LineDatabase::loadCached
+            bool missingLinesAreErrors = false; ///< loading a module whose program runs lines the line database doesn't have throws, rather than only listing them in missingLines
+        };
+
+        /// what the last update() did
+        struct FrameStats
+        {
+            std::uint64_t instructions = 0;         ///< instructions executed
+            std::chrono::nanoseconds time{0};       ///< time spent running the VM, including the callbacks
+            bool budgetExhausted = false;           ///< the VM was still running when the budget ran out
         };
 
         const static std::string CLOSE_ALL_ATTRIB;
@@ -55,14 +69,18 @@ namespace Yarn
 
         std::string moduleName;
 
+        std::vector<std::string> missingLines; ///< ids of the lines the loaded program runs that the line database doesn't have.  They'd be shown blank
+
         Settings setts;
 
+        FrameStats frameStats;
+
         YarnRunnerBase();
 
         virtual void onReceiveText(const std::string_view& s, bool eol = false) = 0;
 
         void onRunLine(const Yarn::YarnVM::Line& line) override;
-        void onRunCommand(const std::string& command) override;
+        void onRunCommand(const std::string_view& command) override;
 
         void replace(const std::string& s, const std::string& repl, const char x = '%');
 
@@ -80,12 +98,32 @@ namespace Yarn
         /// as well as the line database and metadata which are stored in csv files
         void loadModule(const std::string& module, const std::string& startNode = "Start");
 
+        /// -- like loadModule, with the .yarnc, the lines and the metadata parsed at the same time on threads of their own (the lines and metadata on one
+        /// thread with fewer than 3 cores), and the results merged into the runner once they're all done, so the load takes about as long as the slowest of them.  Returns straight away, so a loading screen can keep
+        /// rendering : poll the future with wait_for(std::chrono::seconds(0)), and get() it once it's ready to rethrow anything that went wrong.
+        /// The runner belongs to the loading thread until the future is ready, including the onChangeNode callback for the start node, so don't touch it before.
+        /// The runner is left as it was if the program or the line database can't be read, or if lines are missing and setts.missingLinesAreErrors is set
+        std::future<void> loadModuleAsync(const std::string& module, const std::string& startNode = "Start");
+
+        /// -- like loadModule, for a module embedded in the executable by yarnembed (see yarn_embedded.h).  Doesn't touch the filesystem
+        void loadModuleFromMemory(const Yarn::EmbeddedModule& module, const std::string& startNode = "Start");
+
+        /// -- like loadModule, for a module converted to <module> + ".yarnbundle" by yarnbundle (see yarn_bundle.h).  The program and line database are used in place from the mapped file
+        void loadBundle(const std::string& module, const std::string& startNode = "Start");
+
         void processLine(const std::string_view& line, const Yarn::Markup::LineAttributes& attribs);
 
+        /// advance the VM's clock by deltaTime, then run it until it blocks (options, wait, stop) or has used up either budget.
+        /// The next update carries on exactly where this one stopped.  Returns why the VM last yielded, YIELD_BUDGET_EXHAUSTED if a budget ran out
+        Yarn::YarnVM::YieldReason update(long long deltaTime, std::size_t instructionBudget,
+                                         std::chrono::nanoseconds timeBudget = std::chrono::nanoseconds::max());
+
     private:
 
         void setAttribCallbacks(); // set built in attrib callbacks
         void loadModuleLineDB(const std::string& moduleName);
+        void linkLines(); // resolve the program's line ids to line database indices, once the program and the line database are both loaded
+        void loadStartNode(const std::string& startNode); // load the node the module starts at, if the program has it
         static const std::string& findValue(const Yarn::Markup::Attribute& attrib);
     };
 }
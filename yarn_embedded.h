@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * @file yarn_embedded.h
+ *
+ * @brief Yarn modules baked into the executable by yarnembed, so dialogue loads without touching the filesystem
+ *
+ * yarnembed reads a module's .yarnc, -Lines.csv and -Metadata.csv at build time and writes a header with :
+ * - the .yarnc as a byte array, parsed and linked from memory at load time
+ * - the line database and tags as static tables of already parsed fields, so no csv is parsed at load time
+ *
+ * Usage :
+ * - yarnembed path/to/dialogue dialogue.h dialogue, or yarn_embed_module(target path/to/dialogue dialogue) in CMake
+ * - #include "dialogue.h" and call runner.loadModuleFromMemory(dialogue)
+ *
+ * The program is cached under the module name + ".yarnc", like a program loaded from that file, so saves restore as long as the module is loaded.
+ */
+
+#include <cstddef>
+#include <string_view>
+
+namespace Yarn
+{
+    struct EmbeddedLine
+    {
+        std::string_view id;
+        std::string_view text;
+        std::string_view file;
+        std::string_view node;
+        int lineNumber = 0;
+    };
+
+    struct EmbeddedTag
+    {
+        std::string_view id; ///< line id
+        std::string_view tag;
+    };
+
+    struct EmbeddedModule
+    {
+        std::string_view name;              ///< module path as passed to yarnembed, eg. "test/test9"
+        const unsigned char* yarnc = nullptr;
+        std::size_t yarncSize = 0;
+        const EmbeddedLine* lines = nullptr;
+        std::size_t lineCount = 0;
+        const EmbeddedTag* tags = nullptr;
+        std::size_t tagCount = 0;
+    };
+}
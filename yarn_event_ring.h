@@ -0,0 +1,154 @@
+#pragma once
+
+/**
+ * @file yarn_event_ring.h
+ *
+ * @brief Fixed capacity ring buffer of POD VM events, a pull based alternative to YarnCallbacks
+ *
+ * Point YarnVM::eventRing at an EventRing and the VM writes a 16 byte VMEvent for every line, command, option, options prompt and stop,
+ * instead of calling the callbacks.  Substitutions are copied as Yarn::Values into a second ring, the value pool, and events refer to them by range.
+ * Nothing is allocated per event, and strings are referred to by their index in the program's string pool (image->linked.strings).
+ *
+ * The host drains events in batches with drain().  If the ring is full the VM doesn't run the instruction that would have written the event,
+ * and run() returns YIELD_EVENTS_FULL; running it again after a drain picks up where it left off.
+ *
+ * Options arrive as one OPTION event per option followed by an OPTIONS event, after which the VM is awaiting input : answer with YarnVM::selectOption(OPTION's index).
+ * Commands are only recorded, so a host using the built in "wait" command handles it where it runs the VM, from YarnVM::currentCommand after a YIELD_COMMAND.
+ * Options re-presented by fromJS() still only go to the callbacks.
+ *
+ * The ring is single producer, single consumer : the VM may run on one thread while another thread drains.
+ * Every other VM call (selectOption, setTime...) still has to be made on the VM's thread.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include <yarn_value.h>
+
+namespace Yarn
+{
+    struct VMEvent
+    {
+        enum Type : std::uint8_t { LINE, COMMAND, OPTION, OPTIONS, STOPPED };
+
+        Type type = STOPPED;
+        std::uint8_t enabled = 0;               ///< OPTION : whether the option's condition passed
+        std::uint16_t substitutionCount = 0;    ///< LINE, OPTION
+        std::int32_t string = -1;               ///< LINE, OPTION : line id.  COMMAND : command text.  Index into image->linked.strings
+        std::int32_t index = 0;                 ///< LINE : line database index, see YarnVM::Line::index.  OPTION : index to pass to selectOption().  OPTIONS : number of options
+        std::uint32_t firstSubstitution = 0;    ///< position of the event's first substitution in the value pool, see EventRing::substitution()
+    };
+
+    static_assert(sizeof(VMEvent) == 16, "events should stay 16 bytes so four fit in a cache line");
+    static_assert(std::is_trivially_copyable_v<VMEvent>, "events are copied around as plain memory");
+
+    class EventRing
+    {
+    public:
+
+        /// capacities are rounded up to powers of two.  The value pool must hold the most substitutions any one line or option has
+        explicit EventRing(std::size_t eventCapacity = 256, std::size_t valueCapacity = 1024)
+            : eventMask((std::uint32_t)roundUp(eventCapacity) - 1), valueMask((std::uint32_t)roundUp(valueCapacity) - 1),
+              events(new VMEvent[eventMask + 1]), values(new Yarn::Value[valueMask + 1])
+        {
+        }
+
+        EventRing(const EventRing&) = delete;
+        EventRing& operator=(const EventRing&) = delete;
+
+        // -- producer side, used by the VM --
+
+        /// is there room for one more event with this many substitutions
+        bool reserve(std::size_t substitutions) const
+        {
+            return (eventHead - eventsRead.load(std::memory_order_acquire) <= eventMask)
+                && ((std::uint32_t)(valueHead - valuesRead.load(std::memory_order_acquire)) + substitutions <= (std::size_t)valueMask + 1);
+        }
+
+        std::uint32_t nextValue() const { return valueHead; } ///< where the next pushValue() goes, for VMEvent::firstSubstitution
+
+        void pushValue(const Yarn::Value& value) { values[valueHead++ & valueMask] = value; } ///< not visible to the consumer until the event is published
+
+        void publish(const VMEvent& event)
+        {
+            events[eventHead & eventMask] = event;
+            eventsWritten.store(++eventHead, std::memory_order_release);
+        }
+
+        /// call f(const Yarn::Value&) for every substitution pushed and not drained yet.  The consumer only reads values, so the producer can too
+        template <typename F>
+        void forEachPendingValue(F&& f) const
+        {
+            for (std::uint32_t i = valuesRead.load(std::memory_order_acquire); i != valueHead; i++)
+            {
+                f(values[i & valueMask]);
+            }
+        }
+
+        // -- consumer side --
+
+        /// call f(const VMEvent&) for up to maxEvents published events, oldest first, then hand their space back to the producer.  Returns the number of events drained.
+        /// An event and its substitutions are only valid inside the call to f
+        template <typename F>
+        std::size_t drain(F&& f, std::size_t maxEvents = SIZE_MAX)
+        {
+            const std::uint32_t written = eventsWritten.load(std::memory_order_acquire);
+            std::uint32_t read = eventsRead.load(std::memory_order_relaxed);
+            std::uint32_t valuesEnd = valuesRead.load(std::memory_order_relaxed);
+            std::size_t count = 0;
+
+            while (read != written && count < maxEvents)
+            {
+                const VMEvent& event = events[read & eventMask];
+                f(event);
+
+                valuesEnd = event.firstSubstitution + event.substitutionCount;
+                read++;
+                count++;
+            }
+
+            valuesRead.store(valuesEnd, std::memory_order_release);
+            eventsRead.store(read, std::memory_order_release);
+
+            return count;
+        }
+
+        const Yarn::Value& substitution(const VMEvent& event, std::size_t i) const { return values[(event.firstSubstitution + i) & valueMask]; }
+
+        bool empty() const { return eventsWritten.load(std::memory_order_acquire) == eventsRead.load(std::memory_order_relaxed); }
+
+        std::size_t eventCapacity() const { return (std::size_t)eventMask + 1; }
+
+        std::size_t valueCapacity() const { return (std::size_t)valueMask + 1; }
+
+    private:
+
+        static std::size_t roundUp(std::size_t n)
+        {
+            std::size_t capacity = 1;
+
+            while (capacity < n)
+            {
+                capacity <<= 1;
+            }
+
+            return capacity;
+        }
+
+        const std::uint32_t eventMask;
+        const std::uint32_t valueMask;
+        const std::unique_ptr<VMEvent[]> events;
+        const std::unique_ptr<Yarn::Value[]> values;
+
+        // producer and consumer positions on separate cache lines.  Positions count up forever and wrap around, only their differences matter
+
+        alignas(64) std::uint32_t eventHead = 0;                ///< producer's copy of eventsWritten
+        std::uint32_t valueHead = 0;                            ///< producer only : values written
+        std::atomic<std::uint32_t> eventsWritten = 0;
+
+        alignas(64) std::atomic<std::uint32_t> eventsRead = 0;
+        std::atomic<std::uint32_t> valuesRead = 0;
+    };
+}
@@ -1,316 +1,650 @@
 #include <yarn_vm.h>
 #include <yarn_spinner.pb.h>
 
+#include <cmath>
+#include <iterator>
+
+// YARN_THREADED_DISPATCH (cmake option) selects the computed goto dispatch loop, which needs the labels as values extension of GCC and Clang.
+// Other compilers use the portable switch
+#if defined(YARN_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define YARN_COMPUTED_GOTO 1
+#else
+#define YARN_COMPUTED_GOTO 0
+#endif
+
 using namespace Yarn;
 
-void YarnVM::processInstruction(const Yarn::Instruction& instruction)
+namespace
 {
-    if (!currentNode)
-    {
-        YARN_EXCEPTION("Current node is nullptr in processInstruction()");
-    }
+    // -- built in operators.  They work on the stack in place : the right hand operand is popped, and the result overwrites the left hand operand --
 
-    auto op = instruction.opcode();
+    inline void setResult(Yarn::Value& v, float value) { v.set_float_value(value); }
+    inline void setResult(Yarn::Value& v, bool value) { v.set_bool_value(value); }
 
-    switch (op)
+    inline void popParameterCount(YarnVM::Stack& stack, const LinkedProgram::Instruction& instruction)
     {
-    case Yarn::Instruction_OpCode_JUMP_TO:
-    {
-        const std::string& jumpLabel = get_string_operand(instruction, 0);
-
-        if (currentNode->labels().find(jumpLabel) == currentNode->labels().end())
+        if (instruction.flags & LinkedProgram::POP_PARAMETER_COUNT)
         {
-            YARN_EXCEPTION("JUMP_TO : Jump label doesn't exist in current node");
+            stack.pop();
         }
+    }
 
-        std::int32_t translatedLabel = currentNode->labels().at(jumpLabel);
+    template <typename Operator>
+    inline void numberOperator(YarnVM::Stack& stack, const LinkedProgram::Instruction& instruction, Operator op)
+    {
+        popParameterCount(stack, instruction);
 
-        setInstruction(translatedLabel);
+        const float b = stack.top().float_value();
+        stack.pop();
 
-        return;
+        Yarn::Value& a = stack.top();
+        setResult(a, op(a.float_value(), b));
     }
-    break;
-    case Yarn::Instruction_OpCode_JUMP:
+
+    template <typename Operator>
+    inline void boolOperator(YarnVM::Stack& stack, const LinkedProgram::Instruction& instruction, Operator op)
     {
-        const Yarn::Operand& stackTop = variableStack.top();
+        popParameterCount(stack, instruction);
 
-        if ((variableStack.size() == 0) || !stackTop.has_string_value())
-        {
-            YARN_EXCEPTION("Stack top doesn't have a string value in JUMP instruction");
-        }
+        const bool b = stack.top().bool_value();
+        stack.pop();
 
-        const std::string& jumpLoc = stackTop.string_value();
+        Yarn::Value& a = stack.top();
+        a.set_bool_value(op(a.bool_value(), b));
+    }
 
-        std::int32_t translatedLabel = currentNode->labels().at(jumpLoc);
+    template <typename Operator>
+    inline void stringComparison(YarnVM::Stack& stack, const LinkedProgram::Instruction& instruction, Operator op)
+    {
+        popParameterCount(stack, instruction);
 
-        setInstruction(translatedLabel);
+        const bool result = op(stack.peek(1).string_value(), stack.top().string_value());
+        stack.pop();
 
-        return;
+        stack.top().set_bool_value(result);
     }
-    break;
-    case Yarn::Instruction_OpCode_RUN_LINE:
+}
+
+YarnVM::YieldReason YarnVM::runFor(std::size_t maxInstructions)
+{
+    if (runningState != RUNNING)
     {
-        const std::string& lineID = get_string_operand(instruction, 0);
+        return stateYield();
+    }
 
-        int substitutions = get_float_operand(instruction, 1);
+    return execute(maxInstructions);
+}
 
-        YarnVM::Line l;
-        l.id = lineID;
+void YarnVM::processInstruction()
+{
+    execute(1);
+}
 
-        l.substitutions.reserve(substitutions);
+bool YarnVM::threadedDispatch()
+{
+    return YARN_COMPUTED_GOTO;
+}
 
-        for (int i = 0; i < substitutions; i++)
-        {
-            l.substitutions.push_back(variableStack.top());
-            variableStack.pop();
-        }
+YarnVM::YieldReason YarnVM::stateYield() const
+{
+    switch (runningState)
+    {
+    case AWAITING_INPUT: return YIELD_OPTIONS;
+    case ASLEEP: return YIELD_WAIT;
+    case STOPPED: return YIELD_STOPPED;
+    default: return YIELD_BUDGET_EXHAUSTED;
+    }
+}
+
+YarnVM::YieldReason YarnVM::halt()
+{
+    runningState = STOPPED;
+    return YIELD_STOPPED;
+}
 
-        if (callbacks) callbacks->onRunLine(l);
+YarnVM::YieldReason YarnVM::execute(std::size_t maxInstructions)
+{
+    if (!currentNode)
+    {
+        YARN_EXCEPTION("Current node is nullptr in processInstruction()");
+        return halt();
     }
-    break;
-    case Yarn::Instruction_OpCode_RUN_COMMAND:
+
+    // every instruction takes one from the budget, so the instructions executed are whatever's left of it on the way out
+    std::size_t remaining = maxInstructions;
+
+    struct CountInstructions
     {
-        const std::string& commandText = get_string_operand(instruction, 0);
-        if (callbacks) callbacks->onRunCommand(commandText);
+        YarnVM& vm;
+        const std::size_t& remaining;
+        std::size_t maxInstructions;
+
+        ~CountInstructions() { vm.instructionsExecuted += maxInstructions - remaining; }
+    } countInstructions{*this, remaining, maxInstructions};
+
+    // a compiled node runs until it yields or the program moves to another node.  Nodes that weren't compiled are interpreted
+    if (!compiledNodes.empty())
+    {
+        while (CompiledNode node = compiledNodes[currentNodeIndex])
+        {
+            YieldReason reason;
+
+            if (node(*this, remaining, reason))
+            {
+                return reason;
+            }
+        }
     }
-    break;
-    case Yarn::Instruction_OpCode_ADD_OPTION:
+
+    return interpret(remaining);
+}
+
+YarnVM::YieldReason YarnVM::interpret(std::size_t& budget)
+{
+    // every node's code ends in an END_OF_NODE instruction, and the linker (or Bundle::validate) keeps every jump, and the step after a conditional one,
+    // within the node, so the loop doesn't check the instruction pointer against the node bounds
+    const LinkedProgram& linked = image->linked;
+    const LinkedProgram::Instruction* code = linked.nodes[currentNodeIndex].code.data();
+
+    // every dispatch takes one instruction from the budget.  Counted in a local, so the loop doesn't store to budget on every instruction
+    std::size_t remaining = budget;
+
+    struct ReturnBudget
     {
-        // Adds an entry to the option list (see ShowOptions).
-        // - opA = string: string ID for option to add
-        // - opB = string: destination to go to if this option is selected
-        // - opC = number: number of expressions on the stack to insert
-        //   into the line
-        // - opD = bool: whether the option has a condition on it (in which
-        //   case a value should be popped off the stack and used to signal
-        //   the game that the option should be not available)
+        std::size_t& budget;
+        const std::size_t& remaining;
+
+        ~ReturnBudget() { budget = remaining; }
+    } returnBudget{budget, remaining};
 
-        bool enabled = true;
-        std::vector<Yarn::Operand> substitutions;
+// an instruction that writes to the event ring and finds it full doesn't run, and gives its instruction back to the budget
+#define YARN_RESERVE_EVENT(substitutions) if (!eventRing->reserve(substitutions)) { remaining++; return YIELD_EVENTS_FULL; }
+
+#if YARN_COMPUTED_GOTO
+    // direct threaded : every handler jumps straight to the handler of the next instruction.  Must list the opcodes in the order of LinkedProgram::OpCode
+    static const void* const dispatchTable[] =
+    {
+        &&op_JUMP_TO, &&op_JUMP, &&op_RUN_LINE, &&op_RUN_COMMAND, &&op_ADD_OPTION, &&op_SHOW_OPTIONS,
+        &&op_PUSH_STRING, &&op_PUSH_FLOAT, &&op_PUSH_BOOL, &&op_PUSH_NULL, &&op_JUMP_IF_FALSE, &&op_POP,
+        &&op_CALL_FUNC, &&op_PUSH_VARIABLE, &&op_STORE_VARIABLE, &&op_STOP, &&op_RUN_NODE,
+        &&op_NUMBER_ADD, &&op_NUMBER_SUBTRACT, &&op_NUMBER_MULTIPLY, &&op_NUMBER_DIVIDE, &&op_NUMBER_MODULO, &&op_NUMBER_NEGATE,
+        &&op_NUMBER_EQUAL, &&op_NUMBER_NOT_EQUAL, &&op_NUMBER_LESS, &&op_NUMBER_LESS_EQUAL, &&op_NUMBER_GREATER, &&op_NUMBER_GREATER_EQUAL,
+        &&op_BOOL_AND, &&op_BOOL_OR, &&op_BOOL_XOR, &&op_BOOL_NOT, &&op_BOOL_EQUAL, &&op_BOOL_NOT_EQUAL,
+        &&op_STRING_ADD, &&op_STRING_EQUAL, &&op_STRING_NOT_EQUAL,
+        &&op_JUMP_IF_VARIABLE_NOT_EQUAL, &&op_ADD_TO_VARIABLE, &&op_RUN_NODE_DIRECT,
+        &&op_END_OF_NODE,
+    };
 
-        int substitutionsCt = (int)get_float_operand(instruction, 2);
+    static_assert(std::size(dispatchTable) == LinkedProgram::OPCODE_COUNT, "dispatch table is missing opcodes");
+    static_assert((LinkedProgram::RUN_NODE == 16) && (LinkedProgram::NUMBER_ADD == 17), "dispatch table order doesn't match the opcode values");
 
-        int nOperands = instruction.operands_size();
+    const LinkedProgram::Instruction* instruction = nullptr;
 
-        if (nOperands < 2)
+#define YARN_OP(op) op_##op
+#define YARN_DISPATCH() { if (!remaining) return YIELD_BUDGET_EXHAUSTED; remaining--; instruction = &code[instructionPointer]; goto *dispatchTable[instruction->opcode]; }
+#define YARN_NEXT() { instructionPointer++; YARN_DISPATCH(); }
+
+    YARN_DISPATCH();
+#else
+#define YARN_OP(op) case LinkedProgram::op
+#define YARN_DISPATCH() continue
+#define YARN_NEXT() { instructionPointer++; continue; }
+
+    for (;;)
+    {
+        if (!remaining)
         {
-            YARN_EXCEPTION("Insufficient arguments to ADD_OPTION");
+            return YIELD_BUDGET_EXHAUSTED;
         }
 
-        if (nOperands > 2)
+        remaining--;
+
+        const LinkedProgram::Instruction* instruction = &code[instructionPointer];
+
+        switch (instruction->opcode)
+        {
+#endif
+        YARN_OP(JUMP_TO):
         {
-            if (substitutionsCt)
+            if (instruction->a == LinkedProgram::UNRESOLVED)
             {
-                substitutions.resize(substitutionsCt);
+                YARN_EXCEPTION("JUMP_TO : Jump label doesn't exist in current node");
+                return halt();
+            }
 
-                for (int i = 0; i < substitutionsCt; i++)
+            instructionPointer = instruction->a;
+
+            YARN_DISPATCH();
+        }
+        YARN_NEXT();
+        YARN_OP(JUMP):
+        {
+            const Yarn::Value& stackTop = variableStack.top();
+
+            if ((variableStack.size() == 0) || !stackTop.has_string_value())
+            {
+                YARN_EXCEPTION("Stack top doesn't have a string value in JUMP instruction");
+            }
+
+            const std::string_view jumpLoc = stackTop.string_value();
+
+            // only runs once after an option is selected, so the label is looked up by name
+            std::int32_t translatedLabel = linked.findLabel(linked.nodes[currentNodeIndex], jumpLoc);
+
+            if (translatedLabel == LinkedProgram::UNRESOLVED)
+            {
+                YARN_EXCEPTION("JUMP : Jump label doesn't exist in current node : " + std::string(jumpLoc));
+                return halt();
+            }
+
+            instructionPointer = translatedLabel;
+
+            YARN_DISPATCH();
+        }
+        YARN_NEXT();
+        YARN_OP(RUN_LINE):
+        {
+            int substitutions = instruction->b;
+
+            if (eventRing)
+            {
+                YARN_RESERVE_EVENT(substitutions);
+
+                VMEvent event;
+                event.type = VMEvent::LINE;
+                event.substitutionCount = (std::uint16_t)substitutions;
+                event.string = instruction->a;
+                event.index = lineIndex(instruction->a);
+                event.firstSubstitution = eventRing->nextValue();
+
+                for (int i = 0; i < substitutions; i++)
                 {
-                    substitutions[i] = variableStack.top();
+                    eventRing->pushValue(variableStack.top());
                     variableStack.pop();
                 }
+
+                eventRing->publish(event);
+
+                instructionPointer++;
+
+                return YIELD_LINE;
             }
-        }
 
-        if ((nOperands > 3) && (get_bool_operand(instruction, 3)))
-        {
-            Yarn::Operand& top = variableStack.top();
+            // reuse the storage of the last line rather than building a new one
+            currentLine.id = linked.strings[instruction->a];
+            currentLine.index = lineIndex(instruction->a);
+            currentLine.substitutions.clear();
 
-            if ((!top.has_bool_value()) || (top.has_float_value() && (top.float_value() == 0.f)))
+            for (int i = 0; i < substitutions; i++)
             {
-                YARN_EXCEPTION("ADD_OPTION: condition on top of stack not convertible to a bool value");
+                currentLine.substitutions.push_back(variableStack.top().toOperand());
+                variableStack.pop();
             }
 
-            enabled = top.bool_value();
-            variableStack.pop();
-        }
+            if (callbacks) callbacks->onRunLine(currentLine);
 
-        assert(substitutionsCt == substitutions.size());
+            instructionPointer++;
 
-        Option opt =
+            return (runningState == RUNNING) ? YIELD_LINE : stateYield();
+        }
+        YARN_OP(RUN_COMMAND):
         {
-            Line {get_string_operand(instruction,0), substitutions},
-            get_string_operand(instruction,1),
-            enabled
-        };
+            const std::string_view commandText = linked.strings[instruction->a];
 
-        currentOptionsList.push_back(opt);
-    }
-    break;
-    case Yarn::Instruction_OpCode_SHOW_OPTIONS:
-    {
-        assert(currentOptionsList.size());
+            currentCommand = commandText;
 
-        runningState = AWAITING_INPUT;
+            if (eventRing)
+            {
+                YARN_RESERVE_EVENT(0);
 
-        if (callbacks) callbacks->onPresentOptions(currentOptionsList);
-    }
-    break;
-    case Yarn::Instruction_OpCode_PUSH_STRING:
-    {
-        if (!instruction.operands_size() >= 1)
-        {
-            YARN_EXCEPTION("Missing operand for PUSH_STRING instruction");
-        }
+                VMEvent event;
+                event.type = VMEvent::COMMAND;
+                event.string = instruction->a;
+                event.firstSubstitution = eventRing->nextValue();
+                eventRing->publish(event);
+            }
+            else if (callbacks)
+            {
+                callbacks->onRunCommand(commandText);
+            }
 
-        const Yarn::Operand& op = instruction.operands(0);
+            instructionPointer++;
 
-        if (!op.has_string_value())
-        {
-            YARN_EXCEPTION("Passed non-string operand to PUSH_STRING instruction");
+            // the command may have put the VM to sleep (eg. wait) or stopped it
+            return (runningState == RUNNING) ? YIELD_COMMAND : stateYield();
         }
-
-        variableStack.push(op);
-    }
-    break;
-    case Yarn::Instruction_OpCode_PUSH_FLOAT:
-    {
-        if (!instruction.operands_size() >= 1)
+        YARN_OP(ADD_OPTION):
         {
-            YARN_EXCEPTION("Missing operand for PUSH_FLOAT instruction");
+            // Adds an entry to the option list (see ShowOptions).
+            // - a = string: string ID for option to add
+            // - b = string: destination to go to if this option is selected
+            // - c = number: number of expressions on the stack to insert
+            //   into the line
+            // - HAS_CONDITION flag: whether the option has a condition on it (in which
+            //   case a value should be popped off the stack and used to signal
+            //   the game that the option should be not available)
+
+            int substitutionsCt = instruction->c;
+
+            VMEvent event;
+
+            if (eventRing)
+            {
+                YARN_RESERVE_EVENT(substitutionsCt);
+
+                event.type = VMEvent::OPTION;
+                event.substitutionCount = (std::uint16_t)substitutionsCt;
+                event.string = instruction->a;
+                event.index = (std::int32_t)currentOptionsList.size();
+                event.firstSubstitution = eventRing->nextValue();
+            }
+
+            // build the option in place in the (already allocated) options list
+            Option& opt = currentOptionsList.emplace_back();
+
+            opt.line.id = linked.strings[instruction->a];
+            opt.line.index = lineIndex(instruction->a);
+            opt.destination = linked.strings[instruction->b];
+            opt.enabled = true;
+
+            if (eventRing)
+            {
+                // the substitutions go to the ring as values, the option itself is only kept for its destination
+                for (int i = 0; i < substitutionsCt; i++)
+                {
+                    eventRing->pushValue(variableStack.top());
+                    variableStack.pop();
+                }
+            }
+            else if (substitutionsCt)
+            {
+                opt.line.substitutions.resize(substitutionsCt);
+
+                for (int i = 0; i < substitutionsCt; i++)
+                {
+                    opt.line.substitutions[i] = variableStack.top().toOperand();
+                    variableStack.pop();
+                }
+            }
+
+            if (instruction->flags & LinkedProgram::HAS_CONDITION)
+            {
+                const Yarn::Value& top = variableStack.top();
+
+                if ((!top.has_bool_value()) || (top.has_float_value() && (top.float_value() == 0.f)))
+                {
+                    YARN_EXCEPTION("ADD_OPTION: condition on top of stack not convertible to a bool value");
+                }
+
+                opt.enabled = top.bool_value();
+                variableStack.pop();
+            }
+
+            if (eventRing)
+            {
+                event.enabled = opt.enabled;
+                eventRing->publish(event);
+            }
+            else
+            {
+                assert(substitutionsCt == opt.line.substitutions.size());
+            }
         }
+        YARN_NEXT();
+        YARN_OP(SHOW_OPTIONS):
+        {
+            assert(currentOptionsList.size());
+
+            if (eventRing)
+            {
+                YARN_RESERVE_EVENT(0);
+
+                VMEvent event;
+                event.type = VMEvent::OPTIONS;
+                event.index = (std::int32_t)currentOptionsList.size();
+                event.firstSubstitution = eventRing->nextValue();
+
+                runningState = AWAITING_INPUT;
+                eventRing->publish(event);
+            }
+            else
+            {
+                runningState = AWAITING_INPUT;
+
+                if (callbacks) callbacks->onPresentOptions(currentOptionsList);
+            }
 
-        const Yarn::Operand& op = instruction.operands(0);
+            instructionPointer++;
 
-        if (!op.has_float_value())
+            return YIELD_OPTIONS;
+        }
+        YARN_OP(PUSH_STRING):
+        YARN_OP(PUSH_FLOAT):
+        YARN_OP(PUSH_BOOL):
         {
-            YARN_EXCEPTION("Passed non-float operand to PUSH_FLOAT instruction");
+            // operand types are checked when the program is linked
+            variableStack.push(linked.constants[instruction->a]);
         }
-
-        variableStack.push(op);
-    }
-    break;
-    case Yarn::Instruction_OpCode_PUSH_BOOL:
-    {
-        if (!instruction.operands_size() >= 1)
+        YARN_NEXT();
+        YARN_OP(PUSH_NULL):
         {
-            YARN_EXCEPTION("Missing operand for PUSH_BOOL instruction");
+            variableStack.push(Yarn::Value());
         }
+        YARN_NEXT();
+        YARN_OP(JUMP_IF_FALSE):
+        {
+            // Jumps to the named position in the the node, if the top of the
+            // stack is not null, zero or false.
+            // a = label instruction, b = label name
 
-        const Yarn::Operand& op = instruction.operands(0);
+            const Yarn::Value& top = variableStack.top();
 
-        if (!op.has_bool_value())
+            if (!(top.has_string_value() || (top.has_bool_value() && (top.bool_value() != false)) || (top.has_float_value() && (top.float_value() != 0.f))))
+            {
+                if (instruction->a == LinkedProgram::UNRESOLVED)
+                {
+                    YARN_EXCEPTION("Missing jump label in JUMP_IF_FALSE instruction: " + std::string(linked.strings[instruction->b]));
+                    return halt();
+                }
+
+                // lands on the label's instruction, which is skipped like any other executed instruction
+                instructionPointer = instruction->a;
+            }
+        }
+        YARN_NEXT();
+        YARN_OP(POP):
         {
-            YARN_EXCEPTION("Passed non-bool operand to PUSH_BOOL instruction");
+            if (!variableStack.size())
+            {
+                YARN_EXCEPTION("POP instruction called with 0 stack size");
+            }
+            variableStack.pop();
         }
+        YARN_NEXT();
+        YARN_OP(CALL_FUNC):
+        {
+            const std::int32_t slot = instruction->a;
 
-        variableStack.push(op);
-    }
-    break;
-    case Yarn::Instruction_OpCode_PUSH_NULL:
-    {
-        Yarn::Operand op;
-        op.clear_value();
+            assert(variableStack.size());
 
-        variableStack.push(op);
-    }
-    break;
-    case Yarn::Instruction_OpCode_JUMP_IF_FALSE:
-    {
-        // Jumps to the named position in the the node, if the top of the
-        // stack is not null, zero or false.
-        // opA = string: label name 
+            auto operandCt = variableStack.top().float_value();
 
-        const Yarn::Operand& top = variableStack.top();
+            variableStack.pop();
 
-        if (!(top.has_string_value() || (top.has_bool_value() && (top.bool_value() != false)) || (top.has_float_value() && (top.float_value() != 0.f))))
-        {
-            const std::string& labelName = get_string_operand(instruction, 0);
+            const YarnFunction* function = functionSlots[slot];
 
-            if (currentNode->labels().find(labelName) == currentNode->labels().end())
+            if (!function && !(function = bindFunction(slot)))
             {
-                YARN_EXCEPTION("Missing jump label in JUMP_IF_FALSE instruction: " + labelName);
+                YARN_EXCEPTION("Missing function with identifier : " + linked.functionNames[slot]);
+                return halt();
             }
 
-            std::int32_t translatedLabel = currentNode->labels().at(labelName);
+            auto rval = (*function)(*this, operandCt);
 
-            setInstruction(translatedLabel);
+            this->variableStack.push(rval);
         }
-    }
-    break;
-    case Yarn::Instruction_OpCode_POP:
-    {
-        if (!variableStack.size())
+        YARN_NEXT();
+        YARN_OP(PUSH_VARIABLE):
         {
-            YARN_EXCEPTION("POP instruction called with 0 stack size");
+            variableStack.push(variableStorage[instruction->a]);
         }
-        variableStack.pop();
-    }
-    break;
-    case Yarn::Instruction_OpCode_CALL_FUNC:
-    {
-        int a = instruction.operands_size();
+        YARN_NEXT();
+        YARN_OP(STORE_VARIABLE):
+        {
+            if (!variableStack.size())
+            {
+                YARN_EXCEPTION("STORE_VARIABLE instruction called with empty stack size");
+            }
 
-        const std::string& varname = get_string_operand(instruction, 0);
+            variableStorage[instruction->a] = variableStack.top();
+        }
+        YARN_NEXT();
+        YARN_OP(STOP):
+        {
+            if (eventRing)
+            {
+                YARN_RESERVE_EVENT(0);
+
+                VMEvent event;
+                event.type = VMEvent::STOPPED;
+                event.firstSubstitution = eventRing->nextValue();
 
-        assert(variableStack.size());
+                runningState = STOPPED;
+                eventRing->publish(event);
 
-        auto operandCt = variableStack.top().float_value();
+                return YIELD_STOPPED;
+            }
 
-        variableStack.pop();
+            runningState = STOPPED;
 
-        if (this->functions.find(varname) == this->functions.end())
-        {
-            YARN_EXCEPTION("Missing function with identifier : " + varname);
+            if (callbacks) callbacks->onProgramStopped();
+
+            return YIELD_STOPPED;
         }
+        YARN_OP(RUN_NODE):
+        {
+            if (variableStack.size() && variableStack.top().has_string_value())
+            {
+                const bool loaded = (instruction->a != LinkedProgram::UNRESOLVED) ? loadNode(instruction->a) : loadNode(std::string(variableStack.top().string_value()));
 
-        auto rval = this->functions[varname](*this, operandCt);
+                if (!loaded)
+                {
+                    return halt();
+                }
 
-        this->variableStack.push(rval);
-    }
-    break;
-    case Yarn::Instruction_OpCode_PUSH_VARIABLE:
-    {
-        const std::string& varname = get_string_operand(instruction, 0);
+                variableStack.pop();
 
-        variableStack.push(variableStorage[varname]);
-    }
-    break;
-    case Yarn::Instruction_OpCode_STORE_VARIABLE:
-    {
-        const std::string& varname = get_string_operand(instruction, 0);
+                // the node change callback may have stopped the VM
+                if (runningState != RUNNING)
+                {
+                    return stateYield();
+                }
+
+                code = linked.nodes[currentNodeIndex].code.data();
 
-        if (!variableStack.size())
+                YARN_DISPATCH();
+            }
+            else
+            {
+                YARN_EXCEPTION("RUN_NODE instruction expected string variable on top of stack");
+                return halt();
+            }
+        }
+        YARN_OP(NUMBER_ADD): numberOperator(variableStack, *instruction, [](float a, float b) { return a + b; }); YARN_NEXT();
+        YARN_OP(NUMBER_SUBTRACT): numberOperator(variableStack, *instruction, [](float a, float b) { return a - b; }); YARN_NEXT();
+        YARN_OP(NUMBER_MULTIPLY): numberOperator(variableStack, *instruction, [](float a, float b) { return a * b; }); YARN_NEXT();
+        YARN_OP(NUMBER_DIVIDE): numberOperator(variableStack, *instruction, [](float a, float b) { return a / b; }); YARN_NEXT();
+        YARN_OP(NUMBER_MODULO): numberOperator(variableStack, *instruction, [](float a, float b) { return std::fmod(a, b); }); YARN_NEXT();
+        YARN_OP(NUMBER_EQUAL): numberOperator(variableStack, *instruction, [](float a, float b) { return a == b; }); YARN_NEXT();
+        YARN_OP(NUMBER_NOT_EQUAL): numberOperator(variableStack, *instruction, [](float a, float b) { return a != b; }); YARN_NEXT();
+        YARN_OP(NUMBER_LESS): numberOperator(variableStack, *instruction, [](float a, float b) { return a < b; }); YARN_NEXT();
+        YARN_OP(NUMBER_LESS_EQUAL): numberOperator(variableStack, *instruction, [](float a, float b) { return a <= b; }); YARN_NEXT();
+        YARN_OP(NUMBER_GREATER): numberOperator(variableStack, *instruction, [](float a, float b) { return a > b; }); YARN_NEXT();
+        YARN_OP(NUMBER_GREATER_EQUAL): numberOperator(variableStack, *instruction, [](float a, float b) { return a >= b; }); YARN_NEXT();
+        YARN_OP(NUMBER_NEGATE):
         {
-            YARN_EXCEPTION("STORE_VARIABLE instruction called with empty stack size");
+            popParameterCount(variableStack, *instruction);
+            Yarn::Value& a = variableStack.top();
+            a.set_float_value(-a.float_value());
         }
+        YARN_NEXT();
+        YARN_OP(BOOL_AND): boolOperator(variableStack, *instruction, [](bool a, bool b) { return a && b; }); YARN_NEXT();
+        YARN_OP(BOOL_OR): boolOperator(variableStack, *instruction, [](bool a, bool b) { return a || b; }); YARN_NEXT();
+        YARN_OP(BOOL_XOR): boolOperator(variableStack, *instruction, [](bool a, bool b) { return a != b; }); YARN_NEXT();
+        YARN_OP(BOOL_EQUAL): boolOperator(variableStack, *instruction, [](bool a, bool b) { return a == b; }); YARN_NEXT();
+        YARN_OP(BOOL_NOT_EQUAL): boolOperator(variableStack, *instruction, [](bool a, bool b) { return a != b; }); YARN_NEXT();
+        YARN_OP(BOOL_NOT):
+        {
+            popParameterCount(variableStack, *instruction);
+            Yarn::Value& a = variableStack.top();
+            a.set_bool_value(!a.bool_value());
+        }
+        YARN_NEXT();
+        YARN_OP(STRING_EQUAL): stringComparison(variableStack, *instruction, [](std::string_view a, std::string_view b) { return a == b; }); YARN_NEXT();
+        YARN_OP(STRING_NOT_EQUAL): stringComparison(variableStack, *instruction, [](std::string_view a, std::string_view b) { return a != b; }); YARN_NEXT();
+        YARN_OP(STRING_ADD):
+        {
+            popParameterCount(variableStack, *instruction);
 
-        variableStorage[varname] = variableStack.top();
-    }
-    break;
-    case Yarn::Instruction_OpCode_STOP:
-    {
-        runningState = STOPPED;
-
-        if (callbacks) callbacks->onProgramStopped();
+            std::string result(variableStack.peek(1).string_value());
+            result += variableStack.top().string_value();
+            variableStack.pop();
 
-        return;
-    }
-    break;
-    case Yarn::Instruction_OpCode_RUN_NODE:
-    {
-        if (variableStack.size() && variableStack.top().has_string_value())
+            variableStack.top().set_string_value(makeString(result));
+        }
+        YARN_NEXT();
+        YARN_OP(JUMP_IF_VARIABLE_NOT_EQUAL):
         {
-            const std::string& nodeName = variableStack.top().string_value();
+            const bool equal = (variableStorage[instruction->b].float_value() == linked.constants[instruction->c].float_value());
 
-            loadNode(nodeName);
-
-            variableStack.pop();
+            // the comparison stays on the stack, like it would for JUMP_IF_FALSE
+            variableStack.push(Yarn::Value(equal));
 
-            return;
+            if (!equal)
+            {
+                instructionPointer = instruction->a;
+            }
         }
-        else
+        YARN_NEXT();
+        YARN_OP(ADD_TO_VARIABLE):
         {
-            YARN_EXCEPTION("RUN_NODE instruction expected string variable on top of stack");
+            Yarn::Value& variable = variableStorage[instruction->a];
+            variable.set_float_value(variable.float_value() + linked.constants[instruction->b].float_value());
         }
+        YARN_NEXT();
+        YARN_OP(RUN_NODE_DIRECT):
+        {
+            if (!loadNode(instruction->a))
+            {
+                return halt();
+            }
 
+            // the node change callback may have stopped the VM
+            if (runningState != RUNNING)
+            {
+                return stateYield();
+            }
+
+            code = linked.nodes[currentNodeIndex].code.data();
+        }
+        YARN_DISPATCH();
+        YARN_OP(END_OF_NODE):
+        {
+            YARN_EXCEPTION("processInstruction() ran past the last instruction of the current node");
+            return halt();
+        }
+#if !YARN_COMPUTED_GOTO
+        default:
+        {
+            YARN_EXCEPTION("Unknown instruction opcode");
+            YARN_NEXT();
+        }
+        };
     }
-    break;
-    default:
-    {
-        YARN_EXCEPTION("Unknown instruction opcode");
-        break;
-    }
-    };
+#endif
 
-    advance();
+#undef YARN_OP
+#undef YARN_DISPATCH
+#undef YARN_NEXT
+#undef YARN_RESERVE_EVENT
 }
@@ -1,8 +1,294 @@
+#include <yarn_csv.h>
 #include <yarn_line_database.h>
+#include <yarn_mapped_file.h>
+#include <yarn_program.h>
 
 #include <csv.hpp>
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    // -- binary cache layout, see loadCached().  Fields are in the byte order of the machine that wrote the cache --
+
+    constexpr char CACHE_MAGIC[8] = { 'Y', 'A', 'R', 'N', 'L', 'I', 'N', 'E' };
+    constexpr std::uint32_t CACHE_VERSION = 1;
+    constexpr std::uint32_t CACHE_BYTE_ORDER_MARK = 0x01020304;
+
+    /// identifies the version of a csv file the cache was written from
+    struct SourceStamp
+    {
+        std::uint64_t size = 0;
+        std::int64_t modified = 0;  ///< file clock ticks
+        std::uint64_t hash = 0;     ///< FNV-1a of the contents
+    };
+
+    struct CacheHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t checksum;     ///< FNV-1a of everything after the header
+        std::uint64_t payloadSize;
+        SourceStamp lines;
+        SourceStamp metadata;
+        std::uint32_t stringCount;
+        std::uint32_t lineCount;
+        std::uint32_t tagCount;
+        std::uint32_t stringDataSize;
+    };
+
+    // the payload is : CacheString[stringCount], CacheLine[lineCount], CacheTag[tagCount], then the characters of every string
+
+    struct CacheString
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    struct CacheLine
+    {
+        std::uint32_t id;
+        std::uint32_t text;
+        std::uint32_t file;
+        std::uint32_t node;
+        std::int32_t lineNumber;
+    };
+
+    struct CacheTag
+    {
+        std::uint32_t id;
+        std::uint32_t tag;
+    };
+
+    std::uint64_t fnv1a(const void* data, std::size_t size, std::uint64_t hash = 14695981039346656037ull)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    /// size and modification time of path, and its hash if withHash.  Returns false if the file can't be read
+    bool stamp(const std::string& path, SourceStamp& stamp, bool withHash)
+    {
+        std::error_code error;
+
+        stamp.size = std::filesystem::file_size(path, error);
+        if (error) return false;
+
+        stamp.modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        if (error) return false;
+
+        stamp.hash = 0;
+
+        if (withHash && stamp.size)
+        {
+            Yarn::MappedFile file;
+            std::string mapError;
+
+            if (!file.open(path, mapError)) return false;
+
+            stamp.hash = fnv1a(file.data(), file.size());
+        }
+
+        return true;
+    }
+
+    /// whether the csv file is the version the cache was written from : same size and modification time, or failing that, same contents
+    bool current(const std::string& path, const SourceStamp& cached)
+    {
+        SourceStamp now;
+
+        if (!stamp(path, now, false) || (now.size != cached.size))
+        {
+            return false;
+        }
+
+        return (now.modified == cached.modified) || (stamp(path, now, true) && (now.hash == cached.hash));
+    }
+
+    /// map path for CsvScanner.  Returns false for an empty file, which has no records, and throws if the file can't be read, as the generic reader does
+    bool mapCSV(const std::string& path, Yarn::MappedFile& file)
+    {
+        std::string error;
+
+        if (file.open(path, error))
+        {
+            return true;
+        }
+
+        std::error_code sizeError;
+
+        if (std::filesystem::is_regular_file(path, sizeError) && (std::filesystem::file_size(path, sizeError) == 0))
+        {
+            return false;
+        }
+
+        throw std::runtime_error(error);
+    }
+
+    /// index of the column named name in the header, or SIZE_MAX
+    std::size_t column(const std::vector<std::string_view>& header, std::string_view name)
+    {
+        for (std::size_t i = 0; i < header.size(); i++)
+        {
+            if (header[i] == name)
+            {
+                return i;
+            }
+        }
+
+        return SIZE_MAX;
+    }
+
+    /// the generic reader's is_int() and get<int>() : an integer, optionally surrounded by spaces
+    bool parseInt(std::string_view s, int& value)
+    {
+        while (!s.empty() && (s.front() == ' ')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ')) s.remove_suffix(1);
+
+        const std::from_chars_result result = std::from_chars(s.data(), s.data() + s.size(), value);
+
+        return !s.empty() && (result.ec == std::errc()) && (result.ptr == s.data() + s.size());
+    }
+}
+
 void Yarn::LineDatabase::loadMetadata(const std::string_view& csvFile)
+{
+    const std::size_t YARN_TAGS_COLUMN_INDEX = 3;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+
+    if (!mapCSV(std::string(csvFile), file))
+    {
+        return;
+    }
+
+    CsvScanner scanner(std::string_view((const char*)file.data(), file.size()));
+    std::vector<std::string_view> fields;
+
+    if (!scanner.next(fields))
+    {
+        return;
+    }
+
+    const std::size_t id = column(fields, "id");
+
+    if (id == SIZE_MAX)
+    {
+        loadMetadataGeneric(csvFile);
+        return;
+    }
+
+    // rows have as many tag columns as their line has tags
+    while (scanner.next(fields))
+    {
+        if (id >= fields.size())
+        {
+            continue;
+        }
+
+        for (std::size_t i = YARN_TAGS_COLUMN_INDEX; i < fields.size(); i++)
+        {
+            addTag(fields[id], fields[i]);
+        }
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+
+    parsingTime += duration.count();
+}
+
+void Yarn::LineDatabase::loadLines(const std::string_view& csvFile)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+
+    if (!mapCSV(std::string(csvFile), file))
+    {
+        return;
+    }
+
+    CsvScanner scanner(std::string_view((const char*)file.data(), file.size()));
+    std::vector<std::string_view> fields;
+
+    if (!scanner.next(fields))
+    {
+        return;
+    }
+
+    const std::size_t columnCount = fields.size();
+    const std::size_t id = column(fields, "id");
+    const std::size_t text = column(fields, "text");
+    const std::size_t fileColumn = column(fields, "file");
+    const std::size_t node = column(fields, "node");
+    const std::size_t lineNumberColumn = column(fields, "lineNumber");
+
+    if ((id == SIZE_MAX) || (text == SIZE_MAX) || (fileColumn == SIZE_MAX) || (node == SIZE_MAX) || (lineNumberColumn == SIZE_MAX))
+    {
+        loadLinesGeneric(csvFile);
+        return;
+    }
+
+    // lines come node by node, so the file and node are only interned when they change
+    std::string lastFile;
+    std::string lastNode;
+    std::uint32_t fileName = EMPTY;
+    std::uint32_t nodeName = EMPTY;
+
+    while (scanner.next(fields))
+    {
+        // the generic reader drops rows that don't have a field per column
+        if (fields.size() != columnCount)
+        {
+            continue;
+        }
+
+        int lineNumber = 0;
+
+        if (!parseInt(fields[lineNumberColumn], lineNumber))
+        {
+            assert(0);
+        }
+
+        if ((fileName == EMPTY) || (fields[fileColumn] != lastFile))
+        {
+            fileName = intern(fields[fileColumn]);
+            lastFile = fields[fileColumn];
+        }
+
+        if ((nodeName == EMPTY) || (fields[node] != lastNode))
+        {
+            nodeName = intern(fields[node]);
+            lastNode = fields[node];
+        }
+
+        add(fields[id], fields[text], fileName, nodeName, lineNumber);
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+
+    parsingTime += duration.count();
+}
+
+void Yarn::LineDatabase::loadMetadataGeneric(const std::string_view& csvFile)
 {
     const int YARN_TAGS_COLUMN_INDEX = 3;
 
@@ -16,11 +302,11 @@ void Yarn::LineDatabase::loadMetadata(const std::string_view& csvFile)
 
     for (const csv::CSVRow& row : reader)
     {
-        std::string id = row["id"].get();
+        const csv::string_view id = row["id"].get<csv::string_view>();
 
         for (int i = YARN_TAGS_COLUMN_INDEX; i < row.size(); i++)
         {
-            tags[id].insert(row[i].get());
+            addTag(id, row[i].get<csv::string_view>());
         }
     }
 
@@ -30,7 +316,7 @@ void Yarn::LineDatabase::loadMetadata(const std::string_view& csvFile)
     parsingTime += duration.count();
 }
 
-void Yarn::LineDatabase::loadLines(const std::string_view& csvFile)
+void Yarn::LineDatabase::loadLinesGeneric(const std::string_view& csvFile)
 {
     auto start = std::chrono::high_resolution_clock::now();
 
@@ -49,16 +335,33 @@ void Yarn::LineDatabase::loadLines(const std::string_view& csvFile)
             assert(0);
         }
 
-        std::string id = row["id"].get();
+        add(row["id"].get<csv::string_view>(),
+            row["text"].get<csv::string_view>(),
+            row["file"].get<csv::string_view>(),
+            row["node"].get<csv::string_view>(),
+            lineNumber);
+    }
 
-        lines[id] =
-        {
-            id,
-            row["text"].get(),
-            row["file"].get(),
-            row["node"].get(),
-            lineNumber
-        };
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+
+    parsingTime += duration.count();
+}
+
+void Yarn::LineDatabase::load(const EmbeddedModule& module)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (std::size_t i = 0; i < module.lineCount; i++)
+    {
+        const EmbeddedLine& line = module.lines[i];
+
+        add(line.id, line.text, line.file, line.node, line.lineNumber);
+    }
+
+    for (std::size_t i = 0; i < module.tagCount; i++)
+    {
+        addTag(module.tags[i].id, module.tags[i].tag);
     }
 
     auto stop = std::chrono::high_resolution_clock::now();
@@ -67,3 +370,591 @@ void Yarn::LineDatabase::loadLines(const std::string_view& csvFile)
     parsingTime += duration.count();
 }
 
+void Yarn::LineDatabase::load(std::shared_ptr<const Bundle> bundleToLoad)
+{
+    bundle = std::move(bundleToLoad);
+}
+
+uint64_t Yarn::LineDatabase::sizeBytes() const
+{
+    uint64_t rval = arena.capacity()
+        + lines.capacity() * sizeof(Line)
+        + names.capacity() * sizeof(Span)
+        + tagNames.capacity() * sizeof(std::uint32_t)
+        + index.capacity() * sizeof(Slot);
+
+    for (const auto& [name, nameIndex] : nameIndices)
+    {
+        rval += name.capacity() + sizeof(name) + sizeof(nameIndex) + sizeof(void*); // plus the map's own node and bucket overhead, roughly
+    }
+
+    return rval;
+}
+
+Yarn::LineDatabase::Span Yarn::LineDatabase::append(std::string_view s)
+{
+    if (arena.size() + s.size() > std::numeric_limits<std::uint32_t>::max())
+    {
+        throw std::length_error("line database is over 4 GB");
+    }
+
+    const Span span = { (std::uint32_t)arena.size(), (std::uint32_t)s.size() };
+
+    arena.append(s.data(), s.size());
+
+    return span;
+}
+
+std::uint32_t Yarn::LineDatabase::intern(std::string_view name)
+{
+    auto it = nameIndices.find(name);
+
+    if (it != nameIndices.end())
+    {
+        return it->second;
+    }
+
+    const std::uint32_t nameIndex = (std::uint32_t)names.size();
+
+    names.push_back(append(name));
+    nameIndices.emplace(std::string(name), nameIndex);
+
+    return nameIndex;
+}
+
+std::int32_t Yarn::LineDatabase::probe(std::string_view id) const
+{
+    if (index.empty())
+    {
+        return NOT_FOUND;
+    }
+
+    const std::size_t hash = std::hash<std::string_view>()(id);
+    const std::size_t mask = index.size() - 1;
+
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        const Slot& slot = index[i];
+
+        if (slot.line == EMPTY)
+        {
+            return NOT_FOUND;
+        }
+
+        if ((slot.hash == (std::uint32_t)hash) && (view(lines[slot.line].id) == id))
+        {
+            return (std::int32_t)slot.line;
+        }
+    }
+}
+
+std::uint32_t Yarn::LineDatabase::insert(std::string_view id)
+{
+    const std::int32_t found = probe(id);
+
+    if (found != NOT_FOUND)
+    {
+        return (std::uint32_t)found;
+    }
+
+    if ((lines.size() + 1) * 2 > index.size())
+    {
+        rehash(std::max<std::size_t>(64, index.size() * 2));
+    }
+
+    const std::uint32_t lineIndex = (std::uint32_t)lines.size();
+
+    Line line;
+    line.id = append(id);
+    line.firstTag = (std::uint32_t)tagNames.size();
+    lines.push_back(line);
+
+    const std::size_t hash = std::hash<std::string_view>()(id);
+    const std::size_t mask = index.size() - 1;
+    std::size_t i = hash & mask;
+
+    while (index[i].line != EMPTY)
+    {
+        i = (i + 1) & mask;
+    }
+
+    index[i] = { lineIndex, (std::uint32_t)hash };
+
+    return lineIndex;
+}
+
+void Yarn::LineDatabase::rehash(std::size_t slots)
+{
+    index.assign(slots, {});
+
+    const std::size_t mask = slots - 1;
+
+    for (std::uint32_t lineIndex = 0; lineIndex < lines.size(); lineIndex++)
+    {
+        const std::size_t hash = std::hash<std::string_view>()(view(lines[lineIndex].id));
+        std::size_t i = hash & mask;
+
+        while (index[i].line != EMPTY)
+        {
+            i = (i + 1) & mask;
+        }
+
+        index[i] = { lineIndex, (std::uint32_t)hash };
+    }
+}
+
+void Yarn::LineDatabase::add(std::string_view id, std::string_view text, std::string_view file, std::string_view node, int lineNumber)
+{
+    const std::uint32_t fileName = intern(file);
+    const std::uint32_t nodeName = intern(node);
+
+    add(id, text, fileName, nodeName, lineNumber);
+}
+
+void Yarn::LineDatabase::add(std::string_view id, std::string_view text, std::uint32_t fileName, std::uint32_t nodeName, int lineNumber)
+{
+    const std::uint32_t lineIndex = insert(id);
+    Line& line = lines[lineIndex];
+
+    // a replaced line's text is overwritten in place when the new text fits, so reloading or restoring a module doesn't grow the arena.
+    // Longer text is appended, and the old text stays in the arena until the database is cleared
+    if (text.size() <= line.text.size)
+    {
+        std::memmove(arena.data() + line.text.offset, text.data(), text.size());
+        line.text.size = (std::uint32_t)text.size();
+    }
+    else
+    {
+        line.text = append(text);
+    }
+
+    line.file = fileName;
+    line.node = nodeName;
+    line.lineNumber = lineNumber;
+}
+
+void Yarn::LineDatabase::addTag(std::string_view id, std::string_view tag)
+{
+    const std::uint32_t lineIndex = insert(id);
+    const std::uint32_t tagName = intern(tag);
+
+    Line& line = lines[lineIndex];
+
+    for (std::uint32_t i = 0; i < line.tagCount; i++)
+    {
+        if (tagNames[line.firstTag + i] == tagName)
+        {
+            return;
+        }
+    }
+
+    // a line's tags are usually added together, so its range is at the end.  If it isn't, the range moves there
+    if (line.firstTag + line.tagCount != tagNames.size())
+    {
+        const std::uint32_t firstTag = (std::uint32_t)tagNames.size();
+
+        for (std::uint32_t i = 0; i < line.tagCount; i++)
+        {
+            const std::uint32_t name = tagNames[line.firstTag + i];
+            tagNames.push_back(name);
+        }
+
+        line.firstTag = firstTag;
+    }
+
+    tagNames.push_back(tagName);
+    line.tagCount++;
+}
+
+void Yarn::LineDatabase::clear()
+{
+    arena.clear();
+    lines.clear();
+    names.clear();
+    nameIndices.clear();
+    tagNames.clear();
+    index.clear();
+}
+
+void Yarn::LineDatabase::merge(const LineDatabase& other)
+{
+    for (std::size_t i = 0; i < other.lines.size(); i++)
+    {
+        const LineData data = other.line(i);
+
+        if (other.lines[i].file != EMPTY)
+        {
+            add(data.id, data.text, data.file, data.node, data.lineNumber);
+        }
+
+        for (std::size_t tag = 0; tag < data.tags.size(); tag++)
+        {
+            addTag(data.id, data.tags[tag]);
+        }
+    }
+}
+
+void Yarn::LineDatabase::merge(LineDatabase&& other)
+{
+    if (lines.empty())
+    {
+        arena.swap(other.arena);
+        lines.swap(other.lines);
+        names.swap(other.names);
+        nameIndices.swap(other.nameIndices);
+        tagNames.swap(other.tagNames);
+        index.swap(other.index);
+    }
+    else
+    {
+        merge(other);
+    }
+
+    parsingTime += other.parsingTime;
+}
+
+std::int32_t Yarn::LineDatabase::findLine(std::string_view id) const
+{
+    const std::int32_t lineIndex = probe(id);
+
+    if ((lineIndex != NOT_FOUND) || !bundle)
+    {
+        return lineIndex;
+    }
+
+    // the bundle's lines are numbered after the database's own
+    const BundleFormat::LineRecord* record = bundle->findLine(id);
+
+    return record ? (std::int32_t)(lines.size() + (record - &bundle->line(0))) : NOT_FOUND;
+}
+
+Yarn::LineData Yarn::LineDatabase::line(std::size_t lineIndex) const
+{
+    LineData data;
+
+    if (lineIndex >= lines.size())
+    {
+        const BundleFormat::LineRecord& record = bundle->line(lineIndex - lines.size());
+        const std::span<const std::uint32_t> lineTags = bundle->tags(record);
+
+        data.id = bundle->string(record.id);
+        data.text = bundle->string(record.text);
+        data.file = bundle->string(record.file);
+        data.node = bundle->string(record.node);
+        data.lineNumber = record.lineNumber;
+        data.tags.bundle = bundle.get();
+        data.tags.names = lineTags.data();
+        data.tags.count = lineTags.size();
+
+        return data;
+    }
+
+    const Line& line = lines[lineIndex];
+
+    data.id = view(line.id);
+    data.text = view(line.text);
+    data.file = (line.file != EMPTY) ? name(line.file) : std::string_view();
+    data.node = (line.node != EMPTY) ? name(line.node) : std::string_view();
+    data.lineNumber = line.lineNumber;
+    data.tags.db = this;
+    data.tags.names = tagNames.data() + line.firstTag;
+    data.tags.count = line.tagCount;
+
+    return data;
+}
+
+std::optional<Yarn::LineData> Yarn::LineDatabase::find(std::string_view id) const
+{
+    const std::int32_t lineIndex = findLine(id);
+
+    if (lineIndex == NOT_FOUND)
+    {
+        return std::nullopt;
+    }
+
+    return line(lineIndex);
+}
+
+std::string_view Yarn::LineDatabase::text(std::string_view id) const
+{
+    const std::int32_t lineIndex = findLine(id);
+
+    return (lineIndex != NOT_FOUND) ? text((std::size_t)lineIndex) : std::string_view();
+}
+
+std::string_view Yarn::LineDatabase::text(std::size_t lineIndex) const
+{
+    return (lineIndex < lines.size()) ? view(lines[lineIndex].text) : bundle->string(bundle->line(lineIndex - lines.size()).text);
+}
+
+bool Yarn::LineDatabase::hasTag(std::string_view id, std::string_view tag) const
+{
+    const std::optional<LineData> line = find(id);
+
+    return line && line->tags.contains(tag);
+}
+
+std::vector<std::int32_t> Yarn::LineDatabase::link(const LinkedProgram& program, std::vector<std::string_view>& missing) const
+{
+    std::vector<std::int32_t> lineIndices(program.strings.size(), NOT_FOUND);
+    std::vector<bool> resolved(program.strings.size(), false);
+
+    for (const LinkedProgram::Node& node : program.nodes)
+    {
+        for (const LinkedProgram::Instruction& instruction : node.code)
+        {
+            if ((instruction.opcode != LinkedProgram::RUN_LINE) && (instruction.opcode != LinkedProgram::ADD_OPTION))
+            {
+                continue;
+            }
+
+            // lines are usually run from one place, but options and shared lines aren't
+            if (resolved[instruction.a])
+            {
+                continue;
+            }
+
+            resolved[instruction.a] = true;
+            lineIndices[instruction.a] = findLine(program.strings[instruction.a]);
+
+            if (lineIndices[instruction.a] == NOT_FOUND)
+            {
+                missing.push_back(program.strings[instruction.a]);
+            }
+        }
+    }
+
+    return lineIndices;
+}
+
+std::string Yarn::LineDatabase::cachePath(const std::string& lineCSVFile)
+{
+    const std::string extension = ".csv";
+
+    if (lineCSVFile.ends_with(extension))
+    {
+        return lineCSVFile.substr(0, lineCSVFile.size() - extension.size()) + ".yarnlines";
+    }
+
+    return lineCSVFile + ".yarnlines";
+}
+
+void Yarn::LineDatabase::loadCached(const std::string& lineCSVFile, const std::string& metaCSVFile)
+{
+    const std::string cacheFile = cachePath(lineCSVFile);
+
+    if (loadBinary(cacheFile, lineCSVFile, metaCSVFile))
+    {
+        return;
+    }
+
+    // the cache only holds what was parsed here, not what the database already had
+    LineDatabase parsed;
+    parsed.load(lineCSVFile, metaCSVFile);
+    parsed.saveBinary(cacheFile, lineCSVFile, metaCSVFile);
+
+    merge(std::move(parsed));
+}
+
+bool Yarn::LineDatabase::saveBinary(const std::string& cacheFile, const std::string& lineCSVFile, const std::string& metaCSVFile) const
+{
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byteOrder = CACHE_BYTE_ORDER_MARK;
+
+    if (!stamp(lineCSVFile, header.lines, true) || !stamp(metaCSVFile, header.metadata, true))
+    {
+        return false;
+    }
+
+    // -- string pool.  File and node names repeat on every line, so they're stored once --
+    std::vector<CacheString> strings;
+    std::string stringData;
+    std::unordered_map<std::string_view, std::uint32_t> stringIndices; // views the database's strings
+
+    auto intern = [&](std::string_view s)
+    {
+        auto [it, inserted] = stringIndices.insert({ s, (std::uint32_t)strings.size() });
+
+        if (inserted)
+        {
+            strings.push_back({ (std::uint32_t)stringData.size(), (std::uint32_t)s.size() });
+            stringData += s;
+        }
+
+        return it->second;
+    };
+
+    std::vector<CacheLine> cacheLines;
+    cacheLines.reserve(lines.size());
+
+    // grouped by line, so loading looks each line up once
+    std::vector<CacheTag> cacheTags;
+    cacheTags.reserve(tagNames.size());
+
+    for (std::size_t i = 0; i < lines.size(); i++)
+    {
+        const LineData data = line(i);
+        const std::uint32_t id = intern(data.id);
+
+        // lines that only have tags come back from the tag table
+        if (lines[i].file != EMPTY)
+        {
+            cacheLines.push_back({ id, intern(data.text), intern(data.file), intern(data.node), data.lineNumber });
+        }
+
+        for (std::size_t tag = 0; tag < data.tags.size(); tag++)
+        {
+            cacheTags.push_back({ id, intern(data.tags[tag]) });
+        }
+    }
+
+    if (stringData.size() > std::numeric_limits<std::uint32_t>::max())
+    {
+        return false;
+    }
+
+    std::string payload;
+    payload.append((const char*)strings.data(), strings.size() * sizeof(CacheString));
+    payload.append((const char*)cacheLines.data(), cacheLines.size() * sizeof(CacheLine));
+    payload.append((const char*)cacheTags.data(), cacheTags.size() * sizeof(CacheTag));
+    payload += stringData;
+
+    header.payloadSize = payload.size();
+    header.checksum = fnv1a(payload.data(), payload.size());
+    header.stringCount = (std::uint32_t)strings.size();
+    header.lineCount = (std::uint32_t)cacheLines.size();
+    header.tagCount = (std::uint32_t)cacheTags.size();
+    header.stringDataSize = (std::uint32_t)stringData.size();
+
+    // written to a temporary file and renamed over the cache, so a reader never sees half a cache
+    const std::string temporaryFile = cacheFile + ".tmp";
+
+    {
+        std::ofstream os(temporaryFile, std::ios::binary | std::ios::out | std::ios::trunc);
+
+        if (!os.is_open() || !os.write((const char*)&header, sizeof(header)) || !os.write(payload.data(), (std::streamsize)payload.size()))
+        {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryFile, cacheFile, error);
+
+    if (error)
+    {
+        std::filesystem::remove(temporaryFile, error);
+        return false;
+    }
+
+    return true;
+}
+
+bool Yarn::LineDatabase::loadBinary(const std::string& cacheFile, const std::string& lineCSVFile, const std::string& metaCSVFile)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+    std::string error;
+
+    if (!file.open(cacheFile, error) || (file.size() < sizeof(CacheHeader)))
+    {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || (header.version != CACHE_VERSION) || (header.byteOrder != CACHE_BYTE_ORDER_MARK) ||
+        (header.payloadSize != file.size() - sizeof(header)))
+    {
+        return false;
+    }
+
+    // stale caches are the common failure, and cheaper to rule out than a corrupt one
+    if (!current(lineCSVFile, header.lines) || !current(metaCSVFile, header.metadata))
+    {
+        return false;
+    }
+
+    const unsigned char* payload = file.data() + sizeof(header);
+
+    const std::uint64_t tablesSize = (std::uint64_t)header.stringCount * sizeof(CacheString) + (std::uint64_t)header.lineCount * sizeof(CacheLine) + (std::uint64_t)header.tagCount * sizeof(CacheTag);
+
+    if ((tablesSize + header.stringDataSize != header.payloadSize) || (fnv1a(payload, (std::size_t)header.payloadSize) != header.checksum))
+    {
+        return false;
+    }
+
+    std::vector<CacheString> strings(header.stringCount);
+    std::vector<CacheLine> cacheLines(header.lineCount);
+    std::vector<CacheTag> cacheTags(header.tagCount);
+
+    // copied out rather than cast, as the tables needn't be aligned in the mapping.  Empty tables have no storage to copy to
+    auto read = [&payload](auto& table)
+    {
+        const std::size_t size = table.size() * sizeof(table[0]);
+
+        if (size)
+        {
+            std::memcpy(table.data(), payload, size);
+            payload += size;
+        }
+    };
+
+    read(strings);
+    read(cacheLines);
+    read(cacheTags);
+
+    const std::string_view stringData((const char*)payload, header.stringDataSize);
+
+    for (const CacheString& string : strings)
+    {
+        if ((string.offset > stringData.size()) || (string.size > stringData.size() - string.offset))
+        {
+            return false;
+        }
+    }
+
+    auto valid = [&strings](std::uint32_t index) { return index < strings.size(); };
+
+    for (const CacheLine& line : cacheLines)
+    {
+        if (!valid(line.id) || !valid(line.text) || !valid(line.file) || !valid(line.node))
+        {
+            return false;
+        }
+    }
+
+    for (const CacheTag& tag : cacheTags)
+    {
+        if (!valid(tag.id) || !valid(tag.tag))
+        {
+            return false;
+        }
+    }
+
+    // -- the cache checks out, so nothing can fail from here on --
+    auto string = [&](std::uint32_t index) { return stringData.substr(strings[index].offset, strings[index].size); };
+
+    lines.reserve(lines.size() + cacheLines.size());
+
+    for (const CacheLine& line : cacheLines)
+    {
+        add(string(line.id), string(line.text), string(line.file), string(line.node), line.lineNumber);
+    }
+
+    for (const CacheTag& tag : cacheTags)
+    {
+        addTag(string(tag.id), string(tag.tag));
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+
+    parsingTime += duration.count();
+
+    return true;
+}
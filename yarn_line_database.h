@@ -1,9 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
+
+#include <yarn_bundle.h>
+#include <yarn_embedded.h>
 
 /**
  * @file yarn_line_database.h
@@ -24,35 +31,77 @@
  * db.loadMetadata("Test-Metadata.csv");
  * or:
  * db.load("Test-Lines.csv", "Test-Metadata.csv");
+ * or, for a module embedded in the executable by yarnembed (yarn_embedded.h) :
+ * db.load(module);
+ * or, for a .yarnbundle (yarn_bundle.h), whose lines stay in the mapped file rather than being copied into the database :
+ * db.load(bundle);
+ * or, to skip parsing the csv files when they haven't changed since the last launch :
+ * db.loadCached("Test-Lines.csv", "Test-Metadata.csv");
  *
- * To use the data in your Yarn Dialogue Runner, simply use a LineID string as a key index into the lines or tags member maps.  Eg:
- * std::cout << db.lines[lineID].text << std::endl;
- * 
- * if (db.tags.find("sarcastic") != db.tags.end())
+ * loadCached() keeps a binary copy of the database next to the csv files (Test-Lines.yarnlines) : a checksummed string pool with tables of lines and tags
+ * referring to it, stamped with the size, modification time and hash of both csv files.  The cache is used as long as both files have the size
+ * and modification time they had when it was written, or, if a file was touched, the same hash.  Otherwise the csv files are parsed and the cache is rewritten.
+ *
+ * To use the data in your Yarn Dialogue Runner, look lines up by their LineID.  Eg:
+ * std::cout << db.text(lineID) << std::endl;
+ *
+ * if (std::optional<LineData> line = db.find(lineID))
+ * {
+ *      std::cout << line->file << ":" << line->lineNumber << std::endl;
+ * }
+ *
+ * if (db.hasTag(lineID, "sarcastic"))
  * {
  *      // display with sarcastic font
  * }
+ *
+ * The database is laid out flat : the ids and text of every line live back to back in one arena, file, node and tag names are stored once
+ * and referred to by index, and ids are found through an open addressing hash table.  LineData is a view into it, valid until the database next changes.
+ * Lookups by id look in the database first, then in the bundle.
+ *
+ * Every line, the database's own and the bundle's, has a dense index : 0 to size() - 1 for the database's own lines, then the bundle's, up to lineCount() - 1.
+ * link() resolves the line ids a program runs to those indices once, when the module is loaded, so the runner looks line text up with an array access
+ * (text(index)) instead of hashing the id on every line, and ids the database doesn't have are known before the dialogue runs.
  */
 
 
 namespace Yarn
 {
+    struct LineDatabase;
+    struct LinkedProgram;
+
+    /// the tags of one line.  A view into the line database, valid until it next changes
+    class LineTags
+    {
+    public:
+
+        std::size_t size() const { return count; }
+
+        bool empty() const { return count == 0; }
+
+        std::string_view operator[](std::size_t i) const;
+
+        bool contains(std::string_view tag) const;
+
+    private:
+
+        friend struct LineDatabase;
+
+        const LineDatabase* db = nullptr;
+        const Bundle* bundle = nullptr;         ///< set for lines of a bundle, whose tags index the bundle's string pool
+        const std::uint32_t* names = nullptr;
+        std::size_t count = 0;
+    };
+
+    /// one line of the database.  A view, valid until the database next changes
     struct LineData
     {
-        std::string id;
-        std::string text;
-        std::string file;
-        std::string node;
+        std::string_view id;
+        std::string_view text;
+        std::string_view file;
+        std::string_view node;
         int lineNumber = 0;
-
-        uint64_t sizeBytes() const
-        {
-            return id.size() + sizeof(id)
-                + text.size() + sizeof(text)
-                + file.size() + sizeof(file)
-                + node.size() + sizeof(node)
-                + sizeof(lineNumber);
-        }
+        LineTags tags;
     };
 
     typedef std::string LineID;
@@ -60,22 +109,14 @@ namespace Yarn
 
     struct LineDatabase
     {
-        std::unordered_map<LineID, LineData> lines;
-        std::unordered_map<LineID, std::unordered_set<LineTag> > tags;
+        static constexpr std::int32_t NOT_FOUND = -1;
+
+        std::shared_ptr<const Bundle> bundle; ///< lines and tags read in place from a .yarnbundle, on top of the database's own
         long long parsingTime = 0;
 
-        uint64_t lineCount() const { return lines.size(); }
+        uint64_t lineCount() const { return lines.size() + (bundle ? bundle->lineCount() : 0); }
 
-        uint64_t sizeBytes() const
-        {
-            uint64_t rval = 0;
-            for (const auto& [key, value] : lines)
-            {
-                rval += value.sizeBytes();
-                rval += key.length() + 1 + sizeof(key); // got to include the size of the "key" strings (lineID's) too.
-            }
-            return rval;
-        }
+        uint64_t sizeBytes() const; ///< memory held by the database itself, not counting the mapped bundle
 
         LineDatabase() { }
 
@@ -85,8 +126,142 @@ namespace Yarn
             loadMetadata(metaCSVFile);
         }
 
-        void loadMetadata(const std::string_view& csvFile);
+        void load(const EmbeddedModule& module); ///< lines and tags already parsed by yarnembed
+
+        void load(std::shared_ptr<const Bundle> bundle); ///< lines and tags of a .yarnbundle, looked up where they lie in the mapped file
+
+        void loadMetadata(const std::string_view& csvFile); ///< scanned in place by CsvScanner (yarn_csv.h).  Throws if the file can't be read
+
+        void loadLines(const std::string_view& csvFile); ///< scanned in place by CsvScanner (yarn_csv.h).  Throws if the file can't be read
+
+        /// load with the generic csv reader (depends/csv.hpp), which copies every field and guesses at the layout.  loadMetadata and loadLines fall back
+        /// on these for files without Yarn's columns
+        void loadMetadataGeneric(const std::string_view& csvFile);
+
+        void loadLinesGeneric(const std::string_view& csvFile);
+
+        /// load lineCSVFile and metaCSVFile through the binary cache at cachePath(lineCSVFile), see saveBinary() and loadBinary().
+        /// A cache that can't be written (eg. a read only directory) only costs the time saved by reading it
+        void loadCached(const std::string& lineCSVFile, const std::string& metaCSVFile);
+
+        /// write the database's lines and tags to cacheFile, stamped with the size, modification time and hash of the csv files they were loaded from.  Returns false if the file can't be written
+        bool saveBinary(const std::string& cacheFile, const std::string& lineCSVFile, const std::string& metaCSVFile) const;
+
+        /// add the lines and tags of a cache written by saveBinary().  Returns false, leaving the database as it was, if the cache is missing, corrupt,
+        /// or wasn't written from the current version of the csv files
+        bool loadBinary(const std::string& cacheFile, const std::string& lineCSVFile, const std::string& metaCSVFile);
+
+        static std::string cachePath(const std::string& lineCSVFile); ///< "x-Lines.csv" -> "x-Lines.yarnlines"
+
+        // -- building --
+
+        void add(std::string_view id, std::string_view text, std::string_view file, std::string_view node, int lineNumber); ///< add a line, or replace the line with that id, keeping its tags
+
+        void addTag(std::string_view id, std::string_view tag); ///< a line that isn't in the database yet is added without text
 
-        void loadLines(const std::string_view& csvFile);
+        /// add the lines and tags of other, replacing lines with the same id, and its parsing time.  Takes other's storage instead of copying it when
+        /// the database has no lines of its own.  other's bundle isn't taken
+        void merge(LineDatabase&& other);
+
+        void clear(); ///< the bundle is kept
+
+        // -- lookups --
+
+        std::size_t size() const { return lines.size(); } ///< lines held by the database itself, not counting the bundle's
+
+        std::int32_t findLine(std::string_view id) const; ///< index of the line, NOT_FOUND if there's none with that id
+
+        LineData line(std::size_t index) const; ///< index < lineCount()
+
+        std::optional<LineData> find(std::string_view id) const; ///< a line of the database or of its bundle
+
+        std::string_view text(std::string_view id) const; ///< text of the line, empty if there's no such line.  Valid until the line database changes
+
+        std::string_view text(std::size_t index) const; ///< index < lineCount()
+
+        bool hasTag(std::string_view id, std::string_view tag) const;
+
+        std::string_view name(std::uint32_t index) const { return view(names[index]); } ///< interned file, node or tag name
+
+        /// the index of the line each string of program is the id of, NOT_FOUND for strings no RUN_LINE or ADD_OPTION uses as a line id, see YarnVM::lineIndices.
+        /// Line ids the program uses that aren't in the database are added to missing, once each, viewing the program's string pool
+        std::vector<std::int32_t> link(const LinkedProgram& program, std::vector<std::string_view>& missing) const;
+
+    private:
+
+        static constexpr std::uint32_t EMPTY = 0xFFFFFFFF;
+
+        struct Span
+        {
+            std::uint32_t offset = 0; ///< into arena
+            std::uint32_t size = 0;
+        };
+
+        struct Line
+        {
+            Span id;
+            Span text;
+            std::uint32_t file = EMPTY;     ///< name
+            std::uint32_t node = EMPTY;     ///< name
+            std::int32_t lineNumber = 0;
+            std::uint32_t firstTag = 0;     ///< into tagNames
+            std::uint32_t tagCount = 0;
+        };
+
+        /// entry of the id index.  Keeps part of the id's hash so most mismatches are rejected without touching the line
+        struct Slot
+        {
+            std::uint32_t line = EMPTY;
+            std::uint32_t hash = 0;
+        };
+
+        /// hashes string views and strings alike, so names can be looked up without building a std::string
+        struct NameHash
+        {
+            using is_transparent = void;
+
+            std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+        };
+
+        std::string arena;                  ///< the ids and text of every line, and the names, back to back
+        std::vector<Line> lines;
+        std::vector<Span> names;            ///< file, node and tag names, each stored once
+        std::unordered_map<std::string, std::uint32_t, NameHash, std::equal_to<>> nameIndices;
+        std::vector<std::uint32_t> tagNames; ///< the tags of every line, back to back
+        std::vector<Slot> index;            ///< line ids, open addressing with linear probing.  A power of two in size, at most half full
+
+        std::string_view view(Span span) const { return std::string_view(arena.data() + span.offset, span.size); }
+
+        Span append(std::string_view s);
+
+        std::uint32_t intern(std::string_view name);
+
+        std::int32_t probe(std::string_view id) const; ///< index of the line among the database's own lines, NOT_FOUND if there's none with that id
+
+        std::uint32_t insert(std::string_view id); ///< index of the line with that id, added without text if it's new
+
+        void add(std::string_view id, std::string_view text, std::uint32_t fileName, std::uint32_t nodeName, int lineNumber); ///< add() with the names already interned
+
+        void rehash(std::size_t slots);
+
+        void merge(const LineDatabase& other); ///< add the lines and tags of other, replacing lines with the same id
     };
+
+    inline std::string_view LineTags::operator[](std::size_t i) const
+    {
+        return bundle ? bundle->string(names[i]) : db->name(names[i]);
+    }
+
+    inline bool LineTags::contains(std::string_view tag) const
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if ((*this)[i] == tag)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
 }
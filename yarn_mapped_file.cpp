@@ -0,0 +1,164 @@
+#include <yarn_mapped_file.h>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+using namespace Yarn;
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const std::string& path, std::string& error)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        error = "couldn't open " + path;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+
+    if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart == 0))
+    {
+        CloseHandle(file);
+        error = path + " is empty";
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+    if (!view)
+    {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        error = "couldn't map " + path;
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    bytes = (const unsigned char*)view;
+    length = (std::size_t)fileSize.QuadPart;
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (bytes)
+    {
+        UnmapViewOfFile(bytes);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+    }
+
+    bytes = nullptr;
+    length = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+bool MappedFile::open(const std::string& path, std::string& error)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        error = "couldn't open " + path;
+        return false;
+    }
+
+    struct stat status;
+
+    if ((fstat(fd, &status) != 0) || (status.st_size <= 0))
+    {
+        ::close(fd);
+        error = path + " is empty";
+        return false;
+    }
+
+    void* view = mmap(nullptr, (std::size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping keeps the file alive
+    ::close(fd);
+
+    if (view == MAP_FAILED)
+    {
+        error = "couldn't map " + path;
+        return false;
+    }
+
+    bytes = (const unsigned char*)view;
+    length = (std::size_t)status.st_size;
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (bytes)
+    {
+        munmap((void*)bytes, length);
+    }
+
+    bytes = nullptr;
+    length = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, std::string& error)
+{
+    close();
+
+    std::ifstream is(path, std::ios::binary | std::ios::in);
+
+    if (!is.is_open())
+    {
+        error = "couldn't open " + path;
+        return false;
+    }
+
+    contents.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+
+    if (contents.empty())
+    {
+        error = path + " is empty";
+        return false;
+    }
+
+    bytes = contents.data();
+    length = contents.size();
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    contents.clear();
+    contents.shrink_to_fit();
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * @file yarn_mapped_file.h
+ *
+ * @brief Read only memory mapping of a whole file
+ *
+ * Maps the file with mmap on POSIX systems and with a file mapping on Windows, so its pages are only read from disk when they're touched
+ * and are shared with every other process mapping the same file.  Where neither is available the file is read into memory instead.
+ */
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Yarn
+{
+    class MappedFile
+    {
+    public:
+
+        MappedFile() = default;
+        ~MappedFile() { close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        /// map path, unmapping the file mapped before.  Returns false and fills in error if the file can't be opened, is empty, or can't be mapped
+        bool open(const std::string& path, std::string& error);
+
+        void close();
+
+        const unsigned char* data() const { return bytes; }
+
+        std::size_t size() const { return length; }
+
+    private:
+
+        const unsigned char* bytes = nullptr;
+        std::size_t length = 0;
+
+#if defined(_WIN32)
+        void* fileHandle = nullptr;
+        void* mappingHandle = nullptr;
+#elif !defined(__unix__) && !defined(__APPLE__)
+        std::vector<unsigned char> contents; ///< the file read into memory, where it can't be mapped
+#endif
+    };
+}
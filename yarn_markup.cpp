@@ -1,5 +1,3 @@
-#pragma once
-
 #include <yarn_markup.h>
 #include <regex>
 
@@ -0,0 +1,974 @@
+#include <yarn_program.h>
+#include <yarn_bundle.h>
+#include <yarn_spinner.pb.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <limits>
+#include <mutex>
+#include <unordered_set>
+
+using namespace Yarn;
+
+namespace
+{
+    /// state that's only needed while lowering the program
+    struct Linker
+    {
+        LinkedProgram& linked;
+        std::string& error;
+
+        std::unordered_map<std::int32_t, std::int32_t> stringConstants; // keyed by string
+        std::unordered_map<std::uint32_t, std::int32_t> floatConstants; // keyed by bit pattern so -0 and NaN's don't collapse
+        std::int32_t boolConstants[2] = { LinkedProgram::UNRESOLVED, LinkedProgram::UNRESOLVED };
+        std::unordered_map<std::string, std::int32_t> functionSlots;
+
+        // the node being lowered
+        std::vector<LinkedProgram::Instruction> code;
+        std::vector<LinkedProgram::Label> labels;
+
+        // string values can only view the string pool once it's done growing, so they're filled in at the end of linking
+        std::vector<std::pair<std::int32_t, std::int32_t>> constantStrings;     // constant, string
+        std::vector<std::pair<std::int32_t, std::int32_t>> initialValueStrings; // variable slot, string
+
+        Linker(LinkedProgram& linkedIn, std::string& errorIn) : linked(linkedIn), error(errorIn) { }
+
+        std::int32_t intern(const std::string& s)
+        {
+            auto it = linked.stringIndices.find(s);
+
+            if (it == linked.stringIndices.end())
+            {
+                it = linked.stringIndices.insert({ s, (std::int32_t)linked.strings.size() }).first;
+                linked.strings.push_back(it->first);
+            }
+
+            return it->second;
+        }
+
+        std::int32_t addConstant(const Yarn::Operand& op)
+        {
+            std::int32_t* slot = nullptr;
+            std::int32_t string = LinkedProgram::UNRESOLVED;
+
+            if (op.has_string_value())
+            {
+                string = intern(op.string_value());
+                slot = &stringConstants.insert({ string, LinkedProgram::UNRESOLVED }).first->second;
+            }
+            else if (op.has_float_value())
+            {
+                std::uint32_t bits = 0;
+                float f = op.float_value();
+                std::memcpy(&bits, &f, sizeof(bits));
+
+                slot = &floatConstants.insert({ bits, LinkedProgram::UNRESOLVED }).first->second;
+            }
+            else
+            {
+                slot = &boolConstants[op.bool_value() ? 1 : 0];
+            }
+
+            if (*slot == LinkedProgram::UNRESOLVED)
+            {
+                *slot = (std::int32_t)linked.constants.size();
+                linked.constants.push_back(makeValue(op));
+
+                if (string != LinkedProgram::UNRESOLVED)
+                {
+                    constantStrings.push_back({ *slot, string });
+                }
+            }
+
+            return *slot;
+        }
+
+        /// strings are filled in by resolveStrings()
+        static Value makeValue(const Yarn::Operand& op)
+        {
+            if (op.has_float_value()) return Value(op.float_value());
+            if (op.has_bool_value()) return Value(op.bool_value());
+            return Value();
+        }
+
+        void setInitialValue(const std::string& name, const Yarn::Operand& op)
+        {
+            const std::int32_t slot = variableSlot(name);
+
+            linked.initialValues[slot] = makeValue(op);
+
+            if (op.has_string_value())
+            {
+                initialValueStrings.push_back({ slot, intern(op.string_value()) });
+            }
+        }
+
+        void resolveStrings()
+        {
+            for (const auto& [constant, string] : constantStrings)
+            {
+                linked.constants[constant].set_string_value(linked.strings[string]);
+            }
+
+            for (const auto& [slot, string] : initialValueStrings)
+            {
+                linked.initialValues[slot].set_string_value(linked.strings[string]);
+            }
+        }
+
+        std::int32_t functionSlot(const std::string& name)
+        {
+            auto it = functionSlots.find(name);
+
+            if (it == functionSlots.end())
+            {
+                it = functionSlots.insert({ name, (std::int32_t)linked.functionNames.size() }).first;
+                linked.functionNames.push_back(name);
+            }
+
+            return it->second;
+        }
+
+        std::int32_t variableSlot(const std::string& name)
+        {
+            auto it = linked.variableSlots.find(name);
+
+            if (it == linked.variableSlots.end())
+            {
+                it = linked.variableSlots.insert({ name, (std::int32_t)linked.variableNames.size() }).first;
+                linked.variableNames.push_back(name);
+                linked.initialValues.emplace_back();
+            }
+
+            return it->second;
+        }
+
+        bool fail(const Yarn::Node& node, int index, const std::string& message)
+        {
+            error = "node " + node.name() + ", instruction " + std::to_string(index) + " : " + message;
+            return false;
+        }
+
+        /// lower node into code and labels
+        bool lower(const Yarn::Node& node);
+
+        void fuse();
+
+        void compact(const std::vector<bool>& removed);
+    };
+
+    /// operators the compiler emits as CALL_FUNC, which the VM runs as internal opcodes
+    const std::unordered_map<std::string, LinkedProgram::OpCode> builtInOperators =
+    {
+        { "Number.Add", LinkedProgram::NUMBER_ADD },
+        { "Number.Minus", LinkedProgram::NUMBER_SUBTRACT },
+        { "Number.Multiply", LinkedProgram::NUMBER_MULTIPLY },
+        { "Number.Divide", LinkedProgram::NUMBER_DIVIDE },
+        { "Number.Modulo", LinkedProgram::NUMBER_MODULO },
+        { "Number.UnaryMinus", LinkedProgram::NUMBER_NEGATE },
+        { "Number.EqualTo", LinkedProgram::NUMBER_EQUAL },
+        { "Number.NotEqualTo", LinkedProgram::NUMBER_NOT_EQUAL },
+        { "Number.LessThan", LinkedProgram::NUMBER_LESS },
+        { "Number.LessThanOrEqualTo", LinkedProgram::NUMBER_LESS_EQUAL },
+        { "Number.GreaterThan", LinkedProgram::NUMBER_GREATER },
+        { "Number.GreaterThanOrEqualTo", LinkedProgram::NUMBER_GREATER_EQUAL },
+        { "Bool.And", LinkedProgram::BOOL_AND },
+        { "Bool.Or", LinkedProgram::BOOL_OR },
+        { "Bool.Xor", LinkedProgram::BOOL_XOR },
+        { "Bool.Not", LinkedProgram::BOOL_NOT },
+        { "Bool.EqualTo", LinkedProgram::BOOL_EQUAL },
+        { "Bool.NotEqualTo", LinkedProgram::BOOL_NOT_EQUAL },
+        { "String.Add", LinkedProgram::STRING_ADD },
+        { "String.EqualTo", LinkedProgram::STRING_EQUAL },
+        { "String.NotEqualTo", LinkedProgram::STRING_NOT_EQUAL },
+    };
+
+    bool hasOperand(const Yarn::Instruction& instruction, int index, Yarn::Operand::ValueCase type)
+    {
+        return (instruction.operands_size() > index) && (instruction.operands(index).value_case() == type);
+    }
+}
+
+bool Linker::lower(const Yarn::Node& node)
+{
+    // instructions that are the target of a jump can be reached with anything on the stack
+    std::unordered_set<std::int32_t> jumpTargets;
+    for (const auto& [label, target] : node.labels())
+    {
+        jumpTargets.insert(target);
+    }
+
+    code.assign(node.instructions_size(), {});
+    labels.clear();
+
+    for (int i = 0; i < node.instructions_size(); i++)
+    {
+        const Yarn::Instruction& instruction = node.instructions(i);
+        LinkedProgram::Instruction& lowered = code[i];
+
+        lowered.opcode = (LinkedProgram::OpCode)instruction.opcode();
+
+        switch (instruction.opcode())
+        {
+        case Yarn::Instruction_OpCode_JUMP_TO:
+        case Yarn::Instruction_OpCode_JUMP_IF_FALSE:
+        {
+            if (!hasOperand(instruction, 0, Yarn::Operand::kStringValue))
+            {
+                return fail(node, i, "jump instruction is missing its label operand");
+            }
+
+            const std::string& label = instruction.operands(0).string_value();
+
+            auto it = node.labels().find(label);
+
+            // missing labels are reported when the jump is taken, not when the program is loaded
+            lowered.a = (it != node.labels().end()) ? it->second : LinkedProgram::UNRESOLVED;
+            lowered.b = intern(label);
+        }
+        break;
+        case Yarn::Instruction_OpCode_RUN_LINE:
+        {
+            if (!hasOperand(instruction, 0, Yarn::Operand::kStringValue) || !hasOperand(instruction, 1, Yarn::Operand::kFloatValue))
+            {
+                return fail(node, i, "RUN_LINE expects a string line id and a float substitution count");
+            }
+
+            lowered.a = intern(instruction.operands(0).string_value());
+            lowered.b = (std::int32_t)instruction.operands(1).float_value();
+        }
+        break;
+        case Yarn::Instruction_OpCode_RUN_COMMAND:
+        {
+            if (!hasOperand(instruction, 0, Yarn::Operand::kStringValue))
+            {
+                return fail(node, i, "RUN_COMMAND expects a string command");
+            }
+
+            lowered.a = intern(instruction.operands(0).string_value());
+        }
+        break;
+        case Yarn::Instruction_OpCode_ADD_OPTION:
+        {
+            if (!hasOperand(instruction, 0, Yarn::Operand::kStringValue) ||
+                !hasOperand(instruction, 1, Yarn::Operand::kStringValue) ||
+                !hasOperand(instruction, 2, Yarn::Operand::kFloatValue))
+            {
+                return fail(node, i, "ADD_OPTION expects a string line id, a string destination, and a float substitution count");
+            }
+
+            lowered.a = intern(instruction.operands(0).string_value());
+            lowered.b = intern(instruction.operands(1).string_value());
+            lowered.c = (std::int32_t)instruction.operands(2).float_value();
+
+            if (instruction.operands_size() > 3)
+            {
+                if (!hasOperand(instruction, 3, Yarn::Operand::kBoolValue))
+                {
+                    return fail(node, i, "ADD_OPTION condition operand is not a bool");
+                }
+
+                if (instruction.operands(3).bool_value())
+                {
+                    lowered.flags |= LinkedProgram::HAS_CONDITION;
+                }
+            }
+        }
+        break;
+        case Yarn::Instruction_OpCode_PUSH_STRING:
+        case Yarn::Instruction_OpCode_PUSH_FLOAT:
+        case Yarn::Instruction_OpCode_PUSH_BOOL:
+        {
+            const Yarn::Operand::ValueCase expected =
+                (instruction.opcode() == Yarn::Instruction_OpCode_PUSH_STRING) ? Yarn::Operand::kStringValue :
+                (instruction.opcode() == Yarn::Instruction_OpCode_PUSH_FLOAT) ? Yarn::Operand::kFloatValue :
+                Yarn::Operand::kBoolValue;
+
+            if (!hasOperand(instruction, 0, expected))
+            {
+                return fail(node, i, "push instruction is missing its operand, or the operand has the wrong type");
+            }
+
+            lowered.a = addConstant(instruction.operands(0));
+        }
+        break;
+        case Yarn::Instruction_OpCode_CALL_FUNC:
+        {
+            if (!hasOperand(instruction, 0, Yarn::Operand::kStringValue))
+            {
+                return fail(node, i, "CALL_FUNC expects a string function name");
+            }
+
+            const std::string& name = instruction.operands(0).string_value();
+
+            auto it = builtInOperators.find(name);
+
+            if (it == builtInOperators.end())
+            {
+                lowered.a = functionSlot(name);
+            }
+            else
+            {
+                // the parameter count is fixed for operators, so the PUSH_FLOAT of the count is dropped below where possible
+                lowered.opcode = it->second;
+                lowered.flags |= LinkedProgram::POP_PARAMETER_COUNT;
+            }
+        }
+        break;
+        case Yarn::Instruction_OpCode_PUSH_VARIABLE:
+        case Yarn::Instruction_OpCode_STORE_VARIABLE:
+        {
+            if (!hasOperand(instruction, 0, Yarn::Operand::kStringValue))
+            {
+                return fail(node, i, "variable instruction expects a string variable name");
+            }
+
+            lowered.a = variableSlot(instruction.operands(0).string_value());
+        }
+        break;
+        case Yarn::Instruction_OpCode_RUN_NODE:
+        {
+            lowered.a = LinkedProgram::UNRESOLVED;
+
+            // the compiler always emits PUSH_STRING <node>, RUN_NODE.
+            // anything else we leave for the VM to resolve from the stack at runtime.
+            if ((i > 0) && !jumpTargets.count(i))
+            {
+                const Yarn::Instruction& prev = node.instructions(i - 1);
+
+                if ((prev.opcode() == Yarn::Instruction_OpCode_PUSH_STRING) && hasOperand(prev, 0, Yarn::Operand::kStringValue))
+                {
+                    lowered.a = linked.findNode(prev.operands(0).string_value());
+                }
+            }
+        }
+        break;
+        case Yarn::Instruction_OpCode_JUMP:
+        case Yarn::Instruction_OpCode_SHOW_OPTIONS:
+        case Yarn::Instruction_OpCode_PUSH_NULL:
+        case Yarn::Instruction_OpCode_POP:
+        case Yarn::Instruction_OpCode_STOP:
+            break;
+        default:
+            return fail(node, i, "unknown instruction opcode");
+        }
+    }
+
+    // in name order, like nodes and variables, so the labels' strings and the order they're stored in are the same every time the program is loaded
+    std::vector<const std::string*> labelNames;
+
+    for (const auto& [label, target] : node.labels())
+    {
+        labelNames.push_back(&label);
+    }
+
+    std::sort(labelNames.begin(), labelNames.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+
+    for (const std::string* label : labelNames)
+    {
+        labels.push_back({ intern(*label), node.labels().at(*label) });
+    }
+
+    // -- drop the parameter count pushes in front of built in operators --
+    // an operator that's a jump target could be reached from code that pushed the count, so it has to pop the count itself
+    std::vector<bool> removed(code.size(), false);
+
+    for (std::size_t i = 1; i < code.size(); i++)
+    {
+        LinkedProgram::Instruction& instruction = code[i];
+
+        if ((instruction.flags & LinkedProgram::POP_PARAMETER_COUNT) && (code[i - 1].opcode == LinkedProgram::PUSH_FLOAT) && !jumpTargets.count((std::int32_t)i))
+        {
+            instruction.flags &= ~LinkedProgram::POP_PARAMETER_COUNT;
+            removed[i - 1] = true;
+        }
+    }
+
+    compact(removed);
+
+    fuse();
+
+    // a label at the very end of the node targets the terminator
+    code.push_back({ LinkedProgram::END_OF_NODE });
+
+    // conditional jumps carry on after their target, so one to the terminator would step past it into the next node's code.
+    // Aim them at the instruction before : the step after lands on END_OF_NODE, which reports running off the node like any other path there
+    const std::int32_t end = (std::int32_t)code.size() - 1;
+
+    for (LinkedProgram::Instruction& instruction : code)
+    {
+        if (((instruction.opcode == LinkedProgram::JUMP_IF_FALSE) || (instruction.opcode == LinkedProgram::JUMP_IF_VARIABLE_NOT_EQUAL)) && (instruction.a == end))
+        {
+            instruction.a = end - 1;
+        }
+    }
+
+    return true;
+}
+
+void Linker::fuse()
+{
+    // execution enters at a label for JUMP_TO and JUMP, and after it for JUMP_IF_FALSE.  Only the first instruction of a fused sequence can be entered
+    std::unordered_set<std::int32_t> entries;
+    for (const LinkedProgram::Label& label : labels)
+    {
+        entries.insert(label.target);
+        entries.insert(label.target + 1);
+    }
+
+    auto matches = [&](std::size_t i, std::initializer_list<LinkedProgram::OpCode> sequence)
+    {
+        if (i + sequence.size() > code.size()) return false;
+
+        std::size_t j = i;
+
+        for (LinkedProgram::OpCode opcode : sequence)
+        {
+            if ((code[j].opcode != opcode) || (code[j].flags & LinkedProgram::POP_PARAMETER_COUNT)) return false;
+            if ((j > i) && entries.count((std::int32_t)j)) return false;
+            j++;
+        }
+
+        return true;
+    };
+
+    std::vector<bool> removed(code.size(), false);
+    bool fused = false;
+
+    auto replace = [&](std::size_t i, std::size_t count, const LinkedProgram::Instruction& instruction)
+    {
+        code[i] = instruction;
+        std::fill(removed.begin() + i + 1, removed.begin() + i + count, true);
+        fused = true;
+    };
+
+    for (std::size_t i = 0; i < code.size(); i++)
+    {
+        // PUSH_VARIABLE v, PUSH_FLOAT k, NUMBER_EQUAL, JUMP_IF_FALSE : the usual shape of an if or a condition on the value of a variable
+        if (matches(i, { LinkedProgram::PUSH_VARIABLE, LinkedProgram::PUSH_FLOAT, LinkedProgram::NUMBER_EQUAL, LinkedProgram::JUMP_IF_FALSE }) && (code[i + 3].a != LinkedProgram::UNRESOLVED))
+        {
+            replace(i, 4, { LinkedProgram::JUMP_IF_VARIABLE_NOT_EQUAL, 0, code[i + 3].a, code[i].a, code[i + 1].a });
+            i += 3;
+        }
+        // PUSH_VARIABLE v, PUSH_FLOAT k, NUMBER_ADD, STORE_VARIABLE v, POP : counters, including the node visit counts the compiler maintains
+        else if (matches(i, { LinkedProgram::PUSH_VARIABLE, LinkedProgram::PUSH_FLOAT, LinkedProgram::NUMBER_ADD, LinkedProgram::STORE_VARIABLE, LinkedProgram::POP }) && (code[i].a == code[i + 3].a))
+        {
+            replace(i, 5, { LinkedProgram::ADD_TO_VARIABLE, 0, code[i].a, code[i + 1].a });
+            i += 4;
+        }
+        // PUSH_STRING node, RUN_NODE resolved at link time
+        else if (matches(i, { LinkedProgram::PUSH_STRING, LinkedProgram::RUN_NODE }) && (code[i + 1].a != LinkedProgram::UNRESOLVED))
+        {
+            replace(i, 2, { LinkedProgram::RUN_NODE_DIRECT, 0, code[i + 1].a });
+            i += 1;
+        }
+    }
+
+    if (fused)
+    {
+        compact(removed);
+    }
+}
+
+void Linker::compact(const std::vector<bool>& removed)
+{
+    // a removed instruction maps to the next instruction that's kept.  Jumping to a removed instruction lands there.
+    std::vector<std::int32_t> remap(code.size() + 1);
+    std::int32_t kept = 0;
+
+    for (std::size_t i = 0; i < code.size(); i++)
+    {
+        remap[i] = kept;
+
+        if (!removed[i])
+        {
+            code[kept++] = code[i];
+        }
+    }
+
+    remap[code.size()] = kept;
+    code.resize(kept);
+
+    auto remapTarget = [&remap](std::int32_t target)
+    {
+        return ((target >= 0) && (target < (std::int32_t)remap.size())) ? remap[target] : LinkedProgram::UNRESOLVED;
+    };
+
+    for (LinkedProgram::Instruction& instruction : code)
+    {
+        if ((instruction.opcode == LinkedProgram::JUMP_TO) || (instruction.opcode == LinkedProgram::JUMP_IF_FALSE) || (instruction.opcode == LinkedProgram::JUMP_IF_VARIABLE_NOT_EQUAL))
+        {
+            instruction.a = remapTarget(instruction.a);
+        }
+    }
+
+    for (LinkedProgram::Label& label : labels)
+    {
+        label.target = remapTarget(label.target);
+    }
+}
+
+void LinkedProgram::clear()
+{
+    nodes.clear();
+    loweredCode.clear();
+    loweredLabels.clear();
+    constants.clear();
+    strings.clear();
+    stringIndices.clear();
+    sortedStrings = {};
+    nodeIndices.clear();
+    functionNames.clear();
+    variableNames.clear();
+    initialValues.clear();
+    variableSlots.clear();
+}
+
+std::int32_t LinkedProgram::findNode(const std::string& name) const
+{
+    auto it = nodeIndices.find(name);
+
+    if (it == nodeIndices.end())
+    {
+        return UNRESOLVED;
+    }
+
+    return it->second;
+}
+
+std::int32_t LinkedProgram::findString(const std::string& s) const
+{
+    if (!sortedStrings.empty())
+    {
+        auto it = std::lower_bound(sortedStrings.begin(), sortedStrings.end(), s, [this](std::int32_t index, const std::string& s) { return strings[index] < s; });
+
+        return ((it != sortedStrings.end()) && (strings[*it] == s)) ? *it : UNRESOLVED;
+    }
+
+    auto it = stringIndices.find(s);
+
+    if (it == stringIndices.end())
+    {
+        return UNRESOLVED;
+    }
+
+    return it->second;
+}
+
+std::int32_t LinkedProgram::findVariable(const std::string& name) const
+{
+    auto it = variableSlots.find(name);
+
+    if (it == variableSlots.end())
+    {
+        return UNRESOLVED;
+    }
+
+    return it->second;
+}
+
+std::int32_t LinkedProgram::findLabel(const Node& node, std::string_view label) const
+{
+    for (const Label& l : node.labels)
+    {
+        if (strings[l.name] == label)
+        {
+            return l.target;
+        }
+    }
+
+    return UNRESOLVED;
+}
+
+std::uint64_t LinkedProgram::fingerprint() const
+{
+    // FNV-1a over everything a generated node could refer to by index
+    std::uint64_t hash = 14695981039346656037ull;
+
+    auto mix = [&hash](const void* data, std::size_t size)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+
+    auto mixString = [&mix](std::string_view s)
+    {
+        const std::uint64_t size = s.size();
+        mix(&size, sizeof(size));
+        mix(s.data(), s.size());
+    };
+
+    for (const Node& node : nodes)
+    {
+        mixString(node.source->name());
+
+        for (const Instruction& instruction : node.code)
+        {
+            const std::int32_t fields[] = { instruction.opcode, instruction.flags, instruction.a, instruction.b, instruction.c };
+            mix(fields, sizeof(fields));
+        }
+    }
+
+    for (const Value& constant : constants)
+    {
+        const std::int32_t type = constant.has_float_value() ? 1 : constant.has_bool_value() ? 2 : constant.has_string_value() ? 3 : 0;
+        mix(&type, sizeof(type));
+
+        if (constant.has_float_value())
+        {
+            const float f = constant.float_value();
+            mix(&f, sizeof(f));
+        }
+        else if (constant.has_bool_value())
+        {
+            const bool b = constant.bool_value();
+            mix(&b, sizeof(b));
+        }
+        else if (constant.has_string_value())
+        {
+            mixString(constant.string_value());
+        }
+    }
+
+    for (std::string_view s : strings)
+    {
+        mixString(s);
+    }
+
+    for (const std::vector<std::string>* pool : { &functionNames, &variableNames })
+    {
+        for (const std::string& s : *pool)
+        {
+            mixString(s);
+        }
+    }
+
+    return hash;
+}
+
+bool LinkedProgram::link(const Yarn::Program& program, std::string& error)
+{
+    clear();
+
+    // protobuf maps iterate in a different order every run, so nodes and variables are linked in name order.
+    // That way every index in the linked program (nodes, slots, strings, constants) is the same each time the program is loaded, which code generated by yarn2cpp relies on
+    std::vector<const std::string*> names;
+
+    // -- first pass : number the nodes, so RUN_NODE can refer to nodes that come later in the program --
+    for (const auto& entry : program.nodes())
+    {
+        names.push_back(&entry.first);
+    }
+
+    std::sort(names.begin(), names.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+
+    nodes.reserve(names.size());
+
+    for (const std::string* name : names)
+    {
+        nodeIndices[*name] = (std::int32_t)nodes.size();
+        nodes.push_back({ &program.nodes().at(*name), {}, {} });
+    }
+
+    Linker linker(*this, error);
+
+    // -- declared variables get the first slots --
+    names.clear();
+
+    for (const auto& entry : program.initial_values())
+    {
+        names.push_back(&entry.first);
+    }
+
+    std::sort(names.begin(), names.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+
+    for (const std::string* name : names)
+    {
+        linker.setInitialValue(*name, program.initial_values().at(*name));
+    }
+
+    // -- second pass : lower the instructions of each node --
+    std::vector<std::size_t> codeStarts, labelStarts;
+
+    for (const Node& node : nodes)
+    {
+        if (!linker.lower(*node.source))
+        {
+            clear();
+            return false;
+        }
+
+        codeStarts.push_back(loweredCode.size());
+        labelStarts.push_back(loweredLabels.size());
+
+        loweredCode.insert(loweredCode.end(), linker.code.begin(), linker.code.end());
+        loweredLabels.insert(loweredLabels.end(), linker.labels.begin(), linker.labels.end());
+    }
+
+    codeStarts.push_back(loweredCode.size());
+    labelStarts.push_back(loweredLabels.size());
+
+    // the code is done growing, so the nodes can point into it
+    for (std::size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].code = std::span<const Instruction>(loweredCode).subspan(codeStarts[i], codeStarts[i + 1] - codeStarts[i]);
+        nodes[i].labels = std::span<const Label>(loweredLabels).subspan(labelStarts[i], labelStarts[i + 1] - labelStarts[i]);
+    }
+
+    linker.resolveStrings();
+
+    return true;
+}
+
+bool LinkedProgram::link(const Bundle& bundle, const Yarn::Program& metadata, std::string& error)
+{
+    using namespace BundleFormat;
+
+    clear();
+
+    // the bundle was checked when it was opened : every index in it is in range, and the code runs as it is
+    strings.reserve(bundle.header().programStringCount);
+
+    for (std::uint32_t i = 0; i < bundle.header().programStringCount; i++)
+    {
+        strings.push_back(bundle.string(i));
+    }
+
+    sortedStrings = bundle.section<std::int32_t>(SORTED_STRINGS);
+
+    for (const ValueRecord& constant : bundle.section<ValueRecord>(CONSTANTS))
+    {
+        constants.push_back(bundle.value(constant));
+    }
+
+    const std::span<const Instruction> code = bundle.section<Instruction>(CODE);
+    const std::span<const Label> labels = bundle.section<Label>(LABELS);
+
+    for (const NodeRecord& record : bundle.section<NodeRecord>(NODES))
+    {
+        const std::string name(bundle.string(record.name));
+
+        auto source = metadata.nodes().find(name);
+
+        if (source == metadata.nodes().end())
+        {
+            error = bundle.path() + " : node " + name + " is missing from the node metadata";
+            clear();
+            return false;
+        }
+
+        nodeIndices[name] = (std::int32_t)nodes.size();
+        nodes.push_back({ &source->second, code.subspan(record.firstInstruction, record.instructionCount), labels.subspan(record.firstLabel, record.labelCount) });
+    }
+
+    for (const std::uint32_t name : bundle.section<std::uint32_t>(FUNCTIONS))
+    {
+        functionNames.emplace_back(bundle.string(name));
+    }
+
+    for (const VariableRecord& variable : bundle.section<VariableRecord>(VARIABLES))
+    {
+        variableSlots[std::string(bundle.string(variable.name))] = (std::int32_t)variableNames.size();
+        variableNames.emplace_back(bundle.string(variable.name));
+        initialValues.push_back(bundle.value(variable.initialValue));
+    }
+
+    return true;
+}
+
+namespace
+{
+    /// images by the path they were loaded from, for as long as any VM uses them
+    struct ImageCache
+    {
+        std::mutex mutex;
+        std::condition_variable loaded;                                             ///< notified whenever a path leaves loading
+        std::unordered_map<std::string, std::weak_ptr<const ProgramImage>> images;
+        std::unordered_set<std::string> loading;                                    ///< paths a thread is parsing and linking, without the mutex held
+
+        static ImageCache& instance()
+        {
+            static ImageCache cache;
+            return cache;
+        }
+
+        /// the image loaded from yarncFile, or the one read by read(error) if no VM uses it anymore.  The mutex is only held to look up and add
+        /// images : a thread loading a path that another thread is already loading waits for it and shares its image, rather than reading the file again
+        template <typename Read>
+        std::shared_ptr<const ProgramImage> load(const std::string& yarncFile, std::string& error, Read read)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                loaded.wait(lock, [&]() { return !loading.count(yarncFile); });
+
+                if (std::shared_ptr<const ProgramImage> image = find(yarncFile))
+                {
+                    return image;
+                }
+
+                loading.insert(yarncFile);
+            }
+
+            // takes the path out of loading even if read throws, so threads waiting for it try it themselves
+            struct Loading
+            {
+                ImageCache& cache;
+                const std::string& yarncFile;
+                std::shared_ptr<ProgramImage> image;
+
+                ~Loading()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(cache.mutex);
+                        cache.loading.erase(yarncFile);
+
+                        if (image)
+                        {
+                            cache.add(yarncFile, image);
+                        }
+                    }
+
+                    cache.loaded.notify_all();
+                }
+            } loading{*this, yarncFile, nullptr};
+
+            loading.image = read(error);
+
+            if (loading.image)
+            {
+                loading.image->yarncFile = yarncFile;
+            }
+
+            return loading.image;
+        }
+
+    private:
+
+        /// the image loaded from yarncFile if a VM still uses it.  Doesn't add an entry, those are only made for images that loaded
+        std::shared_ptr<const ProgramImage> find(const std::string& yarncFile) const
+        {
+            auto it = images.find(yarncFile);
+            return (it != images.end()) ? it->second.lock() : nullptr;
+        }
+
+        void add(const std::string& yarncFile, const std::shared_ptr<const ProgramImage>& image)
+        {
+            // drop the entries of images no VM uses anymore
+            for (auto it = images.begin(); it != images.end();)
+            {
+                it = it->second.expired() ? images.erase(it) : std::next(it);
+            }
+
+            images[yarncFile] = image;
+        }
+    };
+
+    std::shared_ptr<ProgramImage> readBundle(const std::string& yarncFile, std::string& error)
+    {
+        std::shared_ptr<ProgramImage> image = std::make_shared<ProgramImage>();
+
+        image->bundle = Bundle::open(yarncFile, error);
+
+        if (!image->bundle)
+        {
+            return nullptr;
+        }
+
+        const std::span<const char> metadata = image->bundle->section<char>(BundleFormat::NODE_METADATA);
+
+        if ((metadata.size() > (std::size_t)std::numeric_limits<int>::max()) || !image->program.ParseFromArray(metadata.data(), (int)metadata.size()))
+        {
+            error = "couldn't parse the node metadata of " + yarncFile;
+            return nullptr;
+        }
+
+        if (!image->linked.link(*image->bundle, image->program, error))
+        {
+            return nullptr;
+        }
+
+        return image;
+    }
+
+    std::shared_ptr<ProgramImage> readProgram(const std::string& yarncFile, std::string& error)
+    {
+        std::ifstream is(yarncFile, std::ios::binary | std::ios::in);
+
+        if (!is.is_open())
+        {
+            error = "couldn't open " + yarncFile;
+            return nullptr;
+        }
+
+        std::shared_ptr<ProgramImage> image = std::make_shared<ProgramImage>();
+
+        if (!image->program.ParseFromIstream(&is))
+        {
+            error = "couldn't parse " + yarncFile;
+            return nullptr;
+        }
+
+        if (!image->linked.link(image->program, error))
+        {
+            return nullptr;
+        }
+
+        return image;
+    }
+}
+
+std::shared_ptr<const ProgramImage> ProgramImage::load(const std::string& yarncFile, std::string& error)
+{
+    return ImageCache::instance().load(yarncFile, error, [&yarncFile](std::string& error)
+    {
+        return Bundle::isBundle(yarncFile) ? readBundle(yarncFile, error) : readProgram(yarncFile, error);
+    });
+}
+
+std::shared_ptr<const ProgramImage> ProgramImage::load(const std::string& yarncFile, const void* data, std::size_t size, std::string& error)
+{
+    return ImageCache::instance().load(yarncFile, error, [&yarncFile, data, size](std::string& error) -> std::shared_ptr<ProgramImage>
+    {
+        std::shared_ptr<ProgramImage> image = std::make_shared<ProgramImage>();
+
+        if ((size > (std::size_t)std::numeric_limits<int>::max()) || !image->program.ParseFromArray(data, (int)size))
+        {
+            error = "couldn't parse " + yarncFile;
+            return nullptr;
+        }
+
+        if (!image->linked.link(image->program, error))
+        {
+            return nullptr;
+        }
+
+        return image;
+    });
+}
+
+std::shared_ptr<const ProgramImage> ProgramImage::create(Yarn::Program&& program, std::string& error)
+{
+    std::shared_ptr<ProgramImage> image = std::make_shared<ProgramImage>();
+
+    image->program = std::move(program);
+
+    if (!image->linked.link(image->program, error))
+    {
+        return nullptr;
+    }
+
+    return image;
+}
+
+const std::shared_ptr<const ProgramImage>& ProgramImage::empty()
+{
+    static const std::shared_ptr<const ProgramImage> image = std::make_shared<ProgramImage>();
+    return image;
+}
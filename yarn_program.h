@@ -0,0 +1,199 @@
+#pragma once
+
+/**
+ * @file yarn_program.h
+ *
+ * @brief Load time linking and lowering of compiled Yarn programs
+ *
+ * The compiled .yarnc program is a tree of protobuf messages that refers to jump labels, functions, and nodes by name.
+ * LinkedProgram lowers every node into a flat array of fixed width instructions once, right after the program is loaded :
+ * - labels, functions, and nodes are resolved to indices, so the VM never hashes a string while it runs
+ * - operands are validated once and stored as indices into side pools of constants and interned strings
+ * - every variable gets a dense slot, so the VM can keep variables in a flat array
+ * - calls to the built in Number, Bool, and String operators become internal opcodes the VM executes inline
+ * - a few common instruction sequences are fused into superinstructions, each executed in one dispatch
+ *
+ * The name -> index tables are kept around for the public by-name interface of the VM (eg. loadNode("Start"))
+ *
+ * ProgramImage bundles a parsed program with its linked form.  Images are immutable once loaded, so any number of VMs, on any threads, can run one image
+ */
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <yarn_spinner.pb.h>
+#include <yarn_value.h>
+
+namespace Yarn
+{
+    class Bundle;
+
+    struct LinkedProgram
+    {
+        static constexpr std::int32_t UNRESOLVED = -1;
+
+        /// opcodes of the lowered instructions.  The values match Yarn::Instruction::OpCode
+        enum OpCode : std::uint16_t
+        {
+            JUMP_TO = Yarn::Instruction_OpCode_JUMP_TO,             ///< a = target instruction, b = string : label name
+            JUMP = Yarn::Instruction_OpCode_JUMP,                   ///< jump to the label named on top of the stack
+            RUN_LINE = Yarn::Instruction_OpCode_RUN_LINE,           ///< a = string : line id, b = substitution count
+            RUN_COMMAND = Yarn::Instruction_OpCode_RUN_COMMAND,     ///< a = string : command text
+            ADD_OPTION = Yarn::Instruction_OpCode_ADD_OPTION,       ///< a = string : line id, b = string : destination label, c = substitution count, flags : HAS_CONDITION
+            SHOW_OPTIONS = Yarn::Instruction_OpCode_SHOW_OPTIONS,
+            PUSH_STRING = Yarn::Instruction_OpCode_PUSH_STRING,     ///< a = constant
+            PUSH_FLOAT = Yarn::Instruction_OpCode_PUSH_FLOAT,       ///< a = constant
+            PUSH_BOOL = Yarn::Instruction_OpCode_PUSH_BOOL,         ///< a = constant
+            PUSH_NULL = Yarn::Instruction_OpCode_PUSH_NULL,
+            JUMP_IF_FALSE = Yarn::Instruction_OpCode_JUMP_IF_FALSE, ///< a = target instruction, b = string : label name
+            POP = Yarn::Instruction_OpCode_POP,
+            CALL_FUNC = Yarn::Instruction_OpCode_CALL_FUNC,         ///< a = function slot
+            PUSH_VARIABLE = Yarn::Instruction_OpCode_PUSH_VARIABLE, ///< a = variable slot
+            STORE_VARIABLE = Yarn::Instruction_OpCode_STORE_VARIABLE, ///< a = variable slot
+            STOP = Yarn::Instruction_OpCode_STOP,
+            RUN_NODE = Yarn::Instruction_OpCode_RUN_NODE,           ///< a = node index, or UNRESOLVED to take the node name from the top of the stack
+
+            // -- internal opcodes, never serialized.  Built in operators recognized at load time and executed inline instead of through the function table --
+            // they pop their operands and push the result like CALL_FUNC would, flags : POP_PARAMETER_COUNT
+
+            NUMBER_ADD,
+            NUMBER_SUBTRACT,
+            NUMBER_MULTIPLY,
+            NUMBER_DIVIDE,
+            NUMBER_MODULO,
+            NUMBER_NEGATE,
+            NUMBER_EQUAL,
+            NUMBER_NOT_EQUAL,
+            NUMBER_LESS,
+            NUMBER_LESS_EQUAL,
+            NUMBER_GREATER,
+            NUMBER_GREATER_EQUAL,
+            BOOL_AND,
+            BOOL_OR,
+            BOOL_XOR,
+            BOOL_NOT,
+            BOOL_EQUAL,
+            BOOL_NOT_EQUAL,
+            STRING_ADD,
+            STRING_EQUAL,
+            STRING_NOT_EQUAL,
+
+            // -- superinstructions : common sequences of lowered instructions fused into one at load time, see Linker::fuse --
+
+            JUMP_IF_VARIABLE_NOT_EQUAL, ///< PUSH_VARIABLE b, PUSH_FLOAT c, NUMBER_EQUAL, JUMP_IF_FALSE a.  a = target instruction, b = variable slot, c = constant
+            ADD_TO_VARIABLE,            ///< PUSH_VARIABLE a, PUSH_FLOAT b, NUMBER_ADD, STORE_VARIABLE a, POP.  a = variable slot, b = constant
+            RUN_NODE_DIRECT,            ///< PUSH_STRING, RUN_NODE.  a = node index
+
+            END_OF_NODE, ///< appended after the last instruction of every node, so the VM doesn't have to check the instruction pointer against the node's bounds
+
+            OPCODE_COUNT
+        };
+
+        enum InstructionFlags : std::uint16_t
+        {
+            HAS_CONDITION = 1 << 0, ///< ADD_OPTION : pop a bool off the stack which enables / disables the option
+            POP_PARAMETER_COUNT = 1 << 1, ///< built in operators : the parameter count pushed for CALL_FUNC is still on the stack and has to be popped first
+        };
+
+        /// fixed width lowered instruction.  What the operands mean depends on the opcode, see OpCode
+        struct Instruction
+        {
+            OpCode opcode = STOP;
+            std::uint16_t flags = 0;
+            std::int32_t a = 0;
+            std::int32_t b = 0;
+            std::int32_t c = 0;
+        };
+
+        static_assert(sizeof(Instruction) == 16, "lowered instructions should stay 16 bytes so a node's code packs densely into cache lines");
+
+        struct Label
+        {
+            std::int32_t name = UNRESOLVED;   ///< string
+            std::int32_t target = UNRESOLVED; ///< instruction index in the lowered code
+        };
+
+        struct Node
+        {
+            const Yarn::Node* source = nullptr;
+            std::span<const Instruction> code; ///< lowered instructions, terminated by END_OF_NODE.  Built in operator calls take fewer instructions than in the source node, so indices don't match the source
+            std::span<const Label> labels;     ///< the source node's labels, remapped to the lowered code
+        };
+
+        std::vector<Node> nodes;
+
+        std::vector<Instruction> loweredCode; ///< the code of every node, back to back.  Empty when the code is used in place from a bundle
+        std::vector<Label> loweredLabels;     ///< the labels of every node, back to back.  Empty when the labels are used in place from a bundle
+
+        std::vector<Value> constants; ///< values pushed by PUSH_STRING, PUSH_FLOAT, PUSH_BOOL.  String constants view the string pool
+
+        std::vector<std::string_view> strings; ///< interned line ids, command text, labels, and string constants.  View the keys of stringIndices, or the string pool of a bundle
+
+        std::unordered_map<std::string, std::int32_t> stringIndices; ///< string -> index into strings.  Empty for bundles, which keep the pool sorted instead
+
+        std::span<const std::int32_t> sortedStrings; ///< indices into strings, in string order.  Only for bundles, see findString()
+
+        std::unordered_map<std::string, std::int32_t> nodeIndices; ///< node name -> index into nodes
+
+        std::vector<std::string> functionNames; ///< function table slot -> name of the function to bind to that slot
+
+        std::vector<std::string> variableNames; ///< variable slot -> name of every variable with an initial value or used by an instruction
+
+        std::vector<Value> initialValues; ///< variable slot -> initial value.  Variables the program doesn't declare start out with no value
+
+        std::unordered_map<std::string, std::int32_t> variableSlots; ///< variable name -> slot.  Only for the by-name interface and serialization, instructions use the slots directly
+
+        LinkedProgram() = default;
+        LinkedProgram(const LinkedProgram&) = delete; ///< nodes, strings, and constants point into the program's own pools
+        LinkedProgram& operator=(const LinkedProgram&) = delete;
+
+        /// lower and link all the nodes in the program.  The program must outlive this object, since the linked nodes point to the source nodes.
+        /// returns false and fills in error if the program contains a malformed instruction
+        bool link(const Yarn::Program& program, std::string& error);
+
+        /// use the code and pools of a bundle in place, see yarn_bundle.h.  metadata is the bundle's node metadata : the program's nodes without their instructions.
+        /// The bundle and metadata must outlive this object.  Returns false and fills in error if a node of the bundle isn't in metadata
+        bool link(const Bundle& bundle, const Yarn::Program& metadata, std::string& error);
+
+        void clear();
+
+        std::int32_t findNode(const std::string& name) const; ///< returns UNRESOLVED if there's no node with that name
+
+        std::int32_t findString(const std::string& s) const; ///< returns UNRESOLVED if the string isn't in the pool
+
+        std::int32_t findVariable(const std::string& name) const; ///< returns UNRESOLVED if the program doesn't use a variable with that name
+
+        std::int32_t findLabel(const Node& node, std::string_view label) const; ///< instruction index of the label, or UNRESOLVED
+
+        std::uint64_t fingerprint() const; ///< hash of the lowered code and of every pool it indexes.  The same every time the same program is loaded, see yarn_compiled.h
+    };
+
+    /// a loaded program and its linked form.  Never modified once loaded : VMs hold it through a shared_ptr<const ProgramImage>, and keep their own state
+    struct ProgramImage
+    {
+        Yarn::Program program;  ///< for bundles, only the nodes' metadata : their code is in the bundle
+        LinkedProgram linked;   ///< points into program and bundle, so an image never moves once it's linked
+        std::string yarncFile;  ///< path the program was loaded from, empty if it wasn't loaded from a file
+        std::shared_ptr<const Bundle> bundle; ///< the mapped .yarnbundle the program runs from, null if it was linked from a .yarnc
+
+        /// load and link a compiled program file, or map a .yarnbundle (see yarn_bundle.h).  Images are cached by path for as long as any VM uses them,
+        /// so loading a file that's already loaded returns the same image, and threads loading the same file at once share one read of it.
+        /// returns nullptr and fills in error if the file can't be read or linked.  Thread safe
+        static std::shared_ptr<const ProgramImage> load(const std::string& yarncFile, std::string& error);
+
+        /// parse and link a compiled program that's already in memory, eg. embedded in the executable by yarnembed.  Cached under yarncFile like load(),
+        /// so saved VM states that refer to yarncFile restore without the file existing, as long as the image is still loaded.  Thread safe
+        static std::shared_ptr<const ProgramImage> load(const std::string& yarncFile, const void* data, std::size_t size, std::string& error);
+
+        /// link a program that's already in memory.  Not cached.  Returns nullptr and fills in error if the program can't be linked
+        static std::shared_ptr<const ProgramImage> create(Yarn::Program&& program, std::string& error);
+
+        /// an empty program, for VMs that haven't loaded one yet
+        static const std::shared_ptr<const ProgramImage>& empty();
+    };
+}
@@ -0,0 +1,350 @@
+#include <yarn_scheduler.h>
+
+#include <algorithm>
+
+using namespace Yarn;
+
+/// a VM and the callbacks that record its output into the buffer of the worker running it
+struct DialogueScheduler::Session : public YarnVM::YarnCallbacks
+{
+    YarnVM vm;
+    SessionId id;
+    bool queued = false; ///< in the runnable list
+    std::vector<Event>* buffer = nullptr; ///< set by the worker for as long as it runs the session
+
+    Session(std::shared_ptr<const ProgramImage> image, const YarnVM::Settings& settings, SessionId id)
+        : vm(std::move(image), settings), id(id)
+    {
+        vm.setCallbacks(this);
+    }
+
+    void onRunLine(const YarnVM::Line& line) override
+    {
+        buffer->push_back({Event::LINE, id, line.id, line.substitutions});
+    }
+
+    void onRunCommand(const std::string_view& command) override
+    {
+        if (vm.handleWaitCommand(command))
+        {
+            return;
+        }
+
+        buffer->push_back({Event::COMMAND, id, command, {}});
+    }
+
+    void onPresentOptions(const YarnVM::OptionsList&) override
+    {
+        // the options stay in vm.currentOptionsList until the host selects one
+        buffer->push_back({Event::OPTIONS, id, {}, {}});
+    }
+
+    void onProgramStopped() override
+    {
+        buffer->push_back({Event::STOPPED, id, {}, {}});
+    }
+};
+
+DialogueScheduler::DialogueScheduler(std::shared_ptr<const ProgramImage> image)
+    : DialogueScheduler(std::move(image), Settings())
+{
+}
+
+DialogueScheduler::DialogueScheduler(std::shared_ptr<const ProgramImage> image, const Settings& settings)
+    : image(image ? std::move(image) : ProgramImage::empty()), settings(settings)
+{
+    workers = settings.threadCount ? settings.threadCount : std::max(1u, std::thread::hardware_concurrency());
+
+    queues.reset(new WorkQueue[workers]);
+    eventBuffers.resize(workers);
+
+    for (unsigned i = 1; i < workers; i++)
+    {
+        threads.emplace_back(&DialogueScheduler::workerLoop, this, i);
+    }
+}
+
+DialogueScheduler::~DialogueScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopping = true;
+    }
+
+    startTick.notify_all();
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+DialogueScheduler::SessionId DialogueScheduler::addSession(const std::string& startNode, const YarnVM::Settings& vmSettings)
+{
+    const SessionId id = freeSessions.empty() ? (SessionId)sessions.size() : freeSessions.back();
+
+    // loaded before it's added, so a start node that throws leaves no half made session behind
+    std::unique_ptr<Session> session = std::make_unique<Session>(image, vmSettings, id);
+    session->vm.setTime(now);
+    session->vm.loadNode(startNode);
+
+    if (freeSessions.empty())
+    {
+        sessions.emplace_back();
+    }
+    else
+    {
+        freeSessions.pop_back();
+    }
+
+    sessions[id] = std::move(session);
+    place(*sessions[id]);
+
+    return id;
+}
+
+void DialogueScheduler::removeSession(SessionId session)
+{
+    if (session < sessions.size() && sessions[session])
+    {
+        if (sessions[session]->queued)
+        {
+            runnable.erase(std::find(runnable.begin(), runnable.end(), session));
+        }
+
+        sleepers.cancel(session);
+        sessions[session].reset();
+        freeSessions.push_back(session);
+    }
+}
+
+YarnVM& DialogueScheduler::vm(SessionId session)
+{
+    return sessions.at(session)->vm;
+}
+
+void DialogueScheduler::selectOption(SessionId session, int selection)
+{
+    Session& s = *sessions.at(session);
+    s.vm.selectOption(selection);
+    place(s);
+}
+
+void DialogueScheduler::resume(SessionId session)
+{
+    place(*sessions.at(session));
+}
+
+void DialogueScheduler::place(Session& session)
+{
+    switch (session.vm.runningState)
+    {
+    case YarnVM::RUNNING:
+        sleepers.cancel(session.id);
+
+        if (!session.queued)
+        {
+            session.queued = true;
+            runnable.push_back(session.id);
+        }
+        break;
+    case YarnVM::ASLEEP:
+        sleepers.schedule(session.id, session.vm.waitUntilTime);
+        break;
+    default:
+        sleepers.cancel(session.id);
+        break;
+    }
+}
+
+void DialogueScheduler::tick(long long dt)
+{
+    lastTick = TickStats();
+    now += dt;
+
+    woken.clear();
+    sleepers.advance(now, woken);
+
+    for (SessionId id : woken)
+    {
+        Session& session = *sessions[id];
+        session.vm.setTime(now);
+        place(session);
+    }
+
+    lastTick.runnable = runnable.size();
+    lastTick.parked = sessionCount() - runnable.size();
+
+    for (std::vector<Event>& buffer : eventBuffers)
+    {
+        buffer.clear();
+    }
+
+    if (runnable.empty())
+    {
+        return;
+    }
+
+    // deal the batches out round robin, so every worker starts with its share and only steals to even out the tail of the tick
+    const std::uint32_t batchSize = (std::uint32_t)std::max<std::size_t>(1, settings.batchSize);
+    unsigned worker = 0;
+
+    for (std::uint32_t begin = 0; begin < runnable.size(); begin += batchSize)
+    {
+        queues[worker].batches.push_back({begin, std::min<std::uint32_t>(begin + batchSize, (std::uint32_t)runnable.size())});
+        worker = (worker + 1) % workers;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        busyWorkers = workers - 1;
+        generation++;
+    }
+
+    startTick.notify_all();
+
+    work(0);
+
+    {
+        std::unique_lock<std::mutex> lock(poolMutex);
+        tickDone.wait(lock, [this] { return busyWorkers == 0; });
+    }
+
+    for (unsigned i = 0; i < workers; i++)
+    {
+        lastTick.steals += queues[i].steals;
+        lastTick.instructions += queues[i].instructions;
+        queues[i].steals = 0;
+        queues[i].instructions = 0;
+    }
+
+    // sessions still running stay queued, sleepers go into the wheel, and the rest are parked until the host answers or resumes them
+    ran.swap(runnable);
+    runnable.clear();
+
+    for (SessionId id : ran)
+    {
+        Session& session = *sessions[id];
+        session.queued = false;
+        place(session);
+    }
+}
+
+void DialogueScheduler::workerLoop(unsigned worker)
+{
+    std::uint64_t seen = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            startTick.wait(lock, [&] { return stopping || generation != seen; });
+
+            if (stopping)
+            {
+                return;
+            }
+
+            seen = generation;
+        }
+
+        work(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+
+            if (--busyWorkers == 0)
+            {
+                tickDone.notify_one();
+            }
+        }
+    }
+}
+
+void DialogueScheduler::work(unsigned worker)
+{
+    std::vector<Event>& buffer = eventBuffers[worker];
+    Batch batch;
+
+    while (takeBatch(worker, batch))
+    {
+        for (std::uint32_t i = batch.begin; i < batch.end; i++)
+        {
+            Session& session = *sessions[runnable[i]];
+
+            const std::uint64_t start = session.vm.instructionsExecuted;
+            runSession(session, buffer);
+            queues[worker].instructions += session.vm.instructionsExecuted - start;
+        }
+    }
+}
+
+bool DialogueScheduler::takeBatch(unsigned worker, Batch& batch)
+{
+    {
+        WorkQueue& own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.batches.empty())
+        {
+            batch = own.batches.back();
+            own.batches.pop_back();
+            return true;
+        }
+    }
+
+    // no batches are added once a tick has started, so once every queue is empty the tick's work is done
+    for (unsigned i = 1; i < workers; i++)
+    {
+        WorkQueue& victim = queues[(worker + i) % workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.batches.empty())
+        {
+            batch = victim.batches.front();
+            victim.batches.pop_front();
+            queues[worker].steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DialogueScheduler::runSession(Session& session, std::vector<Event>& buffer)
+{
+    YarnVM& vm = session.vm;
+    session.buffer = &buffer;
+
+    vm.setTime(now);
+
+    const std::uint64_t start = vm.instructionsExecuted;
+
+    try
+    {
+        for (;;)
+        {
+            const std::uint64_t used = vm.instructionsExecuted - start;
+
+            if (used >= settings.instructionBudget)
+            {
+                break;
+            }
+
+            const YarnVM::YieldReason reason = vm.runFor(settings.instructionBudget - used);
+
+            if (reason != YarnVM::YIELD_LINE && reason != YarnVM::YIELD_COMMAND)
+            {
+                break;
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        // there's no one to rethrow to on a worker thread, so a runtime error just ends the session
+        vm.runningState = YarnVM::STOPPED;
+        buffer.push_back({Event::STOPPED, session.id, {}, {}});
+    }
+
+    session.buffer = nullptr;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+/**
+ * @file yarn_scheduler.h
+ *
+ * @brief Runs many independent dialogue sessions over one shared program image on a work stealing thread pool
+ *
+ * Meant for servers and simulations that step thousands of YarnVMs per tick.  Every session is a YarnVM running the
+ * scheduler's ProgramImage with its own state, started at a node of the host's choosing.
+ *
+ * Each tick() :
+ * - advances the scheduler's clock, and wakes exactly the sleeping sessions whose wait is over, from a timer wheel (see yarn_timer_wheel.h)
+ * - parks sessions that are awaiting input, asleep, or stopped : they aren't handed to a worker, or looked at at all, until they're woken, answered or resumed
+ * - splits the runnable sessions into batches, deals the batches out to the workers' deques, and runs them.  A worker that runs out of batches steals from the others
+ * - runs every session until it presents options, sleeps, stops, or uses up its instruction budget for the tick.  Lines and commands don't stop a session
+ *
+ * Lines, commands, options and stops are recorded as Events in the buffer of the worker that ran the session, so workers never contend on output.
+ * A session only ever runs on one worker per tick, so its own events are in order within that buffer.
+ * The built in "wait <time>" command is handled by the scheduler and puts the session to sleep, other commands are passed on as events.
+ * A session that hits a runtime error is stopped, with a STOPPED event.
+ *
+ * Sessions, options and custom functions are only touched by the host between ticks; nothing here is safe to call while tick() runs.
+ * A session's vm.time is only brought up to date with the scheduler's clock when the session runs.
+ * After changing a session's VM directly (eg. loading a node or restoring a save), call resume() so the scheduler sees its new state.
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <yarn_timer_wheel.h>
+#include <yarn_vm.h>
+
+namespace Yarn
+{
+    class DialogueScheduler
+    {
+    public:
+
+        typedef std::uint32_t SessionId;
+
+        struct Settings
+        {
+            unsigned threadCount = 0;               ///< workers, counting the thread that calls tick().  0 : one per hardware thread
+            std::size_t instructionBudget = 100000; ///< per session per tick, so a session stuck in a loop can't stall the tick
+            std::size_t batchSize = 32;             ///< sessions per unit of work handed to a worker or stolen
+        };
+
+        /// output of a session, recorded while it runs
+        struct Event
+        {
+            enum Type { LINE, COMMAND, OPTIONS, STOPPED };
+
+            Type type;
+            SessionId session;
+            std::string_view text;                       ///< LINE : line id.  COMMAND : command text.  Views the program image's string pool
+            std::vector<Yarn::Operand> substitutions;    ///< LINE only
+        };
+
+        /// what the last tick did
+        struct TickStats
+        {
+            std::size_t runnable = 0;           ///< sessions run
+            std::size_t parked = 0;             ///< sessions awaiting input, asleep, or stopped
+            std::size_t steals = 0;             ///< batches run by a worker other than the one they were dealt to
+            std::uint64_t instructions = 0;
+        };
+
+        DialogueScheduler(std::shared_ptr<const ProgramImage> image);
+
+        DialogueScheduler(std::shared_ptr<const ProgramImage> image, const Settings& settings);
+
+        ~DialogueScheduler(); ///< stops and joins the workers
+
+        DialogueScheduler(const DialogueScheduler&) = delete;
+        DialogueScheduler& operator=(const DialogueScheduler&) = delete;
+
+        /// start a new session at startNode.  Returns the id of the session, ids of removed sessions are reused.
+        /// If startNode can't be loaded and the VM throws (see YarnVM::Settings), the exception is passed on and no session is added
+        SessionId addSession(const std::string& startNode = "Start", const YarnVM::Settings& vmSettings = YarnVM::Settings());
+
+        void removeSession(SessionId session);
+
+        YarnVM& vm(SessionId session); ///< the session's VM, eg. to add custom functions, set variables, or read the options it's presenting
+
+        void selectOption(SessionId session, int selection); ///< answer the options a session presented.  The session runs again on the next tick
+
+        void resume(SessionId session); ///< reschedule a session according to its VM's running state, after the host changed the VM directly
+
+        void tick(long long dt); ///< advance the clock by dt, wake the sessions whose wait is over, and run the runnable sessions.  Blocks until they've all yielded
+
+        long long time() const { return now; }
+
+        const std::vector<std::vector<Event>>& events() const { return eventBuffers; } ///< the last tick's events, one buffer per worker.  Cleared by the next tick
+
+        const TickStats& stats() const { return lastTick; }
+
+        std::size_t sessionCount() const { return sessions.size() - freeSessions.size(); }
+
+        unsigned threadCount() const { return workers; }
+
+        const std::shared_ptr<const ProgramImage> image;
+
+        const Settings settings;
+
+    private:
+
+        struct Session;
+
+        /// a run of entries in the runnable list
+        struct Batch
+        {
+            std::uint32_t begin;
+            std::uint32_t end;
+        };
+
+        /// one per worker.  The owner takes batches from the back, thieves from the front
+        struct alignas(64) WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<Batch> batches;
+            std::size_t steals = 0;             ///< by this worker, this tick
+            std::uint64_t instructions = 0;     ///< by this worker, this tick
+        };
+
+        std::vector<std::unique_ptr<Session>> sessions; ///< indexed by SessionId, nullptr for removed sessions
+        std::vector<SessionId> freeSessions;
+
+        std::vector<SessionId> runnable; ///< sessions to run on the next tick, each at most once
+        std::vector<SessionId> ran;      ///< the sessions run by the last tick, to requeue
+        std::vector<SessionId> woken;
+        TimerWheel sleepers;             ///< asleep sessions, keyed by their VM's waitUntilTime
+        long long now = 0;
+        std::vector<std::vector<Event>> eventBuffers; ///< per worker
+        std::unique_ptr<WorkQueue[]> queues; ///< per worker
+        unsigned workers = 1;
+
+        // -- worker threads.  Worker 0 is the thread calling tick() --
+
+        std::vector<std::thread> threads;
+        std::mutex poolMutex;
+        std::condition_variable startTick;
+        std::condition_variable tickDone;
+        std::uint64_t generation = 0; ///< incremented to start a tick
+        unsigned busyWorkers = 0;
+        bool stopping = false;
+
+        TickStats lastTick;
+
+        void workerLoop(unsigned worker);
+
+        void work(unsigned worker); ///< run batches until every queue is empty
+
+        bool takeBatch(unsigned worker, Batch& batch);
+
+        void runSession(Session& session, std::vector<Event>& buffer);
+
+        void place(Session& session); ///< queue, sleep, or park the session according to its VM's running state
+    };
+}
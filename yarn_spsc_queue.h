@@ -0,0 +1,93 @@
+#pragma once
+
+/**
+ * @file yarn_spsc_queue.h
+ *
+ * @brief Fixed capacity lock free queue between exactly one producer thread and one consumer thread
+ *
+ * push() is only ever called from the producer thread and pop() from the consumer thread.  Neither blocks : push() fails when the queue is full and pop() when it's empty.
+ * Each side keeps a cached copy of the other side's position, so it only touches the other side's cache line when the cached copy says the queue is full / empty.
+ */
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace Yarn
+{
+    template <typename T>
+    class SPSCQueue
+    {
+    public:
+
+        explicit SPSCQueue(std::size_t capacity) : mask(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1), slots(new T[mask + 1]) {} ///< capacity is rounded up to a power of two
+
+        SPSCQueue(const SPSCQueue&) = delete;
+        SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+        /// producer : returns false, without moving from value, if the queue is full
+        bool push(T&& value)
+        {
+            const std::size_t h = head.load(std::memory_order_relaxed);
+
+            if (h - cachedTail > mask)
+            {
+                cachedTail = tail.load(std::memory_order_acquire);
+
+                if (h - cachedTail > mask)
+                {
+                    return false;
+                }
+            }
+
+            slots[h & mask] = std::move(value);
+            head.store(h + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        bool push(const T& value)
+        {
+            T copy = value;
+            return push(std::move(copy));
+        }
+
+        /// consumer : returns false if the queue is empty
+        bool pop(T& value)
+        {
+            const std::size_t t = tail.load(std::memory_order_relaxed);
+
+            if (t == cachedHead)
+            {
+                cachedHead = head.load(std::memory_order_acquire);
+
+                if (t == cachedHead)
+                {
+                    return false;
+                }
+            }
+
+            value = std::move(slots[t & mask]);
+            tail.store(t + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); } ///< only exact when called from one of the two threads while the other is idle
+
+        std::size_t capacity() const { return mask + 1; }
+
+    private:
+
+        const std::size_t mask;
+        const std::unique_ptr<T[]> slots;
+
+        alignas(64) std::atomic<std::size_t> head = 0;  ///< written by the producer
+        std::size_t cachedTail = 0;                      ///< producer's last look at tail
+
+        alignas(64) std::atomic<std::size_t> tail = 0;  ///< written by the consumer
+        std::size_t cachedHead = 0;                      ///< consumer's last look at head
+    };
+}
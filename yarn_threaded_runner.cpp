@@ -0,0 +1,165 @@
+#include <yarn_threaded_runner.h>
+
+Yarn::ThreadedRunner::ThreadedRunner(std::size_t queueCapacity)
+    : outputs(queueCapacity), inputs(queueCapacity)
+{
+    commands.bindMemberCommand("wait", vm, &Yarn::YarnVM::setWaitTime, "usage: wait <time>.  time moves when the UI thread calls advanceTime()");
+}
+
+Yarn::ThreadedRunner::~ThreadedRunner()
+{
+    stop();
+}
+
+void Yarn::ThreadedRunner::start()
+{
+    stop();
+
+    stopping.store(false);
+    thread = std::thread(&ThreadedRunner::threadMain, this);
+}
+
+void Yarn::ThreadedRunner::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+
+    stopping.store(true, std::memory_order_release);
+
+    inputSignal.fetch_add(1, std::memory_order_release);
+    inputSignal.notify_one();
+
+    thread.join();
+}
+
+void Yarn::ThreadedRunner::selectOption(int option)
+{
+    receive({InputEvent::SELECT_OPTION, option});
+}
+
+void Yarn::ThreadedRunner::advanceTime(long long dt)
+{
+    receive({InputEvent::ADVANCE_TIME, dt});
+}
+
+void Yarn::ThreadedRunner::receive(InputEvent&& event)
+{
+    // the VM thread drains input whenever it runs, so a full queue only lasts until it gets scheduled
+    while (!inputs.push(std::move(event)))
+    {
+        std::this_thread::yield();
+    }
+
+    inputSignal.fetch_add(1, std::memory_order_release);
+    inputSignal.notify_one();
+}
+
+void Yarn::ThreadedRunner::send(OutputEvent&& event)
+{
+    event.produced = std::chrono::steady_clock::now();
+
+    while (!outputs.push(std::move(event)))
+    {
+        if (stopping.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+void Yarn::ThreadedRunner::onReceiveText(const std::string_view& s, bool)
+{
+    text.append(s);
+}
+
+void Yarn::ThreadedRunner::onRunLine(const Yarn::YarnVM::Line& line)
+{
+    text.clear();
+    YarnRunnerBase::onRunLine(line);
+
+    OutputEvent event;
+    event.type = OutputEvent::LINE;
+    event.text = std::move(text);
+
+    send(std::move(event));
+}
+
+void Yarn::ThreadedRunner::onPresentOptions(const Yarn::YarnVM::OptionsList& options)
+{
+    OutputEvent event;
+    event.type = OutputEvent::OPTIONS;
+
+    for (const Yarn::YarnVM::Option& option : options)
+    {
+        text.clear();
+        YarnRunnerBase::onRunLine(option.line);
+
+        event.options.push_back(std::move(text));
+        event.enabled.push_back(option.enabled);
+    }
+
+    text.clear();
+
+    send(std::move(event));
+}
+
+void Yarn::ThreadedRunner::onProgramStopped()
+{
+    send(OutputEvent());
+}
+
+void Yarn::ThreadedRunner::threadMain()
+{
+    try
+    {
+        while (!stopping.load(std::memory_order_acquire))
+        {
+            InputEvent input;
+
+            while (inputs.pop(input))
+            {
+                switch (input.type)
+                {
+                case InputEvent::SELECT_OPTION:
+                    if (vm.runningState == YarnVM::AWAITING_INPUT)
+                    {
+                        vm.selectOption((int)input.value);
+                    }
+                    break;
+                case InputEvent::ADVANCE_TIME:
+                    vm.incrementTime(input.value);
+                    break;
+                }
+            }
+
+            if (vm.runningState == YarnVM::RUNNING)
+            {
+                vm.runFor(instructionsPerSlice);
+                continue;
+            }
+
+            // awaiting input, asleep or stopped : nothing happens until the UI thread sends something.
+            // Read the signal before checking the queue, so input pushed in between wakes the wait straight away
+            const std::uint32_t signal = inputSignal.load(std::memory_order_acquire);
+
+            if (inputs.empty() && !stopping.load(std::memory_order_acquire))
+            {
+                inputSignal.wait(signal, std::memory_order_acquire);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        // nothing on this thread can handle the error, so pass it on to the UI
+        vm.runningState = YarnVM::STOPPED;
+
+        OutputEvent event;
+        event.text = e.what();
+
+        send(std::move(event));
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+/**
+ * @file yarn_threaded_runner.h
+ *
+ * @brief Dialogue runner that runs the VM on its own thread and talks to the UI thread through two lock free queues
+ *
+ * The VM thread renders lines and options (line database lookup, substitutions, markup) exactly like YarnRunnerBase,
+ * and sends the finished text to the UI thread as OutputEvents.  The UI thread sends option selections and time updates back as InputEvents.
+ * Both directions are single producer / single consumer queues (yarn_spsc_queue.h), so neither thread ever takes a lock for dialogue traffic.
+ *
+ * Usage :
+ * - load the module and bind commands, functions and markup callbacks as with YarnRunnerBase, then start()
+ * - from the UI thread, poll() for output every frame, and answer with selectOption() / advanceTime()
+ * - stop(), or destroy the runner, to join the VM thread
+ *
+ * Everything but poll(), selectOption(), advanceTime() and stop() belongs to the VM thread while it runs : commands, custom functions and markup callbacks are called there.
+ * The built in "wait" command is bound to the VM's setWaitTime, and time only moves when the UI thread calls advanceTime().
+ * If the output queue is full the VM thread waits for the UI to catch up; when it has nothing to run it sleeps until the UI sends something.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <yarn_dialogue_runner.h>
+#include <yarn_spsc_queue.h>
+
+namespace Yarn
+{
+    struct ThreadedRunner : public YarnRunnerBase
+    {
+        /// VM thread -> UI thread
+        struct OutputEvent
+        {
+            enum Type { LINE, OPTIONS, STOPPED };
+
+            Type type = STOPPED;
+            std::string text;                   ///< LINE : rendered line.  STOPPED : the error that stopped the VM, empty if the dialogue just ended
+            std::vector<std::string> options;   ///< OPTIONS : rendered text of each option
+            std::vector<bool> enabled;          ///< OPTIONS : whether each option can be selected
+            std::chrono::steady_clock::time_point produced; ///< when the VM thread queued the event, for measuring latency
+        };
+
+        /// UI thread -> VM thread
+        struct InputEvent
+        {
+            enum Type { SELECT_OPTION, ADVANCE_TIME };
+
+            Type type = ADVANCE_TIME;
+            long long value = 0; ///< option index, or time delta
+        };
+
+        explicit ThreadedRunner(std::size_t queueCapacity = 256);
+
+        ~ThreadedRunner(); ///< stops the VM thread.  Classes deriving from this should call stop() in their own destructor, since the thread calls their overrides
+
+        void start(); ///< start running the loaded node on the VM thread
+
+        void stop(); ///< ask the VM thread to stop and join it.  Safe to call more than once
+
+        // -- UI thread --
+
+        bool poll(OutputEvent& event) { return outputs.pop(event); } ///< next event from the VM thread, false if there's none yet
+
+        void selectOption(int option); ///< answer the last OPTIONS event
+
+        void advanceTime(long long dt); ///< move the VM's clock forward, eg. to end a wait
+
+        // -- VM thread --
+
+        void onReceiveText(const std::string_view& s, bool eol = false) override;
+
+        void onRunLine(const Yarn::YarnVM::Line& line) override;
+
+        void onPresentOptions(const Yarn::YarnVM::OptionsList& options) override;
+
+        void onProgramStopped() override;
+
+        std::size_t instructionsPerSlice = 10000; ///< the VM thread checks for input at least this often, so a looping script can still be stopped
+
+    private:
+
+        SPSCQueue<OutputEvent> outputs;
+        SPSCQueue<InputEvent> inputs;
+
+        std::atomic<std::uint32_t> inputSignal = 0; ///< bumped whenever there's input, the VM thread waits on it when it has nothing to run
+        std::atomic<bool> stopping = false;
+        std::thread thread;
+
+        std::string text; ///< text of the line being rendered
+
+        void threadMain();
+
+        void send(OutputEvent&& event);
+
+        void receive(InputEvent&& event);
+    };
+}
@@ -0,0 +1,220 @@
+#include <yarn_timer_wheel.h>
+
+#include <algorithm>
+#include <bit>
+
+using namespace Yarn;
+
+TimerWheel::TimerWheel(long long time)
+    : now(time)
+{
+    std::fill(std::begin(heads), std::end(heads), NONE);
+}
+
+void TimerWheel::schedule(TimerId id, long long deadline)
+{
+    if (id >= entries.size())
+    {
+        entries.resize((std::size_t)id + 1);
+    }
+
+    cancel(id);
+
+    entries[id].deadline = deadline;
+    count++;
+
+    if (deadline <= now)
+    {
+        // the slot for the current time has already been expired, so hold it until the next advance()
+        entries[id].slot = DUE_SLOT;
+        entries[id].prev = NONE;
+        entries[id].next = heads[DUE_SLOT];
+
+        if (heads[DUE_SLOT] != NONE)
+        {
+            entries[heads[DUE_SLOT]].prev = id;
+        }
+
+        heads[DUE_SLOT] = id;
+        return;
+    }
+
+    insert(id);
+}
+
+void TimerWheel::cancel(TimerId id)
+{
+    if (scheduled(id))
+    {
+        unlink(id);
+        count--;
+    }
+}
+
+void TimerWheel::insert(TimerId id)
+{
+    Entry& entry = entries[id];
+    const long long delta = entry.deadline - now;
+
+    std::uint32_t slot = OVERFLOW_SLOT;
+
+    for (int level = 0; level < LEVELS; level++)
+    {
+        if (delta < (1LL << (SLOT_BITS * (level + 1))))
+        {
+            const std::uint32_t index = (std::uint32_t)((entry.deadline >> (SLOT_BITS * level)) & (SLOTS - 1));
+            slot = level * SLOTS + index;
+            occupied[level] |= 1ull << index;
+            break;
+        }
+    }
+
+    entry.slot = slot;
+    entry.prev = NONE;
+    entry.next = heads[slot];
+
+    if (heads[slot] != NONE)
+    {
+        entries[heads[slot]].prev = id;
+    }
+
+    heads[slot] = id;
+}
+
+void TimerWheel::unlink(TimerId id)
+{
+    Entry& entry = entries[id];
+
+    if (entry.prev != NONE)
+    {
+        entries[entry.prev].next = entry.next;
+    }
+    else
+    {
+        heads[entry.slot] = entry.next;
+
+        if (entry.next == NONE && entry.slot < OVERFLOW_SLOT)
+        {
+            occupied[entry.slot / SLOTS] &= ~(1ull << (entry.slot % SLOTS));
+        }
+    }
+
+    if (entry.next != NONE)
+    {
+        entries[entry.next].prev = entry.prev;
+    }
+
+    entry.slot = NONE;
+    entry.prev = NONE;
+    entry.next = NONE;
+}
+
+void TimerWheel::cascade(std::uint32_t slot)
+{
+    TimerId id = heads[slot];
+
+    heads[slot] = NONE;
+
+    if (slot < OVERFLOW_SLOT)
+    {
+        occupied[slot / SLOTS] &= ~(1ull << (slot % SLOTS));
+    }
+
+    while (id != NONE)
+    {
+        const TimerId next = entries[id].next;
+        insert(id);
+        id = next;
+    }
+}
+
+void TimerWheel::expire(std::uint32_t slot, std::vector<TimerId>& expired)
+{
+    TimerId id = heads[slot];
+
+    heads[slot] = NONE;
+
+    if (slot < OVERFLOW_SLOT)
+    {
+        occupied[slot / SLOTS] &= ~(1ull << (slot % SLOTS));
+    }
+
+    while (id != NONE)
+    {
+        Entry& entry = entries[id];
+        expired.push_back(id);
+
+        id = entry.next;
+
+        entry.slot = NONE;
+        entry.prev = NONE;
+        entry.next = NONE;
+        count--;
+    }
+}
+
+void TimerWheel::advance(long long time, std::vector<TimerId>& expired)
+{
+    expire(DUE_SLOT, expired);
+
+    while (now < time)
+    {
+        if (!count)
+        {
+            now = time;
+            break;
+        }
+
+        // jump straight to the next time anything can happen : the next occupied level 0 slot in this rotation of level 0,
+        // or else the next time the lowest occupied level cascades
+        const int first = (int)((now + 1) & (SLOTS - 1));
+        const std::uint64_t pending = first ? (occupied[0] & (~0ull << first)) : 0;
+
+        long long next;
+
+        if (pending)
+        {
+            next = (now & ~(long long)(SLOTS - 1)) + std::countr_zero(pending);
+        }
+        else
+        {
+            // level 0 timers left over are in its next rotation, so they're reached at the next level 0 boundary like the level 1 cascade
+            int level = 1;
+
+            if (!occupied[0])
+            {
+                while (level < LEVELS && !occupied[level])
+                {
+                    level++;
+                }
+            }
+
+            const int shift = SLOT_BITS * level;
+            next = ((now >> shift) + 1) << shift;
+        }
+
+        if (next > time)
+        {
+            now = time;
+            break;
+        }
+
+        now = next;
+
+        // timers in a coarse slot move down into the finer levels when time reaches the start of the slot, coarsest first so they can fall through several levels at once
+        if ((now & ((1LL << (SLOT_BITS * LEVELS)) - 1)) == 0)
+        {
+            cascade(OVERFLOW_SLOT);
+        }
+
+        for (int level = LEVELS - 1; level > 0; level--)
+        {
+            if ((now & ((1LL << (SLOT_BITS * level)) - 1)) == 0)
+            {
+                cascade(level * SLOTS + (std::uint32_t)((now >> (SLOT_BITS * level)) & (SLOTS - 1)));
+            }
+        }
+
+        expire((std::uint32_t)(now & (SLOTS - 1)), expired);
+    }
+}
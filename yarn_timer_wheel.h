@@ -0,0 +1,77 @@
+#pragma once
+
+/**
+ * @file yarn_timer_wheel.h
+ *
+ * @brief Hierarchical timer wheel for waking sleeping VMs
+ *
+ * Holds deadlines for small dense ids (eg. session ids) so a host running many VMs doesn't have to check every sleeping VM's waitUntilTime whenever time advances.
+ * Scheduling and cancelling are O(1), and advancing time costs O(expired) plus a little bookkeeping per 64 time units skipped over.
+ *
+ * The wheel has LEVELS levels of 64 slots.  Level 0 slots are one time unit wide, level n slots are 64^n units wide.
+ * A timer goes into the level whose range covers its deadline; when time reaches the start of a higher level slot, its timers cascade down into the finer levels.
+ * Deadlines past the range of the top level wait in an overflow list.
+ * Time units are whatever the host uses for YarnVM::setTime.
+ */
+
+#include <cstdint>
+#include <vector>
+
+namespace Yarn
+{
+    class TimerWheel
+    {
+    public:
+
+        typedef std::uint32_t TimerId;
+
+        static constexpr int LEVELS = 4;
+        static constexpr int SLOT_BITS = 6;
+        static constexpr int SLOTS = 1 << SLOT_BITS;
+
+        explicit TimerWheel(long long time = 0);
+
+        /// set id to expire at deadline, replacing its previous deadline if it had one.  A deadline that's already passed expires on the next advance()
+        void schedule(TimerId id, long long deadline);
+
+        void cancel(TimerId id); ///< no-op if id isn't scheduled
+
+        bool scheduled(TimerId id) const { return id < entries.size() && entries[id].slot != NONE; }
+
+        /// move time forward and append the ids of every timer whose deadline is <= time to expired.  Expired timers are no longer scheduled
+        void advance(long long time, std::vector<TimerId>& expired);
+
+        long long time() const { return now; }
+
+        std::size_t size() const { return count; }
+
+    private:
+
+        static constexpr std::uint32_t NONE = 0xFFFFFFFF;
+        static constexpr std::uint32_t OVERFLOW_SLOT = LEVELS * SLOTS;  ///< deadlines beyond the top level
+        static constexpr std::uint32_t DUE_SLOT = OVERFLOW_SLOT + 1;    ///< deadlines that had already passed when they were scheduled
+
+        /// intrusive doubly linked list node, one per id
+        struct Entry
+        {
+            long long deadline = 0;
+            std::uint32_t slot = NONE;
+            TimerId prev = NONE;
+            TimerId next = NONE;
+        };
+
+        std::vector<Entry> entries;                 ///< indexed by id
+        TimerId heads[DUE_SLOT + 1];                ///< first entry in each slot
+        std::uint64_t occupied[LEVELS] = {};        ///< per level, bit n set if slot n isn't empty
+        long long now;
+        std::size_t count = 0;
+
+        void insert(TimerId id); ///< link id into the slot for its deadline, relative to now
+
+        void unlink(TimerId id);
+
+        void cascade(std::uint32_t slot); ///< reinsert every timer in slot, relative to now
+
+        void expire(std::uint32_t slot, std::vector<TimerId>& expired);
+    };
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+/**
+ * @file yarn_value.h
+ *
+ * @brief Lightweight tagged value type used internally by the Yarn VM
+ *
+ * Yarn::Operand is a protobuf message : copying one does oneof bookkeeping, and string operands own a heap allocated std::string.
+ * The VM instead keeps its stack, variables, and function arguments as 16 byte Values : a float, a bool, no value, or a view of a string.
+ * Strings are never owned by a Value.  They point into the program's interned string pool, or into the VM's StringArena for strings
+ * created while the program runs.
+ *
+ * Values are converted to and from Yarn::Operand only at the edges of the public interface (line substitutions, json serialization).
+ * The accessors mirror Yarn::Operand's so that custom functions read the same way with either type.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include <yarn_spinner.pb.h>
+
+namespace Yarn
+{
+    class Value
+    {
+    public:
+
+        enum Type : std::uint8_t { NONE = 0, FLOAT, BOOL, STRING };
+
+        Value() { floatValue = 0.f; }
+
+        explicit Value(float f) { set_float_value(f); }
+
+        explicit Value(bool b) { set_bool_value(b); }
+
+        explicit Value(std::string_view s) { set_string_value(s); } ///< s must outlive the value, see StringArena
+
+        Type type() const { return valueType; }
+
+        bool has_value() const { return valueType != NONE; }
+        bool has_float_value() const { return valueType == FLOAT; }
+        bool has_bool_value() const { return valueType == BOOL; }
+        bool has_string_value() const { return valueType == STRING; }
+
+        // like Yarn::Operand, the accessors return a default value when the value holds a different type
+        float float_value() const { return (valueType == FLOAT) ? floatValue : 0.f; }
+        bool bool_value() const { return (valueType == BOOL) ? boolValue : false; }
+        std::string_view string_value() const { return (valueType == STRING) ? std::string_view(stringData, stringLength) : std::string_view(); }
+
+        void set_float_value(float f) { valueType = FLOAT; floatValue = f; }
+        void set_bool_value(bool b) { valueType = BOOL; boolValue = b; }
+        void set_string_value(std::string_view s) { valueType = STRING; stringData = s.data(); stringLength = (std::uint32_t)s.size(); } ///< s must outlive the value
+        void clear_value() { valueType = NONE; }
+
+        Yarn::Operand toOperand() const
+        {
+            Yarn::Operand op;
+
+            switch (valueType)
+            {
+            case FLOAT: op.set_float_value(floatValue); break;
+            case BOOL: op.set_bool_value(boolValue); break;
+            case STRING: op.set_string_value(std::string(stringData, stringLength)); break;
+            default: break;
+            }
+
+            return op;
+        }
+
+    private:
+
+        Type valueType = NONE;
+        std::uint32_t stringLength = 0;
+
+        union
+        {
+            float floatValue;
+            bool boolValue;
+            const char* stringData;
+        };
+    };
+
+    static_assert(sizeof(Value) == 16, "Yarn::Value should stay 16 bytes");
+
+    /// Owns the strings the VM creates while it runs (string concatenation, custom function results, deserialized values),
+    /// so Values can refer to them.  Each distinct string is stored once, and stays valid until the arena is cleared, or collected while nothing refers to it.
+    /// The VM collects the arena once it's doubled in size since the last collection, see YarnVM::makeString
+    class StringArena
+    {
+    public:
+
+        static constexpr std::size_t MIN_COLLECTION_SIZE = 1024; ///< no collections below this many strings
+
+        std::string_view intern(std::string_view s)
+        {
+            auto it = strings.find(s);
+
+            if (it == strings.end())
+            {
+                it = strings.emplace(s).first;
+            }
+
+            return *it;
+        }
+
+        Value makeValue(const Yarn::Operand& op)
+        {
+            if (op.has_float_value()) return Value(op.float_value());
+            if (op.has_bool_value()) return Value(op.bool_value());
+            if (op.has_string_value()) return Value(intern(op.string_value()));
+            return Value();
+        }
+
+        std::size_t size() const { return strings.size(); }
+
+        void clear() { strings.clear(); collectionSize = MIN_COLLECTION_SIZE; }
+
+        bool needsCollection() const { return strings.size() >= collectionSize; }
+
+        /// drop the strings that aren't in live, the data() of every string view still in use.  The strings kept don't move
+        void collect(const std::unordered_set<const char*>& live)
+        {
+            std::erase_if(strings, [&live](const std::string& s) { return !live.count(s.data()); });
+
+            collectionSize = std::max(MIN_COLLECTION_SIZE, strings.size() * 2);
+        }
+
+    private:
+
+        struct Hash
+        {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+        };
+
+        std::unordered_set<std::string, Hash, std::equal_to<>> strings; ///< node based, so strings don't move when others are added or erased
+        std::size_t collectionSize = MIN_COLLECTION_SIZE;
+    };
+}
+
+std::ostream& operator<<(std::ostream& str, const Yarn::Value& value);
@@ -1,5 +1,9 @@
 #include <yarn_spinner.pb.h>
 #include <yarn_vm.h>
+#include <yarn_compiled.h>
+
+#include <algorithm>
+#include <charconv>
 
 #ifdef YARN_SERIALIZATION_JSON
 #include <fstream>
@@ -22,7 +26,7 @@ namespace nlohmann
                 js = { {"value", op.float_value()}, {"type", "float"} };
             }
 
-            else if (op.has_float_value())
+            else if (op.has_string_value())
             {
                 js = { {"value", op.string_value()}, {"type", "string"} };
             }
@@ -57,21 +61,16 @@ namespace nlohmann
 namespace Yarn
 {
     NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Yarn::YarnVM::Settings, randomSeed, enableExceptions);
-    NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Yarn::YarnVM::Line, id, substitutions);
-    NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Yarn::YarnVM::Option, line, destination, enabled);
-}
 
-
-namespace Yarn
-{
-    inline void to_json(nlohmann::json& j, const Yarn::YarnVM::Stack& p)
+    // lines and options only view the program's string pool, so they're deserialized by YarnVM::fromJS, which can look the strings up again
+    inline void to_json(nlohmann::json& j, const Yarn::YarnVM::Line& line)
     {
-        j = p.to_json();
+        j = { {"id", std::string(line.id)}, {"substitutions", line.substitutions} };
     }
 
-    inline void from_json(const nlohmann::json& j, Yarn::YarnVM::Stack& p)
+    inline void to_json(nlohmann::json& j, const Yarn::YarnVM::Option& option)
     {
-        p.from_json(j);
+        j = { {"line", option.line}, {"destination", std::string(option.destination)}, {"enabled", option.enabled} };
     }
 }
 
@@ -102,6 +101,19 @@ std::ostream& operator<<(std::ostream& str, const Yarn::Operand& op)
     return str;
 }
 
+std::ostream& operator<<(std::ostream& str, const Yarn::Value& value)
+{
+    switch (value.type())
+    {
+    case Yarn::Value::BOOL: str << value.bool_value(); break;
+    case Yarn::Value::FLOAT: str << value.float_value(); break;
+    case Yarn::Value::STRING: str << value.string_value(); break;
+    default: str << "UNDEFINED"; break;
+    }
+
+    return str;
+}
+
 struct StaticContext
 {
     StaticContext() {}
@@ -110,105 +122,100 @@ struct StaticContext
 
 using namespace Yarn;
 
-unsigned int YarnVM::visitedCount(const std::string& node)
+unsigned int YarnVM::visitedCount(std::string_view node)
 {
-    const std::string& nodeTrackerVariable = "$Yarn.Internal.Visiting." + node;
+    std::string nodeTrackerVariable = "$Yarn.Internal.Visiting.";
+    nodeTrackerVariable += node;
 
-    auto it = this->variableStorage.find(nodeTrackerVariable);
+    const Yarn::Value* tracker = getVariable(nodeTrackerVariable);
 
-    if (it == variableStorage.end())
+    if (!tracker)
     {
         return 0;
     }
 
-    assert(it->second.has_float_value());
+    assert(tracker->has_float_value());
 
-    return it->second.float_value();
+    return tracker->float_value();
 }
 
-void YarnVM::selectOption(const Option& option)
+std::int32_t YarnVM::findVariable(const std::string& name) const
 {
-    runningState = RUNNING;
-
-    Yarn::Operand op;
-    op.set_string_value(option.destination);
-    variableStack.push(op);
+    std::int32_t slot = image->linked.findVariable(name);
 
-    currentOptionsList.clear();
-
-    assert(currentNode);
-
-#if 0
-    std::int32_t translatedLabel = currentNode->labels().at(option.destination);
+    if (slot != LinkedProgram::UNRESOLVED)
+    {
+        return slot;
+    }
 
-    currentOptionsList.resize(0);
+    for (std::size_t i = 0; i < extraVariableNames.size(); i++)
+    {
+        if (extraVariableNames[i] == name)
+        {
+            return (std::int32_t)(image->linked.variableNames.size() + i);
+        }
+    }
 
-    setInstruction(translatedLabel);
-#endif
+    return LinkedProgram::UNRESOLVED;
 }
 
-void YarnVM::selectOption(int selection)
+const Yarn::Value* YarnVM::getVariable(const std::string& name) const
 {
-    if (selection >= currentOptionsList.size())
+    const std::int32_t slot = findVariable(name);
+
+    if (slot == LinkedProgram::UNRESOLVED)
     {
-        YARN_EXCEPTION("Invalid option selected");
+        return nullptr;
     }
 
-    selectOption(currentOptionsList[selection]);
+    return &variableStorage[slot];
 }
 
-std::string YarnVM::get_string_operand(const Yarn::Instruction& instruction, int index)
+void YarnVM::setVariable(const std::string& name, const Yarn::Operand& value)
 {
-    if (instruction.operands_size() <= index)
-    {
-        YARN_EXCEPTION("get_string_operand() : Operand out of bounds");
-    }
-
-    const Yarn::Operand& op = instruction.operands(index);
+    std::int32_t slot = findVariable(name);
 
-    if (!op.has_string_value())
+    if (slot == LinkedProgram::UNRESOLVED)
     {
-        YARN_EXCEPTION("get_string_operand() : operand doesn't have a string value");
+        slot = (std::int32_t)variableStorage.size();
+        extraVariableNames.push_back(name);
+        variableStorage.emplace_back();
     }
 
-    return op.string_value();
+    variableStorage[slot] = strings.makeValue(value);
 }
 
-bool YarnVM::get_bool_operand(const Yarn::Instruction& instruction, int index)
+void YarnVM::selectOption(const Option& option)
 {
-    if (instruction.operands_size() <= index)
-    {
-        YARN_EXCEPTION("get_bool_operand() : Operand out of bounds");
-    }
+    runningState = RUNNING;
 
-    const Yarn::Operand& op = instruction.operands(index);
+    // the destination views the program's string pool, so pushing it doesn't allocate
+    variableStack.push(Yarn::Value(option.destination));
 
-    if (!op.has_bool_value())
-    {
-        YARN_EXCEPTION("get_bool_operand() : operand doesn't have a bool value");
-    }
+    currentOptionsList.clear();
 
-    return op.bool_value();
-}
+    assert(currentNode);
 
-float YarnVM::get_float_operand(const Yarn::Instruction& instruction, int index)
-{
-    if (instruction.operands_size() <= index)
-    {
-        YARN_EXCEPTION("get_float_operand() : Operand out of bounds");
-    }
+#if 0
+    std::int32_t translatedLabel = currentNode->labels().at(option.destination);
 
-    const Yarn::Operand& op = instruction.operands(index);
+    currentOptionsList.resize(0);
+
+    setInstruction(translatedLabel);
+#endif
+}
 
-    if (!op.has_float_value())
+void YarnVM::selectOption(int selection)
+{
+    if (selection >= currentOptionsList.size())
     {
-        YARN_EXCEPTION("get_float_operand() : operand doesn't have a float value");
+        YARN_EXCEPTION("Invalid option selected");
     }
 
-    return op.float_value();
+    selectOption(currentOptionsList[selection]);
 }
 
-const Yarn::Instruction& YarnVM::advance()
+const LinkedProgram::Instruction& YarnVM::advance()
 {
     if (runningState == STOPPED)
     {
@@ -217,7 +224,7 @@ const Yarn::Instruction& YarnVM::advance()
 
     if (currentNode)
     {
-        if (currentNode->instructions_size() > (instructionPointer + 1))
+        if (image->linked.nodes[currentNodeIndex].code.size() > (instructionPointer + 1))
         {
             instructionPointer++;
         }
@@ -236,199 +243,7 @@ const Yarn::Instruction& YarnVM::advance()
 
 void YarnVM::populateFuncs()
 {
-    functions["Number.Add"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_float_value(a + b);
-
-        return rval;
-    };
-
-    functions["Number.Minus"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_float_value(a - b);
-
-        return rval;
-    };
-
-    functions["Number.Multiply"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_float_value(a * b);
-
-        return rval;
-    };
-
-    functions["Number.Divide"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_float_value(a / b);
-
-        return rval;
-    };
-
-    functions["Number.Modulo"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_float_value(std::fmod(a, b));
-
-        return rval;
-    };
-
-    functions["Number.LessThan"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a < b);
-
-        return rval;
-    };
-
-    functions["Number.EqualTo"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a == b);
-
-        return rval;
-    };
-
-    functions["Number.GreaterThan"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a > b);
-
-        return rval;
-    };
-
-    functions["Number.GreaterThanOrEqualTo"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a >= b);
-
-        return rval;
-    };
-
-    functions["Number.LessThanOrEqualTo"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().float_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a <= b);
-
-        return rval;
-    };
-
-    functions["Bool.And"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto a = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-        auto b = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a && b);
-
-        return rval;
-    };
-
-    functions["Bool.Or"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto a = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-        auto b = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a || b);
-
-        return rval;
-    };
-
-    functions["Bool.Xor"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto b = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-        auto a = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(a && b);
-
-        return rval;
-    };
-
-    functions["Bool.Not"] = [](YarnVM& yarn, int parameters)->Yarn::Operand
-    {
-        Yarn::Operand rval;
-
-        auto a = yarn.variableStack.top().bool_value();
-        yarn.variableStack.pop();
-
-        rval.set_bool_value(!a);
-
-        return rval;
-    };
+    // the Number, Bool, and String operators are built into the VM, see LinkedProgram::OpCode
 
     /*
     visited(string node_name)
@@ -437,7 +252,7 @@ void YarnVM::populateFuncs()
     */
     YARN_FUNC("visited")
     {
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         assert(parameters == 1);
 
@@ -460,7 +275,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto node = yarn.variableStack.top().string_value();
         yarn.variableStack.pop();
@@ -480,7 +295,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 0);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
 
@@ -497,7 +312,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 2);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -523,7 +338,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto sides = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -545,7 +360,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -563,7 +378,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 2);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto places = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -596,7 +411,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -614,7 +429,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -632,7 +447,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -652,7 +467,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -672,7 +487,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -691,7 +506,7 @@ void YarnVM::populateFuncs()
     {
         assert(parameters == 1);
 
-        Yarn::Operand rval;
+        Yarn::Value rval;
 
         auto b = yarn.variableStack.top().float_value();
         yarn.variableStack.pop();
@@ -713,13 +528,69 @@ void YarnVM::setTime(long long timeIn)
     }
 }
 
-const Yarn::Instruction& YarnVM::currentInstruction()
+std::string_view YarnVM::makeString(std::string_view s)
+{
+    // intern first : s may view an arena string nothing refers to any more, like a custom function's popped parameter
+    const std::string_view made = strings.intern(s);
+
+    if (strings.needsCollection())
+    {
+        collectStrings(made);
+    }
+
+    return made;
+}
+
+void YarnVM::collectStrings(std::string_view keep)
+{
+    std::unordered_set<const char*> live = { keep.data() };
+
+    auto mark = [&live](const Yarn::Value& value)
+    {
+        if (value.has_string_value())
+        {
+            live.insert(value.string_value().data());
+        }
+    };
+
+    std::for_each(variableStorage.begin(), variableStorage.end(), mark);
+    std::for_each(variableStack.values().begin(), variableStack.values().end(), mark);
+
+    if (eventRing)
+    {
+        eventRing->forEachPendingValue(mark);
+    }
+
+    strings.collect(live);
+}
+
+bool YarnVM::handleWaitCommand(std::string_view command)
+{
+    static constexpr std::string_view WAIT = "wait ";
+
+    if (!command.starts_with(WAIT))
+    {
+        return false;
+    }
+
+    // parsed within the view : the strings of a bundle's pool aren't null terminated
+    std::string_view duration = command.substr(WAIT.size());
+    duration.remove_prefix(std::min(duration.find_first_not_of(' '), duration.size()));
+
+    long long t = 0;
+    std::from_chars(duration.data(), duration.data() + duration.size(), t);
+
+    setWaitTime(t);
+    return true;
+}
+
+const LinkedProgram::Instruction& YarnVM::currentInstruction()
 {
     assert(currentNode);
-    auto instructionCtNode = currentNode->instructions_size();
-    assert(instructionCtNode > (instructionPointer));
+    std::span<const LinkedProgram::Instruction> code = image->linked.nodes[currentNodeIndex].code;
+    assert(code.size() > (instructionPointer));
 
-    return currentNode->instructions(instructionPointer);
+    return code[instructionPointer];
 }
 
 void YarnVM::setInstruction(std::int32_t instruction)
@@ -729,7 +600,7 @@ void YarnVM::setInstruction(std::int32_t instruction)
         YARN_EXCEPTION("current node is null in setInstruction()");
     }
 
-    if (instruction >= currentNode->instructions_size())
+    if ((instruction < 0) || (instruction >= (std::int32_t)image->linked.nodes[currentNodeIndex].code.size()))
     {
         YARN_EXCEPTION("Invalid instruction pointer parameter for setInstruction()");
     }
@@ -738,10 +609,16 @@ void YarnVM::setInstruction(std::int32_t instruction)
 }
 
 
+YarnVM::YarnVM()
+    :
+    YarnVM(Settings())
+{
+}
+
 YarnVM::YarnVM(const YarnVM::Settings& setts)
     :
-    settings(setts),
-    generator(setts.randomSeed)
+    generator(setts.randomSeed),
+    settings(setts)
 {
     static StaticContext sc;
 
@@ -750,19 +627,44 @@ YarnVM::YarnVM(const YarnVM::Settings& setts)
     GOOGLE_PROTOBUF_VERIFY_VERSION;
 }
 
+YarnVM::YarnVM(std::shared_ptr<const ProgramImage> image)
+    :
+    YarnVM(std::move(image), Settings())
+{
+}
+
+YarnVM::YarnVM(std::shared_ptr<const ProgramImage> image, const YarnVM::Settings& setts)
+    :
+    YarnVM(setts)
+{
+    loadProgram(std::move(image));
+}
+
 bool YarnVM::loadNode(const std::string& node)
 {
+    const std::int32_t nodeIndex = image->linked.findNode(node);
+
     // node not found check
-    if (program.nodes().find(node) == program.nodes().end())
+    if (nodeIndex == LinkedProgram::UNRESOLVED)
     {
         YARN_EXCEPTION("loadNode() failure : node not found : " + node);
         return false;
     }
 
-    const Yarn::Node& nodeRef = program.nodes().at(node);
+    return loadNode(nodeIndex);
+}
+
+bool YarnVM::loadNode(std::int32_t nodeIndex)
+{
+    if ((nodeIndex < 0) || (nodeIndex >= (std::int32_t)image->linked.nodes.size()))
+    {
+        YARN_EXCEPTION("loadNode() failure : invalid node index");
+        return false;
+    }
 
     const Yarn::Node* prevNode = currentNode;
-    currentNode = &nodeRef;
+    currentNode = image->linked.nodes[nodeIndex].source;
+    currentNodeIndex = nodeIndex;
     instructionPointer = 0;
 
     runningState = RUNNING;
@@ -772,26 +674,113 @@ bool YarnVM::loadNode(const std::string& node)
     return true;
 }
 
+const YarnVM::YarnFunction* YarnVM::bindFunction(std::int32_t slot)
+{
+    auto it = functions.find(image->linked.functionNames[slot]);
+
+    if (it == functions.end())
+    {
+        return nullptr;
+    }
+
+    functionSlots[slot] = &it->second;
+
+    return functionSlots[slot];
+}
 
 bool YarnVM::loadProgram(const std::string& yarncFileIn)
 {
-    yarncFile = yarncFileIn;
+    std::string error;
+
+    std::shared_ptr<const ProgramImage> loaded = ProgramImage::load(yarncFileIn, error);
+
+    if (!loaded)
+    {
+        YARN_EXCEPTION("loadProgram() failure : " + error);
+        return false;
+    }
+
+    return loadProgram(std::move(loaded));
+}
+
+bool YarnVM::loadProgram(std::shared_ptr<const ProgramImage> imageIn)
+{
+    if (!imageIn)
+    {
+        YARN_EXCEPTION("loadProgram() failure : null program image");
+        return false;
+    }
+
+    // compiled nodes and line indices only fit the image they were made for, but reloading the same image (eg. in fromJS) keeps them
+    if (imageIn != image)
+    {
+        compiledNodes.clear();
+        lineIndices.clear();
+    }
 
-    std::ifstream is(yarncFile, std::ios::binary | std::ios::in);
+    image = std::move(imageIn);
+    yarncFile = image->yarncFile;
 
-    assert(is.is_open());
+    currentNode = nullptr;
+    currentNodeIndex = LinkedProgram::UNRESOLVED;
 
-    bool parsed = program.ParseFromIstream(&is);
+    variableStorage = image->linked.initialValues;
+    extraVariableNames.clear();
+    strings.clear();
 
-    this->variableStorage = std::unordered_map<std::string, Yarn::Operand>(program.initial_values().begin(), program.initial_values().end());
+    // functions that aren't registered yet are bound the first time they're called
+    functionSlots.assign(image->linked.functionNames.size(), nullptr);
 
-    return parsed;
+    for (std::int32_t slot = 0; slot < (std::int32_t)functionSlots.size(); slot++)
+    {
+        bindFunction(slot);
+    }
+
+    return true;
+}
+
+bool YarnVM::useCompiled(const CompiledProgram& program)
+{
+    const LinkedProgram& linked = image->linked;
+
+    // generated code refers to everything by index, so it only runs the exact program it was generated from
+    if ((program.nodeCount != linked.nodes.size()) || (program.fingerprint != linked.fingerprint()))
+    {
+        YARN_EXCEPTION(std::string("useCompiled() failure : ") + program.yarncFile + " was compiled from a different program than " + yarncFile);
+        return false;
+    }
+
+    compiledNodes.assign(program.nodes, program.nodes + program.nodeCount);
+
+    return true;
 }
 
 #ifdef YARN_SERIALIZATION_JSON
 
+std::string_view YarnVM::internedString(const std::string& s)
+{
+    const std::int32_t index = image->linked.findString(s);
+
+    if (index == LinkedProgram::UNRESOLVED)
+    {
+        YARN_EXCEPTION("fromJS() : string not found in program : " + s);
+        return {};
+    }
+
+    return image->linked.strings[index];
+}
+
 void YarnVM::fromJS(const nlohmann::json& js)
 {
+    const int saveVersion = js.value("saveVersion", 0);
+
+    if (saveVersion != SAVE_VERSION)
+    {
+        YARN_EXCEPTION("fromJS() failure : can't restore a save of version " + std::to_string(saveVersion) + ", expected version " + std::to_string(SAVE_VERSION));
+        halt();
+        return;
+    }
+
     settings = js["settings"].get<YarnVM::Settings>();
 
     const std::string& generatorStr = js["generator"].get<std::string>();
@@ -801,14 +790,52 @@ void YarnVM::fromJS(const nlohmann::json& js)
     time = js["time"].get<long long>();
     waitUntilTime = js["waitUntilTime"].get<long long>();
 
-    this->loadProgram(js["yarncFile"].get<std::string>()); // loading the program sets the initial variables
-    this->loadNode(js["currentNode"]);
+    // reattaches to the image if this VM, or any other, already has the program loaded.  loading the program sets the initial variables
+    if (!this->loadProgram(js["yarncFile"].get<std::string>()) || !this->loadNode(js["currentNode"].get<std::string>()))
+    {
+        halt();
+        return;
+    }
+
+    for (Yarn::Value& value : variableStorage)
+    {
+        value.clear_value();
+    }
+
+    for (const auto& [name, value] : js["variables"].get<std::unordered_map<std::string, Yarn::Operand>>())
+    {
+        setVariable(name, value);
+    }
+    variableStack = {};
+
+    for (const Yarn::Operand& op : js["stack"].get<std::vector<Yarn::Operand>>())
+    {
+        variableStack.push(strings.makeValue(op));
+    }
+    currentOptionsList.clear();
+
+    for (const nlohmann::json& optionJS : js["options"])
+    {
+        Option& option = currentOptionsList.emplace_back();
 
-    variableStorage = js["variables"].get< std::unordered_map<std::string, Yarn::Operand>>();
-    variableStack = js["stack"].get<YarnVM::Stack>();
-    currentOptionsList = js["options"].get<OptionsList>();
+        option.line.id = internedString(optionJS["line"]["id"].get<std::string>());
+        option.line.index = lineIndex(image->linked.findString(std::string(option.line.id)));
+        option.line.substitutions = optionJS["line"]["substitutions"].get<std::vector<Yarn::Operand>>();
+        option.destination = internedString(optionJS["destination"].get<std::string>());
+        option.enabled = optionJS["enabled"].get<bool>();
+    }
 
     instructionPointer = js["instructionPointer"].get<std::size_t>();
+
+    // the interpreter doesn't check bounds, it relies on the node's code ending with END_OF_NODE
+    if (instructionPointer >= image->linked.nodes[currentNodeIndex].code.size())
+    {
+        YARN_EXCEPTION("fromJS() failure : instruction pointer " + std::to_string(instructionPointer) + " is past the end of node " + currentNode->name());
+        instructionPointer = 0;
+        halt();
+        return;
+    }
+
     runningState = (RunningState)js["runningState"].get<int>();
 
     if (this->runningState == AWAITING_INPUT)
@@ -821,6 +848,8 @@ nlohmann::json YarnVM::toJS() const
 {
     nlohmann::json rval;
 
+    rval["saveVersion"] = SAVE_VERSION;
+
     { // serialize the settings
 
         rval["settings"] = nlohmann::json(settings);
@@ -833,12 +862,23 @@ nlohmann::json YarnVM::toJS() const
     }
 
     { // serialize variable storage
-        rval["variables"] = nlohmann::json(variableStorage);
+        nlohmann::json& variables = rval["variables"] = nlohmann::json::object();
+
+        for (std::size_t slot = 0; slot < variableStorage.size(); slot++)
+        {
+            const std::string& name = (slot < image->linked.variableNames.size()) ? image->linked.variableNames[slot] : extraVariableNames[slot - image->linked.variableNames.size()];
+
+            variables[name] = variableStorage[slot].toOperand();
+        }
     }
 
     { // serialize the stack
-        // std::list <Yarn::Operand> variableStack2;
-        rval["stack"] = nlohmann::json(variableStack);
+        nlohmann::json& stack = rval["stack"] = nlohmann::json::array();
+
+        for (const Yarn::Value& value : variableStack.values())
+        {
+            stack.push_back(value.toOperand());
+        }
     }
 
     { // serialize the current options list
@@ -866,14 +906,5 @@ nlohmann::json YarnVM::toJS() const
     return rval;
 }
 
-nlohmann::json Yarn::YarnVM::Stack::to_json() const
-{
-    return nlohmann::json(this->c);
-}
-
-void Yarn::YarnVM::Stack::from_json(const nlohmann::json& js)
-{
-    this->c = js.get<YarnVM::Stack::container_type>();
-}
 #endif
 
@@ -12,17 +12,26 @@
  * This runs a .yarnc file of path provided to the loadProgram() method
  * it has callbacks for different events, such as running a line, running a command, changing nodes, showing options, etc.
  * implementing the callbacks, custom functions, and game commands to the function tables are the responsibility of the client code / dialogue runner
- * pumping the instruction queue is the responsibility of the client code / dialogue runner
+ * pumping the instruction queue is the responsibility of the client code / dialogue runner : call run() or runFor() until the VM yields
+ * The program is lowered into a compact instruction format when it's loaded, see yarn_program.h
+ * Loaded programs are immutable ProgramImages shared by every VM running the same program.  A VM only owns its own state (variables, stack, options...)
  * The VM has built in json (de)serialization methods
  * See the public interface / members below, the base dialogue runner class in yarn_dialogue_runner.h, and the included demo console dialogue runner program in demo.cpp for more
  */
 
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <random>
 #include <stack>
+#include <string_view>
+#include <vector>
 
 #include <yarn_spinner.pb.h>
+#include <yarn_event_ring.h>
+#include <yarn_program.h>
+#include <yarn_value.h>
 
 #ifdef YARN_SERIALIZATION_JSON
 #include <json.hpp>
@@ -40,6 +49,7 @@ namespace Yarn
     class Node;
     class Instruction;
     class Program;
+    struct CompiledProgram;
 
 struct YarnVM
 {
@@ -53,49 +63,67 @@ struct YarnVM
     /// information on line to run
     struct Line
     {
-        std::string id; ///< unique identifier for the line - actual text and metadata are stored in lines database object & retrieved from there
+        std::string_view id; ///< unique identifier for the line - actual text and metadata are stored in lines database object & retrieved from there.  Views the program's string pool, valid until another program is loaded
+        std::int32_t index = LinkedProgram::UNRESOLVED; ///< index of the line in the line database the program was linked against (see lineIndices), UNRESOLVED if it wasn't or the database doesn't have the line
         std::vector<Yarn::Operand> substitutions;
     };
 
     /// Information on an option presented to the user
     struct Option
     {
-        Line line;               ///< line to display to the user for this option
-        std::string destination; ///< destination to go to if this option is selected
-        bool  enabled;           ///< whether the option has a condition on it(in which case a value should be popped off the stack and used to signal the game that the option should be not available)
+        Line line;                    ///< line to display to the user for this option
+        std::string_view destination; ///< destination to go to if this option is selected.  Views the program's string pool
+        bool  enabled;                ///< whether the option has a condition on it(in which case a value should be popped off the stack and used to signal the game that the option should be not available)
     };
 
-    /// Variable stack used by the VM
-    class Stack : public std::stack <Yarn::Operand>
+    /// Variable stack used by the VM.  Backed by a vector so a running VM reuses the same storage instead of allocating deque blocks
+    class Stack : public std::stack <Yarn::Value, std::vector<Yarn::Value>>
     {
     public:
 
-#ifdef YARN_SERIALIZATION_JSON
-        nlohmann::json to_json() const;
-        void from_json(const nlohmann::json& js);
-#endif
+        const Yarn::Value& peek(std::size_t depth) const { return c[c.size() - 1 - depth]; } ///< value 'depth' entries below the top of the stack
+
+        const container_type& values() const { return c; } ///< bottom to top
     };
 
-    typedef std::function<Yarn::Operand(YarnVM& yarn, int parameterCount)> YarnFunction;
+    /// custom functions pop their parameters off of yarn.variableStack and return the result.
+    /// A function returning a string it built itself should keep it with yarn.makeString() so the value outlives the call
+    typedef std::function<Yarn::Value(YarnVM& yarn, int parameterCount)> YarnFunction;
     typedef std::vector<Option> OptionsList;
 
     /// Current State of the VM
     enum RunningState { RUNNING, STOPPED, AWAITING_INPUT, ASLEEP};
 
-    #define YARN_FUNC(x) functions[ x ] = [](YarnVM& yarn, int parameters)->Yarn::Operand
+    /// Why run() / runFor() returned control to the caller
+    enum YieldReason
+    {
+        YIELD_LINE,             ///< a line was delivered to onRunLine
+        YIELD_COMMAND,          ///< a command was delivered to onRunCommand
+        YIELD_OPTIONS,          ///< options were presented, the VM is awaiting input unless the callback already selected one
+        YIELD_WAIT,             ///< the VM is asleep until its time reaches waitUntilTime
+        YIELD_STOPPED,          ///< the program stopped, or a runtime error stopped it
+        YIELD_BUDGET_EXHAUSTED, ///< runFor() executed its maximum number of instructions
+        YIELD_EVENTS_FULL       ///< eventRing has no room for the next event.  Drain it and run again
+    };
+
+    #define YARN_FUNC(x) functions[ x ] = [](YarnVM& yarn, int parameters)->Yarn::Value
+
+    /// a node compiled to C++ by yarn2cpp.  Runs the current node from instructionPointer, like execute() does, and returns true with the reason it yielded,
+    /// or false once the program moves to another node.  budget is decremented for every instruction executed, see yarn_compiled.h
+    typedef bool (*CompiledNode)(YarnVM& vm, std::size_t& budget, YieldReason& reason);
 
     /// User bindable callbacks available to the VM.
     struct YarnCallbacks
     {
         // -- mandatory implementation by caller --
         virtual void onRunLine(const YarnVM::Line&) = 0;
-        virtual void onRunCommand(const std::string&) = 0;
+        virtual void onRunCommand(const std::string_view&) = 0; ///< views the program's string pool, like currentCommand
         virtual void onPresentOptions(const OptionsList&) = 0;
 
         // -- additional helper callbacks, default no-op --
 
         virtual void onProgramStopped() {};
-        virtual void onChangeNode(const Yarn::Node* fromNode, const Yarn::Node* toNode) {};
+        virtual void onChangeNode(const Yarn::Node* /*fromNode*/, const Yarn::Node* /*toNode*/) {};
     };
 
     void setCallbacks(YarnCallbacks* callbacks)
@@ -105,11 +133,13 @@ struct YarnVM
 
     /// --- VM state members which are serializable! ---
 
-    OptionsList currentOptionsList;
+    OptionsList currentOptionsList; ///< cleared, not freed, when an option is selected so the next set of options reuses the storage
 
     Stack variableStack;
 
-    std::unordered_map<std::string, Yarn::Operand> variableStorage;
+    std::vector<Yarn::Value> variableStorage; ///< indexed by variable slot, see image->linked.variableNames and extraVariableNames
+
+    std::vector<std::string> extraVariableNames; ///< variables set by the host that the program doesn't use, stored in the slots after the program's own
 
     // https://stackoverflow.com/questions/27727012/c-stdmt19937-and-rng-state-save-load-portability
     // we want to be able to serialize / deserialize the rng state and continue deterministically
@@ -131,21 +161,54 @@ struct YarnVM
 
     const Yarn::Node* currentNode = nullptr;
 
+    Line currentLine; ///< the line most recently run.  Reused for every RUN_LINE so delivering a line doesn't allocate
+
+    std::string_view currentCommand; ///< the command most recently run.  Views the program's string pool
+
+    std::int32_t currentNodeIndex = LinkedProgram::UNRESOLVED; ///< index of currentNode in the linked program
+
+    std::uint64_t instructionsExecuted = 0; ///< running total of instructions executed by this VM, for budgeting and profiling.  Only ever increases
+
     // --- The following members are NOT part of the serializable state! ---
     // c++ callbacks and function tables are to be populated directly by the client / game code
-    // the program is derived from the yarnc filename in the deserialization function
+    // the program image is looked up by the yarnc filename in the deserialization function
 
-    std::unordered_map<std::string, YarnFunction> functions;
+    std::unordered_map<std::string, YarnFunction> functions; ///< bound to the program's function slots on first call.  Don't erase functions the program has already called.
     YarnCallbacks* callbacks = nullptr;
-    Yarn::Program program;
+    EventRing* eventRing = nullptr; ///< when set, lines, commands, options and stops are written here as POD events instead of going to the callbacks.  See yarn_event_ring.h
+    std::shared_ptr<const ProgramImage> image = ProgramImage::empty(); ///< the program and its linked form, shared with every other VM running the same program.  Never null
+
+    std::vector<const YarnFunction*> functionSlots; ///< per slot in image->linked.functionNames, nullptr until bound
+
+    std::vector<std::int32_t> lineIndices; ///< per string in image->linked.strings, the line database index of the line with that id, see LineDatabase::link.  Empty unless set by the dialogue runner, cleared when another program is loaded
+
+    std::vector<CompiledNode> compiledNodes; ///< per node in image->linked.nodes, nullptr for nodes that are interpreted.  Empty unless useCompiled() was called, cleared when another program is loaded
+
+    StringArena strings; ///< strings created while the program runs.  Cleared when a program is loaded, collected by makeString
+
+    /// keep a string the program created (a concatenation, a custom function's result) in strings, for a Value to refer to.  When strings has grown enough,
+    /// the strings no variable, stack entry or undrained event ring substitution refers to are dropped, so Values kept anywhere else don't outlive the next call
+    std::string_view makeString(std::string_view s);
+
+    void collectStrings(std::string_view keep = {}); ///< drop the strings of the arena, other than keep, that no variable, stack entry or undrained event ring substitution refers to
 
     // --- Public method interface below.  Called by your Dialogue Runner class which owns this VM ---
 
-    YarnVM(const Settings& setts = {});
+    YarnVM();
+
+    YarnVM(const Settings& setts);
+
+    explicit YarnVM(std::shared_ptr<const ProgramImage> image); ///< a VM running an already loaded program, see loadProgram
+
+    YarnVM(std::shared_ptr<const ProgramImage> image, const Settings& setts);
 
     bool loadNode(const std::string& node);
 
-    bool loadProgram(const std::string& is);
+    bool loadNode(std::int32_t nodeIndex); ///< load a node by its index in image->linked.nodes
+
+    bool loadProgram(const std::string& yarncFile); ///< loads the file, or shares the image if the file is already loaded, see ProgramImage::load
+
+    bool loadProgram(std::shared_ptr<const ProgramImage> image); ///< run an already loaded program.  Resets the VM's variables
 
     void setTime(long long timeIn); ///< for the built in "wait" command.  units are up to the dialogue runner and script
 
@@ -155,38 +218,72 @@ struct YarnVM
 
     void setWaitTime(long long t) { waitUntil(time + t); } ///< for the built in "wait" command.  units are up to the dialogue runner and script
 
+    bool handleWaitCommand(std::string_view command); ///< if command is the built in "wait <time>", put the VM to sleep for time and return true.  For hosts that don't bind it in a console
+
     void selectOption(const Option& option);
 
     void selectOption(int selection);
 
-    void processInstruction(const Yarn::Instruction& instruction);
+    YieldReason run() { return runFor(std::numeric_limits<std::size_t>::max()); } ///< execute instructions until the VM delivers a line, command or options, sleeps, or stops
+
+    YieldReason runFor(std::size_t maxInstructions); ///< like run(), but returns YIELD_BUDGET_EXHAUSTED after at most maxInstructions.  Returns immediately if the VM isn't running
 
-    const Yarn::Instruction& currentInstruction();
+    void processInstruction(); ///< execute the instruction at the instruction pointer of the current node
+
+    bool useCompiled(const CompiledProgram& program); ///< run the nodes yarn2cpp compiled to C++ instead of interpreting them.  Returns false if program was compiled from a different .yarnc than the one loaded
+
+    static bool threadedDispatch(); ///< whether the interpreter was built with the computed goto dispatch loop, see YARN_THREADED_DISPATCH
+
+    const LinkedProgram::Instruction& currentInstruction();
 
     void setInstruction(std::int32_t instruction);
 
-    const Yarn::Instruction& advance(); ///< advance the instruction pointer and return the next instruction
+    const LinkedProgram::Instruction& advance(); ///< advance the instruction pointer and return the next instruction
+
+    unsigned int visitedCount(std::string_view node); ///< how many times has a node been entered/exited during execution
+
+    // --- variable access by name.  Not for use on hot paths, the program itself accesses variables by slot ---
 
-    unsigned int visitedCount(const std::string& node); ///< how many times has a node been entered/exited during execution
+    std::int32_t findVariable(const std::string& name) const; ///< slot of the variable, or LinkedProgram::UNRESOLVED
+
+    const Yarn::Value* getVariable(const std::string& name) const; ///< nullptr if the variable doesn't exist
+
+    void setVariable(const std::string& name, const Yarn::Operand& value); ///< creates the variable if the program doesn't already use it.  String values are copied into the VM's string arena
 
 #ifdef YARN_SERIALIZATION_JSON
 
+    /// version of the json toJS() writes.  1 : the instruction pointer indexes the node's lowered code, see LinkedProgram::Node
+    static constexpr int SAVE_VERSION = 1;
+
     /// deserializes the static state of the VM from a json input.
     /// loads the node, which causes the node change callback to fire
-    /// if we were in an awaiting input state, we fire the callback to present options
+    /// if we were in an awaiting input state, we fire the callback to present options.
+    /// Saves of another SAVE_VERSION (saves without one index the source node's instructions), and instruction pointers past the end of the node, are errors
     void fromJS(const nlohmann::json& js);
 
     nlohmann::json toJS() const;
 
 #endif
 
+    // --- used by code generated by yarn2cpp ---
+
+    YieldReason interpret(std::size_t& budget); ///< the interpreter loop : execute instructions of the current node until it yields or budget runs out.  Never runs compiled nodes
+
   protected: // internal helper methods
     void populateFuncs();
 
-    std::string get_string_operand(const Yarn::Instruction& instruction, int index);
+    YieldReason execute(std::size_t maxInstructions); ///< runs compiled nodes or the interpreter loop, behind run(), runFor() and processInstruction()
 
-    bool get_bool_operand(const Yarn::Instruction& instruction, int index);
+    YieldReason stateYield() const; ///< yield reason for a VM that's no longer running
 
-    float get_float_operand(const Yarn::Instruction& instruction, int index);
+    YieldReason halt(); ///< stop after a runtime error, when exceptions are disabled
+
+    const YarnFunction* bindFunction(std::int32_t slot);
+
+    std::int32_t lineIndex(std::int32_t string) const { return ((std::size_t)string < lineIndices.size()) ? lineIndices[string] : LinkedProgram::UNRESOLVED; }
+
+#ifdef YARN_SERIALIZATION_JSON
+    std::string_view internedString(const std::string& s); ///< view of the program's copy of a deserialized string
+#endif
 };
 } // namespace Yarn
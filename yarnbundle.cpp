@@ -0,0 +1,75 @@
+/**
+ * @file yarnbundle.cpp
+ *
+ * @brief Converts a Yarn module to a single file .yarnbundle, memory mapped and used in place at load time
+ *
+ * usage : yarnbundle <module> [output.yarnbundle]
+ *
+ * Reads <module>.yarnc, <module>-Lines.csv and <module>-Metadata.csv, the same files YarnRunnerBase::loadModule reads, links the program,
+ * and writes the lowered code, its pools and the line database to output (default : <module>.yarnbundle).
+ * The bundle is opened again once it's written, so a module that wouldn't load fails here instead of at runtime.
+ *
+ * Load the bundle with YarnRunnerBase::loadBundle(), see yarn_bundle.h
+ */
+
+#include <iostream>
+#include <string>
+
+#include <yarn_bundle.h>
+#include <yarn_line_database.h>
+#include <yarn_program.h>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage : yarnbundle <module> [output.yarnbundle]" << std::endl;
+        return 1;
+    }
+
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    const std::string module = argv[1];
+    const std::string output = (argc > 2) ? argv[2] : module + std::string(Yarn::Bundle::EXTENSION);
+
+    std::string error;
+
+    std::shared_ptr<const Yarn::ProgramImage> image = Yarn::ProgramImage::load(module + ".yarnc", error);
+
+    if (!image)
+    {
+        std::cerr << "yarnbundle : " << error << std::endl;
+        return 1;
+    }
+
+    Yarn::LineDatabase db;
+
+    try
+    {
+        db.load(module + "-Lines.csv", module + "-Metadata.csv");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "yarnbundle : couldn't read the line database of " << module << " : " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!Yarn::Bundle::write(output, *image, db, error))
+    {
+        std::cerr << "yarnbundle : " << error << std::endl;
+        return 1;
+    }
+
+    std::shared_ptr<const Yarn::Bundle> bundle = Yarn::Bundle::open(output, error);
+
+    if (!bundle)
+    {
+        std::cerr << "yarnbundle : " << error << std::endl;
+        return 1;
+    }
+
+    std::cout << module << " : " << image->linked.nodes.size() << " nodes, " << image->linked.loweredCode.size() << " instructions, "
+        << bundle->lineCount() << " lines -> " << output << " (" << bundle->header().fileSize << " bytes)" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file yarnembed.cpp
+ *
+ * @brief Bakes a Yarn module into a C++ header, for loading it without filesystem access
+ *
+ * usage : yarnembed <module> <output.h> [name]
+ *
+ * Reads <module>.yarnc, <module>-Lines.csv and <module>-Metadata.csv, the same files YarnRunnerBase::loadModule reads,
+ * and writes a header defining a Yarn::EmbeddedModule called name (default : the module's file name) :
+ * - the .yarnc as a byte array.  It's linked here too, so a module that wouldn't load fails the build instead
+ * - the lines and tags as tables of string views, parsed here with the same LineDatabase code the runner uses, sorted by line id so the output is reproducible
+ *
+ * Pass the module to YarnRunnerBase::loadModuleFromMemory(), see yarn_embedded.h
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <yarn_line_database.h>
+#include <yarn_program.h>
+
+namespace
+{
+    /// s as a C++ string view.  Everything but printable ASCII is escaped, so the header doesn't depend on the compiler's source character set
+    std::string stringView(std::string_view s)
+    {
+        std::string quoted = "std::string_view(\"";
+
+        for (const char c : s)
+        {
+            switch (c)
+            {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (((unsigned char)c < 0x20) || ((unsigned char)c >= 0x7f))
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\%03o", (unsigned char)c);
+                    quoted += escaped;
+                }
+                else
+                {
+                    quoted += c;
+                }
+            }
+        }
+
+        return quoted + "\", " + std::to_string(s.size()) + ")";
+    }
+
+    /// the module's file name as an identifier
+    std::string defaultName(const std::string& module)
+    {
+        std::string name = module.substr(module.find_last_of("/\\") + 1);
+
+        for (char& c : name)
+        {
+            if (!std::isalnum((unsigned char)c))
+            {
+                c = '_';
+            }
+        }
+
+        if (name.empty() || std::isdigit((unsigned char)name[0]))
+        {
+            name = "yarn_" + name;
+        }
+
+        return name;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage : yarnembed <module> <output.h> [name]" << std::endl;
+        return 1;
+    }
+
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    const std::string module = argv[1];
+    const std::string name = (argc > 3) ? argv[3] : defaultName(module);
+    const std::string yarncFile = module + ".yarnc";
+
+    std::vector<char> yarnc;
+
+    {
+        std::ifstream is(yarncFile, std::ios::binary | std::ios::in);
+
+        if (!is.is_open())
+        {
+            std::cerr << "yarnembed : couldn't open " << yarncFile << std::endl;
+            return 1;
+        }
+
+        yarnc.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    std::string error;
+
+    if (!Yarn::ProgramImage::load(yarncFile, yarnc.data(), yarnc.size(), error))
+    {
+        std::cerr << "yarnembed : " << error << std::endl;
+        return 1;
+    }
+
+    Yarn::LineDatabase db;
+
+    try
+    {
+        db.load(module + "-Lines.csv", module + "-Metadata.csv");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "yarnembed : couldn't read the line database of " << module << " : " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<Yarn::LineData> lines;
+    std::vector<std::pair<std::string_view, std::string_view>> tags;
+
+    for (std::size_t i = 0; i < db.size(); i++)
+    {
+        const Yarn::LineData line = db.line(i);
+
+        lines.push_back(line);
+
+        for (std::size_t tag = 0; tag < line.tags.size(); tag++)
+        {
+            tags.push_back({ line.id, line.tags[tag] });
+        }
+    }
+
+    std::sort(lines.begin(), lines.end(), [](const Yarn::LineData& a, const Yarn::LineData& b) { return a.id < b.id; });
+    std::sort(tags.begin(), tags.end());
+
+    std::ofstream os(argv[2], std::ios::out);
+
+    if (!os.is_open())
+    {
+        std::cerr << "yarnembed : couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    os << "// generated by yarnembed from " << module << ", do not edit.  See yarn_embedded.h\n\n";
+    os << "#pragma once\n\n";
+    os << "#include <yarn_embedded.h>\n\n";
+    os << "namespace " << name << "_data\n";
+    os << "{\n";
+
+    // C++ has no empty arrays : an empty program still gets a byte, and empty tables are left out with the module pointing at nothing
+    os << "    inline constexpr unsigned char yarnc[] =\n";
+    os << "    {";
+
+    for (std::size_t i = 0; i < std::max<std::size_t>(yarnc.size(), 1); i++)
+    {
+        char byte[8];
+        std::snprintf(byte, sizeof(byte), "0x%02x,", (i < yarnc.size()) ? (unsigned char)yarnc[i] : 0);
+
+        os << ((i % 16) ? " " : "\n        ") << byte;
+    }
+
+    os << "\n    };\n\n";
+
+    if (!lines.empty())
+    {
+        os << "    inline constexpr Yarn::EmbeddedLine lines[] =\n";
+        os << "    {\n";
+
+        for (const Yarn::LineData& line : lines)
+        {
+            os << "        { " << stringView(line.id) << ", " << stringView(line.text) << ", " << stringView(line.file) << ", "
+                << stringView(line.node) << ", " << line.lineNumber << " },\n";
+        }
+
+        os << "    };\n\n";
+    }
+
+    if (!tags.empty())
+    {
+        os << "    inline constexpr Yarn::EmbeddedTag tags[] =\n";
+        os << "    {\n";
+
+        for (const auto& [id, tag] : tags)
+        {
+            os << "        { " << stringView(id) << ", " << stringView(tag) << " },\n";
+        }
+
+        os << "    };\n\n";
+    }
+
+    os << "}\n\n";
+    os << "inline constexpr Yarn::EmbeddedModule " << name << " =\n";
+    os << "{\n";
+    os << "    " << stringView(module) << ",\n";
+    os << "    " << name << "_data::yarnc, " << yarnc.size() << ",\n";
+    os << "    " << (lines.empty() ? std::string("nullptr") : name + "_data::lines") << ", " << lines.size() << ",\n";
+    os << "    " << (tags.empty() ? std::string("nullptr") : name + "_data::tags") << ", " << tags.size() << ",\n";
+    os << "};\n";
+
+    if (!os.good())
+    {
+        std::cerr << "yarnembed : couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cout << module << " : " << yarnc.size() << " bytes of program, " << lines.size() << " lines, " << tags.size() << " tags -> " << argv[2] << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,609 @@
+/**
+ * @file yarnopt.cpp
+ *
+ * @brief Offline optimizer for compiled .yarnc programs
+ *
+ * usage : yarnopt <input.yarnc> <output.yarnc>
+ *
+ * Rewrites the instructions and labels of every node into a smaller program the unmodified YarnVM runs the same way :
+ * - constant folding : built in operators applied to constants (eg. PUSH_FLOAT 1, PUSH_FLOAT 2, PUSH_FLOAT 2, CALL_FUNC Number.Add) become a single push,
+ *   and conditional jumps on a constant condition become unconditional or disappear.  Only the Number and Bool operators the unmodified VM defines are folded
+ * - jump threading : jumps to jumps go straight to the final destination, jumps to a STOP become a STOP, and jumps to the next instruction are removed.
+ *   Loops made only of jumps are left alone
+ * - dead code removal : instructions that can't be reached from the start of the node or from an option destination are removed, as are unused labels
+ *
+ * Instruction indices change, so VM states saved while running the unoptimized program can't be restored into the optimized one.
+ *
+ * Note that the VM lands on the instruction after the label when JUMP_IF_FALSE jumps, and on the label's instruction itself for JUMP_TO and JUMP.
+ * The instruction at the label of a JUMP_IF_FALSE is kept even when it can't run, so the jump lands in the same place.
+ */
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <yarn_spinner.pb.h>
+
+namespace
+{
+    bool hasOperand(const Yarn::Instruction& instruction, int index, Yarn::Operand::ValueCase type)
+    {
+        return (instruction.operands_size() > index) && (instruction.operands(index).value_case() == type);
+    }
+
+    bool isPush(const Yarn::Instruction& instruction, Yarn::Instruction_OpCode opcode)
+    {
+        const Yarn::Operand::ValueCase type =
+            (opcode == Yarn::Instruction_OpCode_PUSH_STRING) ? Yarn::Operand::kStringValue :
+            (opcode == Yarn::Instruction_OpCode_PUSH_FLOAT) ? Yarn::Operand::kFloatValue :
+            Yarn::Operand::kBoolValue;
+
+        return (instruction.opcode() == opcode) && hasOperand(instruction, 0, type);
+    }
+
+    bool isConstant(const Yarn::Instruction& instruction)
+    {
+        return isPush(instruction, Yarn::Instruction_OpCode_PUSH_STRING) ||
+            isPush(instruction, Yarn::Instruction_OpCode_PUSH_FLOAT) ||
+            isPush(instruction, Yarn::Instruction_OpCode_PUSH_BOOL);
+    }
+
+    /// the parameter count pushed in front of a CALL_FUNC
+    bool isParameterCount(const Yarn::Instruction& instruction, float count)
+    {
+        return isPush(instruction, Yarn::Instruction_OpCode_PUSH_FLOAT) && (instruction.operands(0).float_value() == count);
+    }
+
+    bool isCall(const Yarn::Instruction& instruction)
+    {
+        return (instruction.opcode() == Yarn::Instruction_OpCode_CALL_FUNC) && hasOperand(instruction, 0, Yarn::Operand::kStringValue);
+    }
+
+    Yarn::Instruction makeInstruction(Yarn::Instruction_OpCode opcode)
+    {
+        Yarn::Instruction instruction;
+        instruction.set_opcode(opcode);
+        return instruction;
+    }
+
+    Yarn::Instruction makePush(float f)
+    {
+        Yarn::Instruction instruction = makeInstruction(Yarn::Instruction_OpCode_PUSH_FLOAT);
+        instruction.add_operands()->set_float_value(f);
+        return instruction;
+    }
+
+    Yarn::Instruction makePush(bool b)
+    {
+        Yarn::Instruction instruction = makeInstruction(Yarn::Instruction_OpCode_PUSH_BOOL);
+        instruction.add_operands()->set_bool_value(b);
+        return instruction;
+    }
+
+    /// evaluates a built in binary operator the way the VM does.  Returns false if it isn't one, or the operands have the wrong types.
+    /// Only the operators the unmodified YarnVM defines are folded : the others (Bool.Xor, which it runs as And, the NotEqualTo and String operators)
+    /// are left for the VM to run, or to report
+    bool evaluateBinary(const std::string& function, const Yarn::Instruction& lhs, const Yarn::Instruction& rhs, Yarn::Instruction& result)
+    {
+        if (isPush(lhs, Yarn::Instruction_OpCode_PUSH_FLOAT) && isPush(rhs, Yarn::Instruction_OpCode_PUSH_FLOAT))
+        {
+            const float a = lhs.operands(0).float_value();
+            const float b = rhs.operands(0).float_value();
+
+            if (function == "Number.Add") result = makePush(a + b);
+            else if (function == "Number.Minus") result = makePush(a - b);
+            else if (function == "Number.Multiply") result = makePush(a * b);
+            else if (function == "Number.Divide") result = makePush(a / b);
+            else if (function == "Number.Modulo") result = makePush(std::fmod(a, b));
+            else if (function == "Number.EqualTo") result = makePush(a == b);
+            else if (function == "Number.LessThan") result = makePush(a < b);
+            else if (function == "Number.LessThanOrEqualTo") result = makePush(a <= b);
+            else if (function == "Number.GreaterThan") result = makePush(a > b);
+            else if (function == "Number.GreaterThanOrEqualTo") result = makePush(a >= b);
+            else return false;
+
+            return true;
+        }
+
+        if (isPush(lhs, Yarn::Instruction_OpCode_PUSH_BOOL) && isPush(rhs, Yarn::Instruction_OpCode_PUSH_BOOL))
+        {
+            const bool a = lhs.operands(0).bool_value();
+            const bool b = rhs.operands(0).bool_value();
+
+            if (function == "Bool.And") result = makePush(a && b);
+            else if (function == "Bool.Or") result = makePush(a || b);
+            else return false;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    bool evaluateUnary(const std::string& function, const Yarn::Instruction& operand, Yarn::Instruction& result)
+    {
+        if ((function == "Bool.Not") && isPush(operand, Yarn::Instruction_OpCode_PUSH_BOOL))
+        {
+            result = makePush(!operand.operands(0).bool_value());
+            return true;
+        }
+
+        return false;
+    }
+
+    /// whether JUMP_IF_FALSE falls through when the constant is on top of the stack
+    bool isTruthy(const Yarn::Instruction& constant)
+    {
+        const Yarn::Operand& op = constant.operands(0);
+
+        return op.has_string_value() || (op.has_bool_value() && op.bool_value()) || (op.has_float_value() && (op.float_value() != 0.f));
+    }
+
+    class NodeOptimizer
+    {
+    public:
+
+        NodeOptimizer(Yarn::Node& node)
+            :
+            node(node),
+            code(node.instructions().begin(), node.instructions().end()),
+            labels(node.labels().begin(), node.labels().end())
+        {
+        }
+
+        void optimize()
+        {
+            bool changed = true;
+
+            while (changed)
+            {
+                removeUnusedLabels();
+
+                changed = foldConstants();
+                changed = threadJumps() || changed;
+                changed = removeDeadCode() || changed;
+            }
+
+            node.clear_instructions();
+
+            for (const Yarn::Instruction& instruction : code)
+            {
+                *node.add_instructions() = instruction;
+            }
+
+            node.mutable_labels()->clear();
+            node.mutable_labels()->insert(labels.begin(), labels.end());
+        }
+
+    private:
+
+        Yarn::Node& node;
+        std::vector<Yarn::Instruction> code;
+        std::map<std::string, std::int32_t> labels;
+
+        int size() const { return (int)code.size(); }
+
+        int target(const Yarn::Instruction& jump) const
+        {
+            if (!hasOperand(jump, 0, Yarn::Operand::kStringValue))
+            {
+                return -1;
+            }
+
+            auto it = labels.find(jump.operands(0).string_value());
+
+            return (it != labels.end()) ? it->second : -1;
+        }
+
+        /// instructions execution can start at after a jump : labels, and the instruction after a label for JUMP_IF_FALSE
+        std::set<int> entryPoints() const
+        {
+            std::set<int> entries;
+
+            for (const auto& [name, index] : labels)
+            {
+                entries.insert(index);
+                entries.insert(index + 1);
+            }
+
+            return entries;
+        }
+
+        /// name of a label at the instruction, adding one if there's none
+        std::string labelAt(int index)
+        {
+            for (const auto& [name, target] : labels)
+            {
+                if (target == index) return name;
+            }
+
+            std::string name;
+
+            for (int i = 0; labels.count(name = "yarnopt_" + std::to_string(i)); i++)
+            {
+            }
+
+            labels[name] = index;
+
+            return name;
+        }
+
+        bool foldConstants()
+        {
+            const std::set<int> entries = entryPoints();
+            auto entered = [&entries](int first, int last) { return entries.lower_bound(first) != entries.upper_bound(last); };
+
+            std::vector<bool> removed(code.size(), false);
+            bool changed = false;
+
+            for (int i = 0; i < size(); i++)
+            {
+                Yarn::Instruction result;
+
+                // constant, constant, PUSH_FLOAT 2, CALL_FUNC operator
+                if ((i + 3 < size()) && isConstant(code[i]) && isConstant(code[i + 1]) && isParameterCount(code[i + 2], 2.f) && isCall(code[i + 3]) && !entered(i + 1, i + 3) &&
+                    evaluateBinary(code[i + 3].operands(0).string_value(), code[i], code[i + 1], result))
+                {
+                    code[i] = result;
+                    removed[i + 1] = removed[i + 2] = removed[i + 3] = true;
+                    changed = true;
+                    i += 3;
+                    continue;
+                }
+
+                // constant, PUSH_FLOAT 1, CALL_FUNC operator
+                if ((i + 2 < size()) && isConstant(code[i]) && isParameterCount(code[i + 1], 1.f) && isCall(code[i + 2]) && !entered(i + 1, i + 2) &&
+                    evaluateUnary(code[i + 2].operands(0).string_value(), code[i], result))
+                {
+                    code[i] = result;
+                    removed[i + 1] = removed[i + 2] = true;
+                    changed = true;
+                    i += 2;
+                    continue;
+                }
+
+                // constant, JUMP_IF_FALSE : the jump either never happens or always happens.  The constant stays on the stack either way
+                if ((i + 1 < size()) && isConstant(code[i]) && (code[i + 1].opcode() == Yarn::Instruction_OpCode_JUMP_IF_FALSE) && !entered(i + 1, i + 1))
+                {
+                    if (isTruthy(code[i]))
+                    {
+                        removed[i + 1] = true;
+                        changed = true;
+                        i += 1;
+                    }
+                    else
+                    {
+                        const int landing = target(code[i + 1]) + 1;
+
+                        if ((landing > 0) && (landing < size()))
+                        {
+                            Yarn::Instruction jump = makeInstruction(Yarn::Instruction_OpCode_JUMP_TO);
+                            jump.add_operands()->set_string_value(labelAt(landing));
+                            code[i + 1] = jump;
+                            changed = true;
+                            i += 1;
+                        }
+                    }
+                }
+            }
+
+            compact(removed);
+
+            return changed;
+        }
+
+        bool threadJumps()
+        {
+            std::vector<bool> removed(code.size(), false);
+            bool changed = false;
+
+            for (int i = 0; i < size(); i++)
+            {
+                Yarn::Instruction& instruction = code[i];
+
+                if (instruction.opcode() == Yarn::Instruction_OpCode_JUMP_TO)
+                {
+                    int destination = target(instruction);
+
+                    if ((destination < 0) || (destination >= size())) continue;
+
+                    const int first = destination;
+                    destination = finalDestination(first, i);
+
+                    if (destination < 0)
+                    {
+                        // a loop of jumps, which runs forever : leave it as it is
+                        continue;
+                    }
+
+                    if (destination != first)
+                    {
+                        instruction.mutable_operands(0)->set_string_value(labelAt(destination));
+                        changed = true;
+                    }
+
+                    if (code[destination].opcode() == Yarn::Instruction_OpCode_STOP)
+                    {
+                        instruction = makeInstruction(Yarn::Instruction_OpCode_STOP);
+                        changed = true;
+                    }
+                    else if (destination == i + 1)
+                    {
+                        removed[i] = true;
+                    }
+                }
+                else if (instruction.opcode() == Yarn::Instruction_OpCode_JUMP_IF_FALSE)
+                {
+                    const int landing = target(instruction) + 1;
+
+                    if ((landing <= 0) || (landing >= size()) || (code[landing].opcode() != Yarn::Instruction_OpCode_JUMP_TO))
+                    {
+                        continue;
+                    }
+
+                    const int destination = finalDestination(landing, -1);
+
+                    // JUMP_IF_FALSE lands after its label, so it needs a label in front of the final destination
+                    if ((destination > 0) && (destination != landing))
+                    {
+                        instruction.mutable_operands(0)->set_string_value(labelAt(destination - 1));
+                        changed = true;
+                    }
+                }
+            }
+
+            // a removed jump that's also the landing of a JUMP_IF_FALSE has to stay, see removeDeadCode
+            const std::vector<bool> anchors = findAnchors();
+
+            for (int i = 0; i < size(); i++)
+            {
+                removed[i] = removed[i] && !anchors[i];
+                changed = changed || removed[i];
+            }
+
+            compact(removed);
+
+            return changed;
+        }
+
+        /// where execution ends up from the instruction at from, following JUMP_TOs to the first instruction that isn't one, or to one whose target
+        /// is out of the node.  -1 if the jumps go round in a loop, or come back to the instruction at jump
+        int finalDestination(int from, int jump) const
+        {
+            std::set<int> visited = { jump };
+            int destination = from;
+
+            while (code[destination].opcode() == Yarn::Instruction_OpCode_JUMP_TO)
+            {
+                if (!visited.insert(destination).second)
+                {
+                    return -1;
+                }
+
+                const int next = target(code[destination]);
+
+                if ((next < 0) || (next >= size()))
+                {
+                    return destination;
+                }
+
+                destination = next;
+            }
+
+            return destination;
+        }
+
+        /// instructions at the label of a JUMP_IF_FALSE.  The jump lands on them and runs the instruction after, so they can't be removed
+        std::vector<bool> findAnchors() const
+        {
+            std::vector<bool> anchors(code.size(), false);
+
+            for (const Yarn::Instruction& instruction : code)
+            {
+                const int destination = (instruction.opcode() == Yarn::Instruction_OpCode_JUMP_IF_FALSE) ? target(instruction) : -1;
+
+                if ((destination >= 0) && (destination < size()))
+                {
+                    anchors[destination] = true;
+                }
+            }
+
+            return anchors;
+        }
+
+        bool removeDeadCode()
+        {
+            std::vector<bool> reachable(code.size(), false);
+            std::vector<bool> keep(code.size(), false);
+            std::vector<int> work = { 0 };
+
+            // options jump to their destination label by name, and so could a string pushed onto the stack
+            for (const Yarn::Instruction& instruction : code)
+            {
+                std::string name;
+
+                if ((instruction.opcode() == Yarn::Instruction_OpCode_ADD_OPTION) && hasOperand(instruction, 1, Yarn::Operand::kStringValue))
+                {
+                    name = instruction.operands(1).string_value();
+                }
+                else if (isPush(instruction, Yarn::Instruction_OpCode_PUSH_STRING))
+                {
+                    name = instruction.operands(0).string_value();
+                }
+
+                auto it = labels.find(name);
+
+                if (it != labels.end())
+                {
+                    work.push_back(it->second);
+                }
+            }
+
+            while (work.size())
+            {
+                const int i = work.back();
+                work.pop_back();
+
+                if ((i < 0) || (i >= size()) || reachable[i]) continue;
+
+                reachable[i] = keep[i] = true;
+
+                const Yarn::Instruction& instruction = code[i];
+
+                switch (instruction.opcode())
+                {
+                case Yarn::Instruction_OpCode_JUMP_TO:
+                    work.push_back(target(instruction));
+                    break;
+                case Yarn::Instruction_OpCode_JUMP_IF_FALSE:
+                {
+                    const int destination = target(instruction);
+
+                    if ((destination >= 0) && (destination < size()))
+                    {
+                        keep[destination] = true;
+                        work.push_back(destination + 1);
+                    }
+
+                    work.push_back(i + 1);
+                }
+                break;
+                case Yarn::Instruction_OpCode_JUMP:
+                case Yarn::Instruction_OpCode_STOP:
+                case Yarn::Instruction_OpCode_RUN_NODE:
+                    break;
+                default:
+                    work.push_back(i + 1);
+                    break;
+                }
+            }
+
+            std::vector<bool> removed(code.size(), false);
+            bool changed = false;
+
+            for (int i = 0; i < size(); i++)
+            {
+                removed[i] = !keep[i];
+                changed = changed || removed[i];
+            }
+
+            compact(removed);
+
+            return changed;
+        }
+
+        void removeUnusedLabels()
+        {
+            std::set<std::string> used;
+
+            for (const Yarn::Instruction& instruction : code)
+            {
+                switch (instruction.opcode())
+                {
+                case Yarn::Instruction_OpCode_JUMP_TO:
+                case Yarn::Instruction_OpCode_JUMP_IF_FALSE:
+                case Yarn::Instruction_OpCode_PUSH_STRING:
+                    if (hasOperand(instruction, 0, Yarn::Operand::kStringValue)) used.insert(instruction.operands(0).string_value());
+                    break;
+                case Yarn::Instruction_OpCode_ADD_OPTION:
+                    if (hasOperand(instruction, 1, Yarn::Operand::kStringValue)) used.insert(instruction.operands(1).string_value());
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            for (auto it = labels.begin(); it != labels.end();)
+            {
+                it = used.count(it->first) ? std::next(it) : labels.erase(it);
+            }
+        }
+
+        /// remove instructions.  A label at a removed instruction moves to the next instruction that's kept
+        void compact(const std::vector<bool>& removed)
+        {
+            std::vector<int> remap(code.size() + 1);
+            int kept = 0;
+
+            for (int i = 0; i < size(); i++)
+            {
+                remap[i] = kept;
+
+                if (!removed[i])
+                {
+                    code[kept++] = code[i];
+                }
+            }
+
+            remap[code.size()] = kept;
+            code.resize(kept);
+
+            for (auto& [name, index] : labels)
+            {
+                if ((index >= 0) && (index < (int)remap.size()))
+                {
+                    index = remap[index];
+                }
+            }
+        }
+    };
+
+    int instructionCount(const Yarn::Program& program)
+    {
+        int count = 0;
+
+        for (const auto& [name, node] : program.nodes())
+        {
+            count += node.instructions_size();
+        }
+
+        return count;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage : yarnopt <input.yarnc> <output.yarnc>" << std::endl;
+        return 1;
+    }
+
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Yarn::Program program;
+
+    {
+        std::ifstream is(argv[1], std::ios::binary | std::ios::in);
+
+        if (!is.is_open() || !program.ParseFromIstream(&is))
+        {
+            std::cerr << "yarnopt : couldn't read a compiled yarn program from " << argv[1] << std::endl;
+            return 1;
+        }
+    }
+
+    const int before = instructionCount(program);
+
+    for (auto& [name, node] : *program.mutable_nodes())
+    {
+        NodeOptimizer(node).optimize();
+    }
+
+    std::ofstream os(argv[2], std::ios::binary | std::ios::out);
+
+    if (!os.is_open() || !program.SerializeToOstream(&os))
+    {
+        std::cerr << "yarnopt : couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cout << argv[1] << " : " << before << " -> " << instructionCount(program) << " instructions" << std::endl;
+
+    return 0;
+}